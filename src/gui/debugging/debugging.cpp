@@ -43,7 +43,8 @@ extern "C" {
   
   void dino_load_plugin(PluginInterface& plif) {
     g_plif = &plif;
-    g_dbp = manage(new DebuggingPage(g_plif->get_command_proxy()));
+    g_dbp = manage(new DebuggingPage(g_plif->get_command_proxy(),
+					g_plif->get_sequencer()));
     g_plif->add_page("Debugging", *g_dbp);
   }
   
@@ -18,21 +18,41 @@
    Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 ****************************************************************************/
 
+#include <cstdio>
+
 #include <gtkmm/box.h>
 
 #include "command.hpp"
 #include "commandproxy.hpp"
 #include "debuggingpage.hpp"
+#include "latencyhistogram.hpp"
+#include "sequencer.hpp"
 
 
 using namespace Dino;
 using namespace std;
 
 
-DebuggingPage::DebuggingPage(CommandProxy& proxy)
+namespace {
+  
+  /** Format a cycle count as microseconds. */
+  string usecs(uint64_t cycles) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.1f", 
+	     1e6 * cycles / LatencyHistogram::ticks_per_second());
+    return buf;
+  }
+
+}
+
+
+DebuggingPage::DebuggingPage(CommandProxy& proxy, Sequencer& seq)
   : m_proxy(proxy),
+    m_seq(seq),
     m_stacklist(1, false),
-    m_dbglist(4, false) {
+    m_dbglist(4, false),
+    m_latencylist(6, false),
+    m_profile("Profile the sequencer") {
   
   m_stacklist.get_column(0)->set_title("Undoable commands");
   
@@ -41,6 +61,13 @@ DebuggingPage::DebuggingPage(CommandProxy& proxy)
   m_dbglist.get_column(2)->set_title("Code line");
   m_dbglist.get_column(3)->set_title("Message");
   
+  m_latencylist.get_column(0)->set_title("Sequencable");
+  m_latencylist.get_column(1)->set_title("Calls");
+  m_latencylist.get_column(2)->set_title("Median (\302\265s)");
+  m_latencylist.get_column(3)->set_title("99% (\302\265s)");
+  m_latencylist.get_column(4)->set_title("Max (\302\265s)");
+  m_latencylist.get_column(5)->set_title("Xruns");
+  
   Gtk::VBox* vbox = manage(new Gtk::VBox);
   add(*vbox);
   
@@ -54,7 +81,17 @@ DebuggingPage::DebuggingPage(CommandProxy& proxy)
   vbox->pack_start(*dbgscrw);
   dbgscrw->add(m_dbglist);
   
+  vbox->pack_start(m_profile, Gtk::PACK_SHRINK);
+  Gtk::ScrolledWindow* latscrw = manage(new Gtk::ScrolledWindow);
+  latscrw->set_policy(Gtk::POLICY_AUTOMATIC, Gtk::POLICY_AUTOMATIC);
+  vbox->pack_start(*latscrw);
+  latscrw->add(m_latencylist);
+  
   signal_debug.connect(sigc::mem_fun(*this, &DebuggingPage::add_debug_msg));
+  m_profile.signal_toggled().
+    connect(sigc::mem_fun(*this, &DebuggingPage::toggle_profiling));
+  Glib::signal_timeout().
+    connect(sigc::mem_fun(*this, &DebuggingPage::update_latency), 1000);
   
   reset_gui();
 }
@@ -77,3 +114,40 @@ void DebuggingPage::add_debug_msg(unsigned level, const std::string& file,
   m_dbglist.set_text(row, 2, cc+ line);
   m_dbglist.set_text(row, 3, msg);
 }
+
+
+void DebuggingPage::toggle_profiling() {
+  m_seq.set_profiling(m_profile.get_active());
+  update_latency();
+}
+
+
+bool DebuggingPage::update_latency() {
+  m_latencylist.clear_items();
+  LatencyHistogram const* h = m_seq.get_run_histogram();
+  if (!h)
+    return true;
+  
+  // the whole period first, then the Sequencables
+  guint row = m_latencylist.append_text("Sequencer::run()");
+  m_latencylist.set_text(row, 1, cc+ h->get_count());
+  m_latencylist.set_text(row, 2, usecs(h->get_percentile(0.5)));
+  m_latencylist.set_text(row, 3, usecs(h->get_percentile(0.99)));
+  m_latencylist.set_text(row, 4, usecs(h->get_max()));
+  m_latencylist.set_text(row, 5, cc+ h->get_xruns());
+  Sequencer const& seq = m_seq;
+  for (Sequencer::ConstIterator i = seq.sqbl_begin(); 
+       i != seq.sqbl_end(); ++i) {
+    h = seq.get_histogram(i);
+    if (!h)
+      continue;
+    row = m_latencylist.append_text((*i)->get_label());
+    m_latencylist.set_text(row, 1, cc+ h->get_count());
+    m_latencylist.set_text(row, 2, usecs(h->get_percentile(0.5)));
+    m_latencylist.set_text(row, 3, usecs(h->get_percentile(0.99)));
+    m_latencylist.set_text(row, 4, usecs(h->get_max()));
+    m_latencylist.set_text(row, 5, cc+ h->get_xruns());
+  }
+  
+  return true;
+}
@@ -28,10 +28,15 @@
 #include "plugininterface.hpp"
 
 
+namespace Dino {
+  class Sequencer;
+}
+
+
 class DebuggingPage : public GUIPage {
 public:
   
-  DebuggingPage(Dino::CommandProxy& proxy);
+  DebuggingPage(Dino::CommandProxy& proxy, Dino::Sequencer& seq);
   
   void reset_gui();
   
@@ -40,10 +45,19 @@ protected:
   void add_debug_msg(unsigned level, const std::string& file,
 		      unsigned line, const std::string& msg);
   
+  /** Turn the sequencer latency profiling on or off. */
+  void toggle_profiling();
+  
+  /** Show the latest latency statistics. Called periodically. */
+  bool update_latency();
+  
   Dino::CommandProxy& m_proxy;
+  Dino::Sequencer& m_seq;
 
   Gtk::ListViewText m_stacklist;
   Gtk::ListViewText m_dbglist;
+  Gtk::ListViewText m_latencylist;
+  Gtk::CheckButton m_profile;
   
 };
 
@@ -41,6 +41,31 @@ namespace Dino {
   void AtomicInt::increase() {
     g_atomic_int_inc(&m_data);
   }
+  
+  
+  bool AtomicInt::compare_and_set(Type old_value, Type new_value) {
+    return g_atomic_int_compare_and_exchange(&m_data, old_value, new_value);
+  }
+  
+  
+  AtomicInt::Type AtomicInt::get_acquire() const {
+    return __atomic_load_n(&m_data, __ATOMIC_ACQUIRE);
+  }
+  
+  
+  AtomicInt::Type AtomicInt::get_relaxed() const {
+    return __atomic_load_n(&m_data, __ATOMIC_RELAXED);
+  }
+  
+  
+  void AtomicInt::set_release(Type new_value) {
+    __atomic_store_n(&m_data, new_value, __ATOMIC_RELEASE);
+  }
+  
+  
+  void AtomicInt::set_relaxed(Type new_value) {
+    __atomic_store_n(&m_data, new_value, __ATOMIC_RELAXED);
+  }
 
 
 }
@@ -30,6 +30,9 @@ namespace Dino {
       atomic and lock-free as long as Glib's operations are (should work on 
       all common hardware platforms). They also act as memory barriers. This 
       makes them well suited as building blocks for lock-free data structures.
+      
+      There are also versions of get() and set() with acquire, release and
+      relaxed ordering, which work the same way as the ones in AtomicPtr.
   */
   class AtomicInt {
   public:
@@ -54,6 +57,28 @@ namespace Dino {
 	operation and also a memory barrier. */
     void increase();
     
+    /** Set the atomic integer to @c new_value if its current value is 
+	@c old_value and return @c true, otherwise leave it unchanged and
+	return @c false. This is an atomic and lock-free operation and also
+	a memory barrier. */
+    bool compare_and_set(Type old_value, Type new_value);
+    
+    /** Return the value of the atomic integer. No reads or writes in the 
+	calling thread can be moved before this one. */
+    Type get_acquire() const;
+    
+    /** Return the value of the atomic integer without ordering any other
+	memory accesses. */
+    Type get_relaxed() const;
+    
+    /** Set the value of the atomic integer. No reads or writes in the 
+	calling thread can be moved after this one. */
+    void set_release(Type new_value);
+    
+    /** Set the value of the atomic integer without ordering any other
+	memory accesses. */
+    void set_relaxed(Type new_value);
+  
   private:
     
     /** The actual underlying integral variable. */
@@ -30,6 +30,14 @@ namespace Dino {
       atomic and lock-free as long as Glib's operations are (should work on 
       all common hardware platforms). They also act as memory barriers. This 
       makes them well suited as building blocks for lock-free data structures.
+      
+      The full barriers are more than most lock-free code needs, so there 
+      are also versions of get() and set() with weaker ordering. A node that
+      is published with set_release() and found with get_acquire() is 
+      guaranteed to be seen fully initialised, and on x86 neither of them
+      needs a fence instruction. The relaxed versions are only atomic and 
+      do not order anything, so they are for pointers that only the calling
+      thread writes, or that are not visible to any other thread yet.
   */
   template <typename T>
   class AtomicPtr {
@@ -53,6 +61,55 @@ namespace Dino {
 	operation and also a memory barrier. */
     void set(T* new_value) { g_atomic_pointer_set(&m_pointer, new_value); }
     
+    /** Set the value of the atomic pointer to @c new_value if its current
+	value is @c old_value and return @c true, otherwise leave it 
+	unchanged and return @c false. This is an atomic and lock-free 
+	operation and also a memory barrier. */
+    bool compare_and_set(T* old_value, T* new_value) {
+      return g_atomic_pointer_compare_and_exchange(&m_pointer, old_value, 
+						   new_value);
+    }
+    
+    /** Return the value of the atomic pointer. No reads or writes in the
+	calling thread can be moved before this one, so everything that was
+	written before a matching set_release() is visible after it. */
+    T* get_acquire() { 
+      return static_cast<T*>(__atomic_load_n(&m_pointer, __ATOMIC_ACQUIRE));
+    }
+    
+    /** Return the value of the atomic pointer. No reads or writes in the
+	calling thread can be moved before this one, so everything that was
+	written before a matching set_release() is visible after it. */
+    T const* get_acquire() const { 
+      return static_cast<T*>(__atomic_load_n(&m_pointer, __ATOMIC_ACQUIRE));
+    }
+    
+    /** Return the value of the atomic pointer without ordering any other
+	memory accesses. */
+    T* get_relaxed() { 
+      return static_cast<T*>(__atomic_load_n(&m_pointer, __ATOMIC_RELAXED));
+    }
+    
+    /** Return the value of the atomic pointer without ordering any other
+	memory accesses. */
+    T const* get_relaxed() const { 
+      return static_cast<T*>(__atomic_load_n(&m_pointer, __ATOMIC_RELAXED));
+    }
+    
+    /** Set the value of the atomic pointer. No reads or writes in the 
+	calling thread can be moved after this one, so a thread that reads
+	the new value with get_acquire() sees everything that was written 
+	before it. */
+    void set_release(T* new_value) { 
+      __atomic_store_n(&m_pointer, gpointer(new_value), __ATOMIC_RELEASE);
+    }
+    
+    /** Set the value of the atomic pointer without ordering any other 
+	memory accesses. */
+    void set_relaxed(T* new_value) { 
+      __atomic_store_n(&m_pointer, gpointer(new_value), __ATOMIC_RELAXED);
+    }
+  
   private:
     
     /** The actual underlying pointer. */
@@ -0,0 +1,967 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef COWBTREE_HPP
+#define COWBTREE_HPP
+
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#include "atomicptr.hpp"
+#include "epochdomain.hpp"
+#include "nodepool.hpp"
+
+
+namespace Dino {
+  
+  
+  /** A sorted container that stores its elements in the wide leaves of a
+      B+tree. Consecutive elements are stored next to each other in memory,
+      so scanning the container in order is much faster than following the
+      links of a NodeSkipList.
+      
+      The tree is never changed in place. An edit copies the nodes on the
+      path from the root to the changed leaf, and the new root is published
+      atomically with release ordering, so a reader thread sees either the
+      old tree or the new one. The replaced nodes are retired in an
+      EpochLimbo and deallocated once no reader can be using them, which
+      means that reader threads must only use the tree inside a read-side
+      section of the EpochDomain, i.e. between EpochDomain::enter() and
+      EpochDomain::leave() or between two calls to
+      EpochDomain::quiescent(). The read functions are lock-free and
+      realtime safe. The edit functions allocate memory and must only be
+      called by one thread at a time.
+      
+      Elements that compare equal are kept in the order they were inserted.
+      
+      @tparam T the element type, which must be copy constructible and have
+                an operator<()
+      @tparam L the maximal number of elements in a leaf
+      @tparam F the maximal number of children of an inner node
+      @tparam A the allocator type used for the nodes, HeapAllocator or
+                PoolAllocator
+  */
+  template <typename T, unsigned L = 64, unsigned F = 16,
+	    typename A = HeapAllocator>
+  class CowBTree {
+  public:
+    
+    static_assert(L >= 2, "A leaf must have room for at least 2 elements");
+    static_assert(F >= 3, "An inner node must have at least 3 children");
+    
+    /** The allocator type. */
+    typedef A Allocator;
+    
+    /** The maximal height of the tree. The nodes are never less than a
+	quarter full, so this is enough for any number of elements that
+	fits in memory. */
+    static unsigned const max_height = 16;
+    
+    
+    /** The common part of the leaves and the inner nodes. */
+    struct Node {
+      
+      /** Create an empty node at the given height. */
+      explicit Node(unsigned h) throw() : height(h), size(0), retired(0) {}
+      
+      /** 0 for leaves, 1 for the parents of leaves and so on. */
+      unsigned height;
+      
+      /** The number of elements in a leaf or children in an inner node. */
+      unsigned size;
+      
+      /** Used to link the node into the EpochLimbo when it has been
+	  replaced. Reader threads never touch it. */
+      Node* retired;
+    };
+    
+    
+    /** A leaf with up to @c L elements, stored contiguously. */
+    struct Leaf : Node {
+      
+      Leaf() throw() : Node(0) {}
+      
+      /** Return the elements. */
+      T* data() throw() {
+	return reinterpret_cast<T*>(&storage);
+      }
+      
+      /** Return the elements. */
+      T const* data() const throw() {
+	return reinterpret_cast<T const*>(&storage);
+      }
+      
+      /** The memory for the elements. */
+      typename std::aligned_storage<sizeof(T) * L,
+				    std::alignment_of<T>::value>::type storage;
+    };
+    
+    
+    /** An inner node with up to @c F children and a copy of the first
+	element in each child. */
+    struct Inner : Node {
+      
+      explicit Inner(unsigned h) throw() : Node(h) {}
+      
+      /** Return the first element of each child. */
+      T* keys() throw() {
+	return reinterpret_cast<T*>(&storage);
+      }
+      
+      /** Return the first element of each child. */
+      T const* keys() const throw() {
+	return reinterpret_cast<T const*>(&storage);
+      }
+      
+      /** The children. */
+      Node* children[F];
+      
+      /** The memory for the keys. */
+      typename std::aligned_storage<sizeof(T) * F,
+				    std::alignment_of<T>::value>::type storage;
+    };
+    
+    
+    /** A bidirectional iterator over the elements in one version of the 
+	tree. It keeps the path from the root of that version to the current
+	element, so it stays valid while the version is protected by the
+	EpochDomain even if the tree is edited, but it will not see the
+	edits. */
+    class ConstIterator
+      : public std::iterator<std::bidirectional_iterator_tag, T const> {
+    public:
+      
+      /** Create an iterator that is equal to CowBTree::end(). It can't be
+	  decremented since it doesn't belong to any version. */
+      ConstIterator() throw() : m_root(0), m_height(0) {
+	m_path[0] = 0;
+	m_index[0] = 0;
+      }
+      
+      /** Return the current element. */
+      T const& operator*() const throw() {
+	return static_cast<Leaf const*>(m_path[0])->data()[m_index[0]];
+      }
+      
+      /** Return a pointer to the current element. */
+      T const* operator->() const throw() {
+	return static_cast<Leaf const*>(m_path[0])->data() + m_index[0];
+      }
+      
+      /** Step to the next element. This takes amortised constant time. */
+      ConstIterator& operator++() throw() {
+	if (++m_index[0] == m_path[0]->size)
+	  next_leaf();
+	return *this;
+      }
+      
+      /** Step to the next element and return a copy of the iterator as it
+	  was before. */
+      ConstIterator operator++(int) throw() {
+	ConstIterator result = *this;
+	++*this;
+	return result;
+      }
+      
+      /** Step to the previous element. The end iterator of a non-empty
+	  version steps to the last element. This takes amortised constant
+	  time. */
+      ConstIterator& operator--() throw() {
+	if (m_path[0] == 0)
+	  last_leaf();
+	else if (m_index[0] > 0)
+	  --m_index[0];
+	else
+	  prev_leaf();
+	return *this;
+      }
+      
+      /** Step to the previous element and return a copy of the iterator as
+	  it was before. */
+      ConstIterator operator--(int) throw() {
+	ConstIterator result = *this;
+	--*this;
+	return result;
+      }
+      
+      /** Return @c true if both iterators point to the same element. */
+      bool operator==(ConstIterator const& i) const throw() {
+	return m_path[0] == i.m_path[0] &&
+	  (m_path[0] == 0 || m_index[0] == i.m_index[0]);
+      }
+      
+      /** Return @c true if the iterators point to different elements. */
+      bool operator!=(ConstIterator const& i) const throw() {
+	return !(*this == i);
+      }
+      
+      /** Return @c true if there is no element before this one in its
+	  version, i.e. if it can't be decremented. Unlike a comparison with
+	  CowBTree::begin() this does not load the current version. */
+      bool is_first() const throw() {
+	if (m_path[0] == 0)
+	  return m_root == 0;
+	for (unsigned h = 0; h <= m_height; ++h) {
+	  if (m_index[h] != 0)
+	    return false;
+	}
+	return true;
+      }
+    
+    private:
+      
+      friend class CowBTree;
+      
+      /** Move to the last element of the last leaf. */
+      void last_leaf() throw() {
+	Node const* n = m_root;
+	m_height = n->height;
+	for (unsigned h = m_height; h > 0; --h) {
+	  m_path[h] = n;
+	  m_index[h] = n->size - 1;
+	  n = static_cast<Inner const*>(n)->children[n->size - 1];
+	}
+	m_path[0] = n;
+	m_index[0] = n->size - 1;
+      }
+      
+      /** Move to the last element of the previous leaf. */
+      void prev_leaf() throw() {
+	unsigned h = 1;
+	while (m_index[h] == 0)
+	  ++h;
+	for (--m_index[h]; h > 0; --h) {
+	  m_path[h - 1] =
+	    static_cast<Inner const*>(m_path[h])->children[m_index[h]];
+	  m_index[h - 1] = m_path[h - 1]->size - 1;
+	}
+      }
+      
+      /** Move to the first element of the next leaf, or to the end. */
+      void next_leaf() throw() {
+	unsigned h = 1;
+	while (h <= m_height && ++m_index[h] == m_path[h]->size)
+	  ++h;
+	if (h > m_height) {
+	  m_path[0] = 0;
+	  return;
+	}
+	for ( ; h > 0; --h) {
+	  m_path[h - 1] =
+	    static_cast<Inner const*>(m_path[h])->children[m_index[h]];
+	  m_index[h - 1] = 0;
+	}
+      }
+      
+      /** The nodes from the leaf at index 0 to the root, or 0 at index 0
+	  for the end iterator. */
+      Node const* m_path[max_height + 1];
+      
+      /** The index of the current child or element in each node. */
+      unsigned m_index[max_height + 1];
+      
+      /** The root of the version, so the end iterator can be 
+	  decremented. */
+      Node const* m_root;
+      
+      /** The height of the root. */
+      unsigned m_height;
+    };
+    
+    
+    /** Create an empty tree that uses @c domain to decide when replaced
+	nodes can be deallocated, and allocates its nodes using @c alloc. */
+    CowBTree(EpochDomain& domain, A const& alloc = A()) throw()
+      : m_alloc(alloc),
+	m_root(0),
+	m_size(0),
+	m_limbo(domain, RetirePolicy(alloc)) {
+    }
+    
+    /** Release all memory used by the tree. The readers must be done with
+	it. */
+    ~CowBTree() throw() {
+      destroy_tree(m_alloc, m_root.get_relaxed());
+    }
+    
+    /** Copying is not allowed. */
+    CowBTree(CowBTree const&) = delete;
+    
+    /** Assignment is not allowed. */
+    CowBTree& operator=(CowBTree const&) = delete;
+    
+    /** Return the allocator used by this tree. */
+    A const& get_allocator() const throw() {
+      return m_alloc;
+    }
+    
+    /** @name Reader threads
+	These functions are realtime safe and may be called by any thread
+	inside a read-side section of the EpochDomain.
+	@{ */
+    
+    /** Return an iterator to the first element of the current version. */
+    ConstIterator begin() const throw() {
+      ConstIterator i;
+      Node const* n = m_root.get_acquire();
+      if (!n)
+	return i;
+      i.m_root = n;
+      i.m_height = n->height;
+      for (unsigned h = n->height; h > 0; --h) {
+	i.m_path[h] = n;
+	i.m_index[h] = 0;
+	n = static_cast<Inner const*>(n)->children[0];
+      }
+      i.m_path[0] = n;
+      i.m_index[0] = 0;
+      return i;
+    }
+    
+    /** Return the end iterator of the current version. */
+    ConstIterator end() const throw() {
+      ConstIterator i;
+      i.m_root = m_root.get_acquire();
+      return i;
+    }
+    
+    /** Return an iterator to the first element that is not less than
+	@c c, or end(). */
+    ConstIterator lower_bound(T const& c) const {
+      return find(Less(c));
+    }
+    
+    /** Return an iterator to the first element that is larger than @c c,
+	or end(). */
+    ConstIterator upper_bound(T const& c) const {
+      return find(LessOrEqual(c));
+    }
+    
+    /** @} */
+    
+    /** @name Writer thread
+	These functions are @b not realtime safe, and must only be called
+	by one thread at a time. They also deallocate the replaced nodes
+	that no reader can be using any more.
+	@{ */
+    
+    /** Return the number of elements. */
+    size_t size() const throw() {
+      return m_size;
+    }
+    
+    /** Insert a copy of @c v after all elements that are not larger than
+	it. This takes O(log n) time and allocates O(log n) nodes.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case the tree is not changed
+    */
+    void insert(T const& v) {
+      m_limbo.collect();
+      if (!m_root.get_relaxed()) {
+	insert_first(v);
+	return;
+      }
+      
+      // find the path to the leaf
+      ConstIterator pos;
+      Node const* n = m_root.get_relaxed();
+      pos.m_root = n;
+      pos.m_height = n->height;
+      for (unsigned h = n->height; h > 0; --h) {
+	pos.m_path[h] = n;
+	pos.m_index[h] = child_index(static_cast<Inner const*>(n), 
+				     LessOrEqual(v));
+	n = static_cast<Inner const*>(n)->children[pos.m_index[h]];
+      }
+      Leaf const* leaf = static_cast<Leaf const*>(n);
+      pos.m_path[0] = n;
+      pos.m_index[0] = 
+	std::upper_bound(leaf->data(), leaf->data() + leaf->size, v) -
+	leaf->data();
+      insert_at(pos, v);
+    }
+    
+    /** Insert a copy of @c v before the element that @c pos points to, or
+	at the end if @c pos is end(). @c pos must have been created from 
+	the current version of the tree, and the caller must make sure that
+	the order is kept. This takes O(log n) time and allocates O(log n)
+	nodes.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case the tree is not changed
+    */
+    void insert(ConstIterator const& pos, T const& v) {
+      m_limbo.collect();
+      if (!m_root.get_relaxed()) {
+	insert_first(v);
+	return;
+      }
+      
+      // the end iterator has no path, so insert after the last element
+      if (pos.m_path[0]) {
+	insert_at(pos, v);
+	return;
+      }
+      ConstIterator last = pos;
+      last.last_leaf();
+      ++last.m_index[0];
+      insert_at(last, v);
+    }
+    
+    /** Replace the element that @c pos points to with a copy of @c v.
+	@c pos must have been created from the current version of the tree,
+	and the caller must make sure that the order is kept. This takes 
+	O(log n) time and allocates O(log n) nodes.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case the tree is not changed
+    */
+    void set(ConstIterator const& pos, T const& v) {
+      m_limbo.collect();
+      Leaf const* leaf = static_cast<Leaf const*>(pos.m_path[0]);
+      T const* items[L];
+      for (unsigned i = 0; i < leaf->size; ++i)
+	items[i] = (i == pos.m_index[0] ? &v : leaf->data() + i);
+      copy_path(pos, items, leaf->size);
+    }
+    
+    /** Remove the element that @c pos points to. @c pos must have been
+	created from the current version of the tree, i.e. after the last
+	edit. Nodes that get less than a quarter full are merged with or
+	take elements from a neighbour. This takes O(log n) time and
+	allocates O(log n) nodes.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case the tree is not changed
+    */
+    void erase(ConstIterator const& pos) {
+      m_limbo.collect();
+      Fresh fresh(m_alloc);
+      Node* old[2 * (max_height + 1)];
+      unsigned n_old = 0;
+      
+      // copy the leaf without the element
+      Leaf* leaf = const_cast<Leaf*>(static_cast<Leaf const*>(pos.m_path[0]));
+      T const* items[L];
+      unsigned n_items = 0;
+      for (unsigned i = 0; i < leaf->size; ++i) {
+	if (i != pos.m_index[0])
+	  items[n_items++] = leaf->data() + i;
+      }
+      Node* a = 0;
+      Node* b = 0;
+      if (n_items > 0)
+	build_leaves(items, n_items, a, b, fresh);
+      old[n_old++] = leaf;
+      
+      // copy the inner nodes above it, merging the new node with a
+      // neighbour if it has become too small
+      for (unsigned h = 1; h <= pos.m_height; ++h) {
+	Inner const* cin = static_cast<Inner const*>(pos.m_path[h]);
+	Inner* in = const_cast<Inner*>(cin);
+	unsigned i = pos.m_index[h];
+	Node* children[F];
+	T const* keys[F];
+	unsigned size = 0;
+	for (unsigned j = 0; j < in->size; ++j) {
+	  if (j != i) {
+	    children[size] = in->children[j];
+	    keys[size++] = in->keys() + j;
+	  }
+	  else if (a) {
+	    children[size] = a;
+	    keys[size++] = first_of(a);
+	  }
+	}
+	if (a && a->size < min_size(h - 1) && size > 1) {
+	  unsigned j = (i + 1 < size ? i : i - 1);
+	  Node* c1;
+	  Node* c2;
+	  merge(children[j], children[j + 1], c1, c2, fresh);
+	  old[n_old++] = (children[j] == a ? children[j + 1] : children[j]);
+	  fresh.drop(a);
+	  children[j] = c1;
+	  keys[j] = first_of(c1);
+	  if (c2) {
+	    children[j + 1] = c2;
+	    keys[j + 1] = first_of(c2);
+	  }
+	  else {
+	    for (unsigned k = j + 1; k + 1 < size; ++k) {
+	      children[k] = children[k + 1];
+	      keys[k] = keys[k + 1];
+	    }
+	    --size;
+	  }
+	}
+	a = 0;
+	if (size > 0)
+	  build_inners(h, children, keys, size, a, b, fresh);
+	old[n_old++] = in;
+      }
+      
+      // a root with a single child is not needed
+      while (a && a->height > 0 && a->size == 1) {
+	Node* child = static_cast<Inner*>(a)->children[0];
+	fresh.drop(a);
+	a = child;
+      }
+      
+      fresh.keep();
+      m_root.set_release(a);
+      --m_size;
+      for (unsigned k = 0; k < n_old; ++k)
+	m_limbo.retire(old[k]);
+    }
+    
+    /** Replace all elements with copies of the elements in the sorted
+	range [@c first, @c last). The new tree is built bottom up with
+	full nodes, which takes O(n) time, and published at once. Returns
+	@c false and leaves the tree unchanged if the range is not sorted.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case the tree is not changed
+    */
+    template <typename Iter>
+    bool assign(Iter first, Iter last) {
+      m_limbo.collect();
+      for (Iter i = first, j = first; i != last; j = i) {
+	if (++i != last && *i < *j)
+	  return false;
+      }
+      
+      Node* root = build_tree(first, last);
+      Node* old = m_root.get_relaxed();
+      m_root.set_release(root);
+      m_size = std::distance(first, last);
+      retire_tree(old);
+      return true;
+    }
+    
+    /** Remove all elements. */
+    void clear() throw() {
+      Node* old = m_root.get_relaxed();
+      m_root.set_release(0);
+      m_size = 0;
+      retire_tree(old);
+      m_limbo.collect();
+    }
+    
+    /** Deallocate the replaced nodes that no reader can be using any
+	more. The edit functions call this too. */
+    void collect() throw() {
+      m_limbo.collect();
+    }
+    
+    /** @} */
+  
+  private:
+    
+    /** A policy type for the EpochLimbo that deallocates replaced nodes. */
+    struct RetirePolicy {
+      RetirePolicy(A const& a) throw() : alloc(a) {}
+      Node*& link(Node* n) throw() { return n->retired; }
+      void free(Node* n) throw() { destroy_node(alloc, n); }
+      A alloc;
+    };
+    
+    /** Keeps track of the nodes that an edit has allocated but not yet
+	published, and deallocates them if the edit fails. */
+    class Fresh {
+    public:
+      Fresh(A& alloc) throw() : m_alloc(alloc), m_size(0) {}
+      ~Fresh() throw() {
+	for (unsigned i = 0; i < m_size; ++i) {
+	  if (m_nodes[i])
+	    destroy_node(m_alloc, m_nodes[i]);
+	}
+      }
+      template <typename N> N* add(N* n) throw() {
+	m_nodes[m_size++] = n;
+	return n;
+      }
+      /** Deallocate a node that has been replaced before it was published.
+       */
+      void drop(Node* n) throw() {
+	for (unsigned i = 0; i < m_size; ++i) {
+	  if (m_nodes[i] == n) {
+	    destroy_node(m_alloc, n);
+	    m_nodes[i] = 0;
+	  }
+	}
+      }
+      /** Keep all the nodes, they have been published. */
+      void keep() throw() { m_size = 0; }
+    private:
+      A& m_alloc;
+      Node* m_nodes[4 * (max_height + 2)];
+      unsigned m_size;
+    };
+    
+    /** A predicate that returns true for values less than a given value. */
+    struct Less {
+      Less(T const& c) : m_c(c) { }
+      bool operator()(T const& d) const { return d < m_c; }
+      T const& m_c;
+    };
+    
+    /** A predicate that returns true for values less than or equal to a
+	given value. */
+    struct LessOrEqual {
+      LessOrEqual(T const& c) : m_c(c) { }
+      bool operator()(T const& d) const { return !(m_c < d); }
+      T const& m_c;
+    };
+    
+    /** Return the smallest number of elements or children that a node at
+	height @c h should have, unless it is the root. */
+    static unsigned min_size(unsigned h) throw() {
+      return h == 0 ? (L / 4 > 1 ? L / 4 : 1) : (F / 4 > 2 ? F / 4 : 2);
+    }
+    
+    /** Return the index of the last child of @c in whose first element
+	@c pred returns @c true for, or 0. */
+    template <typename P>
+    static unsigned child_index(Inner const* in, P const& pred) {
+      unsigned i = 0;
+      while (i + 1 < in->size && pred(in->keys()[i + 1]))
+	++i;
+      return i;
+    }
+    
+    /** Make a single leaf with @c v the root of an empty tree. */
+    void insert_first(T const& v) {
+      Fresh fresh(m_alloc);
+      Leaf* leaf = fresh.add(create_leaf());
+      push(leaf, v);
+      fresh.keep();
+      m_root.set_release(leaf);
+      ++m_size;
+    }
+    
+    /** Insert a copy of @c v at @c pos, which must have a path to a leaf
+	but may point past its last element. */
+    void insert_at(ConstIterator const& pos, T const& v) {
+      Leaf const* leaf = static_cast<Leaf const*>(pos.m_path[0]);
+      unsigned p = pos.m_index[0];
+      T const* items[L + 1];
+      for (unsigned i = 0; i < leaf->size; ++i)
+	items[i < p ? i : i + 1] = leaf->data() + i;
+      items[p] = &v;
+      copy_path(pos, items, leaf->size + 1);
+      ++m_size;
+    }
+    
+    /** Replace the leaf that @c pos points to with the @c n elements in 
+	@c items, which may be one more than fits in a leaf, and copy the
+	path above it. The new root is published and the replaced nodes are
+	retired. */
+    void copy_path(ConstIterator const& pos, T const** items, unsigned n) {
+      Fresh fresh(m_alloc);
+      
+      // copy the leaf, splitting it if it is full
+      Node* a;
+      Node* b;
+      build_leaves(items, n, a, b, fresh);
+      
+      // and copy the inner nodes above it
+      for (unsigned h = 1; h <= pos.m_height; ++h) {
+	Inner const* in = static_cast<Inner const*>(pos.m_path[h]);
+	Node* children[F + 1];
+	T const* keys[F + 1];
+	unsigned size = 0;
+	for (unsigned i = 0; i < in->size; ++i) {
+	  if (i == pos.m_index[h]) {
+	    children[size] = a;
+	    keys[size++] = first_of(a);
+	    if (b) {
+	      children[size] = b;
+	      keys[size++] = first_of(b);
+	    }
+	  }
+	  else {
+	    children[size] = in->children[i];
+	    keys[size++] = in->keys() + i;
+	  }
+	}
+	build_inners(h, children, keys, size, a, b, fresh);
+      }
+      
+      // a new level is added if the root was split
+      if (b) {
+	Inner* top = fresh.add(create_inner(pos.m_height + 1));
+	push(top, a, first_of(a));
+	push(top, b, first_of(b));
+	a = top;
+      }
+      
+      fresh.keep();
+      m_root.set_release(a);
+      for (unsigned h = 0; h <= pos.m_height; ++h)
+	m_limbo.retire(const_cast<Node*>(pos.m_path[h]));
+    }
+    
+    /** Return an iterator to the first element that @c pred returns
+	@c false for. */
+    template <typename P>
+    ConstIterator find(P const& pred) const {
+      ConstIterator i;
+      Node const* n = m_root.get_acquire();
+      if (!n)
+	return i;
+      i.m_root = n;
+      i.m_height = n->height;
+      for (unsigned h = n->height; h > 0; --h) {
+	Inner const* in = static_cast<Inner const*>(n);
+	i.m_path[h] = n;
+	i.m_index[h] = child_index(in, pred);
+	n = in->children[i.m_index[h]];
+      }
+      Leaf const* leaf = static_cast<Leaf const*>(n);
+      T const* d = leaf->data();
+      i.m_path[0] = n;
+      i.m_index[0] = std::partition_point(d, d + leaf->size, pred) - d;
+      if (i.m_index[0] == leaf->size)
+	i.next_leaf();
+      return i;
+    }
+    
+    /** Return the first element in a non-empty node. */
+    static T const* first_of(Node const* n) throw() {
+      if (n->height == 0)
+	return static_cast<Leaf const*>(n)->data();
+      return static_cast<Inner const*>(n)->keys();
+    }
+    
+    /** Allocate an empty leaf. */
+    Leaf* create_leaf() {
+      return new (m_alloc.allocate(sizeof(Leaf))) Leaf;
+    }
+    
+    /** Allocate an empty inner node at height @c h. */
+    Inner* create_inner(unsigned h) {
+      return new (m_alloc.allocate(sizeof(Inner))) Inner(h);
+    }
+    
+    /** Destroy the elements or keys in a node and deallocate it. */
+    static void destroy_node(A& alloc, Node* n) throw() {
+      if (n->height == 0) {
+	Leaf* leaf = static_cast<Leaf*>(n);
+	for (unsigned i = 0; i < leaf->size; ++i)
+	  leaf->data()[i].~T();
+	leaf->~Leaf();
+	alloc.deallocate(leaf, sizeof(Leaf));
+      }
+      else {
+	Inner* in = static_cast<Inner*>(n);
+	for (unsigned i = 0; i < in->size; ++i)
+	  in->keys()[i].~T();
+	in->~Inner();
+	alloc.deallocate(in, sizeof(Inner));
+      }
+    }
+    
+    /** Deallocate all nodes in the tree with the root @c n. */
+    static void destroy_tree(A& alloc, Node* n) throw() {
+      if (!n)
+	return;
+      if (n->height > 0) {
+	Inner* in = static_cast<Inner*>(n);
+	for (unsigned i = 0; i < in->size; ++i)
+	  destroy_tree(alloc, in->children[i]);
+      }
+      destroy_node(alloc, n);
+    }
+    
+    /** Retire all nodes in the tree with the root @c n. */
+    void retire_tree(Node* n) throw() {
+      if (!n)
+	return;
+      if (n->height > 0) {
+	Inner* in = static_cast<Inner*>(n);
+	for (unsigned i = 0; i < in->size; ++i)
+	  retire_tree(in->children[i]);
+      }
+      m_limbo.retire(n);
+    }
+    
+    /** Add a copy of @c v to the end of @c leaf. */
+    static void push(Leaf* leaf, T const& v) {
+      new (leaf->data() + leaf->size) T(v);
+      ++leaf->size;
+    }
+    
+    /** Add @c child to the end of @c in, with a copy of its first element
+	@c key. */
+    static void push(Inner* in, Node* child, T const* key) {
+      new (in->keys() + in->size) T(*key);
+      in->children[in->size] = child;
+      ++in->size;
+    }
+    
+    /** Build one leaf with the @c n elements in @c items if they fit,
+	otherwise two leaves that share them evenly. @c b is set to 0 if
+	there is only one leaf. */
+    void build_leaves(T const** items, unsigned n, Node*& a, Node*& b,
+		      Fresh& fresh) {
+      unsigned split = (n <= L ? n : n / 2);
+      Leaf* l = fresh.add(create_leaf());
+      a = l;
+      b = 0;
+      for (unsigned i = 0; i < n; ++i) {
+	if (i == split) {
+	  l = fresh.add(create_leaf());
+	  b = l;
+	}
+	push(l, *items[i]);
+      }
+    }
+    
+    /** Build one inner node at height @c h with the @c n children in
+	@c children if they fit, otherwise two nodes that share them evenly.
+	@c b is set to 0 if there is only one node. */
+    void build_inners(unsigned h, Node** children, T const** keys,
+		      unsigned n, Node*& a, Node*& b, Fresh& fresh) {
+      unsigned split = (n <= F ? n : n / 2);
+      Inner* in = fresh.add(create_inner(h));
+      a = in;
+      b = 0;
+      for (unsigned i = 0; i < n; ++i) {
+	if (i == split) {
+	  in = fresh.add(create_inner(h));
+	  b = in;
+	}
+	push(in, children[i], keys[i]);
+      }
+    }
+    
+    /** Build one or two new nodes with the contents of the neighbours
+	@c x and @c y, evenly shared if there are two. */
+    void merge(Node* x, Node* y, Node*& a, Node*& b, Fresh& fresh) {
+      if (x->height == 0) {
+	T const* items[2 * L];
+	unsigned n = 0;
+	Leaf* xl = static_cast<Leaf*>(x);
+	Leaf* yl = static_cast<Leaf*>(y);
+	for (unsigned i = 0; i < xl->size; ++i)
+	  items[n++] = xl->data() + i;
+	for (unsigned i = 0; i < yl->size; ++i)
+	  items[n++] = yl->data() + i;
+	build_leaves(items, n, a, b, fresh);
+      }
+      else {
+	Node* children[2 * F];
+	T const* keys[2 * F];
+	unsigned n = 0;
+	Inner* xi = static_cast<Inner*>(x);
+	Inner* yi = static_cast<Inner*>(y);
+	for (unsigned i = 0; i < xi->size; ++i, ++n) {
+	  children[n] = xi->children[i];
+	  keys[n] = xi->keys() + i;
+	}
+	for (unsigned i = 0; i < yi->size; ++i, ++n) {
+	  children[n] = yi->children[i];
+	  keys[n] = yi->keys() + i;
+	}
+	build_inners(x->height, children, keys, n, a, b, fresh);
+      }
+    }
+    
+    /** Build a tree with the elements in the sorted range [@c first,
+	@c last) and return its root, or 0 if the range is empty. Every
+	level is split into as few nodes as possible, with the elements or
+	children shared evenly between them. */
+    template <typename Iter>
+    Node* build_tree(Iter first, Iter last) {
+      size_t n = std::distance(first, last);
+      if (n == 0)
+	return 0;
+      
+      // the nodes on the level that is being built are kept in a buffer,
+      // which has to be on the heap since a level may have many nodes. 
+      // [0, done) are the finished nodes on the new level and [next, nodes)
+      // are the nodes on the level below that don't have a parent yet.
+      size_t nodes = (n + L - 1) / L;
+      std::unique_ptr<Node*[]> level(new Node*[nodes]);
+      size_t done = 0;
+      size_t next = nodes;
+      try {
+	for ( ; done < nodes; ++done) {
+	  Leaf* leaf = create_leaf();
+	  level[done] = leaf;
+	  size_t size = n / nodes + (done < n % nodes ? 1 : 0);
+	  for (size_t i = 0; i < size; ++i, ++first)
+	    push(leaf, *first);
+	}
+	for (unsigned h = 1; nodes > 1; ++h) {
+	  size_t parents = (nodes + F - 1) / F;
+	  done = 0;
+	  next = 0;
+	  for ( ; done < parents; ++done) {
+	    Inner* in = create_inner(h);
+	    size_t size = nodes / parents + (done < nodes % parents ? 1 : 0);
+	    try {
+	      for (size_t i = 0; i < size; ++i)
+		push(in, level[next + i], first_of(level[next + i]));
+	    }
+	    catch (...) {
+	      destroy_node(m_alloc, in);
+	      throw;
+	    }
+	    next += size;
+	    level[done] = in;
+	  }
+	  nodes = parents;
+	  next = nodes;
+	}
+      }
+      catch (...) {
+	for (size_t k = 0; k < done; ++k)
+	  destroy_tree(m_alloc, level[k]);
+	for (size_t k = next; k < nodes; ++k)
+	  destroy_tree(m_alloc, level[k]);
+	throw;
+      }
+      return level[0];
+    }
+    
+    
+    /** The allocator for the nodes. */
+    A m_alloc;
+    
+    /** The root of the current version, or 0 if the tree is empty. */
+    AtomicPtr<Node> m_root;
+    
+    /** The number of elements. */
+    size_t m_size;
+    
+    /** The nodes that have been replaced but may still be used by readers.
+     */
+    EpochLimbo<Node, RetirePolicy> m_limbo;
+  
+  };
+
+
+}
+
+
+#endif
@@ -16,7 +16,12 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#include <algorithm>
+#include <iterator>
+
 #include "curve.hpp"
+#include "editlistener.hpp"
+#include "eventbuffer.hpp"
 
 
 namespace Dino {
@@ -28,6 +33,209 @@ namespace Dino {
   using std::shared_ptr;
   using std::string;
   using std::unique_ptr;
+  using std::vector;
+  
+  
+  namespace {
+    
+    /** The number of ticks in a beat. */
+    int64_t const beat_ticks = int64_t(1) << 24;
+    
+    /** The number of values that are computed in one batch. */
+    unsigned const batch_size = 64;
+    
+    /** The number of points in a Curve::Version chunk, unless the last 
+	point has the same time as the following ones. */
+    size_t const chunk_size = 64;
+    
+    /** Return a SongTime as a single tick count. */
+    inline int64_t to_ticks(SongTime const& st) throw() {
+      return int64_t(st.get_beat()) * beat_ticks + st.get_tick();
+    }
+    
+    /** Return a tick count as a SongTime. */
+    inline SongTime from_ticks(int64_t t) throw() {
+      return SongTime(SongTime::Beat(t >> 24), 
+		      SongTime::Tick(t & (beat_ticks - 1)));
+    }
+    
+    /** Round @c t up to the next multiple of @c step. */
+    inline int64_t grid_ceil(int64_t t, int64_t step) throw() {
+      int64_t r = t % step;
+      return r == 0 ? t : t + (r > 0 ? step - r : -r);
+    }
+    
+    /** Compute @c n values, rounded to the nearest integer, on a line that
+	starts at @c v0 and increases by @c dv per step. There are no branches
+	or dependencies between the iterations, so the compiler can vectorise
+	this. */
+    inline void interpolate(double v0, double dv, 
+			    unsigned n, int32_t* out) throw() {
+      for (unsigned i = 0; i < n; ++i)
+	out[i] = int32_t(v0 + dv * i + 0.5);
+    }
+    
+    /** Return the MIDI value for a point value, scaled with @c scale. This
+	rounds the same way as sequence() does. */
+    inline int midi_value(AtomicInt::Type v, double scale, 
+			  int max_value) throw() {
+      return std::max(0, std::min<int>(int32_t(v * scale + 0.5), max_value));
+    }
+    
+    /** Compare points by time only. */
+    inline bool earlier(Curve::Point const& a, Curve::Point const& b) throw() {
+      return a.m_time < b.m_time;
+    }
+    
+    /** Compare a time to the first point of a Curve::Version chunk. */
+    template <typename C>
+    inline bool before_chunk(SongTime const& t, C const& c) throw() {
+      return t < c->front().m_time;
+    }
+    
+    /** Enters an EpochDomain when it's created and leaves it when it's 
+	destroyed, so the removed nodes of a curve can't be deallocated while
+	a position is reading it. */
+    class ReadGuard {
+    public:
+      ReadGuard(EpochDomain& d) throw() : m_domain(d), m_token(d.enter()) {}
+      ~ReadGuard() throw() { m_domain.leave(m_token); }
+    private:
+      EpochDomain& m_domain;
+      int m_token;
+    };
+    
+    /** Increases the removal count of a curve when it's created and when
+	it's destroyed. A CowBTree retires the replaced nodes before the edit
+	returns, so the count has to change before the edit starts, and it 
+	is odd until the edit is done so positions that are looked up in the
+	meantime aren't trusted later. */
+    class EditStamp {
+    public:
+      EditStamp(AtomicInt& removals) throw() : m_removals(removals) {
+	m_removals.increase();
+      }
+      ~EditStamp() throw() { m_removals.increase(); }
+    private:
+      AtomicInt& m_removals;
+    };
+  
+  }
+  
+  
+  struct Curve::ListStorage {
+    
+    ListStorage(EpochDomain& domain) throw(bad_alloc)
+      : points(PoolAllocator()),
+	removed(domain, PointList::RetirePolicy(points.get_allocator())) {
+    }
+    
+    /** The list of curve points. */
+    PointList points;
+    
+    /** The removed nodes that may still be used by positions. */
+    EpochLimbo<NodeBase, PointList::RetirePolicy> removed;
+  };
+  
+  
+  struct Curve::TreeStorage {
+    
+    TreeStorage(EpochDomain& domain) throw(bad_alloc)
+      : points(domain) {
+    }
+    
+    /** The tree of curve points. It retires its own replaced nodes. */
+    PointTree points;
+  };
+  
+  
+  /** The segment cursor for ListStorage. It holds the node before the
+      segment, or the head of the list before the first point. */
+  class Curve::ListSegment {
+  public:
+    
+    ListSegment(Curve const& c, CurvePosition const& cp) throw()
+      : m_head(c.m_list->points.head_marker()),
+	m_end(c.m_list->points.end_marker()),
+	m_a(cp.node),
+	m_b(m_a->links()[0].next.get_acquire()) {
+    }
+    
+    /** Return the point before the segment, or 0 before the first. */
+    Point const* first() const throw() {
+      if (m_a == m_head)
+	return 0;
+      return &static_cast<Node const*>(m_a)->data;
+    }
+    
+    /** Return the point after the segment, or 0 after the last. */
+    Point const* second() const throw() {
+      if (m_b == m_end)
+	return 0;
+      return &static_cast<Node const*>(m_b)->data;
+    }
+    
+    /** Move to the next segment. second() must not be 0. */
+    void step() throw() {
+      m_a = m_b;
+      m_b = m_a->links()[0].next.get_acquire();
+    }
+    
+    /** Store the segment in @c cp. */
+    void store(CurvePosition const& cp) const throw() {
+      cp.node = m_a;
+    }
+    
+  private:
+    
+    NodeBase const* m_head;
+    NodeBase const* m_end;
+    NodeBase const* m_a;
+    NodeBase const* m_b;
+  };
+  
+  
+  /** The segment cursor for TreeStorage. It holds the point before the 
+      segment and an iterator to the point after it in the same version of
+      the tree. */
+  class Curve::TreeSegment {
+  public:
+    
+    TreeSegment(Curve const&, CurvePosition const& cp) throw()
+      : m_a(cp.point),
+	m_b(cp.next) {
+    }
+    
+    /** Return the point before the segment, or 0 before the first. */
+    Point const* first() const throw() {
+      return m_a;
+    }
+    
+    /** Return the point after the segment, or 0 after the last. */
+    Point const* second() const throw() {
+      if (m_b == m_end)
+	return 0;
+      return &*m_b;
+    }
+    
+    /** Move to the next segment. second() must not be 0. */
+    void step() throw() {
+      m_a = &*m_b;
+      ++m_b;
+    }
+    
+    /** Store the segment in @c cp. */
+    void store(CurvePosition const& cp) const throw() {
+      cp.point = m_a;
+      cp.next = m_b;
+    }
+    
+  private:
+    
+    Point const* m_a;
+    PointTree::ConstIterator m_b;
+    PointTree::ConstIterator m_end;
+  };
   
 
   Curve::Point::Point(SongTime const& st, AtomicInt::Type v) throw()
@@ -50,30 +258,61 @@ namespace Dino {
     : IteratorT<ConstIterator, ConstIterator, Node const>(node) {
   }
 
+
+  Curve::ConstIterator::ConstIterator(PointTree::ConstIterator const& i) 
+    throw()
+    : IteratorT<ConstIterator, ConstIterator, Node const>(i) {
+  }
+
   
   Curve::Iterator::Iterator() throw() 
     : IteratorT<Iterator, ConstIterator, Node>(0) {}
 
 
   Curve::Iterator::operator ConstIterator() throw() {
-    return ConstIterator(m_node);
+    if (m_node)
+      return ConstIterator(m_node);
+    return ConstIterator(m_tree);
   }
 
   
   Curve::Iterator::Iterator(NodeBase* node) throw() 
     : IteratorT<Iterator, ConstIterator, Node>(node) {}
+
+  
+  Curve::Iterator::Iterator(PointTree::ConstIterator const& i) throw() 
+    : IteratorT<Iterator, ConstIterator, Node>(i) {}
     
     
+  Curve::ControllerID Curve::pitchbend() throw() {
+    return 128;
+  }
+  
+  
   Curve::Curve(string const& label, 
-	       SongTime const& length, ControllerID cid) throw() 
+	       SongTime const& length, ControllerID cid, Storage storage) 
+    throw(bad_alloc)
     : Sequencable(label, length),
-      m_cid(cid) {
+      m_cid(cid),
+      m_interpolation(Linear),
+      m_resolution(32),
+      m_removals(0),
+      m_listener(0),
+      m_any_changed(true) {
+    if (storage == BTree)
+      m_tree.reset(new TreeStorage(m_domain));
+    else
+      m_list.reset(new ListStorage(m_domain));
   }
   
   
   Curve::~Curve() throw() {
-    for (auto i = m_positions.begin(); i != m_positions.end(); ++i)
-      (*i)->curve = 0;
+  
+  }
+  
+  
+  Curve::Storage Curve::get_storage() const throw() {
+    return m_tree ? BTree : SkipList;
   }
     
   
@@ -84,9 +323,43 @@ namespace Dino {
   
   void Curve::set_controller_id(ControllerID cid) throw() {
     m_cid = cid;
+    notify_changed();
+  }
+  
+  
+  Curve::Interpolation Curve::get_interpolation() const throw() {
+    return m_interpolation;
+  }
+  
+  
+  void Curve::set_interpolation(Interpolation mode) throw() {
+    m_interpolation = mode;
+    notify_changed();
+  }
+  
+  
+  unsigned Curve::get_resolution() const throw() {
+    return m_resolution;
+  }
+  
+  
+  void Curve::set_resolution(unsigned events_per_beat) throw() {
+    m_resolution = std::max(1u, std::min(events_per_beat, 
+					 unsigned(beat_ticks)));
+    notify_changed();
   }
     
   
+  EditListener* Curve::get_edit_listener() const throw() {
+    return m_listener;
+  }
+  
+  
+  void Curve::set_edit_listener(EditListener* listener) throw() {
+    m_listener = listener;
+  }
+  
+  
   Curve::Iterator Curve::add_point(SongTime const& time, AtomicInt::Type value)
     throw(bad_alloc, out_of_range) {
 
@@ -94,10 +367,26 @@ namespace Dino {
     if (time > get_length() || time < SongTime(0, 0))
       throw out_of_range("Time for curve point is out of range");
     
-    Node* n = new Node(Point(time, value));
-    Iterator i = upper_bound(time);
-    m_data.insert(i.m_node, n);
-    return Iterator(n);
+    Iterator result;
+    if (m_list) {
+      Node* n = m_list->points.create_node(Point(time, value));
+      Iterator i = upper_bound(time);
+      m_list->points.insert(i.m_node, n);
+      result = Iterator(n);
+    }
+    else {
+      {
+	EditStamp stamp(m_removals);
+	m_tree->points.insert(Point(time, value));
+      }
+      result = upper_bound(time);
+      --result;
+    }
+    touch(time, time);
+    notify_changed();
+    if (m_listener)
+      m_listener->point_added(*this, time, value);
+    return result;
   }
   
   
@@ -119,9 +408,84 @@ namespace Dino {
       throw invalid_argument("Inserting the point at the given position would "
 			     "break the order");
     
-    Node* n = new Node(Point(time, value));
-    m_data.insert(before.m_node, n);
-    return Iterator(n);
+    Iterator result;
+    if (m_list) {
+      Node* n = m_list->points.create_node(Point(time, value));
+      m_list->points.insert(before.m_node, n);
+      result = Iterator(n);
+    }
+    else {
+      size_t k = count_before(before, time);
+      {
+	EditStamp stamp(m_removals);
+	m_tree->points.insert(before.m_tree, Point(time, value));
+      }
+      result = find_after(time, k);
+    }
+    touch(time, time);
+    notify_changed();
+    if (m_listener)
+      m_listener->point_added(*this, time, value);
+    return result;
+  }
+  
+  
+  void Curve::add_points(Point const* first, Point const* last)
+    throw(bad_alloc, out_of_range, invalid_argument) {
+    
+    // First, delete any old nodes that should be deleted.
+    delete_queued_nodes();
+    
+    // check the whole range before we change anything
+    for (Point const* p = first; p != last; ++p) {
+      if (p->m_time > get_length() || p->m_time < SongTime(0, 0))
+	throw out_of_range("Time for curve point is out of range");
+      if (p != first && p->m_time < (p - 1)->m_time)
+	throw invalid_argument("The curve points are not sorted");
+    }
+    if (first == last)
+      return;
+    
+    // the tree is rebuilt with the new points merged into the old ones
+    if (m_tree) {
+      PointTree& tree = m_tree->points;
+      vector<Point> merged;
+      merged.reserve(tree.size() + (last - first));
+      std::merge(tree.begin(), tree.end(), first, last, 
+		 std::back_inserter(merged), earlier);
+      EditStamp stamp(m_removals);
+      tree.assign(merged.begin(), merged.end());
+    }
+    
+    // walk through the existing points and insert every run of new points
+    // that fits before the next existing one in one go
+    else {
+      PointList& list = m_list->points;
+      NodeBase* next = list.upper_bound(*first);
+      Point const* run = first;
+      while (run != last) {
+	while (next != list.end_marker() && 
+	       !(run->m_time < static_cast<Node*>(next)->data.m_time))
+	  next = next->links()[0].next.get_relaxed();
+	Point const* run_end = run + 1;
+	if (next == list.end_marker())
+	  run_end = last;
+	else {
+	  SongTime const& t = static_cast<Node*>(next)->data.m_time;
+	  while (run_end != last && run_end->m_time < t)
+	    ++run_end;
+	}
+	list.bulk_insert(next, run, run_end);
+	run = run_end;
+      }
+    }
+    touch(first->m_time, (last - 1)->m_time);
+    notify_changed();
+    
+    if (m_listener) {
+      for (Point const* p = first; p != last; ++p)
+	m_listener->point_added(*this, p->m_time, p->m_value.get());
+    }
   }
   
   
@@ -155,23 +519,46 @@ namespace Dino {
 			   "would break the order");
     }
     
-    // If the time has changed we need to remove the node and add a new one.
-    if (time != iter->m_time) {
-      Node* n = new Node(Point(time, value));
-      Iterator before = iter;
-      m_data.insert((++before).m_node, n);
-      Node* old = static_cast<Node*>(iter.m_node);
-      m_data.remove(old);
-      shared_ptr<Node> sp = shared_ptr<Node>(old);
-      for (auto i = m_positions.begin(); i != m_positions.end(); ++i) {
-	(*i)->to_be_confirmed.
-	  push_node(new NodeQueue<shared_ptr<Node>>::Node(sp));
+    SongTime old_time = iter->m_time;
+    AtomicInt::Type old_value = iter->m_value.get();
+    
+    // If the time has changed we need to remove the node and add a new one,
+    // or replace the point in the tree.
+    if (time != old_time) {
+      Iterator result;
+      if (m_list) {
+	Node* n = m_list->points.create_node(Point(time, value));
+	Iterator before = iter;
+	m_list->points.insert((++before).m_node, n);
+	Node* old = static_cast<Node*>(iter.m_node);
+	m_list->points.remove(old);
+	m_removals.increase();
+	m_list->removed.retire(old);
+	result = Iterator(n);
       }
-      return Iterator(n);
+      else {
+	size_t k = count_before(iter, time);
+	{
+	  EditStamp stamp(m_removals);
+	  m_tree->points.set(iter.m_tree, Point(time, value));
+	}
+	result = find_after(time, k);
+      }
+      touch(old_time, old_time);
+      touch(time, time);
+      notify_changed();
+      if (m_listener)
+	m_listener->point_moved(*this, old_time, old_value, time, value);
+      return result;
     }
     
-    // If not we can just tweak the value.
-    static_cast<Node*>(iter.m_node)->data.m_value.set(value);
+    // If not we can just tweak the value, the tree is not changed either
+    // since the values are atomic.
+    const_cast<Point&>(*iter).m_value.set(value);
+    touch(time, time);
+    notify_changed();
+    if (m_listener)
+      m_listener->point_moved(*this, old_time, old_value, time, value);
     return iter;
   }
   
@@ -181,62 +568,400 @@ namespace Dino {
     delete_queued_nodes();
     
     // Then, remove this node.
+    Point point = *iter;
     Iterator next = iter;
-    ++next;
-    Node* node = static_cast<Node*>(iter.m_node);
-    m_data.remove(node);
-    shared_ptr<Node> sp = shared_ptr<Node>(node);
-    for (auto i = m_positions.begin(); i != m_positions.end(); ++i) {
-      (*i)->to_be_confirmed.
-	push_node(new NodeQueue<shared_ptr<Node>>::Node(sp));
+    if (m_list) {
+      ++next;
+      Node* node = static_cast<Node*>(iter.m_node);
+      m_list->points.remove(node);
+      m_removals.increase();
+      m_list->removed.retire(node);
+    }
+    else {
+      size_t k = count_before(iter, point.m_time);
+      {
+	EditStamp stamp(m_removals);
+	m_tree->points.erase(iter.m_tree);
+      }
+      next = find_after(point.m_time, k);
     }
+    touch(point.m_time, point.m_time);
+    notify_changed();
+    if (m_listener)
+      m_listener->point_removed(*this, point.m_time, point.m_value.get());
     return next;
   }
     
   
+  Curve::Transaction::Transaction() throw() {
+  
+  }
+  
+  
+  void Curve::Transaction::add_point(SongTime const& time, 
+				     AtomicInt::Type value) 
+    throw(bad_alloc) {
+    Edit e = { 0, false, Point(time, value) };
+    m_edits.push_back(e);
+  }
+  
+  
+  void Curve::Transaction::move_point(Iterator iter, SongTime const& time, 
+				      AtomicInt::Type value) 
+    throw(bad_alloc) {
+    Edit e = { &*iter, false, Point(time, value) };
+    m_edits.push_back(e);
+  }
+  
+  
+  void Curve::Transaction::remove_point(Iterator iter) throw(bad_alloc) {
+    Edit e = { &*iter, true, Point() };
+    m_edits.push_back(e);
+  }
+  
+  
+  size_t Curve::Transaction::get_size() const throw() {
+    return m_edits.size();
+  }
+  
+  
+  void Curve::Transaction::clear() throw() {
+    m_edits.clear();
+  }
+  
+  
+  void Curve::commit(Transaction& t) 
+    throw(bad_alloc, out_of_range, invalid_argument) {
+    
+    // First, delete any old nodes that should be deleted.
+    delete_queued_nodes();
+    
+    if (t.m_edits.empty())
+      return;
+    
+    // check the changes and find the time range that they touch
+    vector<Point const*> touched;
+    vector<Point> removed;
+    vector<Point> added;
+    SongTime first_time = get_length();
+    SongTime last_time(0, 0);
+    for (size_t i = 0; i < t.m_edits.size(); ++i) {
+      Transaction::Edit const& e = t.m_edits[i];
+      if (e.target) {
+	touched.push_back(e.target);
+	if (m_listener)
+	  removed.push_back(*e.target);
+	first_time = std::min(first_time, e.target->m_time);
+	last_time = std::max(last_time, e.target->m_time);
+      }
+      if (!e.remove) {
+	if (e.point.m_time > get_length() || e.point.m_time < SongTime(0, 0))
+	  throw out_of_range("Time for curve point is out of range");
+	added.push_back(e.point);
+	first_time = std::min(first_time, e.point.m_time);
+	last_time = std::max(last_time, e.point.m_time);
+      }
+    }
+    std::sort(touched.begin(), touched.end());
+    if (std::adjacent_find(touched.begin(), touched.end()) != touched.end())
+      throw invalid_argument("A point is changed more than once");
+    
+    // merge the untouched points in the range with the new ones, the new
+    // ones go after old ones with the same time
+    Iterator first = lower_bound(first_time);
+    Iterator last = upper_bound(last_time);
+    vector<Point> kept;
+    for (Iterator i = first; i != last; ++i) {
+      if (!std::binary_search(touched.begin(), touched.end(), &*i))
+	kept.push_back(*i);
+    }
+    std::stable_sort(added.begin(), added.end(), earlier);
+    vector<Point> merged(kept.size() + added.size());
+    std::merge(kept.begin(), kept.end(), added.begin(), added.end(), 
+	       merged.begin(), earlier);
+    
+    if (!replace_points(first, last, merged))
+      throw invalid_argument("The changes do not fit in the curve");
+    touch(first_time, last_time);
+    notify_changed();
+    
+    if (m_listener) {
+      for (size_t i = 0; i < removed.size(); ++i)
+	m_listener->point_removed(*this, removed[i].m_time, 
+				  removed[i].m_value.get());
+      for (size_t i = 0; i < t.m_edits.size(); ++i) {
+	Transaction::Edit const& e = t.m_edits[i];
+	if (!e.remove)
+	  m_listener->point_added(*this, e.point.m_time, 
+				  e.point.m_value.get());
+      }
+    }
+    
+    t.clear();
+  }
+  
+  
+  Curve::Version::ConstIterator::ConstIterator() throw()
+    : m_version(0),
+      m_chunk(0),
+      m_index(0) {
+  }
+  
+  
+  bool Curve::Version::ConstIterator::
+  operator==(ConstIterator const& iter) const throw() {
+    return m_chunk == iter.m_chunk && m_index == iter.m_index;
+  }
+  
+  
+  bool Curve::Version::ConstIterator::
+  operator!=(ConstIterator const& iter) const throw() {
+    return !operator==(iter);
+  }
+  
+  
+  Curve::Point const& Curve::Version::ConstIterator::operator*() const throw() {
+    return (*m_version->m_chunks[m_chunk])[m_index];
+  }
+  
+  
+  Curve::Point const* 
+  Curve::Version::ConstIterator::operator->() const throw() {
+    return &operator*();
+  }
+  
+  
+  Curve::Version::ConstIterator& 
+  Curve::Version::ConstIterator::operator++() throw() {
+    if (++m_index == m_version->m_chunks[m_chunk]->size()) {
+      ++m_chunk;
+      m_index = 0;
+    }
+    return *this;
+  }
+  
+  
+  Curve::Version::ConstIterator 
+  Curve::Version::ConstIterator::operator++(int) throw() {
+    ConstIterator result = *this;
+    operator++();
+    return result;
+  }
+  
+  
+  Curve::Version::ConstIterator::ConstIterator(Version const* version,
+					       size_t chunk, 
+					       size_t index) throw()
+    : m_version(version),
+      m_chunk(chunk),
+      m_index(index) {
+  }
+  
+  
+  Curve::Version::Version() throw()
+    : m_size(0) {
+  }
+  
+  
+  size_t Curve::Version::get_size() const throw() {
+    return m_size;
+  }
+  
+  
+  size_t Curve::Version::get_chunk_count() const throw() {
+    return m_chunks.size();
+  }
+  
+  
+  size_t Curve::Version::count_shared_chunks(Version const& version) const 
+    throw() {
+    // the chunks are sorted by time in both versions, so the shared ones
+    // can be found in a single merge pass
+    size_t shared = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < m_chunks.size() && j < version.m_chunks.size()) {
+      if (m_chunks[i] == version.m_chunks[j]) {
+	++shared;
+	++i;
+	++j;
+      }
+      else if (m_chunks[i]->front() < version.m_chunks[j]->front())
+	++i;
+      else
+	++j;
+    }
+    return shared;
+  }
+  
+  
+  Curve::Version::ConstIterator Curve::Version::begin() const throw() {
+    return ConstIterator(this, 0, 0);
+  }
+  
+  
+  Curve::Version::ConstIterator Curve::Version::end() const throw() {
+    return ConstIterator(this, m_chunks.size(), 0);
+  }
+  
+  
+  shared_ptr<Curve::Version const> Curve::get_version() throw(bad_alloc) {
+    
+    if (m_version && !m_any_changed)
+      return m_version;
+    
+    shared_ptr<Version> v(new Version);
+    if (!m_version || m_version->m_chunks.empty())
+      copy_chunks(*v, begin(), end());
+    
+    // share the unchanged chunks and copy every run of changed chunks from
+    // the list, the chunk boundaries are the first times of the old chunks
+    else {
+      vector<shared_ptr<Version::Chunk const> > const& old = 
+	m_version->m_chunks;
+      for (size_t i = 0; i < old.size(); ) {
+	if (!m_changed[i]) {
+	  v->m_chunks.push_back(old[i]);
+	  v->m_size += old[i]->size();
+	  ++i;
+	  continue;
+	}
+	size_t j = i + 1;
+	while (j < old.size() && m_changed[j])
+	  ++j;
+	Iterator first = (i == 0 ? begin() : 
+			  lower_bound(old[i]->front().m_time));
+	Iterator last = (j == old.size() ? end() :
+			 lower_bound(old[j]->front().m_time));
+	copy_chunks(*v, first, last);
+	i = j;
+      }
+    }
+    
+    m_changed.assign(v->m_chunks.size(), false);
+    m_any_changed = false;
+    m_version = v;
+    return m_version;
+  }
+  
+  
+  void Curve::restore(shared_ptr<Version const> const& version)
+    throw(bad_alloc, invalid_argument) {
+    
+    // First, delete any old nodes that should be deleted.
+    delete_queued_nodes();
+    
+    // only the chunks between the common prefix and the common suffix of
+    // the two versions need to be replaced
+    shared_ptr<Version const> current = get_version();
+    vector<shared_ptr<Version::Chunk const> > const& a = current->m_chunks;
+    vector<shared_ptr<Version::Chunk const> > const& b = version->m_chunks;
+    size_t begin = 0;
+    while (begin < a.size() && begin < b.size() && a[begin] == b[begin])
+      ++begin;
+    size_t a_end = a.size();
+    size_t b_end = b.size();
+    while (a_end > begin && b_end > begin && a[a_end - 1] == b[b_end - 1]) {
+      --a_end;
+      --b_end;
+    }
+    
+    if (begin != a_end || begin != b_end) {
+      vector<Point> points;
+      for (size_t i = begin; i < b_end; ++i) {
+	for (size_t j = 0; j < b[i]->size(); ++j) {
+	  Point const& p = (*b[i])[j];
+	  if (p.m_time > get_length() || p.m_time < SongTime(0, 0))
+	    throw invalid_argument("The version does not fit in the curve");
+	  points.push_back(p);
+	}
+      }
+      Iterator first = (begin == a.size() ? end() :
+			lower_bound(a[begin]->front().m_time));
+      Iterator last = (a_end == a.size() ? end() :
+		       lower_bound(a[a_end]->front().m_time));
+      vector<Point> removed;
+      if (m_listener)
+	removed.assign(first, last);
+      if (!replace_points(first, last, points))
+	throw invalid_argument("The version does not fit in the curve");
+      notify_changed();
+      if (m_listener) {
+	for (size_t i = 0; i < removed.size(); ++i)
+	  m_listener->point_removed(*this, removed[i].m_time, 
+				    removed[i].m_value.get());
+	for (size_t i = 0; i < points.size(); ++i)
+	  m_listener->point_added(*this, points[i].m_time, 
+				  points[i].m_value.get());
+      }
+    }
+    
+    // the points are now exactly the ones in the version
+    m_changed.assign(version->m_chunks.size(), false);
+    m_any_changed = false;
+    m_version = version;
+  }
+  
+  
   Curve::Iterator Curve::begin() throw() {
-    return Iterator(m_data.first_node());
+    if (m_list)
+      return Iterator(m_list->points.first_node());
+    return Iterator(m_tree->points.begin());
   }
   
   
   Curve::Iterator Curve::end() throw() {
-    return Iterator(m_data.end_marker());
+    if (m_list)
+      return Iterator(m_list->points.end_marker());
+    return Iterator(m_tree->points.end());
   }
     
   
   Curve::Iterator Curve::lower_bound(SongTime const& time) throw() {
-    return Iterator(m_data.lower_bound(Point(time)));
+    if (m_list)
+      return Iterator(m_list->points.lower_bound(Point(time)));
+    return Iterator(m_tree->points.lower_bound(Point(time)));
   }
   
 
   Curve::Iterator Curve::upper_bound(SongTime const& time) throw() {
-    return Iterator(m_data.upper_bound(Point(time)));
+    if (m_list)
+      return Iterator(m_list->points.upper_bound(Point(time)));
+    return Iterator(m_tree->points.upper_bound(Point(time)));
   }
     
    
   Curve::ConstIterator Curve::begin() const throw() {
-    return ConstIterator(m_data.first_node());
+    if (m_list)
+      return ConstIterator(m_list->points.first_node());
+    return ConstIterator(m_tree->points.begin());
   }
   
     
   Curve::ConstIterator Curve::end() const throw() {
-    return ConstIterator(m_data.end_marker());
+    if (m_list)
+      return ConstIterator(m_list->points.end_marker());
+    return ConstIterator(m_tree->points.end());
   }
     
   
   Curve::ConstIterator Curve::lower_bound(SongTime const& time) const throw() {
-    return ConstIterator(m_data.lower_bound(Point(time)));
+    if (m_list)
+      return ConstIterator(m_list->points.lower_bound(Point(time)));
+    return ConstIterator(m_tree->points.lower_bound(Point(time)));
   }
   
   
   Curve::ConstIterator Curve::upper_bound(SongTime const& time) const throw() {
-    return ConstIterator(m_data.upper_bound(Point(time)));
+    if (m_list)
+      return ConstIterator(m_list->points.upper_bound(Point(time)));
+    return ConstIterator(m_tree->points.upper_bound(Point(time)));
   }
   
   
   unique_ptr<Sequencable::Position> 
   Curve::create_position(SongTime const& st) const {
-    auto pos = unique_ptr<CurvePosition>(new CurvePosition());
+    auto pos = unique_ptr<CurvePosition>(new CurvePosition);
     update_position(*pos, st);
     return move(pos);
   }
@@ -245,58 +970,347 @@ namespace Dino {
   void Curve::update_position(Sequencable::Position& pos, 
 			      SongTime const& st) const {
     Sequencable::update_position(pos, st);
-    static_cast<CurvePosition&>(pos).node = m_data.find_less(Point(st));
+    CurvePosition& cp = static_cast<CurvePosition&>(pos);
+    cp.last_value = -1;
+    ReadGuard guard(m_domain);
+    
+    // if the node is still in the curve and before the new time, search
+    // forward from it, otherwise leave the search to resolve_position()
+    if (m_list && cp.found && cp.removals == m_removals.get() &&
+	(cp.node == m_list->points.head_marker() || 
+	 static_cast<Node const*>(cp.node)->data.m_time < st)) {
+      cp.node = m_list->points.find_less(Point(st), cp.node);
+      return;
+    }
+    cp.found = false;
+  }
+  
+  
+  void Curve::copy_position(Sequencable::Position& dst, 
+			    Sequencable::Position const& src) const {
+    CurvePosition& d = static_cast<CurvePosition&>(dst);
+    CurvePosition const& s = static_cast<CurvePosition const&>(src);
+    ReadGuard guard(m_domain);
+    resolve_position(s);
+    Sequencable::update_position(d, s.get_time());
+    d.found = s.found;
+    d.removals = s.removals;
+    d.node = s.node;
+    d.point = s.point;
+    d.next = s.next;
+    d.last_value = -1;
+  }
+  
+  
+  void Curve::advance_position(Sequencable::Position& pos, 
+			       SongTime const& st) const {
+    // sequence() and get_next_event() walk forward from the node
+    Sequencable::update_position(pos, st);
   }
   
   
   bool Curve::sequence(Sequencable::Position& pos, SongTime const& to, 
-		       EventBuffer& /*buf*/) const {
-    // check if the position needs to be updated
+		       EventBuffer& buf) const {
+    if (m_list)
+      return sequence_segments<ListSegment>(pos, to, buf);
+    return sequence_segments<TreeSegment>(pos, to, buf);
+  }
+  
+  
+  template <typename S>
+  bool Curve::sequence_segments(Sequencable::Position& pos, SongTime const& to,
+				EventBuffer& buf) const {
     CurvePosition& cp = static_cast<CurvePosition&>(pos);
-    NodeQueue<shared_ptr<Node>>::Node* n;
-    bool needs_update = false;
-    while ((n = cp.to_be_confirmed.pop_node())) {
-      if (n->data.get() == cp.node)
-	needs_update = true;
-      cp.to_be_deleted.push_node(n);
-    }
-    if (needs_update)
-      update_position(pos, pos.get_time());
-    
-    // for each curve point with time < to:
-    NodeBase* nb = cp.node->links[0].next.get();
-    NodeBase* last_sequenced = nb;
-    while (nb != m_data.end_marker()) {
-      Node* node = static_cast<Node*>(node);
-      if (node->data.m_time >= to)
-	break;
-      last_sequenced = node;
-      if (node->data.m_time >= cp.get_time()) {
-	//   interpolate events until to and write to buf
+    ReadGuard guard(m_domain);
+    
+    // if the position has been relocated we only need to search for the
+    // node if there are points before the end of the range
+    if (!cp.found || cp.removals != m_removals.get()) {
+      ConstIterator first = begin();
+      if (first == end() || !(first->m_time < to)) {
+	Sequencable::update_position(pos, to);
+	cp.found = false;
+	return true;
+      }
+      resolve_position(cp);
+    }
+    
+    // only CCs and pitchbend can be sequenced
+    unsigned char status;
+    int max_value;
+    if (m_cid < 128) {
+      status = 0xB0;
+      max_value = 127;
+    }
+    else if (m_cid == pitchbend()) {
+      status = 0xE0;
+      max_value = 16383;
+    }
+    else {
+      update_position(pos, to);
+      return true;
+    }
+    
+    // the point values are in the range [0, 2^31) so this scales them to 
+    // the MIDI range
+    double const scale = (max_value + 1) / 2147483648.0;
+    int64_t const step = beat_ticks / m_resolution;
+    int64_t const end = to_ticks(to);
+    int64_t t = grid_ceil(to_ticks(pos.get_time()), step);
+    S s(*this, cp);
+    
+    while (t < end) {
+      
+      // find the segment that t is in
+      while (s.second() && to_ticks(s.second()->m_time) <= t)
+	s.step();
+      
+      // nothing is written before the first point
+      if (!s.first()) {
+	if (!s.second())
+	  break;
+	t = grid_ceil(to_ticks(s.second()->m_time), step);
+	continue;
+      }
+      
+      // compute the start value and the change per step for this segment,
+      // after the last point the value is constant
+      Point const& pa = *s.first();
+      double v = pa.m_value.get() * scale;
+      double dv = 0;
+      int64_t seg_end = end;
+      if (s.second()) {
+	Point const& pb = *s.second();
+	int64_t ta = to_ticks(pa.m_time);
+	int64_t tb = to_ticks(pb.m_time);
+	seg_end = std::min(seg_end, tb);
+	if (m_interpolation == Linear) {
+	  double slope = (pb.m_value.get() * scale - v) / (tb - ta);
+	  v += slope * (t - ta);
+	  dv = slope * step;
+	}
+      }
+      int64_t samples = (seg_end - t + step - 1) / step;
+      
+      // compute and write the values in batches, if the value is constant
+      // we only need to look at the first one
+      while (samples > 0) {
+	int32_t values[batch_size];
+	unsigned count = (dv == 0 ? 1 : std::min<int64_t>(samples, batch_size));
+	interpolate(v, dv, count, values);
+	for (unsigned i = 0; i < count; ++i) {
+	  int value = std::max(0, std::min<int>(values[i], max_value));
+	  if (value == cp.last_value)
+	    continue;
+	  unsigned char data[3] = { status };
+	  if (status == 0xB0) {
+	    data[1] = m_cid;
+	    data[2] = value;
+	  }
+	  else {
+	    data[1] = value & 0x7F;
+	    data[2] = value >> 7;
+	  }
+	  SongTime st = from_ticks(t + i * step);
+	  if (!buf.write_event(st, 3, data)) {
+	    Sequencable::update_position(pos, st);
+	    s.store(cp);
+	    return false;
+	  }
+	  cp.last_value = value;
+	}
+	int64_t done = (dv == 0 ? samples : count);
+	v += dv * count;
+	t += done * step;
+	samples -= done;
       }
-      nb = node->links[0].next.get();
     }
     
     // update pos with time to and the last node before it
     Sequencable::update_position(pos, to);
-    cp.node = last_sequenced;
+    s.store(cp);
     
     return true;
   }
 
 
-  void Curve::remove_curve_position(CurvePosition* c) {
-    auto iter = m_positions.find(c);
-    if (iter != m_positions.end())
-      m_positions.erase(iter);
+  SongTime Curve::get_next_event(Sequencable::Position const& pos) const {
+    if (m_list)
+      return find_next_event<ListSegment>(pos);
+    return find_next_event<TreeSegment>(pos);
   }
-
-
+  
+  
+  template <typename S>
+  SongTime Curve::find_next_event(Sequencable::Position const& pos) const {
+    CurvePosition const& cp = static_cast<CurvePosition const&>(pos);
+    
+    // only CCs and pitchbend are sequenced
+    int max_value;
+    if (m_cid < 128)
+      max_value = 127;
+    else if (m_cid == pitchbend())
+      max_value = 16383;
+    else
+      return SongTime::max_valid();
+    double const scale = (max_value + 1) / 2147483648.0;
+    
+    ReadGuard guard(m_domain);
+    
+    // a relocated position is not looked up until it is sequenced. Nothing
+    // is written before the first point, and after it the value at the
+    // position may not have been written yet, so without the node the 
+    // answer is the first point or the time of the position.
+    if (!cp.found || cp.removals != m_removals.get()) {
+      ConstIterator first = begin();
+      if (first == end())
+	return SongTime::max_valid();
+      SongTime const& t = first->m_time;
+      return pos.get_time() < t ? t : pos.get_time();
+    }
+    
+    // sequence() may leave the node behind points that are before the time
+    // of the position, so find the segment that it is in
+    S s(*this, cp);
+    while (s.second() && !(pos.get_time() < s.second()->m_time))
+      s.step();
+    
+    // nothing is written before the first point
+    if (!s.first()) {
+      if (!s.second())
+	return SongTime::max_valid();
+      return s.second()->m_time;
+    }
+    
+    // if the value is constant until the next point, or after the last 
+    // one, and it has already been written, nothing happens until then
+    int v = midi_value(s.first()->m_value.get(), scale, max_value);
+    if (v != cp.last_value)
+      return pos.get_time();
+    if (!s.second())
+      return SongTime::max_valid();
+    Point const& pb = *s.second();
+    if (m_interpolation == Step || 
+	midi_value(pb.m_value.get(), scale, max_value) == v)
+      return pb.m_time;
+    return pos.get_time();
+  }
+  
+  
   void Curve::delete_queued_nodes() throw() {
-    for (auto i = m_positions.begin(); i != m_positions.end(); ++i) {
-      NodeQueue<shared_ptr<Node>>::Node* n;
-      while ((n = (*i)->to_be_deleted.pop_node()))
-	delete n;
+    if (m_list)
+      m_list->removed.collect();
+    else
+      m_tree->points.collect();
+  }
+  
+  
+  void Curve::resolve_position(CurvePosition const& cp) const throw() {
+    AtomicInt::Type removals = m_removals.get();
+    if (cp.found && cp.removals == removals)
+      return;
+    if (m_list)
+      cp.node = m_list->points.find_less(Point(cp.get_time()));
+    else {
+      // the point before is found in the same version as the one after it
+      cp.next = m_tree->points.lower_bound(Point(cp.get_time()));
+      PointTree::ConstIterator a = cp.next;
+      cp.point = (a.is_first() ? 0 : &*--a);
+    }
+    
+    // a tree that is being edited may retire the nodes that were just
+    // looked up without changing the count again, so they are not cached
+    cp.found = (m_list || (removals & 1) == 0);
+    cp.removals = removals;
+  }
+  
+  
+  bool Curve::replace_points(Iterator first, Iterator last, 
+			     vector<Point> const& points) throw(bad_alloc) {
+    
+    // the tree is rebuilt with the points outside the range
+    if (m_tree) {
+      PointTree& tree = m_tree->points;
+      vector<Point> all;
+      all.reserve(tree.size() + points.size());
+      all.insert(all.end(), begin(), first);
+      all.insert(all.end(), points.begin(), points.end());
+      all.insert(all.end(), last, end());
+      EditStamp stamp(m_removals);
+      return tree.assign(all.begin(), all.end());
+    }
+    
+    // switch the ranges, the old nodes are still linked to each other at
+    // level 0 so we can retire them afterwards
+    if (!m_list->points.replace(first.m_node, last.m_node, 
+				points.begin(), points.end()))
+      return false;
+    m_removals.increase();
+    for (NodeBase* n = first.m_node; n != last.m_node; ) {
+      NodeBase* next = n->links()[0].next.get_relaxed();
+      m_list->removed.retire(static_cast<Node*>(n));
+      n = next;
+    }
+    return true;
+  }
+  
+  
+  size_t Curve::count_before(Iterator iter, SongTime const& time) throw() {
+    size_t k = 0;
+    Iterator first = begin();
+    while (iter != first && (--iter)->m_time == time)
+      ++k;
+    return k;
+  }
+  
+  
+  Curve::Iterator Curve::find_after(SongTime const& time, size_t k) throw() {
+    Iterator i = lower_bound(time);
+    for ( ; k > 0; --k)
+      ++i;
+    return i;
+  }
+  
+  
+  void Curve::touch(SongTime const& first, SongTime const& last) throw() {
+    
+    // if there is no version to share chunks with the whole curve will be
+    // copied anyway
+    if (!m_version || m_version->m_chunks.empty()) {
+      m_any_changed = true;
+      return;
+    }
+    
+    // points before the first chunk belong to it, all other points belong
+    // to the last chunk that doesn't start after them
+    vector<shared_ptr<Version::Chunk const> > const& c = m_version->m_chunks;
+    size_t i = std::upper_bound(c.begin(), c.end(), first, 
+				before_chunk<shared_ptr<Version::Chunk const> >)
+      - c.begin();
+    size_t j = std::upper_bound(c.begin() + i, c.end(), last, 
+				before_chunk<shared_ptr<Version::Chunk const> >)
+      - c.begin();
+    for (i = (i > 0 ? i - 1 : 0); i < j; ++i)
+      m_changed[i] = true;
+    if (j == 0)
+      m_changed[0] = true;
+    m_any_changed = true;
+  }
+  
+  
+  void Curve::copy_chunks(Version& version, 
+			  ConstIterator first, ConstIterator last) const
+    throw(bad_alloc) {
+    while (first != last) {
+      shared_ptr<Version::Chunk> chunk(new Version::Chunk);
+      chunk->reserve(chunk_size);
+      do {
+	chunk->push_back(*first);
+	++first;
+      } while (first != last && 
+	       (chunk->size() < chunk_size || !(chunk->back() < *first)));
+      version.m_size += chunk->size();
+      version.m_chunks.push_back(chunk);
     }
   }
 
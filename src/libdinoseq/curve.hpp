@@ -21,12 +21,14 @@
 
 #include <iterator>
 #include <memory>
-#include <set>
 #include <stdexcept>
+#include <vector>
 
 #include "atomicint.hpp"
+#include "cowbtree.hpp"
+#include "epochdomain.hpp"
 #include "meta.hpp"
-#include "nodequeue.hpp"
+#include "nodepool.hpp"
 #include "nodeskiplist.hpp"
 #include "sequencable.hpp"
 #include "songtime.hpp"
@@ -35,6 +37,9 @@
 namespace Dino {
   
   
+  class EditListener;
+  
+  
   /** A curve that can be sequenced as MIDI controller values.
       The curve consists of points with specified times and values,
       and when sequenced it will interpolate the events inbetween
@@ -42,6 +47,19 @@ namespace Dino {
       smooth. There are functions for adding and removing points,
       as well as moving them around and iterating over them.
       
+      Any number of positions, in any number of sequencers, can play the
+      same curve. Removed points are kept in a single list for the whole
+      curve until no position can be using them, so the cost of an edit
+      does not depend on the number of positions.
+      
+      The points are stored in a NodeSkipList by default. A curve can 
+      also be created with BTree storage, which keeps the points in the 
+      wide leaves of a CowBTree. Sequencing and scanning a long curve is 
+      faster then, since consecutive points are next to each other in 
+      memory, but every edit copies a path in the tree and invalidates all
+      iterators, and commit(), restore() and add_points() rebuild the 
+      whole tree. The interface is the same for both.
+      
       @ingroup mididata
   */
   class Curve : public Sequencable {
@@ -69,38 +87,81 @@ namespace Dino {
 
   private:
     
+    /** The list type used for the points. All nodes for a curve are 
+	allocated from its own pools. */
+    typedef NodeSkipList<Point, 2, 20, PoolAllocator> PointList;
+    
+    /** The tree type used for the points of curves with BTree 
+	storage. */
+    typedef CowBTree<Point, 64, 16, PoolAllocator> PointTree;
+    
     /** The NodeBase type used internally. */
-    typedef NodeSkipList<Point>::NodeBase NodeBase;
+    typedef PointList::NodeBase NodeBase;
     
     /** The Node type used internally. */
-    typedef NodeSkipList<Point>::Node Node;
+    typedef PointList::Node Node;
+    
+    /** The skip list storage and its removed nodes. */
+    struct ListStorage;
+    
+    /** The B-tree storage. */
+    struct TreeStorage;
     
+    /** A cursor over the segments between consecutive points in a 
+	ListStorage. */
+    class ListSegment;
     
-    /** This is the Position subclass for Curve. It holds a NodeBase pointer
-	to the last sequenced node (or the skiplist head, if no node in the
-	list has been played yet). */
+    /** A cursor over the segments between consecutive points in a 
+	TreeStorage. */
+    class TreeSegment;
+    
+    
+    /** This is the Position subclass for Curve. It caches where the last
+	sequenced point is in the storage of the curve. The point is looked
+	up lazily, so the cache is empty after a relocation until the 
+	position is sequenced or copied. */
     struct CurvePosition : Position {
-      CurvePosition() throw() : Position(SongTime(0, 0)), node(0) {}
+      CurvePosition() throw() 
+	: Position(SongTime(0, 0)), 
+	  found(false),
+	  removals(0),
+	  node(0), 
+	  point(0),
+	  last_value(-1) {
+      }
+      
+      /** @c true if the cache has been filled in since the position was
+	  last relocated. This is a cache, so it may be filled in when the
+	  position is used as the source of a copy. It is only protected 
+	  from deallocation while the curve is being read, so it must not be
+	  used if @c removals is out of date. */
+      mutable bool found;
       
-      /** The last sequenced node, or the head of the curve if no node in
-	  it has been sequenced yet. */
-      NodeBase const* node;
+      /** The value of Curve::m_removals when the cache was filled in. If it
+	  has changed the cached points may have been removed from the 
+	  curve. */
+      mutable AtomicInt::Type removals;
       
-      /** The nodes that have been removed from the curve and need to be
-	  confirmed by the sequencing thread (moved to to_be_deleted). */
-      NodeQueue<std::shared_ptr<Node>> to_be_confirmed;
+      /** For ListStorage, the last sequenced node, or the head of the list
+	  if no node in it has been sequenced yet. */
+      mutable NodeBase const* node;
       
-      /** The nodes that have been confirmed by the sequencing thread as
-	  OK to delete. */
-      NodeQueue<std::shared_ptr<Node>> to_be_deleted;
+      /** For TreeStorage, the last sequenced point, or 0 if no point has
+	  been sequenced yet. */
+      mutable Point const* point;
       
-      /** The Curve that this position is used with. */
-      Curve* curve;
+      /** For TreeStorage, the point after @c point. */
+      mutable PointTree::ConstIterator next;
+      
+      /** The last MIDI value that was written for this position, or -1 if
+	  nothing has been written since the position was last updated. */
+      int last_value;
     };
     
 
     /** A base class template for Iterator and ConstIterator that
-	implements all the common operations.
+	implements all the common operations. It holds a node for 
+	ListStorage and a tree iterator for TreeStorage.
 	@tparam T the Node type (either Node or  Node @c const)
     */
     template <typename Derived, typename Compare, typename N>
@@ -118,7 +179,7 @@ namespace Dino {
       /** Equality operator. Returns true if @c *this and @c iter point
 	  to the same list element. */
       bool operator==(Compare const& iter) const throw() {
-	return m_node == iter.m_node;
+	return m_node == iter.m_node && (m_node || m_tree == iter.m_tree);
       }
       
       /** Inequality operator, negation of the equality operator. */
@@ -128,17 +189,20 @@ namespace Dino {
       
       /** Return a proper pointer to the curve point. */
       Point const* operator->() const throw() {
-	return &static_cast<N*>(m_node)->data;
+	return &operator*();
       }
       
       /** Return a reference to the curve point. */
       Point const& operator*() const throw() {
-	return static_cast<N*>(m_node)->data;
+	return m_node ? static_cast<N*>(m_node)->data : *m_tree;
       }
       
       /** Make the iterator point to the next curve point. */
       Derived& operator++() throw() {
-	m_node = static_cast<N*>(m_node)->links[0].next.get();
+	if (m_node)
+	  m_node = static_cast<N*>(m_node)->links()[0].next.get_acquire();
+	else
+	  ++m_tree;
 	return static_cast<Derived&>(*this);
       }
       
@@ -152,7 +216,10 @@ namespace Dino {
       
       /** Make the iterator point to the previous curve point. */
       Derived& operator--() throw() {
-	m_node = m_node->links[0].prev;
+	if (m_node)
+	  m_node = m_node->links()[0].prev;
+	else
+	  --m_tree;
 	return static_cast<Derived&>(*this);
       }
       
@@ -170,8 +237,18 @@ namespace Dino {
 	  be used by derived classes. */
       IteratorT(NB* node) throw() : m_node(node) {}
       
-      /** The NodeBase pointer. */
+      /** Create a new IteratorT from a tree iterator. This should only be
+	  used by derived classes. */
+      IteratorT(PointTree::ConstIterator const& i) throw() 
+	: m_node(0), 
+	  m_tree(i) {
+      }
+      
+      /** The NodeBase pointer, or 0 for TreeStorage. */
       NB* m_node;
+      
+      /** The tree iterator, for TreeStorage. */
+      PointTree::ConstIterator m_tree;
 
     };
     
@@ -195,6 +272,9 @@ namespace Dino {
       
       /** Create a new ConstIterator from a NodeBase pointer. */
       explicit ConstIterator(NodeBase const* node) throw();
+      
+      /** Create a new ConstIterator from a tree iterator. */
+      explicit ConstIterator(PointTree::ConstIterator const& i) throw();
 
     };
     
@@ -218,6 +298,9 @@ namespace Dino {
       /** Create a new Iterator from a NodeBase pointer. */
       explicit Iterator(NodeBase* node) throw();
       
+      /** Create a new Iterator from a tree iterator. */
+      explicit Iterator(PointTree::ConstIterator const& i) throw();
+      
     };
     
     
@@ -225,19 +308,76 @@ namespace Dino {
     typedef unsigned ControllerID;
     
     
-    /** Create a new Curve with the given label, length and controller ID. */
+    /** The ways to compute the controller values between two points. */
+    enum Interpolation {
+      /** Interpolate linearly between the points. */
+      Linear,
+      /** Keep the value of a point until the next point. */
+      Step
+    };
+    
+    
+    /** The data structures that the points can be stored in. */
+    enum Storage {
+      /** A NodeSkipList with one node per point. */
+      SkipList,
+      /** A CowBTree with up to 64 points per leaf. */
+      BTree
+    };
+    
+    
+    /** Return the controller ID used for pitchbend curves. The IDs 0 to 127
+	are used for the MIDI CCs with the same numbers, curves with other
+	IDs are not sequenced. */
+    static ControllerID pitchbend() throw();
+    
+    /** Create a new Curve with the given label, length, controller ID and
+	storage for the points.
+	
+	@throw std::bad_alloc if the node pools could not be allocated
+    */
     Curve(std::string const& label, 
-	  SongTime const& length, ControllerID cid = 0) throw();
+	  SongTime const& length, ControllerID cid = 0,
+	  Storage storage = SkipList) 
+      throw(std::bad_alloc);
     
     /** Destroy the curve. */
     ~Curve() throw();
     
+    /** Return the storage that the points are kept in. */
+    Storage get_storage() const throw();
+    
     /** Return the controller ID. */
     ControllerID get_controller_id() const throw();
     
     /** Set the controller ID. */
     void set_controller_id(ControllerID cid) throw();
     
+    /** Return the interpolation mode. */
+    Interpolation get_interpolation() const throw();
+    
+    /** Set the interpolation mode. */
+    void set_interpolation(Interpolation mode) throw();
+    
+    /** Return the maximal number of events per beat that are written when
+	the curve is sequenced. */
+    unsigned get_resolution() const throw();
+    
+    /** Set the maximal number of events per beat that are written when the
+	curve is sequenced. The values are sampled on a grid with this many
+	steps per beat, and only samples where the MIDI value has changed are
+	written, so dense curves can not flood the MIDI output. The value is
+	clamped to the range [1, SongTime::ticks_per_beat()]. */
+    void set_resolution(unsigned events_per_beat) throw();
+    
+    /** Return the EditListener that is told about all changes to the 
+	points, or 0 if there is none. */
+    EditListener* get_edit_listener() const throw();
+    
+    /** Set the EditListener that is told about all changes to the points.
+	Use 0 to remove the current one. */
+    void set_edit_listener(EditListener* listener) throw();
+    
     /** Add a curve point at the last position that keeps the order
 	of points consistent. Return an iterator for the new point. 
     
@@ -262,6 +402,21 @@ namespace Dino {
 		       Iterator before) 
       throw(std::bad_alloc, std::out_of_range, std::invalid_argument);
     
+    /** Add all points in the sorted range [@c first, @c last). New points 
+	with the same time as existing points are added after them, just 
+	like with add_point(). The new points are merged into the curve in 
+	one pass, and every run of new points that end up next to each other
+	is linked together before it is inserted, so this takes O(n + m) time
+	for n new points and m existing ones instead of O(n log(n + m)).
+	
+	@throw std::bad_alloc if there isn't enough memory to add the points
+	@throw std::out_of_range if any point is earlier than @c SongTime(0,0)
+                                 or later than get_length()
+	@throw std::invalid_argument if the range is not sorted
+    */
+    void add_points(Point const* first, Point const* last)
+      throw(std::bad_alloc, std::out_of_range, std::invalid_argument);
+    
     /** Move the point referred to by @c iter to the given time and value.
 	Return a new iterator to the point (the old one will be invalidated)
 	or end() if moving the point to the given time would make the points
@@ -281,6 +436,209 @@ namespace Dino {
 	to the next point in the curve. */
     Iterator remove_point(Iterator iter) throw();
     
+    
+    /** A set of changes to the points of a curve that are collected and 
+	then applied all at once with Curve::commit(). Nothing happens to 
+	the curve until then, so the sequencer never sees a partly applied
+	set of changes. */
+    class Transaction {
+    public:
+      
+      /** Create an empty transaction. */
+      Transaction() throw();
+      
+      /** Add a point at the given time. Like Curve::add_point(), it will
+	  end up after any existing points with the same time.
+	  
+	  @throw std::bad_alloc if the change could not be stored
+      */
+      void add_point(SongTime const& time, AtomicInt::Type value) 
+	throw(std::bad_alloc);
+      
+      /** Move the point that @c iter refers to to the given time and 
+	  value. Unlike Curve::move_point() it may be moved past other 
+	  points, the points are sorted again when the transaction is 
+	  committed.
+	  
+	  @throw std::bad_alloc if the change could not be stored
+      */
+      void move_point(Iterator iter, SongTime const& time, 
+		      AtomicInt::Type value) throw(std::bad_alloc);
+      
+      /** Remove the point that @c iter refers to.
+	  
+	  @throw std::bad_alloc if the change could not be stored
+      */
+      void remove_point(Iterator iter) throw(std::bad_alloc);
+      
+      /** Return the number of changes in the transaction. */
+      size_t get_size() const throw();
+      
+      /** Forget all changes. */
+      void clear() throw();
+    
+    private:
+      
+      friend class Curve;
+      
+      /** A single change. */
+      struct Edit {
+	
+	/** The point that is moved or removed, or 0 for new points. */
+	Point const* target;
+	
+	/** @c true if the point should be removed. */
+	bool remove;
+	
+	/** The new time and value for added and moved points. */
+	Point point;
+      };
+      
+      /** The changes, in the order they were made. */
+      std::vector<Edit> m_edits;
+    };
+    
+    /** Apply all changes in @c t at once and clear it. All the points 
+	from the earliest to the latest time that is touched by the changes
+	are replaced by new nodes in a single pass over that range, and the
+	new range is made visible to the sequencer with a single pointer 
+	write, so this takes O(n + k log k) time for n points in that range
+	and k changes. With BTree storage the whole tree is rebuilt, so n is
+	the number of points in the curve. All iterators to points in the 
+	range are invalidated.
+	The curve must not have been changed in other ways since the 
+	changes were added to @c t, and they must all refer to points in 
+	this curve. 
+	
+	The EditListener is told about the removed and moved points as 
+	removals, followed by the added and moved points as additions.
+	
+	@throw std::bad_alloc if the new points could not be allocated
+	@throw std::out_of_range if any new time is smaller than 
+				 @c SongTime(0,0) or larger than get_length()
+	@throw std::invalid_argument if a point is moved or removed more 
+				     than once, or the new points would 
+				     not be in order with the rest of the
+				     curve
+    */
+    void commit(Transaction& t) 
+      throw(std::bad_alloc, std::out_of_range, std::invalid_argument);
+    
+    
+    /** A frozen copy of the points of a curve, as returned by 
+	Curve::get_version(). A version never changes once it has been 
+	created, so it can be read by any thread, for example to save or 
+	render the curve in the background, while the curve itself is being
+	edited. The points are stored in chunks of about 64 points that are 
+	shared between versions, so a new version only copies the chunks 
+	that have been edited since the previous one. */
+    class Version {
+    public:
+      
+      /** A forward iterator over the points of a Version. */
+      class ConstIterator 
+	: public std::iterator<std::forward_iterator_tag, Point const> {
+      public:
+	
+	/** Create a singular iterator. */
+	ConstIterator() throw();
+	
+	/** Equality operator. */
+	bool operator==(ConstIterator const& iter) const throw();
+	
+	/** Inequality operator. */
+	bool operator!=(ConstIterator const& iter) const throw();
+	
+	/** Return a reference to the point. */
+	Point const& operator*() const throw();
+	
+	/** Return a pointer to the point. */
+	Point const* operator->() const throw();
+	
+	/** Make the iterator point to the next point. */
+	ConstIterator& operator++() throw();
+	
+	/** Make the iterator point to the next point, postfix version. */
+	ConstIterator operator++(int) throw();
+      
+      private:
+	
+	friend class Version;
+	
+	/** Create an iterator to point @c index in chunk @c chunk. */
+	ConstIterator(Version const* version, 
+		      size_t chunk, size_t index) throw();
+	
+	/** The version that is iterated over. */
+	Version const* m_version;
+	
+	/** The current chunk. */
+	size_t m_chunk;
+	
+	/** The index of the point in the current chunk. */
+	size_t m_index;
+      };
+      
+      /** Create an empty version. */
+      Version() throw();
+      
+      /** Return the number of points. */
+      size_t get_size() const throw();
+      
+      /** Return the number of chunks that the points are stored in. */
+      size_t get_chunk_count() const throw();
+      
+      /** Return the number of chunks that this version shares with 
+	  @c version. */
+      size_t count_shared_chunks(Version const& version) const throw();
+      
+      /** Return an iterator to the first point. */
+      ConstIterator begin() const throw();
+      
+      /** Return an iterator to the end of the version. */
+      ConstIterator end() const throw();
+    
+    private:
+      
+      friend class Curve;
+      
+      /** A sorted run of points. Points with the same time are never 
+	  split between two chunks, and chunks are never empty. */
+      typedef std::vector<Point> Chunk;
+      
+      /** The chunks, in order. */
+      std::vector<std::shared_ptr<Chunk const> > m_chunks;
+      
+      /** The total number of points. */
+      size_t m_size;
+    };
+    
+    /** Return a Version with the current points of the curve. If the curve
+	hasn't changed since the last call the same Version is returned 
+	again, otherwise only the chunks of the last Version that contain 
+	changed points are copied from the curve, so this takes O(c + k) 
+	time for c chunks and k points in the changed chunks. This function
+	is @b not realtime safe.
+	
+	@throw std::bad_alloc if the new chunks could not be allocated
+    */
+    std::shared_ptr<Version const> get_version() throw(std::bad_alloc);
+    
+    /** Make the points of the curve equal to the points in @c version,
+	which must have been returned by get_version() for this curve. Only
+	the span from the first to the last chunk that isn't shared between
+	@c version and the current points is replaced, in the same way as 
+	commit() does it, so undoing or redoing a small edit is cheap and the
+	sequencer sees the whole change at once. The EditListener is told 
+	about the replaced points as removals followed by additions.
+	
+	@throw std::bad_alloc if the new points could not be allocated
+	@throw std::invalid_argument if the points in @c version do not fit
+				     in the curve
+    */
+    void restore(std::shared_ptr<Version const> const& version)
+      throw(std::bad_alloc, std::invalid_argument);
+    
     /** Return an iterator to the first curve point. */
     Iterator begin() throw();
     
@@ -317,38 +675,137 @@ namespace Dino {
     virtual std::unique_ptr<Position> 
     create_position(SongTime const& st) const;
     
-    /** Update a Position object to a new time. 
+    /** Update a Position object to a new time. If the new time is after
+	the old one the skip list is searched forward from the old node, 
+	which takes O(log d) time for a move past d points. Otherwise, and 
+	always with BTree storage, the search from the head is done the next
+	time the position is sequenced, and only if there are points in the
+	sequenced range. 
 	This function is realtime safe and can be called by the sequencer
 	in an RT thread. */
     virtual void update_position(Position& pos, SongTime const& st) const;
     
+    /** Make @c dst a copy of @c src in constant time. If no point has been
+	removed since @c src was last used, its node is reused, otherwise
+	it is looked up again once and stored in @c src for later copies. 
+	This function is realtime safe. */
+    virtual void copy_position(Position& dst, Position const& src) const;
+    
+    /** Move @c pos forward to @c st in constant time. Only the time is 
+	changed, so the last written value is kept and sequence() will not
+	write it again unless it has changed. This function is realtime 
+	safe. */
+    virtual void advance_position(Position& pos, SongTime const& st) const;
+    
     /** Write MIDI data from the Sequencable to an EventBuffer.
 	The function returns @c false if it was not able to write all events
 	in the range [@c pos, @c to) to @c buf. @c pos will be updated to point
 	to the end of the range of events that were written.
+	The values between the curve points are computed in batches for a
+	whole segment at a time. Nothing is written before the first point,
+	and the value of the last point is kept after it.
 	This function is realtime safe. */
     virtual bool sequence(Position& pos, SongTime const& to, 
 			  EventBuffer& buf) const;
     
+    /** Return the time of the next event that sequence() may write for 
+	@c pos. Before the first point this is the time of the first point,
+	in a segment where the MIDI value is constant and has already been
+	written it is the time of the next point, and after the last point
+	it is SongTime::max_valid() once the last value has been written.
+	Otherwise it is the time of @c pos. If @c pos has been relocated and
+	not sequenced since, this does not search for its node and returns
+	the time of the first point or the time of @c pos, whichever is 
+	later, in constant time. This function is realtime safe. */
+    virtual SongTime get_next_event(Position const& pos) const;
+  
   private:
     
-    /** Called by the CurvePosition destructor to remove itself. */
-    void remove_curve_position(CurvePosition* c);
-    
-    /** Used internally to actually delete removed nodes once the 
-	CurvePositions have confirmed the deletions. */
+    /** Deallocate the removed nodes that no position can be using any 
+	more. */
     void delete_queued_nodes() throw();
     
+    /** Look up the node for @c cp if it hasn't been looked up yet or may
+	have been removed from the curve. */
+    void resolve_position(CurvePosition const& cp) const throw();
+    
+    /** Implement sequence() using the segment cursor @c S, which must
+	match the storage of the curve. */
+    template <typename S>
+    bool sequence_segments(Position& pos, SongTime const& to, 
+			   EventBuffer& buf) const;
+    
+    /** Implement get_next_event() using the segment cursor @c S, which 
+	must match the storage of the curve. */
+    template <typename S>
+    SongTime find_next_event(Position const& pos) const;
+    
+    /** Replace the points in [@c first, @c last) with @c points and retire
+	the old ones. Return @c false and leave the curve unchanged if the 
+	new points would break the order. */
+    bool replace_points(Iterator first, Iterator last, 
+			std::vector<Point> const& points) throw(std::bad_alloc);
+    
+    /** Return the number of points with the time @c time right before
+	@c iter. */
+    size_t count_before(Iterator iter, SongTime const& time) throw();
+    
+    /** Return an iterator to the point that follows the first @c k points
+	with the time @c time. This is used to find a point again after the
+	tree has been edited. */
+    Iterator find_after(SongTime const& time, size_t k) throw();
+    
+    /** Mark the chunks of the current Version that contain points in the
+	time range [@c first, @c last] as changed. */
+    void touch(SongTime const& first, SongTime const& last) throw();
+    
+    /** Append the points in the range [@c first, @c last) to @c version
+	as new chunks. */
+    void copy_chunks(Version& version, 
+		     ConstIterator first, ConstIterator last) const
+      throw(std::bad_alloc);
     
-    /** The list of curve points. */
-    NodeSkipList<Point> m_data;
     
     /** The ID of the controller this curve is for. */
     ControllerID m_cid;
     
-    /** The active CurvePositions. */
-    std::set<CurvePosition*> m_positions;
+    /** The interpolation mode. */
+    Interpolation m_interpolation;
+    
+    /** The maximal number of events per beat. */
+    unsigned m_resolution;
+    
+    /** The number of points that have been removed from the curve. The 
+	positions use it to check if their cached nodes are still valid. 
+	With BTree storage every edit replaces nodes, so it is increased 
+	both before and after every edit and is odd while the tree is being
+	changed. */
+    AtomicInt m_removals;
     
+    /** The reclamation domain for removed nodes. The positions enter it 
+	whenever they read the curve. */
+    mutable EpochDomain m_domain;
+    
+    /** The points, if the storage is SkipList. */
+    std::unique_ptr<ListStorage> m_list;
+    
+    /** The points, if the storage is BTree. */
+    std::unique_ptr<TreeStorage> m_tree;
+    
+    /** The EditListener, or 0. */
+    EditListener* m_listener;
+    
+    /** The last Version returned by get_version(), or 0. */
+    std::shared_ptr<Version const> m_version;
+    
+    /** One flag for every chunk in m_version, set if the chunk has been
+	changed since. */
+    std::vector<bool> m_changed;
+    
+    /** @c true if any flag in m_changed is set, or if the whole curve 
+	needs to be copied the next time get_version() is called. */
+    bool m_any_changed;
+  
   };
   
 
@@ -0,0 +1,84 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "curvehistory.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::invalid_argument;
+  using std::shared_ptr;
+  
+  
+  CurveHistory::CurveHistory(Curve& curve, size_t max_depth) 
+    throw(bad_alloc)
+    : m_curve(curve),
+      m_max_depth(max_depth) {
+    m_undo.push_back(m_curve.get_version());
+  }
+  
+  
+  void CurveHistory::checkpoint() throw(bad_alloc) {
+    shared_ptr<Curve::Version const> v = m_curve.get_version();
+    if (v == m_undo.back())
+      return;
+    m_undo.push_back(v);
+    m_redo.clear();
+    if (m_undo.size() > m_max_depth + 1)
+      m_undo.pop_front();
+  }
+  
+  
+  bool CurveHistory::undo() throw(bad_alloc, invalid_argument) {
+    if (!can_undo())
+      return false;
+    m_curve.restore(m_undo[m_undo.size() - 2]);
+    m_redo.push_back(m_undo.back());
+    m_undo.pop_back();
+    return true;
+  }
+  
+  
+  bool CurveHistory::redo() throw(bad_alloc, invalid_argument) {
+    if (!can_redo())
+      return false;
+    m_curve.restore(m_redo.back());
+    m_undo.push_back(m_redo.back());
+    m_redo.pop_back();
+    return true;
+  }
+  
+  
+  bool CurveHistory::can_undo() const throw() {
+    return m_undo.size() > 1;
+  }
+  
+  
+  bool CurveHistory::can_redo() const throw() {
+    return !m_redo.empty();
+  }
+  
+  
+  shared_ptr<Curve::Version const> CurveHistory::get_current() const throw() {
+    return m_undo.back();
+  }
+
+
+}
@@ -0,0 +1,124 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef CURVEHISTORY_HPP
+#define CURVEHISTORY_HPP
+
+#include <deque>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include "curve.hpp"
+
+
+namespace Dino {
+  
+  
+  /** An undo history for a Curve, built from the Versions that 
+      Curve::get_version() returns. A checkpoint only stores a pointer to a 
+      Version, which shares all unchanged chunks with the previous one, so
+      keeping a long history costs little more than the changed points, and
+      undoing or redoing only replaces the points that differ between the 
+      two Versions.
+      
+      None of the functions are realtime safe, and they must be called from
+      the thread that edits the curve.
+      
+      @ingroup mididata
+  */
+  class CurveHistory {
+  public:
+    
+    /** Create a history for @c curve that keeps at most @c max_depth steps
+	that can be undone. The current points of the curve are the first
+	checkpoint.
+	
+	@throw std::bad_alloc if the first Version could not be created
+    */
+    CurveHistory(Curve& curve, size_t max_depth = 100) throw(std::bad_alloc);
+    
+    /** Record the current points of the curve as a new step that can be 
+	undone, and forget all steps that could be redone. Nothing is 
+	recorded if the curve hasn't changed since the last checkpoint.
+	Changes that are made after the last checkpoint are lost if undo() 
+	or redo() is called.
+	
+	@throw std::bad_alloc if the Version could not be created
+    */
+    void checkpoint() throw(std::bad_alloc);
+    
+    /** Restore the points of the curve to the checkpoint before the last 
+	one. Return @c false if there is nothing to undo. If an exception is
+	thrown the curve and the history are left as they were.
+	
+	@throw std::bad_alloc if the points could not be restored
+	@throw std::invalid_argument if the curve has been made too short 
+				     for the points
+    */
+    bool undo() throw(std::bad_alloc, std::invalid_argument);
+    
+    /** Restore the points of the curve to the last checkpoint that was 
+	undone. Return @c false if there is nothing to redo. If an exception
+	is thrown the curve and the history are left as they were.
+	
+	@throw std::bad_alloc if the points could not be restored
+	@throw std::invalid_argument if the curve has been made too short 
+				     for the points
+    */
+    bool redo() throw(std::bad_alloc, std::invalid_argument);
+    
+    /** Return @c true if undo() would change the curve. */
+    bool can_undo() const throw();
+    
+    /** Return @c true if redo() would change the curve. */
+    bool can_redo() const throw();
+    
+    /** Return the Version of the last checkpoint, or of the last undone or
+	redone step. */
+    std::shared_ptr<Curve::Version const> get_current() const throw();
+  
+  private:
+    
+    /** Copying is not allowed. */
+    CurveHistory(CurveHistory const&) = delete;
+    
+    /** Assignment is not allowed. */
+    CurveHistory& operator=(CurveHistory const&) = delete;
+    
+    
+    /** The curve. */
+    Curve& m_curve;
+    
+    /** The maximal number of steps that can be undone. */
+    size_t m_max_depth;
+    
+    /** The checkpoints up to and including the current one. */
+    std::deque<std::shared_ptr<Curve::Version const> > m_undo;
+    
+    /** The undone checkpoints, the next one to redo last. */
+    std::vector<std::shared_ptr<Curve::Version const> > m_redo;
+  
+  };
+
+
+}
+
+
+#endif
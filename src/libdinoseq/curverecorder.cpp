@@ -0,0 +1,89 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+
+#include "curverecorder.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  
+  
+  CurveRecorder::CurveRecorder(Curve& curve, size_t max_batch) throw()
+    : m_curve(curve),
+      m_max_batch(max_batch) {
+  }
+  
+  
+  bool CurveRecorder::write_event(SongTime const& st, size_t bytes, 
+				  unsigned char const* data) {
+    if (bytes < 3 || st < SongTime(0, 0) || st > m_curve.get_length())
+      return true;
+    
+    // convert the MIDI value to the range [0, 2^31) used by the curve
+    Curve::ControllerID cid = m_curve.get_controller_id();
+    AtomicInt::Type value;
+    if ((data[0] & 0xF0) == 0xB0 && cid < 128 && data[1] == cid)
+      value = AtomicInt::Type(data[2] & 0x7F) << 24;
+    else if ((data[0] & 0xF0) == 0xE0 && cid == Curve::pitchbend())
+      value = AtomicInt::Type((data[1] & 0x7F) | ((data[2] & 0x7F) << 7)) << 17;
+    else
+      return true;
+    
+    m_points.push_back(Curve::Point(st, value));
+    if (m_max_batch > 0 && m_points.size() >= m_max_batch)
+      flush();
+    return true;
+  }
+  
+  
+  void CurveRecorder::flush() throw(bad_alloc) {
+    if (m_points.empty())
+      return;
+    
+    // the events should already be sorted, but make sure
+    std::stable_sort(m_points.begin(), m_points.end());
+    
+    // the curve may have been shortened since the events were written,
+    // drop the points that don't fit in it any more
+    Curve::Point end(m_curve.get_length(), 0);
+    m_points.erase(std::upper_bound(m_points.begin(), m_points.end(), end),
+		   m_points.end());
+    if (m_points.empty())
+      return;
+    
+    try {
+      m_curve.add_points(&m_points[0], &m_points[0] + m_points.size());
+    }
+    catch (...) {
+      m_points.clear();
+      throw;
+    }
+    m_points.clear();
+  }
+  
+  
+  size_t CurveRecorder::get_pending() const throw() {
+    return m_points.size();
+  }
+
+
+}
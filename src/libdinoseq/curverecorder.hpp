@@ -0,0 +1,91 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef CURVERECORDER_HPP
+#define CURVERECORDER_HPP
+
+#include <new>
+#include <vector>
+
+#include "curve.hpp"
+#include "eventbuffer.hpp"
+
+
+namespace Dino {
+  
+  
+  /** An EventBuffer that records controller events into a Curve. Events
+      for the curve's controller (CC or pitchbend, on any channel) are
+      converted to curve points and collected in a batch, which is added
+      to the curve using Curve::add_points() when flush() is called. All 
+      other events, and events after the end of the curve, are ignored.
+      
+      This is meant to be used in a non-realtime consumer thread together 
+      with RecordBuffer::read_events() or SmfReader::read_track(). To keep
+      the memory use bounded when importing large amounts of data the 
+      batch can be flushed automatically when it reaches a given size.
+      
+      @ingroup sequencing
+  */
+  class CurveRecorder : public EventBuffer {
+  public:
+    
+    /** Create a new recorder for the given curve. If @c max_batch is not
+	0 the batch is flushed automatically when it has that many 
+	points. */
+    CurveRecorder(Curve& curve, size_t max_batch = 0) throw();
+    
+    /** Add a point to the batch if the event is for the curve's 
+	controller, and flush the batch if it is full. This function is 
+	@b not realtime safe.
+	
+	@throw std::bad_alloc if the batch could not grow or be flushed
+    */
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data);
+    
+    /** Add all points in the batch to the curve and clear the batch. The 
+	batch is cleared even if this function throws. Points that are after
+	the end of the curve, because it has been shortened since they were
+	written, are dropped. This function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the points could not be added
+    */
+    void flush() throw(std::bad_alloc);
+    
+    /** Return the number of points in the batch. */
+    size_t get_pending() const throw();
+  
+  private:
+    
+    /** The curve we are recording to. */
+    Curve& m_curve;
+    
+    /** The points that have not been added yet. */
+    std::vector<Curve::Point> m_points;
+    
+    /** The batch size that triggers a flush, or 0. */
+    size_t m_max_batch;
+  
+  };
+
+
+}
+
+
+#endif
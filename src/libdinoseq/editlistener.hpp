@@ -0,0 +1,72 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef EDITLISTENER_HPP
+#define EDITLISTENER_HPP
+
+#include "atomicint.hpp"
+
+
+namespace Dino {
+  
+  
+  class Curve;
+  class Sequencable;
+  class SongTime;
+  
+  
+  /** An abstract base class for objects that want to know about the edits
+      made to Curves and Sequencers, for example to keep a journal of them.
+      A listener is set with Curve::set_edit_listener() or 
+      Sequencer::set_edit_listener(), and the functions are called in the
+      thread that made the edit, after the edit has been done. They must 
+      not throw any exceptions or modify the object that was edited.
+      
+      @ingroup mididata */
+  class EditListener {
+  public:
+    
+    /** Called when a point has been added to @c curve. This is also called
+	once for every point that is added by Curve::add_points(). */
+    virtual void point_added(Curve const& curve, SongTime const& time,
+			     AtomicInt::Type value) throw() = 0;
+    
+    /** Called when the point at @c old_time with the value @c old_value has
+	been moved to @c time and given the value @c value. */
+    virtual void point_moved(Curve const& curve, SongTime const& old_time,
+			     AtomicInt::Type old_value, SongTime const& time,
+			     AtomicInt::Type value) throw() = 0;
+    
+    /** Called when the point at @c time with the value @c value has been
+	removed from @c curve. */
+    virtual void point_removed(Curve const& curve, SongTime const& time,
+			       AtomicInt::Type value) throw() = 0;
+    
+    /** Called when @c sqbl has been added to a Sequencer. */
+    virtual void sequencable_added(Sequencable const& sqbl) throw() = 0;
+    
+    /** Called when @c sqbl has been removed from a Sequencer. */
+    virtual void sequencable_removed(Sequencable const& sqbl) throw() = 0;
+  
+  };
+
+
+}
+
+
+#endif
@@ -0,0 +1,113 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "epochdomain.hpp"
+
+
+namespace Dino {
+  
+  
+  EpochDomain::EpochDomain() throw()
+    : m_epoch(1) {
+    for (unsigned i = 0; i < max_readers; ++i)
+      m_used[i] = false;
+  }
+  
+  
+  int EpochDomain::register_reader() throw() {
+    for (unsigned i = 0; i < max_readers; ++i) {
+      if (!m_used[i]) {
+	m_used[i] = true;
+	m_slots[i].set(m_epoch.get());
+	return i;
+      }
+    }
+    return -1;
+  }
+  
+  
+  void EpochDomain::unregister_reader(int reader) throw() {
+    m_slots[reader].set(0);
+    m_used[reader] = false;
+  }
+  
+  
+  unsigned EpochDomain::get_readers() const throw() {
+    unsigned result = 0;
+    for (unsigned i = 0; i < max_readers; ++i)
+      result += m_used[i];
+    return result;
+  }
+  
+  
+  void EpochDomain::quiescent(int reader) throw() {
+    // this needs the full barrier, the writer must see the new epoch 
+    // before the reader reads any node after it
+    m_slots[reader].set(m_epoch.get());
+  }
+  
+  
+  void EpochDomain::offline(int reader) throw() {
+    // the reads that the reader made before this must not be moved after
+    // it, but nothing needs to be ordered after it
+    m_slots[reader].set_release(0);
+  }
+  
+  
+  int EpochDomain::enter() throw() {
+    while (true) {
+      for (unsigned i = 0; i < max_readers; ++i) {
+	if (m_entered[i].get_relaxed() == 0 && 
+	    m_entered[i].compare_and_set(0, m_epoch.get()))
+	  return i;
+      }
+    }
+  }
+  
+  
+  void EpochDomain::leave(int token) throw() {
+    m_entered[token].set_release(0);
+  }
+  
+  
+  EpochDomain::Epoch EpochDomain::retire() throw() {
+    // the epoch wraps around after 2^32 retired nodes, but it skips 0 
+    // since that means "offline" in the reader slots
+    Epoch result = m_epoch.get();
+    Epoch next = Epoch(unsigned(result) + 1);
+    m_epoch.set(next != 0 ? next : 1);
+    return result;
+  }
+  
+  
+  bool EpochDomain::is_safe(Epoch tag) const throw() {
+    // compare the epochs using serial number arithmetic so the wrap-around
+    // doesn't matter as long as no reader lags 2^31 epochs behind
+    for (unsigned i = 0; i < max_readers; ++i) {
+      Epoch seen = m_slots[i].get();
+      if (seen != 0 && Epoch(unsigned(seen) - unsigned(tag)) <= 0)
+	return false;
+      seen = m_entered[i].get();
+      if (seen != 0 && Epoch(unsigned(seen) - unsigned(tag)) <= 0)
+	return false;
+    }
+    return true;
+  }
+
+
+}
@@ -0,0 +1,285 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef EPOCHDOMAIN_HPP
+#define EPOCHDOMAIN_HPP
+
+#include <cstddef>
+
+#include "atomicint.hpp"
+
+
+namespace Dino {
+  
+  
+  /** A domain for quiescent state based reclamation of nodes that have been
+      removed from lock-free data structures with one writer thread and 
+      one or more read-only threads.
+      
+      Every reader thread registers a slot with register_reader() and then
+      calls quiescent() at a point where it does not hold any pointers into
+      the data structures that use the domain, for example once per 
+      period in a realtime thread. A reader that will not touch the data 
+      structures for a while can call offline(), which means that the writer
+      will not wait for it until the next call to quiescent().
+      
+      Readers that come and go, like the positions of a Sequencable that 
+      may be played by any number of sequencers, can instead wrap every 
+      access in enter() and leave(). They don't have to be registered, and
+      they only hold a slot while they are between the two calls.
+      
+      The writer calls retire() for every node it removes from a data 
+      structure, and gets an epoch tag back. A node with tag @c e can be 
+      deallocated as soon as is_safe(@c e) returns @c true, which is when 
+      every online reader has called quiescent() after the node was 
+      retired. Nodes are normally kept in an EpochLimbo, which does the 
+      bookkeeping.
+      
+      The domain has a fixed number of reader slots and does not allocate
+      any memory, so it can be a plain member of the data structures that
+      use it. Several data structures can share a domain, in which case the
+      readers only have to call quiescent() once for all of them.
+      
+      @ingroup seqengine
+  */
+  class EpochDomain {
+  public:
+    
+    /** The type of the epoch tags. */
+    typedef AtomicInt::Type Epoch;
+    
+    /** The maximal number of readers. */
+    static unsigned const max_readers = 16;
+    
+    /** Create a new domain with no registered readers. */
+    EpochDomain() throw();
+    
+    /** Copying is not allowed. */
+    EpochDomain(EpochDomain const&) = delete;
+    
+    /** Assignment is not allowed. */
+    EpochDomain& operator=(EpochDomain const&) = delete;
+    
+    /** Register a new reader and return its slot, or -1 if all slots are 
+	taken. The reader starts out online, as if it had just called 
+	quiescent(). This should only be called from the writer thread. */
+    int register_reader() throw();
+    
+    /** Unregister a reader. The reader thread must not use the slot 
+	after this. This should only be called from the writer thread. */
+    void unregister_reader(int reader) throw();
+    
+    /** Return the number of registered readers. This should only be called
+	from the writer thread. */
+    unsigned get_readers() const throw();
+    
+    /** @name Reader threads
+	These functions are realtime safe.
+	@{ */
+    
+    /** Tell the domain that the reader with the slot @c reader does not
+	hold any pointers to nodes in the data structures that use this 
+	domain. All nodes that were retired before this call may be 
+	deallocated after it. */
+    void quiescent(int reader) throw();
+    
+    /** Tell the domain that the reader with the slot @c reader will not 
+	touch the data structures that use this domain until its next 
+	call to quiescent(). */
+    void offline(int reader) throw();
+    
+    /** Start a read-side critical section without a registered slot and
+	return a token that should be passed to leave() when it ends. The 
+	reader must not use any pointers to nodes that it got before this 
+	call, unless it knows by other means that they have not been 
+	retired. This is lock-free as long as fewer than max_readers threads
+	are between enter() and leave() for the same domain at once, 
+	otherwise it spins until one of them leaves. */
+    int enter() throw();
+    
+    /** End a read-side critical section that was started with enter(). */
+    void leave(int token) throw();
+    
+    /** @} */
+    
+    /** Return the epoch tag for a node that has just been removed from 
+	a data structure and advance the epoch. This should only be called
+	from the writer thread. */
+    Epoch retire() throw();
+    
+    /** Return @c true if all nodes retired with the tag @c tag or earlier
+	can be deallocated, i.e. if all online readers have called 
+	quiescent() after they were retired. This takes O(max_readers) time
+	and should only be called from the writer thread. */
+    bool is_safe(Epoch tag) const throw();
+  
+  private:
+    
+    /** The current epoch. It is never 0. */
+    AtomicInt m_epoch;
+    
+    /** The epoch that each reader saw in its last call to quiescent(),
+	or 0 if the slot is free or the reader is offline. */
+    AtomicInt m_slots[max_readers];
+    
+    /** Whether each slot is taken. Only used by the writer thread. */
+    bool m_used[max_readers];
+    
+    /** The epochs seen by the readers that are between enter() and leave(),
+	or 0 for free slots. */
+    AtomicInt m_entered[max_readers];
+  
+  };
+  
+  
+  /** A list of retired nodes waiting to be deallocated. The nodes are linked
+      through a pointer in the nodes themselves that the readers never 
+      touch, so retiring a node does not allocate any memory and there is
+      no limit on the number of nodes in the list.
+      
+      The nodes are kept in two generations. New nodes are added to the 
+      open generation, and when the closed generation is empty the open one
+      is closed and tagged with the epoch of its newest node. The closed
+      generation is deallocated as a whole when it is safe, so a reader that
+      calls quiescent() regularly always lets the writer make progress and 
+      the garbage is bounded by the number of nodes retired during two 
+      quiescent periods of the slowest reader, no matter how the calls
+      interleave with the edits.
+      
+      All functions should only be called from the writer thread.
+      
+      @tparam B the node type
+      @tparam P a policy type with a member function 
+		<tt>B*& link(B*)</tt> that returns the pointer used to link
+		retired nodes and a member function <tt>void free(B*)</tt> 
+		that deallocates a node
+  */
+  template <typename B, typename P>
+  class EpochLimbo {
+  public:
+    
+    /** Create an empty list that uses @c domain to decide when nodes can
+	be deallocated and @c policy to link and deallocate them. */
+    EpochLimbo(EpochDomain& domain, P const& policy = P()) throw()
+      : m_domain(domain),
+	m_policy(policy),
+	m_size(0) {
+    }
+    
+    /** Deallocate all nodes in the list. The readers must be done with 
+	them. */
+    ~EpochLimbo() throw() {
+      free_generation(m_open);
+      free_generation(m_closed);
+    }
+    
+    /** Copying is not allowed. */
+    EpochLimbo(EpochLimbo const&) = delete;
+    
+    /** Assignment is not allowed. */
+    EpochLimbo& operator=(EpochLimbo const&) = delete;
+    
+    /** Return the domain. */
+    EpochDomain& get_domain() const throw() {
+      return m_domain;
+    }
+    
+    /** Add a node that has been removed from its data structure. No reader
+	that calls quiescent() after this can find the node. */
+    void retire(B* node) throw() {
+      m_policy.link(node) = m_open.head;
+      m_open.head = node;
+      m_open.tag = m_domain.retire();
+      ++m_open.size;
+      ++m_size;
+    }
+    
+    /** Deallocate the nodes that are safe to deallocate and return the
+	number of deallocated nodes. */
+    size_t collect() throw() {
+      size_t result = 0;
+      for (int i = 0; i < 2; ++i) {
+	if (!m_closed.head) {
+	  m_closed = m_open;
+	  m_open = Generation();
+	}
+	if (!m_closed.head || !m_domain.is_safe(m_closed.tag))
+	  break;
+	result += free_generation(m_closed);
+      }
+      return result;
+    }
+    
+    /** Return the number of nodes waiting to be deallocated. */
+    size_t get_size() const throw() {
+      return m_size;
+    }
+  
+  private:
+    
+    /** A list of retired nodes. */
+    struct Generation {
+      Generation() : head(0), tag(0), size(0) {}
+      
+      /** The last retired node. */
+      B* head;
+      
+      /** The tag of the last retired node. */
+      EpochDomain::Epoch tag;
+      
+      /** The number of nodes. */
+      size_t size;
+    };
+    
+    /** Deallocate all nodes in @c g and return the number of nodes. */
+    size_t free_generation(Generation& g) throw() {
+      B* node;
+      while ((node = g.head)) {
+	g.head = m_policy.link(node);
+	m_policy.free(node);
+      }
+      size_t result = g.size;
+      m_size -= g.size;
+      g = Generation();
+      return result;
+    }
+    
+    
+    /** The domain. */
+    EpochDomain& m_domain;
+    
+    /** The policy object that links and deallocates nodes. */
+    P m_policy;
+    
+    /** The nodes that have been retired since the last generation was 
+	closed. */
+    Generation m_open;
+    
+    /** The nodes that are waiting for the readers. */
+    Generation m_closed;
+    
+    /** The total number of nodes in both generations. */
+    size_t m_size;
+  
+  };
+
+
+}
+
+
+#endif
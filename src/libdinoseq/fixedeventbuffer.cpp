@@ -0,0 +1,139 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "fixedeventbuffer.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  
+  
+  namespace {
+    
+    /** The alignment of the event headers. */
+    size_t const alignment = sizeof(int64_t);
+    
+    /** Round @c n up to the next multiple of the header alignment. */
+    inline size_t align(size_t n) throw() {
+      return (n + alignment - 1) & ~(alignment - 1);
+    }
+    
+    /** Compare two event offsets by the time of the events, and by the 
+	offsets (i.e. the order they were written in) if the times are
+	equal. */
+    template <typename E>
+    struct OffsetLess {
+      OffsetLess(unsigned char const* base) : m_base(base) { }
+      bool operator()(uint32_t a, uint32_t b) const throw() {
+	SongTime const& ta = reinterpret_cast<E const*>(m_base + a)->get_time();
+	SongTime const& tb = reinterpret_cast<E const*>(m_base + b)->get_time();
+	if (ta != tb)
+	  return ta < tb;
+	return a < b;
+      }
+      unsigned char const* m_base;
+    };
+  
+  }
+  
+  
+  FixedEventBuffer::FixedEventBuffer(size_t bytes, size_t events) 
+    throw(bad_alloc)
+    : m_data(new unsigned char[align(bytes)]),
+      m_offsets(new uint32_t[events]),
+      m_capacity(align(bytes)),
+      m_max_events(events),
+      m_used(0),
+      m_events(0),
+      m_overflows(0) {
+  }
+  
+  
+  bool FixedEventBuffer::write_event(SongTime const& st, size_t bytes, 
+				     unsigned char const* data) {
+    size_t needed = align(sizeof(Event) + bytes);
+    if (m_events == m_max_events || needed > m_capacity - m_used) {
+      ++m_overflows;
+      return false;
+    }
+    Event* e = reinterpret_cast<Event*>(&m_data[m_used]);
+    e->m_time = st;
+    e->m_size = bytes;
+    std::memcpy(e + 1, data, bytes);
+    m_offsets[m_events++] = m_used;
+    m_used += needed;
+    return true;
+  }
+  
+  
+  void FixedEventBuffer::clear() throw() {
+    m_used = 0;
+    m_events = 0;
+  }
+  
+  
+  void FixedEventBuffer::sort() throw() {
+    // the offsets are usually sorted already, so check that first
+    OffsetLess<Event> less(m_data.get());
+    uint32_t* first = m_offsets.get();
+    uint32_t* last = first + m_events;
+    for (uint32_t* i = first; i != last && i + 1 != last; ++i) {
+      if (less(i[1], i[0])) {
+	std::sort(first, last, less);
+	break;
+      }
+    }
+  }
+  
+  
+  FixedEventBuffer::ConstIterator FixedEventBuffer::begin() const throw() {
+    return ConstIterator(m_data.get(), m_offsets.get());
+  }
+  
+  
+  FixedEventBuffer::ConstIterator FixedEventBuffer::end() const throw() {
+    return ConstIterator(m_data.get(), m_offsets.get() + m_events);
+  }
+  
+  
+  size_t FixedEventBuffer::get_event_count() const throw() {
+    return m_events;
+  }
+  
+  
+  size_t FixedEventBuffer::get_bytes_used() const throw() {
+    return m_used;
+  }
+  
+  
+  size_t FixedEventBuffer::get_overflows() const throw() {
+    return m_overflows;
+  }
+  
+  
+  void FixedEventBuffer::reset_overflows() throw() {
+    m_overflows = 0;
+  }
+
+
+}
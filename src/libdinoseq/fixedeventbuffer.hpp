@@ -0,0 +1,247 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef FIXEDEVENTBUFFER_HPP
+#define FIXEDEVENTBUFFER_HPP
+
+#include <iterator>
+#include <memory>
+#include <new>
+
+#include <stdint.h>
+
+#include "eventbuffer.hpp"
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  /** An EventBuffer that stores events in preallocated memory.
+      All memory is allocated in the constructor, so write_event() never
+      allocates and is realtime safe. The events are stored back to back 
+      as a header with the time and size followed by the data bytes, and 
+      can be read directly from the buffer using begin() and end() without
+      copying, e.g. to write them to a JACK MIDI port. If an event does not
+      fit write_event() returns @c false and increases the overflow counter.
+      
+      The buffer is not thread safe; it is meant to be filled and drained 
+      in the same thread, for example once per JACK period:
+      @code
+      buf.clear();
+      sequencer.run(from, to);
+      buf.sort();
+      for (auto i = buf.begin(); i != buf.end(); ++i)
+	write_to_port(i->get_time(), i->get_size(), i->get_data());
+      @endcode
+      
+      @ingroup sequencing 
+  */
+  class FixedEventBuffer : public EventBuffer {
+  public:
+    
+    /** The header of an event stored in the buffer. The data bytes follow
+	directly after it. */
+    class Event {
+    public:
+      
+      /** Return the time of the event. */
+      SongTime const& get_time() const throw() { return m_time; }
+      
+      /** Return the number of data bytes. */
+      size_t get_size() const throw() { return m_size; }
+      
+      /** Return a pointer to the data bytes. */
+      unsigned char const* get_data() const throw() {
+	return reinterpret_cast<unsigned char const*>(this + 1);
+      }
+    
+    private:
+      
+      friend class FixedEventBuffer;
+      
+      /** The time of the event. */
+      SongTime m_time;
+      
+      /** The number of data bytes. */
+      uint32_t m_size;
+    
+    };
+    
+    
+    /** A random access iterator over the events in the buffer. The events
+	are not copied, the iterator points directly into the buffer. */
+    class ConstIterator 
+      : public std::iterator<std::random_access_iterator_tag, Event const> {
+    public:
+      
+      /** Create a singular iterator. */
+      ConstIterator() throw() : m_base(0), m_offset(0) { }
+      
+      /** Equality operator. */
+      bool operator==(ConstIterator const& iter) const throw() {
+	return m_offset == iter.m_offset;
+      }
+      
+      /** Inequality operator. */
+      bool operator!=(ConstIterator const& iter) const throw() {
+	return m_offset != iter.m_offset;
+      }
+      
+      /** Return a reference to the event. */
+      Event const& operator*() const throw() {
+	return *reinterpret_cast<Event const*>(m_base + *m_offset);
+      }
+      
+      /** Return a pointer to the event. */
+      Event const* operator->() const throw() {
+	return &operator*();
+      }
+      
+      /** Return a reference to the event @c n steps from this one. */
+      Event const& operator[](ptrdiff_t n) const throw() {
+	return *reinterpret_cast<Event const*>(m_base + m_offset[n]);
+      }
+      
+      /** Step to the next event. */
+      ConstIterator& operator++() throw() { ++m_offset; return *this; }
+      
+      /** Step to the next event, postfix version. */
+      ConstIterator operator++(int) throw() { 
+	ConstIterator tmp(*this);
+	++m_offset;
+	return tmp;
+      }
+      
+      /** Step to the previous event. */
+      ConstIterator& operator--() throw() { --m_offset; return *this; }
+      
+      /** Step to the previous event, postfix version. */
+      ConstIterator operator--(int) throw() { 
+	ConstIterator tmp(*this);
+	--m_offset;
+	return tmp;
+      }
+      
+      /** Step @c n events forward. */
+      ConstIterator& operator+=(ptrdiff_t n) throw() { 
+	m_offset += n; 
+	return *this; 
+      }
+      
+      /** Return an iterator @c n events forward. */
+      ConstIterator operator+(ptrdiff_t n) const throw() { 
+	return ConstIterator(m_base, m_offset + n);
+      }
+      
+      /** Return the number of events between two iterators. */
+      ptrdiff_t operator-(ConstIterator const& iter) const throw() {
+	return m_offset - iter.m_offset;
+      }
+    
+    private:
+      
+      friend class FixedEventBuffer;
+      
+      /** Create an iterator from a base pointer and an offset pointer. */
+      ConstIterator(unsigned char const* base, uint32_t const* offset) 
+	throw() 
+	: m_base(base), m_offset(offset) { 
+      }
+      
+      /** The start of the event memory. */
+      unsigned char const* m_base;
+      
+      /** A pointer into the offset array. */
+      uint32_t const* m_offset;
+    
+    };
+    
+    
+    /** Create a new buffer that can hold @c bytes bytes of event data 
+	(including an event header of a few bytes for every event) and at 
+	most @c events events. This function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the memory could not be allocated
+    */
+    FixedEventBuffer(size_t bytes = 8192, size_t events = 512) 
+      throw(std::bad_alloc);
+    
+    /** Copy an event into the buffer. Returns @c false and increases the
+	overflow counter if there is not enough room left. This function is
+	realtime safe. */
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data);
+    
+    /** Remove all events from the buffer. This does not reset the overflow
+	counter. This function is realtime safe. */
+    void clear() throw();
+    
+    /** Sort the events by time. Events with the same time keep the order 
+	they were written in. This function is realtime safe. */
+    void sort() throw();
+    
+    /** Return an iterator to the first event. */
+    ConstIterator begin() const throw();
+    
+    /** Return an iterator to the end of the buffer. */
+    ConstIterator end() const throw();
+    
+    /** Return the number of events in the buffer. */
+    size_t get_event_count() const throw();
+    
+    /** Return the number of bytes used, including the event headers. */
+    size_t get_bytes_used() const throw();
+    
+    /** Return the number of events that did not fit in the buffer since it
+	was created or reset_overflows() was last called. */
+    size_t get_overflows() const throw();
+    
+    /** Set the overflow counter to 0. */
+    void reset_overflows() throw();
+  
+  private:
+    
+    /** The event memory. */
+    std::unique_ptr<unsigned char[]> m_data;
+    
+    /** The offsets of the events in @c m_data, in iteration order. */
+    std::unique_ptr<uint32_t[]> m_offsets;
+    
+    /** The size of @c m_data. */
+    size_t m_capacity;
+    
+    /** The size of @c m_offsets. */
+    size_t m_max_events;
+    
+    /** The number of used bytes in @c m_data. */
+    size_t m_used;
+    
+    /** The number of events. */
+    size_t m_events;
+    
+    /** The number of events that did not fit. */
+    size_t m_overflows;
+  
+  };
+
+
+}
+
+
+#endif
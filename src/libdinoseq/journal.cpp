@@ -0,0 +1,458 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "curve.hpp"
+#include "journal.hpp"
+#include "sequencer.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::map;
+  using std::runtime_error;
+  using std::shared_ptr;
+  using std::string;
+  using std::vector;
+  
+  
+  namespace {
+    
+    /** The magic bytes at the start of every journal. */
+    char const magic[8] = { 'D', 'I', 'N', 'O', 'J', 'R', 'N', 'L' };
+    
+    /** The size of the file header, the magic bytes and a version. */
+    size_t const header_size = 16;
+    
+    /** The current format version. */
+    uint32_t const version = 1;
+    
+    /** The number of records that are written with a single write(). */
+    size_t const write_batch = 128;
+    
+    /** The edit types. */
+    enum {
+      Nop,
+      AddPoint,
+      MovePoint,
+      RemovePoint,
+      AddSequencable,
+      RemoveSequencable
+    };
+    
+    /** Return @c t plus @c ms milliseconds. */
+    timespec add_ms(timespec t, unsigned ms) throw() {
+      t.tv_sec += ms / 1000;
+      t.tv_nsec += long(ms % 1000) * 1000000;
+      if (t.tv_nsec >= 1000000000) {
+	t.tv_nsec -= 1000000000;
+	++t.tv_sec;
+      }
+      return t;
+    }
+    
+    /** Return @c true if @c a is not earlier than @c b. */
+    bool not_before(timespec const& a, timespec const& b) throw() {
+      return a.tv_sec > b.tv_sec || 
+	(a.tv_sec == b.tv_sec && a.tv_nsec >= b.tv_nsec);
+    }
+    
+    /** Find the first point in @c c with the given time and value. */
+    Curve::Iterator find_point(Curve& c, SongTime const& time, 
+			       AtomicInt::Type value) throw() {
+      Curve::Iterator i = c.lower_bound(time);
+      for ( ; i != c.end() && i->m_time == time; ++i) {
+	if (i->m_value.get() == value)
+	  return i;
+      }
+      return c.end();
+    }
+  
+  }
+  
+  
+  Journal::Journal(string const& filename, unsigned sync_interval)
+    throw(runtime_error)
+    : m_fd(-1),
+      m_end(header_size),
+      m_interval(std::max(sync_interval, 1u)),
+      m_flush(0),
+      m_quit(0),
+      m_written(0),
+      m_syncs(0),
+      m_dropped(0) {
+    
+    m_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (m_fd < 0)
+      throw runtime_error("Could not open " + filename);
+    
+    // write the header to new files and check it in old ones
+    char header[header_size];
+    std::memset(header, 0, header_size);
+    std::memcpy(header, magic, sizeof(magic));
+    std::memcpy(header + sizeof(magic), &version, sizeof(version));
+    struct stat st;
+    bool ok = !fstat(m_fd, &st);
+    if (ok && st.st_size == 0)
+      ok = (write(m_fd, header, header_size) == ssize_t(header_size) &&
+	    !fdatasync(m_fd));
+    else if (ok) {
+      char old[header_size];
+      ok = (pread(m_fd, old, header_size, 0) == ssize_t(header_size) &&
+	    !std::memcmp(old, header, header_size));
+      
+      // cut off a partial record at the end, or all new records would be
+      // misaligned
+      if (ok) {
+	m_end = header_size + 
+	  (st.st_size - header_size) / sizeof(Record) * sizeof(Record);
+	if (m_end != st.st_size)
+	  ok = !ftruncate(m_fd, m_end) && !fdatasync(m_fd);
+      }
+    }
+    if (!ok) {
+      close(m_fd);
+      throw runtime_error(filename + " is not a valid journal");
+    }
+    
+    if (sem_init(&m_wake, 0, 0)) {
+      close(m_fd);
+      throw runtime_error("Could not create semaphore for journal");
+    }
+    if (sem_init(&m_flushed, 0, 0)) {
+      sem_destroy(&m_wake);
+      close(m_fd);
+      throw runtime_error("Could not create semaphore for journal");
+    }
+    if (pthread_create(&m_thread, 0, &thread_main, this)) {
+      sem_destroy(&m_flushed);
+      sem_destroy(&m_wake);
+      close(m_fd);
+      throw runtime_error("Could not create journal thread");
+    }
+  }
+  
+  
+  Journal::~Journal() throw() {
+    for (auto i = m_curves.begin(); i != m_curves.end(); ++i) {
+      if (i->second.first->get_edit_listener() == this)
+	i->second.first->set_edit_listener(0);
+    }
+    for (size_t i = 0; i < m_sequencers.size(); ++i) {
+      if (m_sequencers[i]->get_edit_listener() == this)
+	m_sequencers[i]->set_edit_listener(0);
+    }
+    m_quit.set(1);
+    sem_post(&m_wake);
+    pthread_join(m_thread, 0);
+    sem_destroy(&m_flushed);
+    sem_destroy(&m_wake);
+    close(m_fd);
+  }
+  
+  
+  void Journal::attach(Curve& curve, uint32_t id) throw(bad_alloc) {
+    m_curves[&curve] = std::make_pair(&curve, id);
+    curve.set_edit_listener(this);
+  }
+  
+  
+  void Journal::detach(Curve& curve) throw() {
+    m_curves.erase(&curve);
+    if (curve.get_edit_listener() == this)
+      curve.set_edit_listener(0);
+  }
+  
+  
+  void Journal::attach(Sequencer& seq) throw(bad_alloc) {
+    if (std::find(m_sequencers.begin(), m_sequencers.end(), &seq) == 
+	m_sequencers.end())
+      m_sequencers.push_back(&seq);
+    seq.set_edit_listener(this);
+  }
+  
+  
+  void Journal::detach(Sequencer& seq) throw() {
+    m_sequencers.erase(std::remove(m_sequencers.begin(), 
+				   m_sequencers.end(), &seq),
+		       m_sequencers.end());
+    if (seq.get_edit_listener() == this)
+      seq.set_edit_listener(0);
+  }
+  
+  
+  void Journal::flush() throw() {
+    m_flush.set(1);
+    sem_post(&m_wake);
+    while (sem_wait(&m_flushed) && errno == EINTR);
+  }
+  
+  
+  size_t Journal::get_written() const throw() {
+    return m_written.get();
+  }
+  
+  
+  size_t Journal::get_syncs() const throw() {
+    return m_syncs.get();
+  }
+  
+  
+  size_t Journal::get_dropped() const throw() {
+    return m_dropped.get();
+  }
+  
+  
+  size_t Journal::replay(string const& filename, 
+			 vector<shared_ptr<Curve>> const& curves,
+			 Sequencer* seq) throw(runtime_error) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw runtime_error("Could not open " + filename);
+    char header[header_size];
+    if (read(fd, header, header_size) != ssize_t(header_size) ||
+	std::memcmp(header, magic, sizeof(magic)) ||
+	std::memcmp(header + sizeof(magic), &version, sizeof(version))) {
+      close(fd);
+      throw runtime_error(filename + " is not a valid journal");
+    }
+    
+    size_t applied = 0;
+    Record buf[write_batch];
+    size_t bytes = 0;
+    ssize_t n;
+    while ((n = read(fd, reinterpret_cast<char*>(buf) + bytes, 
+		     sizeof(buf) - bytes)) > 0) {
+      bytes += n;
+      size_t records = bytes / sizeof(Record);
+      for (size_t i = 0; i < records; ++i) {
+	Record const& r = buf[i];
+	if (r.id >= curves.size() || !curves[r.id])
+	  continue;
+	Curve& c = *curves[r.id];
+	SongTime time(r.beat, r.tick);
+	try {
+	  if (r.op == AddPoint) {
+	    c.add_point(time, r.value);
+	    ++applied;
+	  }
+	  else if (r.op == MovePoint || r.op == RemovePoint) {
+	    Curve::Iterator p = find_point(c, time, r.value);
+	    if (p == c.end())
+	      continue;
+	    if (r.op == MovePoint)
+	      c.move_point(p, SongTime(r.new_beat, r.new_tick), r.new_value);
+	    else
+	      c.remove_point(p);
+	    ++applied;
+	  }
+	  else if (r.op == AddSequencable && seq) {
+	    seq->add_sequencable(curves[r.id]);
+	    ++applied;
+	  }
+	  else if (r.op == RemoveSequencable && seq) {
+	    Sequencer::Iterator s = seq->sqbl_find(curves[r.id]);
+	    if (s == seq->sqbl_end())
+	      continue;
+	    seq->remove_sequencable(s);
+	    ++applied;
+	  }
+	}
+	catch (bad_alloc&) {
+	  close(fd);
+	  throw runtime_error("Could not allocate memory for the journal");
+	}
+	catch (...) {
+	  // the edit can't be done in this state, skip it
+	}
+      }
+      // keep a partial record for the next read
+      bytes -= records * sizeof(Record);
+      std::memmove(buf, buf + records, bytes);
+    }
+    close(fd);
+    if (n < 0)
+      throw runtime_error("Could not read " + filename);
+    return applied;
+  }
+  
+  
+  void Journal::point_added(Curve const& curve, SongTime const& time,
+			    AtomicInt::Type value) throw() {
+    push(AddPoint, curve, time, value);
+  }
+  
+  
+  void Journal::point_moved(Curve const& curve, SongTime const& old_time,
+			    AtomicInt::Type old_value, SongTime const& time,
+			    AtomicInt::Type value) throw() {
+    push(MovePoint, curve, old_time, old_value, time, value);
+  }
+  
+  
+  void Journal::point_removed(Curve const& curve, SongTime const& time,
+			      AtomicInt::Type value) throw() {
+    push(RemovePoint, curve, time, value);
+  }
+  
+  
+  void Journal::sequencable_added(Sequencable const& sqbl) throw() {
+    push(AddSequencable, sqbl, SongTime(), 0);
+  }
+  
+  
+  void Journal::sequencable_removed(Sequencable const& sqbl) throw() {
+    push(RemoveSequencable, sqbl, SongTime(), 0);
+  }
+  
+  
+  void Journal::push(uint32_t op, Sequencable const& curve, 
+		     SongTime const& time, AtomicInt::Type value, 
+		     SongTime const& new_time, AtomicInt::Type new_value) 
+    throw() {
+    auto iter = m_curves.find(&curve);
+    if (iter == m_curves.end())
+      return;
+    Record r = { op, iter->second.second, time.get_beat(), time.get_tick(), 
+		 value, new_time.get_beat(), new_time.get_tick(), new_value };
+    Record nop;
+    std::memset(&nop, 0, sizeof(nop));
+    
+    // the queue never pops its last node, so every record is followed by
+    // an empty one to let the writer thread see it right away
+    Queue::Node* node = 0;
+    Queue::Node* marker = 0;
+    try {
+      node = m_queue.create_node(r);
+      marker = m_queue.create_node(nop);
+    }
+    catch (bad_alloc&) {
+      if (node)
+	m_queue.destroy_node(node);
+      m_dropped.increase();
+      return;
+    }
+    m_queue.push_node(node);
+    m_queue.push_node(marker);
+    sem_post(&m_wake);
+  }
+  
+  
+  void* Journal::thread_main(void* arg) {
+    Journal& j = *static_cast<Journal*>(arg);
+    timespec last_sync;
+    clock_gettime(CLOCK_REALTIME, &last_sync);
+    bool dirty = false;
+    
+    while (true) {
+      
+      // sleep until there is something to do, or until the next sync is 
+      // due if there are unsynced records
+      if (dirty) {
+	timespec deadline = add_ms(last_sync, j.m_interval);
+	while (sem_timedwait(&j.m_wake, &deadline) && errno == EINTR);
+      }
+      else
+	while (sem_wait(&j.m_wake) && errno == EINTR);
+      
+      // read the flags before draining, so everything that was pushed 
+      // before they were set is written
+      bool quit = j.m_quit.get();
+      bool flush = j.m_flush.get();
+      if (j.drain())
+	dirty = true;
+      
+      timespec now;
+      clock_gettime(CLOCK_REALTIME, &now);
+      if (dirty && (quit || flush || 
+		    not_before(now, add_ms(last_sync, j.m_interval)))) {
+	fdatasync(j.m_fd);
+	j.m_syncs.increase();
+	dirty = false;
+	last_sync = now;
+      }
+      if (flush) {
+	j.m_flush.set(0);
+	sem_post(&j.m_flushed);
+      }
+      if (quit)
+	break;
+    }
+    
+    return 0;
+  }
+  
+  
+  bool Journal::drain() throw() {
+    Record buf[write_batch];
+    size_t n = 0;
+    size_t total = 0;
+    while (Queue::Node* node = m_queue.pop_node()) {
+      if (node->data.op != Nop) {
+	buf[n++] = node->data;
+	if (n == write_batch) {
+	  write_records(buf, n);
+	  total += n;
+	  n = 0;
+	}
+      }
+      m_queue.destroy_node(node);
+    }
+    write_records(buf, n);
+    total += n;
+    return total > 0;
+  }
+  
+  
+  void Journal::write_records(Record const* buf, size_t n) throw() {
+    char const* data = reinterpret_cast<char const*>(buf);
+    size_t bytes = n * sizeof(Record);
+    size_t done = 0;
+    while (done < bytes) {
+      ssize_t w = write(m_fd, data + done, bytes - done);
+      if (w < 0 && errno == EINTR)
+	continue;
+      if (w <= 0)
+	break;
+      done += w;
+    }
+    
+    // don't leave a partial record for the next write to append to
+    size_t records = done / sizeof(Record);
+    m_end += records * sizeof(Record);
+    if (done % sizeof(Record))
+      while (ftruncate(m_fd, m_end) && errno == EINTR);
+    m_written.set(m_written.get() + records);
+    
+    // m_dropped is also increased by the editing thread
+    for (size_t i = records; i < n; ++i)
+      m_dropped.increase();
+  }
+
+
+}
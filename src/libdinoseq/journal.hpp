@@ -0,0 +1,257 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef JOURNAL_HPP
+#define JOURNAL_HPP
+
+#include <map>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "atomicint.hpp"
+#include "editlistener.hpp"
+#include "nodequeue.hpp"
+
+
+namespace Dino {
+  
+  
+  class Curve;
+  class Sequencer;
+  
+  
+  /** An append-only journal of the edits made to a set of Curves and
+      Sequencers, which can be replayed after a crash to recover the edits
+      made since the last full save. 
+      
+      The Curves are attached with numeric IDs, and every edit is recorded
+      as a small fixed size record that refers to the Curve by its ID. The
+      records are pushed on a lock-free queue by the thread that makes the
+      edit and written to the file by a background thread, so the editing
+      thread never waits for the disk. The writer thread syncs the file at
+      most once every sync interval, so a burst of edits only costs one
+      @c fdatasync().
+      
+      All edits to the attached objects must be made from the same thread,
+      since the queue only supports a single producer. Adding and removing
+      Sequencables is only recorded for attached Curves.
+      
+      @ingroup mididata
+  */
+  class Journal : public EditListener {
+  public:
+    
+    /** Open the journal @c filename for appending, creating it if it does
+	not exist, and start the writer thread. If the file ends with a
+	partial record, left by a crash in the middle of a write, it is cut
+	off so the new records are appended after the last whole one. The 
+	file is synced at most once every @c sync_interval milliseconds, and
+	at the latest @c sync_interval milliseconds after an edit. This 
+	function is @b not realtime safe.
+	
+	@throw std::runtime_error if the file could not be opened, is not a
+				  journal, or the thread could not be created
+    */
+    Journal(std::string const& filename, unsigned sync_interval = 100)
+      throw(std::runtime_error);
+    
+    /** Detach from all objects, write and sync all queued records and stop
+	the writer thread. This function is @b not realtime safe. */
+    ~Journal() throw();
+    
+    /** Record all edits to @c curve with the ID @c id. The IDs are what 
+	replay() uses to find the Curves, so they must stay the same between
+	sessions. 
+	
+	@throw std::bad_alloc if the ID could not be stored
+    */
+    void attach(Curve& curve, uint32_t id) throw(std::bad_alloc);
+    
+    /** Stop recording edits to @c curve. */
+    void detach(Curve& curve) throw();
+    
+    /** Record all Curves that are added to or removed from @c seq. 
+	
+	@throw std::bad_alloc if the Sequencer could not be stored
+    */
+    void attach(Sequencer& seq) throw(std::bad_alloc);
+    
+    /** Stop recording the Curves added to and removed from @c seq. */
+    void detach(Sequencer& seq) throw();
+    
+    /** Block until all edits that have been made so far have been written
+	to the file and synced. */
+    void flush() throw();
+    
+    /** Return the number of records that have been written to the file. */
+    size_t get_written() const throw();
+    
+    /** Return the number of times the file has been synced. */
+    size_t get_syncs() const throw();
+    
+    /** Return the number of edits that could not be recorded because
+	there was no memory for the queue nodes or they could not be
+	written to the file. */
+    size_t get_dropped() const throw();
+    
+    /** Apply all edits in the journal @c filename. Curve IDs are indices
+	in @c curves, and Sequencables are added to and removed from @c seq
+	if it is not 0. Moved and removed points are found by their old time
+	and value. Records that refer to unknown Curves or points, or that
+	fail, are skipped, and a truncated record at the end of the file is 
+	ignored. Return the number of edits that were applied. The Curves
+	and the Sequencer should not be attached to a Journal while this is
+	running, since the replayed edits would be recorded again.
+	
+	@throw std::runtime_error if the file could not be read or is not 
+				  a journal
+    */
+    static size_t replay(std::string const& filename, 
+			 std::vector<std::shared_ptr<Curve>> const& curves,
+			 Sequencer* seq = 0) throw(std::runtime_error);
+    
+    virtual void point_added(Curve const& curve, SongTime const& time,
+			     AtomicInt::Type value) throw();
+    
+    virtual void point_moved(Curve const& curve, SongTime const& old_time,
+			     AtomicInt::Type old_value, SongTime const& time,
+			     AtomicInt::Type value) throw();
+    
+    virtual void point_removed(Curve const& curve, SongTime const& time,
+			       AtomicInt::Type value) throw();
+    
+    virtual void sequencable_added(Sequencable const& sqbl) throw();
+    
+    virtual void sequencable_removed(Sequencable const& sqbl) throw();
+  
+  private:
+    
+    /** A record in the journal file. */
+    struct Record {
+      
+      /** The type of edit. */
+      uint32_t op;
+      
+      /** The Curve ID. */
+      uint32_t id;
+      
+      /** The beat of the point time, or of the old time for moves. */
+      int32_t beat;
+      
+      /** The tick of the point time, or of the old time for moves. */
+      uint32_t tick;
+      
+      /** The point value, or the old value for moves. */
+      int32_t value;
+      
+      /** The beat of the new time for moves. */
+      int32_t new_beat;
+      
+      /** The tick of the new time for moves. */
+      uint32_t new_tick;
+      
+      /** The new value for moves. */
+      int32_t new_value;
+    };
+    
+    /** The queue type used to pass records to the writer thread. */
+    typedef NodeQueue<Record> Queue;
+    
+    /** Copying is not allowed. */
+    Journal(Journal const&) = delete;
+    
+    /** Assignment is not allowed. */
+    Journal& operator=(Journal const&) = delete;
+    
+    /** Push a record for the Curve @c curve on the queue, if it is 
+	attached. */
+    void push(uint32_t op, Sequencable const& curve, SongTime const& time,
+	      AtomicInt::Type value, SongTime const& new_time = SongTime(),
+	      AtomicInt::Type new_value = 0) throw();
+    
+    /** The function that the writer thread executes. */
+    static void* thread_main(void* arg);
+    
+    /** Write all records in the queue to the file. Return @c true if 
+	anything was written. */
+    bool drain() throw();
+    
+    /** Write @c n records from @c buf to the file. If the write fails
+	the file is truncated to the last whole record and the records that
+	were not written are counted as dropped. */
+    void write_records(Record const* buf, size_t n) throw();
+    
+    
+    /** The journal file. */
+    int m_fd;
+    
+    /** The end of the last whole record in the file. */
+    off_t m_end;
+    
+    /** The sync interval in milliseconds. */
+    unsigned m_interval;
+    
+    /** The records that haven't been written yet. */
+    Queue m_queue;
+    
+    /** The attached Curves and their IDs. */
+    std::map<Sequencable const*, std::pair<Curve*, uint32_t>> m_curves;
+    
+    /** The attached Sequencers. */
+    std::vector<Sequencer*> m_sequencers;
+    
+    /** The writer thread. */
+    pthread_t m_thread;
+    
+    /** Posted when there are new records or the thread should check 
+	m_flush or m_quit. */
+    sem_t m_wake;
+    
+    /** Posted by the writer thread when a flush has been done. */
+    sem_t m_flushed;
+    
+    /** Set to 1 when flush() is waiting for the writer thread. */
+    AtomicInt m_flush;
+    
+    /** Set to 1 when the writer thread should exit. */
+    AtomicInt m_quit;
+    
+    /** The number of records written to the file. */
+    AtomicInt m_written;
+    
+    /** The number of syncs. */
+    AtomicInt m_syncs;
+    
+    /** The number of edits that could not be recorded. */
+    AtomicInt m_dropped;
+  
+  };
+
+
+}
+
+
+#endif
@@ -0,0 +1,168 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <limits>
+
+#include "latencyhistogram.hpp"
+
+
+namespace Dino {
+  
+  
+  namespace {
+    
+    /** The largest time that can be stored. */
+    uint64_t const max_time = std::numeric_limits<AtomicInt::Type>::max();
+    
+    /** Return the time from the monotonic clock in nanoseconds. */
+    uint64_t clock_ns() throw() {
+      timespec ts;
+      clock_gettime(CLOCK_MONOTONIC, &ts);
+      return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+  
+  }
+  
+  
+  uint64_t LatencyHistogram::now() throw() {
+#if defined(__i386__) || defined(__x86_64__)
+    uint32_t lo, hi;
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return (uint64_t(hi) << 32) | lo;
+#else
+    return clock_ns();
+#endif
+  }
+  
+  
+  double LatencyHistogram::ticks_per_second() throw() {
+#if defined(__i386__) || defined(__x86_64__)
+    static double tps = 0;
+    if (tps == 0) {
+      timespec ts = { 0, 20000000 };
+      uint64_t ns = clock_ns();
+      uint64_t cycles = now();
+      nanosleep(&ts, 0);
+      tps = double(now() - cycles) * 1e9 / double(clock_ns() - ns);
+    }
+    return tps;
+#else
+    return 1e9;
+#endif
+  }
+  
+  
+  LatencyHistogram::LatencyHistogram() throw() {
+    reset();
+  }
+  
+  
+  void LatencyHistogram::record(uint64_t cycles) throw() {
+    
+    // there is only one writer, so the counters don't need atomic
+    // increments or barriers, the readers only need to see every value 
+    // whole
+    if (cycles > max_time)
+      cycles = max_time;
+    AtomicInt& b = m_bins[bin(cycles)];
+    b.set_relaxed(b.get_relaxed() + 1);
+    m_last.set_relaxed(cycles);
+    if (AtomicInt::Type(cycles) > m_max.get_relaxed())
+      m_max.set_relaxed(cycles);
+    m_count.set_relaxed(m_count.get_relaxed() + 1);
+  }
+  
+  
+  void LatencyHistogram::add_xrun() throw() {
+    m_xruns.increase();
+  }
+  
+  
+  size_t LatencyHistogram::get_count() const throw() {
+    return m_count.get();
+  }
+  
+  
+  uint64_t LatencyHistogram::get_last() const throw() {
+    return m_last.get();
+  }
+  
+  
+  uint64_t LatencyHistogram::get_max() const throw() {
+    return m_max.get();
+  }
+  
+  
+  uint64_t LatencyHistogram::get_percentile(double p) const throw() {
+    size_t total = 0;
+    size_t counts[bins];
+    for (unsigned b = 0; b < bins; ++b) {
+      counts[b] = m_bins[b].get();
+      total += counts[b];
+    }
+    if (total == 0)
+      return 0;
+    
+    // find the bin that holds the sample with rank ceil(p * total)
+    size_t rank = std::max<size_t>(1, size_t(std::ceil(p * total)));
+    size_t seen = 0;
+    uint64_t max = get_max();
+    for (unsigned b = 0; b < bins; ++b) {
+      seen += counts[b];
+      if (seen >= rank)
+	return std::min(bin_limit(b) - 1, max);
+    }
+    return max;
+  }
+  
+  
+  size_t LatencyHistogram::get_xruns() const throw() {
+    return m_xruns.get();
+  }
+  
+  
+  void LatencyHistogram::reset() throw() {
+    for (unsigned b = 0; b < bins; ++b)
+      m_bins[b].set(0);
+    m_count.set(0);
+    m_last.set(0);
+    m_max.set(0);
+    m_xruns.set(0);
+  }
+  
+  
+  unsigned LatencyHistogram::bin(uint64_t cycles) throw() {
+    if (cycles < 4)
+      return cycles;
+    unsigned octave = 63 - __builtin_clzll(cycles);
+    return 4 * (octave - 1) + ((cycles >> (octave - 2)) & 3);
+  }
+  
+  
+  uint64_t LatencyHistogram::bin_limit(unsigned b) throw() {
+    if (b < 4)
+      return b + 1;
+    unsigned octave = b / 4 + 1;
+    return uint64_t(4 + b % 4 + 1) << (octave - 2);
+  }
+
+
+}
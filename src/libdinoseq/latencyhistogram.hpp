@@ -0,0 +1,127 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef LATENCYHISTOGRAM_HPP
+#define LATENCYHISTOGRAM_HPP
+
+#include <cstddef>
+
+#include <stdint.h>
+
+#include "atomicint.hpp"
+
+
+namespace Dino {
+  
+  
+  /** A histogram of running times, measured in CPU cycles. The bins are 
+      spaced logarithmically with four bins per power of two, so every
+      bin is at most 25% wide and the whole range of a 32 bit counter fits
+      in a small fixed array. Recording a time only updates a few atomic
+      integers, so one thread can record times in a realtime thread while
+      any number of other threads read the statistics. The statistics are
+      not read atomically as a whole, so they may be off by the last few 
+      samples while times are being recorded.
+      
+      Times longer than the largest value an AtomicInt can hold are 
+      clamped to that value.
+      
+      @ingroup seqengine
+  */
+  class LatencyHistogram {
+  public:
+    
+    /** The number of bins. */
+    static unsigned const bins = 128;
+    
+    /** Return the current value of the CPU cycle counter, or the time in 
+	nanoseconds from a monotonic clock on platforms where the cycle
+	counter can't be read directly. This function is realtime safe. */
+    static uint64_t now() throw();
+    
+    /** Return the number of now() units per second. This is measured the 
+	first time the function is called, so the first call is @b not 
+	realtime safe. */
+    static double ticks_per_second() throw();
+    
+    /** Create an empty histogram. */
+    LatencyHistogram() throw();
+    
+    /** Add a time to the histogram. This function is realtime safe, but 
+	must only be called from one thread at a time. */
+    void record(uint64_t cycles) throw();
+    
+    /** Count an xrun that was caused by this histogram's code. This 
+	function is realtime safe. */
+    void add_xrun() throw();
+    
+    /** Return the number of recorded times. */
+    size_t get_count() const throw();
+    
+    /** Return the last recorded time. */
+    uint64_t get_last() const throw();
+    
+    /** Return the longest recorded time. */
+    uint64_t get_max() const throw();
+    
+    /** Return an upper bound for the shortest time that is longer than or 
+	equal to the fraction @c p of all recorded times, so 
+	get_percentile(0.5) is the median. The result is never larger than
+	get_max(), and is 0 if no times have been recorded. */
+    uint64_t get_percentile(double p) const throw();
+    
+    /** Return the number of xruns that this histogram's code has been
+	blamed for. */
+    size_t get_xruns() const throw();
+    
+    /** Clear all statistics. Times that are recorded while this function
+	is running may be lost. */
+    void reset() throw();
+  
+  private:
+    
+    /** Return the bin that @c cycles belongs to. */
+    static unsigned bin(uint64_t cycles) throw();
+    
+    /** Return the smallest time that is larger than all times in bin 
+	@c b. */
+    static uint64_t bin_limit(unsigned b) throw();
+    
+    
+    /** The number of times in every bin. */
+    AtomicInt m_bins[bins];
+    
+    /** The number of recorded times. */
+    AtomicInt m_count;
+    
+    /** The last recorded time. */
+    AtomicInt m_last;
+    
+    /** The longest recorded time. */
+    AtomicInt m_max;
+    
+    /** The number of xruns. */
+    AtomicInt m_xruns;
+  
+  };
+
+
+}
+
+
+#endif
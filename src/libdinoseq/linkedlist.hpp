@@ -24,6 +24,7 @@
 
 #include "atomicint.hpp"
 #include "atomicptr.hpp"
+#include "epochdomain.hpp"
 #include "meta.hpp"
 #include "nodelist.hpp"
 
@@ -31,9 +32,9 @@
 namespace Dino {
   
   
-  /** A lock-free linked list with one writer and one reader.
+  /** A lock-free linked list with one writer and any number of readers.
       This class template implements a lock-free linked list for one RW thread
-      and one read-only thread, the latter of which may be a realtime thread.
+      and one or more read-only threads, which may be realtime threads.
       
       The RW thread should do all the manipulation of the list using insert()
       and erase(), and can also iterate over the list using the iterators
@@ -43,23 +44,43 @@ namespace Dino {
       to iterate over the list, as well as calling 
       reader_holds_no_iterator() when the reader thread does not hold any
       ReaderIterator objects for this LinkedList. These functions are realtime
-      safe.
+      safe. 
+      
+      Erased nodes are deallocated using an EpochDomain. By default the list
+      has its own domain with a single reader that uses 
+      reader_holds_no_iterator(), but it can also share a domain with other
+      data structures. The list is then given the slot of its reader, and
+      reader_holds_no_iterator() calls EpochDomain::quiescent() for that 
+      slot.
       
       No functions take any locks, however insert(), erase() and 
       delete_erased_nodes() may allocate or deallocate memory and should thus
       not be called from a realtime thread. 
   
       The only requirement for the datatype T is that is should be 
-      CopyConstructable or MoveConstructable. */
-  template <typename T>
+      CopyConstructable or MoveConstructable. The nodes are allocated using
+      an allocator of type @c A, HeapAllocator or PoolAllocator. */
+  template <typename T, typename A = HeapAllocator>
   class LinkedList {
   private:
     
     /** The base type of Node. It is used for the end marker. */
-    typedef typename NodeList<T>::NodeBase NodeBase;
+    typedef typename NodeList<T, A>::NodeBase NodeBase;
 
     /** The type of all nodes in the list, except the end marker. */
-    typedef typename NodeList<T>::Node Node;
+    typedef typename NodeList<T, A>::Node Node;
+    
+    
+    /** The EpochLimbo policy for erased nodes. They are linked through
+	their @c m_prev pointers, which the readers never use. */
+    struct ErasePolicy {
+      ErasePolicy(NodeList<T, A>& l) throw() : list(&l) {}
+      NodeBase*& link(NodeBase* n) throw() { return n->m_prev; }
+      void free(NodeBase* n) throw() { 
+	list->destroy_node(static_cast<Node*>(n)); 
+      }
+      NodeList<T, A>* list;
+    };
     
 
     /** A class template that implements all the operations of a
@@ -114,7 +135,7 @@ namespace Dino {
       
       /** Make the iterator point to the next element in the list. */
       Derived& operator++() throw() {
-	m_node = static_cast<N*>(m_node)->m_next.get();
+	m_node = static_cast<N*>(m_node)->m_next.get_acquire();
 	return static_cast<Derived&>(*this);
       }
       
@@ -143,8 +164,8 @@ namespace Dino {
       /** The NodeBase type. It's either NodeBase or NodeBase c const. */
       typedef typename ForwardIterator<Derived, Compare, V>::NB NB;
       
-      /** LinkedList<T> needs to call the private constructor. */
-      friend class LinkedList<T>;
+      /** LinkedList<T, A> needs to call the private constructor. */
+      friend class LinkedList<T, A>;
       
       /** The constructor that creates an iterator from a list node. */
       explicit BiIterator(NB* node) throw() 
@@ -181,8 +202,8 @@ namespace Dino {
 	public std::iterator<std::bidirectional_iterator_tag, 
 			     T const, AtomicInt::Type> {
 
-      /** LinkedList<T> needs to call the private constructor. */
-      friend class LinkedList<T>;
+      /** LinkedList<T, A> needs to call the private constructor. */
+      friend class LinkedList<T, A>;
       
       /** The constructor that creates an iterator from a list node. */
       explicit ConstIterator(NodeBase const* node) throw() 
@@ -204,8 +225,8 @@ namespace Dino {
 	public std::iterator<std::bidirectional_iterator_tag, 
 			     T, AtomicInt::Type> {
       
-      /** LinkedList<T> needs to call the private constructor. */
-      friend class LinkedList<T>;
+      /** LinkedList<T, A> needs to call the private constructor. */
+      friend class LinkedList<T, A>;
       
       /** The constructor that creates an iterator from a list node. */
       explicit Iterator(NodeBase* node) throw() 
@@ -231,8 +252,8 @@ namespace Dino {
       : public ForwardIterator<ReaderIterator, ReaderIterator, T const>,
 	public std::iterator<std::forward_iterator_tag, T, AtomicInt::Type> {
 
-      /** LinkedList<T> needs to call the private constructor. */
-      friend class LinkedList<T>;
+      /** LinkedList<T, A> needs to call the private constructor. */
+      friend class LinkedList<T, A>;
       
       /** The constructor that creates an iterator from a list node. */
       explicit ReaderIterator(NodeBase const* node) throw() 
@@ -247,24 +268,48 @@ namespace Dino {
     };
     
     
-    /** Construct an empty list. */
-    LinkedList() throw() 
-      : m_erased_list(0),
-	m_erase_counter(0),
-	m_delete_ok(std::numeric_limits<decltype(m_delete_ok)>::max()),
-	m_size(0),
-	m_erased_list_size(0) {
+    /** Construct an empty list that allocates its nodes using @c alloc. 
+	The list gets its own EpochDomain with one reader, which should
+	call reader_holds_no_iterator(). */
+    LinkedList(A const& alloc = A()) throw() 
+      : m_data(alloc),
+	m_erased(m_own_domain, ErasePolicy(m_data)),
+	m_reader(m_own_domain.register_reader()),
+	m_size(0) {
+    
+    }
+    
+    /** Construct an empty list that allocates its nodes using @c alloc and
+	shares the EpochDomain @c domain with other data structures. 
+	@c reader is the slot that the reader thread has registered in 
+	@c domain, and reader_holds_no_iterator() marks it as quiescent. 
+	Since that also covers the other data structures in the domain, the
+	reader should only call it when it doesn't hold any iterators for 
+	any of them. The list does not unregister the slot. */
+    LinkedList(EpochDomain& domain, int reader, A const& alloc = A()) 
+      throw() 
+      : m_data(alloc),
+	m_erased(domain, ErasePolicy(m_data)),
+	m_reader(reader),
+	m_size(0) {
 
     }
     
     /** Release all memory used by the list. */
     ~LinkedList() throw() {
-      Node* n = m_erased_list;
-      while (n != 0) {
-	Node* n2 = n;
-	n = static_cast<Node*>(n->m_prev);
-	delete n2;
-      }
+      if (&get_domain() == &m_own_domain)
+	m_own_domain.unregister_reader(m_reader);
+    }
+    
+    /** Copying is not allowed. */
+    LinkedList(LinkedList const&) = delete;
+    
+    /** Assignment is not allowed. */
+    LinkedList& operator=(LinkedList const&) = delete;
+    
+    /** Return the EpochDomain that is used to deallocate erased nodes. */
+    EpochDomain& get_domain() const throw() {
+      return m_erased.get_domain();
     }
     
     /** Returns a ConstIterator to the beginning of the list. */
@@ -299,7 +344,7 @@ namespace Dino {
       delete_erased_nodes();
       if (m_size == std::numeric_limits<AtomicInt::Type>::max())
 	throw std::overflow_error("The list is full");
-      Node* node = new Node(data);
+      Node* node = m_data.create_node(data);
       m_data.insert(pos.m_node, node);
       ++m_size;
       return Iterator(node);
@@ -318,48 +363,40 @@ namespace Dino {
       delete_erased_nodes();
       if (m_size == std::numeric_limits<AtomicInt::Type>::max())
 	throw std::overflow_error("The list is full");
-      Node* node = new Node(std::move(data));
+      Node* node = m_data.create_node(std::move(data));
       m_data.insert(pos.m_node, node);
       ++m_size;
       return Iterator(node);
     }
 
     
-    /** Erase the element pointed to by @c pos from the list.
-	@throw std::overflow_error if there are too many erased elements that
-	                           have not been deallocated yet. See 
-				   reader_holds_no_iterator(). */
-    Iterator erase(Iterator pos) throw(std::overflow_error) {
+    /** Erase the element pointed to by @c pos from the list. The node is
+	not deallocated until all readers are done with it, see
+	reader_holds_no_iterator(). This does not allocate any memory. */
+    Iterator erase(Iterator pos) throw() {
       delete_erased_nodes();
-      if (m_erased_list_size == std::numeric_limits<AtomicInt::Type>::max())
-	throw std::overflow_error("Too many elements waiting for deletion");
       Iterator result = pos;
       ++result;
       Node* node = static_cast<Node*>(pos.m_node);
       m_data.remove(node);
-      node->m_prev = m_erased_list;
-      m_erased_list = node;
-      ++m_erased_list_size;
-      m_erase_counter.increase();
+      m_erased.retire(node);
       --m_size;
       return result;
     }
     
-    /** Deallocate all erased nodes. See reader_holds_no_iterator(). This is
-	called automatically when you insert() or erase() so you should 
-	normally not have to call it directly. */
+    /** Deallocate the erased nodes that no reader can be using any more and
+	return the number of deallocated nodes. See 
+	reader_holds_no_iterator(). This is called automatically when you 
+	insert() or erase() so you should normally not have to call it 
+	directly. */
     AtomicInt::Type delete_erased_nodes() throw() {
-      if (m_erase_counter.get() == m_delete_ok.get()) {
-	Node* node;
-	while ((node = m_erased_list)) {
-	  m_erased_list = static_cast<Node*>(node->m_prev);
-	  delete node;
-	}
-	AtomicInt::Type result = m_erased_list_size;
-	m_erased_list_size = 0;
-	return result;
-      }
-      return 0;
+      return m_erased.collect();
+    }
+    
+    /** Return the number of erased nodes that have not been deallocated 
+	yet. */
+    AtomicInt::Type get_erased_size() const throw() {
+      return m_erased.get_size();
     }
     
     /** Returns the number of elements in the list. This should not be
@@ -395,9 +432,11 @@ namespace Dino {
 	The reader thread should call this function periodically when it does
 	not hold any iterators for the list. After a call to this function
 	any ReaderIterator returned from an earlier reader_begin() or 
-	reader_end() may be invalid. */
+	reader_end() may be invalid. If the list shares its EpochDomain 
+	with other data structures this marks the reader slot that was 
+	given to the constructor as quiescent in the shared domain. */
     void reader_holds_no_iterator() throw() {
-      m_delete_ok.set(m_erase_counter.get());
+      get_domain().quiescent(m_reader);
     }
     
     /** @} */
@@ -405,26 +444,21 @@ namespace Dino {
   private:
     
     /** The NodeList that holds the actual nodes. */
-    NodeList<T> m_data;
+    NodeList<T, A> m_data;
     
-    /** A list of erased nodes waiting for deallocation, linked through the
-	@c m_prev link to save atomic calls. */
-    Node* m_erased_list;
+    /** The domain used when the list doesn't share one with other data
+	structures. */
+    EpochDomain m_own_domain;
     
-    /** A counter that is increased every time erase() is called. */
-    AtomicInt m_erase_counter;
+    /** The erased nodes waiting for deallocation. */
+    EpochLimbo<NodeBase, ErasePolicy> m_erased;
     
-    /** reader_holds_no_iterator() copies the value of AtomicInt here.
-	delete_erased_nodes() will only actually delete nodes if the values
-	of @c m_delete_ok and @c m_erase_counter are equal. */
-    AtomicInt m_delete_ok;
+    /** The reader slot in the domain. */
+    int m_reader;
     
     /** The number of elements in the list. */
     AtomicInt::Type m_size;
     
-    /** The number of nodes in the list of erased nodes. */
-    AtomicInt::Type m_erased_list_size;
-    
   };
   
   
@@ -20,8 +20,10 @@
 #define NODELIST_HPP
 
 #include <limits>
+#include <new>
 
 #include "atomicptr.hpp"
+#include "nodepool.hpp"
 
 
 namespace Dino {
@@ -30,19 +32,27 @@ namespace Dino {
   /** A basic doubly linked list. This is a very basic list, it has no
       iterator interface and the user is responsible for allocating and
       deallocating the Node objects before inserting and after removing
-      them, using @c new and @c delete. The only exception is when the
-      destructor for the list is called, at which point all nodes still
-      in the list will be deallocated using @c delete.
+      them, using create_node() and destroy_node(). The only exception is 
+      when the destructor for the list is called, at which point all nodes
+      still in the list will be deallocated using destroy_node(). If the 
+      default HeapAllocator is used, @c new and @c delete work too.
       
       This list type is more suited as a building block for more complex
       data structures than as a stand-alone linked list. All operations
       except construction and destruction are thread-safe and lock-free
       as long as only one thread is calling insert() and remove().
+      
+      @tparam T the payload type
+      @tparam A the allocator type used for the nodes, HeapAllocator or
+                PoolAllocator
   */
-  template <typename T>
+  template <typename T, typename A = HeapAllocator>
   class NodeList {
   public:
     
+    /** The allocator type. */
+    typedef A Allocator;
+    
 
     /** A base struct for Node. This struct has only a back link and is used 
 	for the end marker so we don't have to use Node with its
@@ -88,21 +98,67 @@ namespace Dino {
     
     
     /** Construct an empty list. */
-    NodeList() throw() 
-      : m_head(&m_end) {
+    NodeList(A const& alloc = A()) throw() 
+      : m_alloc(alloc),
+	m_head(&m_end) {
 
     }
     
     /** Release all memory used by the list and its nodes. */
     ~NodeList() throw() {
-      NodeBase* nb = m_head.get();
+      NodeBase* nb = m_head.get_relaxed();
       while (nb != &m_end) {
 	Node* n = static_cast<Node*>(nb);
-	nb = static_cast<Node*>(nb)->m_next.get();
-	delete n;
+	nb = static_cast<Node*>(nb)->m_next.get_relaxed();
+	destroy_node(n);
+      }
+    }
+    
+    /** Return the allocator used by this list. */
+    A const& get_allocator() const throw() {
+      return m_alloc;
+    }
+    
+    /** Allocate and construct a new node with the given data, using the 
+	list's allocator. The node is not inserted in the list.
+	
+	@throw std::bad_alloc if the node could not be allocated
+    */
+    Node* create_node(T const& data) {
+      void* mem = m_alloc.allocate(sizeof(Node));
+      try {
+	return new (mem) Node(data);
+      }
+      catch (...) {
+	m_alloc.deallocate(mem, sizeof(Node));
+	throw;
       }
     }
     
+    /** Allocate and construct a new node with the given data, which may be
+	moved, using the list's allocator. The node is not inserted in the 
+	list.
+	
+	@throw std::bad_alloc if the node could not be allocated
+    */
+    Node* create_node(T&& data) {
+      void* mem = m_alloc.allocate(sizeof(Node));
+      try {
+	return new (mem) Node(std::move(data));
+      }
+      catch (...) {
+	m_alloc.deallocate(mem, sizeof(Node));
+	throw;
+      }
+    }
+    
+    /** Destroy and deallocate a node created by create_node(). The node must
+	not be in the list. */
+    void destroy_node(Node* node) {
+      node->~Node();
+      m_alloc.deallocate(node, sizeof(Node));
+    }
+    
     /** Returns the first node in the list. You can use it to insert nodes
 	at the beginning using list.insert(list.first_node(), my_node).
 	This returns a NodeBase instead of a Node since the list may be
@@ -110,9 +166,10 @@ namespace Dino {
 	However, if the return value differs from that of end_marker() it is
 	safe to use @c static_cast to cast it to a Node pointer.
 	
-	This function is atomic and a memory barrier. */
+	This function is atomic and has acquire ordering, so the node is 
+	seen fully initialised. */
     NodeBase* first_node() throw() {
-      return m_head.get();
+      return m_head.get_acquire();
     }
     
     /** Returns the first node in the list. You can use it to insert nodes
@@ -122,9 +179,10 @@ namespace Dino {
 	However, if the return value differs from that of end_marker() it is
 	safe to use @c static_cast to cast it to a Node pointer. 
     
-	This function is atomic and a memory barrier. */
+	This function is atomic and has acquire ordering, so the node is 
+	seen fully initialised. */
     NodeBase const* first_node() const throw() {
-      return m_head.get();
+      return m_head.get_acquire();
     }
     
     /** Returns a pointer to the end marker of the list. You can use it
@@ -145,37 +203,40 @@ namespace Dino {
 	be inserted before the NodeBase @c before, which must either be a
 	pointer to a node already in the list, or node_end(). The list 
 	assumes ownership of the object pointed to by @c node and will 
-	deallocate it in the list destructor using @c delete unless the 
+	deallocate it in the list destructor using destroy_node() unless the
 	node has been removed from the list before that. This means that 
-	the Node object @b must be allocated using @c new unless you are 
-	completely sure that it will be removed before the list destructor 
-	is called. */
+	the Node object @b must be allocated using create_node() unless you
+	are completely sure that it will be removed before the list 
+	destructor is called. */
     void insert(NodeBase* before, Node* node) throw() {
-      node->m_next.set(before);
+      node->m_next.set_relaxed(before);
       Node* prev = static_cast<Node*>(before->m_prev);
       node->m_prev = prev;
       before->m_prev = node;
       if (prev)
-	prev->m_next.set(node);
+	prev->m_next.set_release(node);
       else
-	m_head.set(node);
+	m_head.set_release(node);
     }
     
     /** Remove the given node from the list. The caller assumes ownership
 	of the node. */
     void remove(Node* node) throw() {
       Node* prev = static_cast<Node*>(node->m_prev);
-      NodeBase* next = node->m_next.get();
+      NodeBase* next = node->m_next.get_relaxed();
       next->m_prev = prev;
       if (prev)
-	prev->m_next.set(next);
+	prev->m_next.set_release(next);
       else
-	m_head.set(next);
+	m_head.set_release(next);
     }
     
     
   private:
     
+    /** The allocator for the nodes. */
+    A m_alloc;
+    
     /** The end marker. */
     NodeBase m_end;
     
@@ -0,0 +1,183 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "nodepool.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::unique_ptr;
+  
+  
+  namespace {
+    
+    /** The alignment of all blocks. */
+    size_t const alignment = 16;
+    
+    /** The number of pooled size classes in a PoolAllocator. */
+    size_t const size_classes = 32;
+    
+    /** Round @c n up to a multiple of the alignment. */
+    inline size_t align(size_t n) throw() {
+      return (n + alignment - 1) & ~(alignment - 1);
+    }
+    
+    /** Return the size class for @c bytes bytes. */
+    inline size_t size_class(size_t bytes) throw() {
+      return bytes > 0 ? (align(bytes) / alignment) - 1 : 0;
+    }
+  
+  }
+  
+  
+  NodePool::NodePool(size_t block_size, size_t blocks_per_slab) throw()
+    : m_block_size(align(block_size > 0 ? block_size : 1)),
+      m_blocks_per_slab(blocks_per_slab > 0 ? blocks_per_slab : 1),
+      m_slabs(0),
+      m_free(0),
+      m_allocated(0),
+      m_capacity(0) {
+  }
+  
+  
+  NodePool::~NodePool() throw() {
+    while (m_slabs) {
+      Slab* s = m_slabs;
+      m_slabs = s->next;
+      ::operator delete(s);
+    }
+  }
+  
+  
+  void* NodePool::allocate() throw(bad_alloc) {
+    if (!m_free)
+      add_slab(m_blocks_per_slab);
+    FreeBlock* b = m_free;
+    m_free = b->next;
+    ++m_allocated;
+    return b;
+  }
+  
+  
+  void NodePool::deallocate(void* block) throw() {
+    FreeBlock* b = static_cast<FreeBlock*>(block);
+    b->next = m_free;
+    m_free = b;
+    --m_allocated;
+  }
+  
+  
+  void NodePool::reserve(size_t blocks) throw(bad_alloc) {
+    if (m_capacity - m_allocated < blocks)
+      add_slab(blocks - (m_capacity - m_allocated));
+  }
+  
+  
+  size_t NodePool::get_block_size() const throw() {
+    return m_block_size;
+  }
+  
+  
+  size_t NodePool::get_allocated() const throw() {
+    return m_allocated;
+  }
+  
+  
+  size_t NodePool::get_capacity() const throw() {
+    return m_capacity;
+  }
+  
+  
+  void NodePool::add_slab(size_t blocks) throw(bad_alloc) {
+    size_t header = align(sizeof(Slab));
+    char* mem = 
+      static_cast<char*>(::operator new(header + blocks * m_block_size));
+    Slab* s = reinterpret_cast<Slab*>(mem);
+    s->next = m_slabs;
+    m_slabs = s;
+    
+    // add the blocks to the free list backwards, so they will be allocated
+    // in address order
+    char* first = mem + header;
+    for (size_t i = blocks; i > 0; --i) {
+      FreeBlock* b = reinterpret_cast<FreeBlock*>(first + 
+						  (i - 1) * m_block_size);
+      b->next = m_free;
+      m_free = b;
+    }
+    m_capacity += blocks;
+  }
+  
+  
+  struct PoolAllocator::Pools {
+    
+    Pools(size_t b) : blocks_per_slab(b) { }
+    
+    /** The number of blocks per slab for new pools. */
+    size_t blocks_per_slab;
+    
+    /** The pools, created when they are first needed. */
+    unique_ptr<NodePool> pools[size_classes];
+  };
+  
+  
+  PoolAllocator::PoolAllocator(size_t blocks_per_slab) throw(bad_alloc)
+    : m_pools(new Pools(blocks_per_slab)) {
+  }
+  
+  
+  void* PoolAllocator::allocate(size_t bytes) throw(bad_alloc) {
+    if (bytes > max_pooled_size())
+      return ::operator new(bytes);
+    return get_pool(bytes).allocate();
+  }
+  
+  
+  void PoolAllocator::deallocate(void* p, size_t bytes) throw() {
+    if (bytes > max_pooled_size())
+      ::operator delete(p);
+    else
+      m_pools->pools[size_class(bytes)]->deallocate(p);
+  }
+  
+  
+  void PoolAllocator::reserve(size_t bytes, size_t blocks) 
+    throw(bad_alloc) {
+    if (bytes <= max_pooled_size())
+      get_pool(bytes).reserve(blocks);
+  }
+  
+  
+  size_t PoolAllocator::max_pooled_size() throw() {
+    return size_classes * alignment;
+  }
+  
+  
+  NodePool& PoolAllocator::get_pool(size_t bytes) throw(bad_alloc) {
+    size_t c = size_class(bytes);
+    unique_ptr<NodePool>& pool = m_pools->pools[c];
+    if (!pool)
+      pool.reset(new NodePool((c + 1) * alignment, 
+			      m_pools->blocks_per_slab));
+    return *pool;
+  }
+
+
+}
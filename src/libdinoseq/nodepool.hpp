@@ -0,0 +1,205 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef NODEPOOL_HPP
+#define NODEPOOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+
+
+namespace Dino {
+  
+  
+  /** A pool of memory blocks with a fixed size. The blocks are carved out of
+      larger slabs and freed blocks are kept in a free list and reused, so 
+      once the pool has grown to its working size allocate() and deallocate()
+      are just a couple of pointer operations and never call the system 
+      allocator. Blocks that are allocated after each other are also close 
+      to each other in memory. No memory is returned to the system until the
+      pool is destroyed.
+      
+      A NodePool is not thread safe. 
+  */
+  class NodePool {
+  public:
+    
+    /** Create a new pool for blocks of at least @c block_size bytes that 
+	allocates @c blocks_per_slab blocks at a time. No memory is allocated
+	until it is needed. */
+    NodePool(size_t block_size, size_t blocks_per_slab = 256) throw();
+    
+    /** Release all memory used by the pool. Any blocks that are still 
+	allocated become invalid. */
+    ~NodePool() throw();
+    
+    /** Copying is not allowed. */
+    NodePool(NodePool const&) = delete;
+    
+    /** Assignment is not allowed. */
+    NodePool& operator=(NodePool const&) = delete;
+    
+    /** Return a block of get_block_size() bytes. This is realtime safe 
+	unless the pool has to allocate a new slab.
+	
+	@throw std::bad_alloc if a new slab was needed but could not be 
+			      allocated
+    */
+    void* allocate() throw(std::bad_alloc);
+    
+    /** Return a block to the pool. @c block must have been returned from 
+	allocate() in this pool. This function is realtime safe. */
+    void deallocate(void* block) throw();
+    
+    /** Make sure that at least @c blocks blocks can be allocated without
+	allocating new slabs.
+	
+	@throw std::bad_alloc if the memory could not be allocated
+    */
+    void reserve(size_t blocks) throw(std::bad_alloc);
+    
+    /** Return the size of the blocks. This may be larger than the size
+	requested in the constructor. */
+    size_t get_block_size() const throw();
+    
+    /** Return the number of blocks that are currently allocated. */
+    size_t get_allocated() const throw();
+    
+    /** Return the total number of blocks in all slabs. */
+    size_t get_capacity() const throw();
+  
+  private:
+    
+    /** A free block, linked to the next free block. */
+    struct FreeBlock {
+      FreeBlock* next;
+    };
+    
+    /** The header of a slab. The blocks follow it in memory. */
+    struct Slab {
+      Slab* next;
+    };
+    
+    /** Allocate a new slab with @c blocks blocks and add them to the free
+	list. */
+    void add_slab(size_t blocks) throw(std::bad_alloc);
+    
+    
+    /** The size of the blocks. */
+    size_t m_block_size;
+    
+    /** The number of blocks in a new slab. */
+    size_t m_blocks_per_slab;
+    
+    /** The list of slabs. */
+    Slab* m_slabs;
+    
+    /** The list of free blocks. */
+    FreeBlock* m_free;
+    
+    /** The number of allocated blocks. */
+    size_t m_allocated;
+    
+    /** The total number of blocks. */
+    size_t m_capacity;
+  
+  };
+  
+  
+  /** The default allocator for the node containers, NodeSkipList, NodeList,
+      NodeQueue and LinkedList. It just uses the global @c new and 
+      @c delete operators, so nodes can also be created with @c new and 
+      destroyed with @c delete. */
+  struct HeapAllocator {
+    
+    /** Allocate @c bytes bytes.
+	@throw std::bad_alloc if the memory could not be allocated
+    */
+    void* allocate(size_t bytes) throw(std::bad_alloc) {
+      return ::operator new(bytes);
+    }
+    
+    /** Deallocate memory returned from allocate(). */
+    void deallocate(void* p, size_t) throw() {
+      ::operator delete(p);
+    }
+  
+  };
+  
+  
+  /** An allocator for the node containers that takes the memory from 
+      NodePools, one pool for each size class. Sizes are rounded up to a
+      multiple of 16 bytes, and sizes larger than max_pooled_size() are 
+      allocated on the heap instead.
+      
+      Copies of a PoolAllocator share the same pools, so memory may be 
+      allocated through one copy and deallocated through another, e.g. when 
+      nodes are moved from one container to another. The pools are destroyed
+      with the last copy. A PoolAllocator and its copies must only be used in
+      one thread at a time.
+  */
+  class PoolAllocator {
+  public:
+    
+    /** Create a new allocator with its own set of pools, which will allocate
+	@c blocks_per_slab blocks at a time.
+	
+	@throw std::bad_alloc if the pool table could not be allocated
+    */
+    explicit PoolAllocator(size_t blocks_per_slab = 256) 
+      throw(std::bad_alloc);
+    
+    /** Allocate @c bytes bytes.
+	@throw std::bad_alloc if the memory could not be allocated
+    */
+    void* allocate(size_t bytes) throw(std::bad_alloc);
+    
+    /** Deallocate memory returned from allocate(). @c bytes must be the same
+	as the size that was allocated. */
+    void deallocate(void* p, size_t bytes) throw();
+    
+    /** Make sure that @c blocks blocks of @c bytes bytes can be allocated
+	without allocating any new slabs.
+	
+	@throw std::bad_alloc if the memory could not be allocated
+    */
+    void reserve(size_t bytes, size_t blocks) throw(std::bad_alloc);
+    
+    /** Return the largest size that is allocated from a pool. */
+    static size_t max_pooled_size() throw();
+  
+  private:
+    
+    /** The pools, indexed by size class. */
+    struct Pools;
+    
+    /** Return the pool for @c bytes bytes, creating it if needed. */
+    NodePool& get_pool(size_t bytes) throw(std::bad_alloc);
+    
+    
+    /** The pools, shared with all copies of this allocator. */
+    std::shared_ptr<Pools> m_pools;
+  
+  };
+
+
+}
+
+
+#endif
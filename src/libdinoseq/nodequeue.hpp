@@ -19,7 +19,10 @@
 #ifndef NODEQUEUE_HPP
 #define NODEQUEUE_HPP
 
+#include <new>
+
 #include "atomicptr.hpp"
+#include "nodepool.hpp"
 
 
 namespace Dino {
@@ -28,19 +31,25 @@ namespace Dino {
   /** This is a very basic lock-free realtime-safe queue for one pusher
       and one popper. It does not allocate and deallocate the list nodes
       itself since that would not be realtime-safe, the caller has to do that
-      using the ordinary @c new and @c delete operators; @b not @c malloc(), 
-      placement @c new or something else, the destructor deallocates all
-      remaining nodes using @c delete so they all must be allocated using
-      @c new.
+      using create_node() and destroy_node(). The destructor deallocates all
+      remaining nodes using destroy_node() so they all must be allocated 
+      using create_node(), or @c new if the default HeapAllocator is used.
       
       This queue has a quirk - pop_node() will return 0 if there is only one
       element in the queue. This means that if you want your pushed node
       to be popped as soon as possible you need to push a dummy node after it.
+      
+      @tparam T the payload type
+      @tparam A the allocator type used for the nodes, HeapAllocator or
+                PoolAllocator
   */
-  template <typename T>
+  template <typename T, typename A = HeapAllocator>
   class NodeQueue {
   public:
     
+    /** The allocator type. */
+    typedef A Allocator;
+    
     /** This is a base class for the queue nodes. It is for internal use only.
      */
     struct NodeBase {
@@ -52,8 +61,8 @@ namespace Dino {
       AtomicPtr<NodeBase> next;
     };
     
-    /** This is the type of object you should allocate (using @c new) and
-	push on the queue using push_node(). */
+    /** This is the type of object you should allocate (using create_node())
+	and push on the queue using push_node(). */
     struct Node : NodeBase {
       
       /** Create a new node with the given data element. This constructor
@@ -66,8 +75,12 @@ namespace Dino {
     };
     
     
-    /** Create a new queue. This function is realtime-safe. */
-    NodeQueue() throw() : m_tail(&m_head) {}
+    /** Create a new queue that allocates its nodes using @c alloc. This 
+	function is realtime-safe. */
+    NodeQueue(A const& alloc = A()) throw() 
+      : m_alloc(alloc), 
+	m_tail(&m_head) {
+    }
     
     /** Destroy the queue and delete any elements still in it. This function
 	is neither thread-safe nor realtime-safe, so you must make sure that
@@ -76,23 +89,55 @@ namespace Dino {
     
 	This function will not throw any exceptions unless @b ~T() does. */
     ~NodeQueue() {
-      NodeBase* nb = m_head.next.get();
+      NodeBase* nb = m_head.next.get_relaxed();
       while (nb != 0) {
 	Node* n = static_cast<Node*>(nb);
-	nb = nb->next.get();
-	delete n;
+	nb = nb->next.get_relaxed();
+	destroy_node(n);
+      }
+    }
+    
+    /** Return the allocator used by this queue. */
+    A const& get_allocator() const throw() {
+      return m_alloc;
+    }
+    
+    /** Allocate and construct a new node with the given data element, 
+	using the queue's allocator. The node is not pushed on the queue.
+	This function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the node could not be allocated
+    */
+    Node* create_node(T const& d) {
+      void* mem = m_alloc.allocate(sizeof(Node));
+      try {
+	return new (mem) Node(d);
+      }
+      catch (...) {
+	m_alloc.deallocate(mem, sizeof(Node));
+	throw;
       }
     }
     
+    /** Destroy and deallocate a node created by create_node(), or by 
+	another queue using a copy of the same allocator. The node must not
+	be in the queue. */
+    void destroy_node(Node* node) {
+      node->~Node();
+      m_alloc.deallocate(node, sizeof(Node));
+    }
+    
     /** Push a new node onto the end of the queue. This function may only be
 	called from one single thread. The @c node must not already be in the
 	queue. 
     
 	This function is realtime-safe. */
     void push_node(Node* node) throw() {
-      // this function never touches any node other than the tail
-      node->next.set(0);
-      m_tail->next.set(node);
+      // this function never touches any node other than the tail, and the
+      // release ordering makes sure that the consumer sees the new node
+      // fully initialised
+      node->next.set_relaxed(0);
+      m_tail->next.set_release(node);
       m_tail = node;
     }
     
@@ -100,29 +145,32 @@ namespace Dino {
 	called from one single thread. It will return 0 if there are less than
 	2 nodes in the queue, the last node will not be popped until more
 	nodes have been pushed. Once you have popped a node you are responisble
-	for deallocating it using @c delete.
+	for deallocating it using destroy_node().
 	
 	This function is realtime-safe. */
     Node* pop_node() throw() {
       // if this is 0 the queue is empty
-      NodeBase* nb = m_head.next.get();
+      NodeBase* nb = m_head.next.get_acquire();
       if (nb == 0)
 	return 0;
       
       // if this is 0 the queue contains one single element (the tail), and 
       // we can't pop it since push_node() may be writing to it
-      NodeBase* nb2 = nb->next.get();
+      NodeBase* nb2 = nb->next.get_acquire();
       if (nb2 == 0)
 	return 0;
       
       // else, there is more than one element in the queue and we can pop the
       // first one since push() only ever writes to the tail
-      m_head.next.set(nb2);
+      m_head.next.set_relaxed(nb2);
       return static_cast<Node*>(nb);
     }
     
   private:
     
+    /** The allocator for the nodes. */
+    A m_alloc;
+    
     /** The head of the queue. This node never gets popped, it's just a 
 	marker. */
     NodeBase m_head;
@@ -19,12 +19,16 @@
 #ifndef NODESKIPLIST_HPP
 #define NODESKIPLIST_HPP
 
-#include <cstdlib>
 #include <limits>
 #include <memory>
+#include <new>
 
+#include <stdint.h>
+
+#include "atomicint.hpp"
 #include "atomicptr.hpp"
 #include "meta.hpp"
+#include "nodepool.hpp"
 
 
 namespace Dino {
@@ -33,24 +37,33 @@ namespace Dino {
   /** A basic skip list. This is a very basic list, it has no
       iterator interface and the user is responsible for allocating and
       deallocating the Node objects before inserting and after removing
-      them, using @c new and @c delete. The only exception is when the
-      destructor for the list is called, at which point all nodes still
-      in the list will be deallocated using @c delete.
+      them, using create_node() and destroy_node(). The only exception is 
+      when the destructor for the list is called, at which point all nodes 
+      still in the list will be deallocated using destroy_node().
       
       This list type is more suited to be used as a building block for more 
       complex data structures than as a stand-alone skip list. All operations
       except construction and destruction are thread-safe and lock-free
       as long as only one thread is calling insert() and remove().
       
+      The list keeps track of the highest level that has any nodes, and 
+      searches from the head start at that level instead of at level 
+      @c M - 1, so small lists are searched in O(log n) steps too.
+      
       @tparam T the payload type of the skiplist
       @tparam K the inverse of the probability that a node should have links
                 at level N, given that it has links at level N-1
       @tparam M the maximum number of levels
+      @tparam A the allocator type used for the nodes and their links, 
+                HeapAllocator or PoolAllocator
   */
-  template <typename T, int K = 2, int M = 20>
+  template <typename T, int K = 2, int M = 20, typename A = HeapAllocator>
   class NodeSkipList {
   public:
     
+    /** The allocator type. */
+    typedef A Allocator;
+    
     
     struct NodeBase;
     
@@ -73,72 +86,162 @@ namespace Dino {
     };
     
     
-    /** A base struct for Node. This only has the links and is used for the
-	head and end markers so we don't have to use Node with its
-	potentially expensive data member for that. */
+    /** A base struct for Node. This only has the number of levels and is 
+	used for the head and end markers so we don't have to use Node with
+	its potentially expensive data member for that. The links are stored 
+	in memory directly before the NodeBase, so finding them does not 
+	require following another pointer. */
     struct NodeBase {
       
-      /** Constructs a new NodeBase. */
-      NodeBase(size_t l) throw() 
-	: levels(l), 
-	  links(l > 0 ? new LinkNode[levels] : 0) {}
+      /** Constructs a new NodeBase. There must be @c l LinkNode objects in
+	  the memory directly before it. */
+      explicit NodeBase(size_t l) throw() 
+	: levels(l) {}
       
-      /** The number of elements in links. */
-      size_t levels;
+      /** Return the links to the previous and next nodes on different 
+	  levels. */
+      LinkNode* links() throw() {
+	return reinterpret_cast<LinkNode*>(this) - levels;
+      }
       
-      /** The links to the previous and next nodes on different levels. */
-      std::unique_ptr<LinkNode[]> links;
+      /** Return the links to the previous and next nodes on different 
+	  levels. */
+      LinkNode const* links() const throw() {
+	return reinterpret_cast<LinkNode const*>(this) - levels;
+      }
+      
+      /** The number of elements in links(). */
+      size_t levels;
     };
     
     
     /** The node type of NodeSkipList. It inherits NodeBase and adds the data
-	member. */
+	member. Nodes can only be created using create_node(), which 
+	allocates the links together with the node. */
     struct Node : NodeBase {
       
-      /** Constructs a new node with the given data. This function will
-	  not throw any exceptions unless the copy constructor for @c T
-	  does. */
-      Node(T const& d, size_t l = 0) 
+      /** The data element of this list node. */
+      T data;
+    
+    private:
+      
+      friend class NodeSkipList;
+      
+      /** Constructs a new node with the given data. This function will not
+	  throw any exceptions unless the copy constructor for @c T does. */
+      Node(T const& d, size_t l) 
 	: NodeBase(l), 
 	  data(d) {
-	if (this->levels == 0) {
-	  do {
-	    ++(this->levels);
-	  } while (this->levels <= M && (std::rand() % K == 0));
-	}
-	this->links = std::unique_ptr<LinkNode[]>(new LinkNode[this->levels]);
       }
       
       /** Constructs a new node with the given data, which may be moved.
 	  This function will not throw any exceptions unless the move
 	  constructor for @c T does. */
-      Node(T&& d, size_t levels) : NodeBase(levels), data(std::move(d)) {}
+      Node(T&& d, size_t l) 
+	: NodeBase(l), 
+	  data(std::move(d)) {
+      }
       
-      /** The data element of this list node. */
-      T data;
+      /** Nodes can't be copied. */
+      Node(Node const&) = delete;
     };
     
     
-    /** Construct an empty list. */
-    NodeSkipList() throw() 
-      : m_head(M),
-	m_end(M) {
-      for (int l = 0; l < M; ++l) {
-	m_head.links[l].next.set(&m_end);
-	m_end.links[l].prev = &m_head;
-      }
+    /** Construct an empty list that allocates its nodes using @c alloc. 
+	The random number generator for the node levels is seeded from the
+	address of the list, use seed() if you need the same list shape
+	every time. */
+    NodeSkipList(A const& alloc = A()) throw() 
+      : m_alloc(alloc),
+	m_levels(1) {
+      seed(reinterpret_cast<uintptr_t>(this));
+      for (int l = 0; l < M; ++l)
+	m_head.node.links()[l].next.set_relaxed(&m_end.node);
+      m_end.node.links()[0].prev = &m_head.node;
     }
     
     /** Release all memory used by the list and its nodes. */
     ~NodeSkipList() throw() {
-      NodeBase* nb = m_head.links[0].next.get();
-      while (nb != &m_end) {
+      NodeBase* nb = m_head.node.links()[0].next.get_relaxed();
+      while (nb != &m_end.node) {
 	Node* n = static_cast<Node*>(nb);
-	nb = nb->links[0].next.get();
-	delete n;
+	nb = nb->links()[0].next.get_relaxed();
+	destroy_node(n);
+      }
+    }
+    
+    /** Return the allocator used by this list. */
+    A const& get_allocator() const throw() {
+      return m_alloc;
+    }
+    
+    /** Allocate and construct a new node with the given data and number of
+	levels, using the list's allocator. If @c levels is 0 a random number
+	of levels will be used. The node is not inserted in the list. This 
+	function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the node could not be allocated
+    */
+    Node* create_node(T const& d, size_t levels = 0) {
+      if (levels == 0)
+	levels = random_level();
+      char* mem = static_cast<char*>(m_alloc.allocate(node_size(levels)));
+      LinkNode* links = reinterpret_cast<LinkNode*>(mem);
+      for (size_t l = 0; l < levels; ++l)
+	new (links + l) LinkNode();
+      try {
+	return new (links + levels) Node(d, levels);
+      }
+      catch (...) {
+	m_alloc.deallocate(mem, node_size(levels));
+	throw;
       }
     }
     
+    /** Seed the random number generator used to pick the number of levels
+	for new nodes. Lists that are seeded with the same value and get
+	the same sequence of create_node() calls will have the same shape. */
+    void seed(uint64_t s) throw() {
+      // run the seed through a splitmix64 step so similar seeds give 
+      // unrelated sequences, and make sure the state is never 0
+      uint64_t z = s + 0x9E3779B97F4A7C15ULL;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      z = z ^ (z >> 31);
+      m_rng = (z != 0 ? z : 1);
+    }
+    
+    /** Destroy and deallocate a node created by create_node(). The node 
+	must not be in the list. */
+    void destroy_node(Node* node) throw() {
+      destroy_node(m_alloc, node);
+    }
+    
+    /** Destroy and deallocate a node created by create_node() in a list 
+	that uses a copy of @c alloc. This can be used to destroy nodes 
+	after the list itself has been destroyed. */
+    static void destroy_node(A& alloc, Node* node) throw() {
+      size_t levels = node->levels;
+      LinkNode* links = node->links();
+      node->~Node();
+      for (size_t l = 0; l < levels; ++l)
+	links[l].~LinkNode();
+      alloc.deallocate(links, node_size(levels));
+    }
+    
+    /** A policy type for EpochLimbo that can be used to deallocate removed
+	nodes when no reader thread can be using them any more. The nodes 
+	are linked through their lowest @c prev link, which is cleared by
+	remove() and never read by the reader threads. */
+    struct RetirePolicy {
+      RetirePolicy(A const& a) throw() : alloc(a) {}
+      NodeBase*& link(NodeBase* n) throw() { return n->links()[0].prev; }
+      void free(NodeBase* n) throw() { 
+	destroy_node(alloc, static_cast<Node*>(n)); 
+      }
+      A alloc;
+    };
+    
     /** Returns the first node in the list. You can use it to insert nodes
 	at the beginning using list.insert(list.first_node(), my_node).
 	This returns a NodeBase instead of a Node since the list may be
@@ -146,9 +249,10 @@ namespace Dino {
 	However, if the return value differs from that of end_marker() it is
 	safe to use @c static_cast to cast it to a Node pointer.
 	
-	This function is atomic and a memory barrier. */
+	This function is atomic and has acquire ordering, so the node is 
+	seen fully initialised. */
     NodeBase* first_node() throw() {
-      return m_head.links[0].next.get();
+      return m_head.node.links()[0].next.get_acquire();
     }
     
     /** Returns the first node in the list. You can use it to insert nodes
@@ -158,15 +262,23 @@ namespace Dino {
 	However, if the return value differs from that of end_marker() it is
 	safe to use @c static_cast to cast it to a Node pointer. 
     
-	This function is atomic and a memory barrier. */
+	This function is atomic and has acquire ordering, so the node is 
+	seen fully initialised. */
     NodeBase const* first_node() const throw() {
-      return m_head.links[0].next.get();
+      return m_head.node.links()[0].next.get_acquire();
+    }
+    
+    /** Returns a pointer to the head marker of the list. You can compare
+	it to the return value of find_less() or use it as the start node
+	of a search. */
+    NodeBase* head_marker() throw() {
+      return &m_head.node;
     }
     
     /** Returns a pointer to the end marker of the list. You can compare
 	it to the return value of find_less(). */
     NodeBase const* head_marker() const throw() {
-      return &m_head;
+      return &m_head.node;
     }
     
     /** Returns a pointer to the end marker of the list. You can use it
@@ -174,24 +286,24 @@ namespace Dino {
 	list.insert(list.end_marker(), my_node) or compare it to return
 	values of find(). */
     NodeBase* end_marker() throw() {
-      return &m_end;
+      return &m_end.node;
     }
     
     /** Returns a const pointer to the end marker of the list. You can 
 	compare it to return values of find(). */
     NodeBase const* end_marker() const throw() {
-      return &m_end;
+      return &m_end.node;
     }
     
     /** Insert a new node into the list at a given position. The node will
 	be inserted before the NodeBase @c before, which must either be a
 	pointer to a node already in the list, or end_marker(). The list 
 	assumes ownership of the object pointed to by @c node and will 
-	deallocate it in the list destructor using @c delete unless the 
+	deallocate it in the list destructor using destroy_node() unless the 
 	node has been removed from the list before that. This means that 
-	the Node object @b must be allocated using @c new unless you are 
-	completely sure that it will be removed before the list destructor 
-	is called.
+	the Node object @b must be allocated using create_node() unless you 
+	are completely sure that it will be removed before the list 
+	destructor is called.
 	
 	If inserting the new Node at the given position would break the order
 	of the list it will not be inserted and the function will return 
@@ -201,36 +313,180 @@ namespace Dino {
       // Check that we can insert the node in this position.
       if ((before != end_marker() &&
 	   static_cast<Node*>(before)->data < node->data) ||
-	  (before->links[0].prev != head_marker() &&
-	   node->data < static_cast<Node*>(before->links[0].prev)->data))
+	  (before->links()[0].prev != head_marker() &&
+	   node->data < static_cast<Node*>(before->links()[0].prev)->data))
 	return false;
       
       // For each level, set the next and prev pointers of the new node.
-      NodeBase* next = before;
-      NodeBase* prev = next->links[0].prev;
-      node->links[0].next.set(next);
-      node->links[0].prev = prev;
+      // The previous node on a level is found by walking back from the 
+      // one on the level below, since the end marker only has a level 0 
+      // link to walk back from.
+      NodeBase* prev = before->links()[0].prev;
+      node->links()[0].next.set_relaxed(before);
+      node->links()[0].prev = prev;
       for (size_t l = 1; l < node->levels; ++l) {
-	while (next->levels <= l)
-	  next = next->links[l - 1].next.get();
-	node->links[l].next.set(next);
-	prev = next->links[l].prev;
-	node->links[l].prev = prev;
+	while (prev->levels <= l)
+	  prev = prev->links()[l - 1].prev;
+	node->links()[l].next.set_relaxed(prev->links()[l].next.get_relaxed());
+	node->links()[l].prev = prev;
       }
 
       // Insert the node into the list.
       for (size_t l = 0; l < node->levels; ++l) {
-	node->links[l].next.get()->links[l].prev = node;
+	set_prev(node->links()[l].next.get_relaxed(), l, node);
 	// After this line read-only threads can actually see the new node
-	// when traversing the list at level l.
-	node->links[l].prev->links[l].next.set(node);
+	// when traversing the list at level l. The release ordering makes 
+	// sure that they see it fully initialised.
+	node->links()[l].prev->links()[l].next.set_release(node);
       }
       
+      // Searches may start at the new levels now. A reader that still sees
+      // the old value just doesn't use them.
+      if (AtomicInt::Type(node->levels) > m_levels.get_relaxed())
+	m_levels.set_relaxed(node->levels);
+      
       return true;
     }
     
+    /** Insert copies of all elements in the sorted range [@c first, @c last)
+	before the NodeBase @c before, which must either be a pointer to a 
+	node already in the list, or end_marker(). The new nodes are created
+	using create_node(), but instead of random levels they get the 
+	levels of a perfectly balanced skip list (the i:th new node gets 
+	1 + ctz(i) levels, counting from 1), and they are linked to each 
+	other before any of them are made visible, so this takes O(n) time 
+	for n new elements. The whole range becomes visible to reading 
+	threads at once, when the link at level 0 is written. The higher 
+	levels are published after that and only make searches faster.
+	
+	Returns a pointer to the first new node, or @c before if the range
+	is empty. If the range is not sorted or inserting it at the given
+	position would break the order of the list, nothing is inserted and
+	0 is returned.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+	                      case nothing is inserted
+    */
+    template <typename Iter>
+    NodeBase* bulk_insert(NodeBase* before, Iter first, Iter last) {
+      return replace(before, before, first, last);
+    }
+    
+    /** Replace the nodes in the range [@c first, @c last) with copies of
+	all elements in the sorted range [@c dfirst, @c dlast). @c first 
+	and @c last must be nodes in the list or end_marker(), and 
+	@c first must not be after @c last. The new nodes are created and
+	linked to each other the same way as in bulk_insert(), and the
+	whole range is switched at once when the link at level 0 is written,
+	so a reading thread that traverses the list sees either all the old 
+	nodes or all the new ones, never a mix. All levels have been updated
+	when this function returns.
+	
+	The old nodes are unlinked but not deallocated, and their @c next
+	links are left as they were, so the caller can still walk from 
+	@c first to @c last at level 0 to retire them.
+	
+	Returns a pointer to the first new node, or @c last if the new range
+	is empty. If the new range is not sorted or would break the order of
+	the list, nothing is changed and 0 is returned.
+	
+	@throw std::bad_alloc if the nodes could not be allocated, in which
+			      case nothing is changed
+    */
+    template <typename Iter>
+    NodeBase* replace(NodeBase* first, NodeBase* last, 
+		      Iter dfirst, Iter dlast) {
+      
+      // find the last node before @c first and the first node that isn't
+      // before @c last on every level
+      NodeBase* next[M];
+      NodeBase* prev[M];
+      next[0] = last;
+      prev[0] = first->links()[0].prev;
+      for (int l = 1; l < M; ++l) {
+	next[l] = next[l - 1];
+	while (next[l] != &m_end.node && next[l]->levels <= size_t(l))
+	  next[l] = next[l]->links()[l - 1].next.get_relaxed();
+	prev[l] = prev[l - 1];
+	while (prev[l]->levels <= size_t(l))
+	  prev[l] = prev[l]->links()[l - 1].prev;
+      }
+      
+      // create the new nodes and link them to each other and to the 
+      // previous nodes, but don't change any links in the list yet
+      NodeBase* tail[M];
+      NodeBase* head[M];
+      for (int l = 0; l < M; ++l) {
+	tail[l] = prev[l];
+	head[l] = 0;
+      }
+      bool ordered = true;
+      try {
+	for (size_t i = 1; dfirst != dlast; ++dfirst, ++i) {
+	  size_t levels = 1 + __builtin_ctzll(i);
+	  Node* n = create_node(*dfirst, levels < size_t(M) ? levels : M);
+	  if (tail[0] != head_marker() && 
+	      n->data < static_cast<Node*>(tail[0])->data)
+	    ordered = false;
+	  for (size_t l = 0; l < n->levels; ++l) {
+	    n->links()[l].prev = tail[l];
+	    if (head[l])
+	      tail[l]->links()[l].next.set_relaxed(n);
+	    else
+	      head[l] = n;
+	    tail[l] = n;
+	  }
+	  if (!ordered)
+	    break;
+	}
+      }
+      catch (...) {
+	if (head[0])
+	  destroy_chain(head[0], tail[0]);
+	throw;
+      }
+      if (head[0] && 
+	  (!ordered || (last != end_marker() && 
+			static_cast<Node*>(last)->data < 
+			static_cast<Node*>(tail[0])->data))) {
+	destroy_chain(head[0], tail[0]);
+	return 0;
+      }
+      if (!head[0] && first == last)
+	return last;
+      
+      // link the last new node on every level to the rest of the list
+      for (int l = 0; l < M && head[l]; ++l)
+	tail[l]->links()[l].next.set_relaxed(next[l]);
+      
+      // and publish the new nodes, level 0 first. On the levels that have
+      // no new nodes the old ones are just skipped.
+      for (int l = 0; l < M; ++l) {
+	NodeBase* n = (head[l] ? head[l] : next[l]);
+	if (prev[l]->links()[l].next.get_relaxed() == n)
+	  continue;
+	set_prev(next[l], l, (head[l] ? tail[l] : prev[l]));
+	// After this line read-only threads can see the new nodes, and not
+	// the old ones, when traversing the list at level l.
+	prev[l]->links()[l].next.set_release(n);
+      }
+      
+      // the new nodes may have added levels and the removed ones may have
+      // emptied some
+      AtomicInt::Type levels = M;
+      while (levels > 1 && 
+	     m_head.node.links()[levels - 1].next.get_relaxed() == &m_end.node)
+	--levels;
+      m_levels.set_relaxed(levels);
+      
+      return head[0] ? head[0] : last;
+    }
+    
     /** Remove the given node from the list. The caller assumes ownership
-	of the node. */
+	of the node, but reader threads may still be using it, so it should
+	be retired in an EpochLimbo with RetirePolicy instead of being
+	destroyed directly unless the caller knows that there are no readers.
+    */
     void remove(Node* node) throw() {
 
       // Change the links of the previous and next nodes to point past
@@ -239,41 +495,56 @@ namespace Dino {
       // this node to 0, but don't touch the next links - a read-only
       // thread may be holding a pointer to this node.
       for (int l = node->levels - 1; l >= 0; --l) {
-	NodeBase* next = node->links[l].next.get();
+	NodeBase* next = node->links()[l].next.get_relaxed();
 	// After this line the read-only threads can no longer see this
 	// node when traversing the list at level l.
-	node->links[l].prev->links[l].next.set(next);
-	next->links[l].prev = node->links[l].prev;
-	node->links[l].prev = 0;
+	node->links()[l].prev->links()[l].next.set_release(next);
+	set_prev(next, l, node->links()[l].prev);
+	node->links()[l].prev = 0;
       }
+      
+      // Searches from the head don't have to look at empty levels. A 
+      // reader that still sees the old value finds the end marker there.
+      AtomicInt::Type levels = m_levels.get_relaxed();
+      while (levels > 1 && 
+	     m_head.node.links()[levels - 1].next.get_relaxed() == &m_end.node)
+	--levels;
+      m_levels.set_relaxed(levels);
+    }
+    
+    /** Return the number of levels that are used by nodes in the list, 
+	which is where searches from the head start. This is at least 1 
+	even if the list is empty. */
+    size_t levels() const throw() {
+      return m_levels.get_relaxed();
     }
     
     
     /** Return the first node with a value not less than @c c, or end_marker()
 	if there is no such node. */
     NodeBase* lower_bound(T const& c) {
-      return find_less(c)->links[0].next.get();
+      return find_less(c)->links()[0].next.get_acquire();
     }
     
 
     /** Return the first node with a value not less than @c c, or end_marker()
 	if there is no such node. */
     NodeBase const* lower_bound(T const& c) const {
-      return find_less(c)->links[0].next.get();
+      return find_less(c)->links()[0].next.get_acquire();
     }
     
 
     /** Return the first node with a value larger than @c c, or end_marker()
 	if there is no such node. */
     NodeBase* upper_bound(T const& c) {
-      return find_less_or_equal(c)->links[0].next.get();
+      return find_less_or_equal(c)->links()[0].next.get_acquire();
     }
     
 
     /** Return the first node with a value larger than @c c, or end_marker()
 	if there is no such node. */
     NodeBase const* upper_bound(T const& c) const {
-      return find_less_or_equal(c)->links[0].next.get();
+      return find_less_or_equal(c)->links()[0].next.get_acquire();
     }
     
 
@@ -291,6 +562,26 @@ namespace Dino {
     }
     
 
+    /** Return the last node with a value less than @c c, or head_marker()
+	if there is no such node, searching forward from @c start. 
+	@c start must be head_marker() or a node in the list with a value
+	less than @c c. The search climbs the levels of the nodes it passes
+	and then descends like a search from the head, so it takes 
+	O(log d) expected time where d is the number of nodes between 
+	@c start and the result. */
+    NodeBase* find_less(T const& c, NodeBase* start) {
+      return find_last_impl(*this, Less(c), start);
+    }
+    
+
+    /** Return the last node with a value less than @c c, or head_marker()
+	if there is no such node, searching forward from @c start. See the
+	non-const version. */
+    NodeBase const* find_less(T const& c, NodeBase const* start) const {
+      return find_last_impl(*this, Less(c), start);
+    }
+    
+
     /** Return the last node with a value less than or equal to @c c, 
 	or head_marker() if there is no such node. */
     NodeBase* find_less_or_equal(T const& c) {
@@ -304,28 +595,136 @@ namespace Dino {
       return find_less_or_equal_impl(*this, c);
     }
     
+    
+    /** Return the last node whose data element @c pred returns @c true for,
+	or head_marker() if there is no such node. The nodes that @c pred
+	returns @c true for must be a (possibly empty) prefix of the list,
+	which is the case for any predicate of the form 
+	<tt>data < c</tt> for a value @c c in some order that is consistent
+	with the order of the list. */
+    template <typename P>
+    NodeBase* find_last(P pred) {
+      return find_last_impl(*this, pred);
+    }
+    
+    
+    /** Return the last node whose data element @c pred returns @c true for,
+	or head_marker() if there is no such node. See the non-const 
+	version. */
+    template <typename P>
+    NodeBase const* find_last(P pred) const {
+      return find_last_impl(*this, pred);
+    }
+    
+    
+    /** Return the last node whose data element @c pred returns @c true for,
+	or head_marker() if there is no such node, searching forward from
+	@c start. @c start must be head_marker() or a node in the list that
+	@c pred returns @c true for. This is a finger search, see 
+	find_less(). */
+    template <typename P>
+    NodeBase* find_last(P pred, NodeBase* start) {
+      return find_last_impl(*this, pred, start);
+    }
+    
+    
+    /** Return the last node whose data element @c pred returns @c true for,
+	or head_marker() if there is no such node, searching forward from
+	@c start. See the non-const version. */
+    template <typename P>
+    NodeBase const* find_last(P pred, NodeBase const* start) const {
+      return find_last_impl(*this, pred, start);
+    }
+    
   private:
     
+    /** A head or end marker with @c L levels of links. The head needs all
+	M levels since searches start there, but nothing is ever reached
+	through the end marker, so it only has the level 0 link that 
+	iterators step back from. */
+    template <int L>
+    struct Marker {
+      Marker() throw() : node(L) {}
+      LinkNode links[L];
+      NodeBase node;
+    };
+    
+    /** Set the previous node of @c n at level @c l to @c prev, unless 
+	@c n is the end marker and doesn't have that level. */
+    void set_prev(NodeBase* n, size_t l, NodeBase* prev) throw() {
+      if (l == 0 || n != &m_end.node)
+	n->links()[l].prev = prev;
+    }
+    
+    /** Return the number of bytes needed for a node with @c levels levels,
+	including the links. */
+    static size_t node_size(size_t levels) throw() {
+      return levels * sizeof(LinkNode) + sizeof(Node);
+    }
+    
+    /** Destroy a chain of new nodes from @c first to @c last, linked at 
+	level 0, that have not been published in the list. */
+    void destroy_chain(NodeBase* first, NodeBase* last) throw() {
+      while (first) {
+	NodeBase* next = 
+	  (first == last ? 0 : first->links()[0].next.get_relaxed());
+	destroy_node(static_cast<Node*>(first));
+	first = next;
+      }
+    }
+    
+    /** Return the next number from the xorshift64* generator. */
+    uint64_t random() throw() {
+      m_rng ^= m_rng >> 12;
+      m_rng ^= m_rng << 25;
+      m_rng ^= m_rng >> 27;
+      return m_rng * 0x2545F4914F6CDD1DULL;
+    }
+    
+    /** Return a random number of levels in the range [1, M] for a new node,
+	where every level has the probability 1/K of being added given that
+	the level below it was. This only uses one random number per node;
+	for K = 2 the number of levels is just one more than the number of 
+	trailing zero bits. */
+    size_t random_level() throw() {
+      uint64_t r = random();
+      size_t levels = 1;
+      if (K == 2) {
+	if (r != 0)
+	  levels += __builtin_ctzll(r);
+	else
+	  levels = M;
+      }
+      else {
+	while (levels < M && r % K == 0) {
+	  r /= K;
+	  ++levels;
+	}
+      }
+      return levels < M ? levels : M;
+    }
+    
+    /** A predicate that returns true for values less than a given value. */
+    struct Less {
+      Less(T const& c) : m_c(c) { }
+      bool operator()(T const& d) const { return d < m_c; }
+      T const& m_c;
+    };
+    
+    /** A predicate that returns true for values less than or equal to a
+	given value. */
+    struct LessOrEqual {
+      LessOrEqual(T const& c) : m_c(c) { }
+      bool operator()(T const& d) const { return !(m_c < d); }
+      T const& m_c;
+    };
+    
     /** A template implementation of find_less(), to avoid duplication of
 	code for the const and non-const overloads. */
     template <typename NSL>
     static typename copy_const<NSL, NodeBase>::type* 
     find_less_impl(NSL& me, T const& c) {
-      
-      typedef typename copy_const<NSL, NodeBase>::type NB;
-      typedef typename copy_const<NSL, Node>::type N;
-      
-      NB* i = &me.m_head;
-      int level = M - 1;
-      do {
-	NB* next = i->links[level].next.get();
-	if (next == me.end_marker() || 
-	    !(static_cast<N*>(next)->data < c))
-	  --level;
-	else
-	  i = next;
-      } while (level >= 0);
-      return i;
+      return find_last_impl(me, Less(c));
     }
 			     
 
@@ -334,28 +733,68 @@ namespace Dino {
     template <typename NSL>
     static typename copy_const<NSL, NodeBase>::type*
     find_less_or_equal_impl(NSL& me, T const& c) {
+      return find_last_impl(me, LessOrEqual(c));
+    }
+    
+    
+    /** A template implementation of find_last(), which is also used to 
+	implement find_less() and find_less_or_equal(). */
+    template <typename NSL, typename P>
+    static typename copy_const<NSL, NodeBase>::type*
+    find_last_impl(NSL& me, P const& pred) {
+      return find_last_impl(me, pred, &me.m_head.node);
+    }
+    
+    
+    /** A template implementation of find_last() with a start node. From
+	the head this is the usual search, from the highest level that has
+	any nodes and down. From any other node the search starts at level 0
+	and moves up to the top level of every node it steps to, so it 
+	climbs while the target is far away, and the descent starts when the
+	next node at the current level is past the target. Stepping to a 
+	taller node can't happen once the search has started going down, 
+	since that node would have been seen on the level above. */
+    template <typename NSL, typename P>
+    static typename copy_const<NSL, NodeBase>::type*
+    find_last_impl(NSL& me, P const& pred, 
+		   typename copy_const<NSL, NodeBase>::type* start) {
       
       typedef typename copy_const<NSL, NodeBase>::type NB;
       typedef typename copy_const<NSL, Node>::type N;
       
-      NB* i = &me.m_head;
-      int level = M - 1;
+      NB* i = start;
+      int level = 0;
+      if (start == me.head_marker())
+	level = me.m_levels.get_relaxed() - 1;
       do {
-	NB* next = i->links[level].next.get();
-	if (next == me.end_marker() || (c < static_cast<N*>(next)->data))
+	NB* next = i->links()[level].next.get_acquire();
+	if (next == me.end_marker() || !pred(static_cast<N*>(next)->data))
 	  --level;
-	else
+	else {
 	  i = next;
+	  if (int(next->levels) - 1 > level)
+	    level = next->levels - 1;
+	}
       } while (level >= 0);
       return i;
     }
 			     
     
-    /** A pointer to the head of the list. */
-    NodeBase m_head;
+    /** The allocator for the nodes and their links. */
+    A m_alloc;
+    
+    /** The state of the random number generator for the node levels. */
+    uint64_t m_rng;
+    
+    /** The number of levels that have any nodes, at least 1. It is only
+	written by the thread that changes the list. */
+    AtomicInt m_levels;
+    
+    /** The head of the list. */
+    Marker<M> m_head;
     
     /** The end marker. */
-    NodeBase m_end;
+    Marker<1> m_end;
     
   };
   
@@ -0,0 +1,108 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+
+#include "fixedeventbuffer.hpp"
+#include "offlinerenderer.hpp"
+#include "sequencer.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::runtime_error;
+  using std::shared_ptr;
+  
+  
+  namespace {
+    
+    /** Convert a SongTime to a number of ticks. */
+    inline int64_t to_ticks(SongTime const& st) throw() {
+      return (int64_t(st.get_beat()) << 24) + st.get_tick();
+    }
+    
+    /** Convert a number of ticks to a SongTime. */
+    inline SongTime from_ticks(int64_t t) throw() {
+      return SongTime(SongTime::Beat(t >> 24), SongTime::Tick(t & 0xFFFFFF));
+    }
+  
+  }
+  
+  
+  OfflineRenderer::OfflineRenderer(Sequencer& seq, size_t bytes, 
+				   size_t events) throw(bad_alloc)
+    : m_seq(seq),
+      m_buffer(new FixedEventBuffer(bytes, events)),
+      m_windows(0) {
+  }
+  
+  
+  shared_ptr<EventBuffer> OfflineRenderer::get_buffer() throw() {
+    return m_buffer;
+  }
+  
+  
+  size_t OfflineRenderer::render(SongTime const& from, SongTime const& to, 
+				 EventBuffer& out, SongTime const& window)
+    throw(runtime_error) {
+    
+    int64_t const max_window = std::max<int64_t>(1, to_ticks(window));
+    int64_t const end = to_ticks(to);
+    int64_t t = to_ticks(from);
+    int64_t size = max_window;
+    size_t events = 0;
+    m_windows = 0;
+    
+    while (t < end) {
+      int64_t next = std::min(t + size, end);
+      m_buffer->clear();
+      m_buffer->reset_overflows();
+      m_seq.run(from_ticks(t), from_ticks(next));
+      ++m_windows;
+      
+      // if the window didn't fit, try again with a smaller one
+      if (m_buffer->get_overflows() > 0) {
+	if (next - t == 1)
+	  throw runtime_error("Too many events in a single tick");
+	size = (next - t) / 2;
+	continue;
+      }
+      
+      m_buffer->sort();
+      for (auto i = m_buffer->begin(); i != m_buffer->end(); ++i) {
+	if (!out.write_event(i->get_time(), i->get_size(), i->get_data()))
+	  throw runtime_error("The output buffer did not accept an event");
+      }
+      events += m_buffer->get_event_count();
+      t = next;
+      size = std::min(size * 2, max_window);
+    }
+    
+    m_buffer->clear();
+    return events;
+  }
+  
+  
+  size_t OfflineRenderer::get_windows() const throw() {
+    return m_windows;
+  }
+
+
+}
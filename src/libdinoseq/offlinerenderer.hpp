@@ -0,0 +1,110 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef OFFLINERENDERER_HPP
+#define OFFLINERENDERER_HPP
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  class EventBuffer;
+  class FixedEventBuffer;
+  class Sequencer;
+  
+  
+  /** A driver that runs a Sequencer over a range of song time as fast as
+      possible, without any realtime pacing, e.g. to export a song to a 
+      MIDI file. The Sequencables should be routed to the buffer returned 
+      by get_buffer(). render() then calls Sequencer::run() for one large 
+      window at a time, sorts the events in each window and writes them 
+      to the output EventBuffer, such as an SmfWriter or a RawDumpBuffer.
+      
+      If a window has more events than fit in the buffer the window is 
+      halved and sequenced again, and it grows back to the maximal size
+      after every window that fits. 
+      
+      @code
+      OfflineRenderer r(seq);
+      for (auto i = seq.sqbl_begin(); i != seq.sqbl_end(); ++i)
+	seq.set_event_buffer(i, r.get_buffer());
+      std::ofstream file("song.mid");
+      SmfWriter smf(file);
+      r.render(SongTime(0, 0), song_length, smf);
+      smf.finish();
+      @endcode
+      
+      @ingroup seqengine
+  */
+  class OfflineRenderer {
+  public:
+    
+    /** Create a renderer for @c seq with a buffer that can hold @c bytes 
+	bytes of event data and @c events events per window.
+	
+	@throw std::bad_alloc if the buffer could not be allocated
+    */
+    OfflineRenderer(Sequencer& seq, size_t bytes = 1 << 22, 
+		    size_t events = 1 << 18) throw(std::bad_alloc);
+    
+    /** Return the buffer that the Sequencables should write to. */
+    std::shared_ptr<EventBuffer> get_buffer() throw();
+    
+    /** Sequence the range [@c from, @c to) and write all events to 
+	@c out in time order, in windows of at most @c window. Returns the 
+	number of events written. Nothing else may call run() on the 
+	Sequencer while this is running.
+	
+	@throw std::runtime_error if @c out does not accept an event, or if
+				  a window of a single tick has more events
+				  than fit in the buffer
+    */
+    size_t render(SongTime const& from, SongTime const& to, EventBuffer& out,
+		  SongTime const& window = SongTime(64, 0))
+      throw(std::runtime_error);
+    
+    /** Return the number of times Sequencer::run() was called by the last 
+	call to render(), including windows that were sequenced again with 
+	a smaller size. */
+    size_t get_windows() const throw();
+  
+  private:
+    
+    /** The sequencer that is rendered. */
+    Sequencer& m_seq;
+    
+    /** The buffer that the events for the current window are written 
+	to. */
+    std::shared_ptr<FixedEventBuffer> m_buffer;
+    
+    /** The number of windows in the last render() call. */
+    size_t m_windows;
+  
+  };
+
+
+}
+
+
+#endif
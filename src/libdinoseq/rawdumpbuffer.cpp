@@ -0,0 +1,55 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "rawdumpbuffer.hpp"
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::ostream;
+  
+  
+  RawDumpBuffer::RawDumpBuffer(ostream& stream) throw()
+    : m_stream(stream),
+      m_events(0) {
+  }
+  
+  
+  bool RawDumpBuffer::write_event(SongTime const& st, size_t bytes, 
+				  unsigned char const* data) {
+    Header h;
+    h.beat = st.get_beat();
+    h.tick = st.get_tick();
+    h.size = bytes;
+    m_stream.write(reinterpret_cast<char const*>(&h), sizeof(h));
+    m_stream.write(reinterpret_cast<char const*>(data), bytes);
+    if (!m_stream)
+      return false;
+    ++m_events;
+    return true;
+  }
+  
+  
+  size_t RawDumpBuffer::get_event_count() const throw() {
+    return m_events;
+  }
+
+
+}
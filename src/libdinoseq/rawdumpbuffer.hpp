@@ -0,0 +1,85 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef RAWDUMPBUFFER_HPP
+#define RAWDUMPBUFFER_HPP
+
+#include <iostream>
+
+#include <stdint.h>
+
+#include "eventbuffer.hpp"
+
+
+namespace Dino {
+  
+  
+  class SongTime;
+  
+  
+  /** An EventBuffer that writes the events it receives to an @c ostream
+      in a simple binary format. Every event is written as a Header in the
+      native byte order, followed by the data bytes. This is much faster
+      to write and parse than a MIDI file, and it keeps the full precision
+      of the SongTimes.
+      
+      @ingroup sequencing 
+  */
+  class RawDumpBuffer : public EventBuffer {
+  public:
+    
+    /** The header that is written before the data bytes of every 
+	event. */
+    struct Header {
+      
+      /** The beat of the event time. */
+      int32_t beat;
+      
+      /** The tick of the event time. */
+      uint32_t tick;
+      
+      /** The number of data bytes. */
+      uint32_t size;
+    };
+    
+    /** Create a new buffer that writes to @c stream. */
+    RawDumpBuffer(std::ostream& stream) throw();
+    
+    /** Write an event to the stream. Returns @c false if the stream is in
+	a bad state. */
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data);
+    
+    /** Return the number of events that have been written. */
+    size_t get_event_count() const throw();
+  
+  private:
+    
+    /** The stream that the events are written to. */
+    std::ostream& m_stream;
+    
+    /** The number of events written. */
+    size_t m_events;
+  
+  };
+
+
+}
+
+
+#endif
@@ -0,0 +1,117 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstring>
+
+#include "recordbuffer.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  
+  
+  RecordBuffer::RecordBuffer(size_t capacity) throw(bad_alloc)
+    : m_capacity(capacity),
+      m_pending(0) {
+    
+    // one node is always stuck at the end of each queue, so we need two
+    // extra nodes to be able to queue @c capacity events
+    for (size_t i = 0; i < capacity + 2; ++i)
+      m_free.push_node(m_free.create_node(Event()));
+  }
+  
+  
+  RecordBuffer::~RecordBuffer() throw() {
+    if (m_pending)
+      m_free.destroy_node(m_pending);
+  }
+  
+  
+  bool RecordBuffer::write_event(SongTime const& st, size_t bytes, 
+				 unsigned char const* data) {
+    Queue::Node* n = 0;
+    if (bytes == 0 || bytes > max_event_size || !(n = m_free.pop_node())) {
+      m_dropped.increase();
+      return false;
+    }
+    n->data.time = st;
+    n->data.size = bytes;
+    std::memcpy(n->data.data, data, bytes);
+    m_events.push_node(n);
+    
+    // only this thread changes m_written and m_high_water, so they can be 
+    // read and written in separate steps
+    m_written.increase();
+    AtomicInt::Type queued = m_written.get() - m_read.get();
+    if (queued > m_high_water.get())
+      m_high_water.set(queued);
+    
+    return true;
+  }
+  
+  
+  bool RecordBuffer::end_cycle() throw() {
+    Queue::Node* n = m_free.pop_node();
+    if (!n)
+      return false;
+    n->data.size = 0;
+    m_events.push_node(n);
+    return true;
+  }
+  
+  
+  size_t RecordBuffer::read_events(EventBuffer& buf) {
+    size_t count = 0;
+    while (m_pending || (m_pending = m_events.pop_node())) {
+      Event const& e = m_pending->data;
+      if (e.size > 0) {
+	if (!buf.write_event(e.time, e.size, e.data))
+	  break;
+	m_read.increase();
+	++count;
+      }
+      m_free.push_node(m_pending);
+      m_pending = 0;
+    }
+    return count;
+  }
+  
+  
+  size_t RecordBuffer::get_capacity() const throw() {
+    return m_capacity;
+  }
+  
+  
+  size_t RecordBuffer::get_written() const throw() {
+    return m_written.get();
+  }
+  
+  
+  size_t RecordBuffer::get_dropped() const throw() {
+    return m_dropped.get();
+  }
+  
+  
+  size_t RecordBuffer::get_high_water() const throw() {
+    return m_high_water.get();
+  }
+
+
+}
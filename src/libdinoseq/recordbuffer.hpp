@@ -0,0 +1,170 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef RECORDBUFFER_HPP
+#define RECORDBUFFER_HPP
+
+#include <new>
+
+#include "atomicint.hpp"
+#include "eventbuffer.hpp"
+#include "nodequeue.hpp"
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  /** An EventBuffer that passes recorded MIDI events from the realtime 
+      thread to a non-realtime consumer thread. The realtime thread writes
+      timestamped events with write_event() like to any other EventBuffer,
+      and the consumer thread moves them on to another EventBuffer, e.g. a
+      CurveRecorder, with read_events().
+      
+      All nodes are allocated in the constructor and passed back and forth
+      between the two threads in two lock-free queues, one for events and 
+      one for free nodes, so write_event() never allocates. If the consumer
+      falls behind and there are no free nodes left the event is dropped 
+      and the drop counter is increased. Only MIDI messages of at most 3 
+      bytes are recorded, longer events are dropped as well.
+      
+      Since NodeQueue::pop_node() never returns the last node in a queue,
+      the realtime thread should call end_cycle() after writing the events
+      for a cycle. It pushes an empty marker event that makes all the real 
+      events before it readable.
+      
+      @code
+      // in the realtime thread
+      rec.write_event(time, 3, data);
+      rec.end_cycle();
+      
+      // in the consumer thread
+      rec.read_events(curve_recorder);
+      curve_recorder.flush();
+      @endcode
+      
+      @ingroup sequencing
+  */
+  class RecordBuffer : public EventBuffer {
+  public:
+    
+    /** The maximal size of a recorded event. */
+    static size_t const max_event_size = 3;
+    
+    /** Create a new buffer that can hold at least @c capacity events that
+	have not been read yet. This function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the nodes could not be allocated
+    */
+    RecordBuffer(size_t capacity = 4096) throw(std::bad_alloc);
+    
+    /** Destroy the buffer. No other threads may use it when this is 
+	called. */
+    ~RecordBuffer() throw();
+    
+    /** Queue an event for the consumer thread. Returns @c false and 
+	increases the drop counter if the event is too large or there are
+	no free nodes left. This function may only be called from one 
+	thread, and it is realtime safe. */
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data);
+    
+    /** Mark the end of a cycle, making all events written so far readable.
+	Returns @c false if there was no free node for the marker, in which
+	case the last event stays unreadable until end_cycle() has been 
+	called again. This should be called from the same thread as 
+	write_event(), and it is realtime safe. */
+    bool end_cycle() throw();
+    
+    /** Write all readable events to @c buf, in the order they were 
+	written to this buffer, and return the number of events written. If
+	@c buf is full the rest of the events are kept and will be written
+	in the next call. This function may only be called from one thread,
+	the consumer thread. It is realtime safe if @c buf.write_event() is.
+    */
+    size_t read_events(EventBuffer& buf);
+    
+    /** Return the number of events that can be queued. */
+    size_t get_capacity() const throw();
+    
+    /** Return the number of events that have been written to the 
+	buffer. */
+    size_t get_written() const throw();
+    
+    /** Return the number of events that have been dropped because they 
+	were too large or the buffer was full. */
+    size_t get_dropped() const throw();
+    
+    /** Return the largest number of events that have been waiting to be
+	read at the same time. If this gets close to get_capacity() the 
+	consumer thread is not reading often enough. */
+    size_t get_high_water() const throw();
+  
+  private:
+    
+    /** A recorded event. Events with size 0 are cycle markers. */
+    struct Event {
+      
+      /** The time of the event. */
+      SongTime time;
+      
+      /** The number of data bytes. */
+      unsigned char size;
+      
+      /** The data bytes. */
+      unsigned char data[max_event_size];
+    };
+    
+    /** The queue type used for the events and the free nodes. */
+    typedef NodeQueue<Event> Queue;
+    
+    
+    /** The number of events that can be queued. */
+    size_t m_capacity;
+    
+    /** The queue that the realtime thread pushes events on. */
+    Queue m_events;
+    
+    /** The queue that the consumer thread pushes read nodes on. */
+    Queue m_free;
+    
+    /** An event that has been popped but not yet accepted by the 
+	EventBuffer passed to read_events(). */
+    Queue::Node* m_pending;
+    
+    /** The number of events written, only changed by the realtime 
+	thread. */
+    AtomicInt m_written;
+    
+    /** The number of events read, only changed by the consumer thread. */
+    AtomicInt m_read;
+    
+    /** The number of dropped events. */
+    AtomicInt m_dropped;
+    
+    /** The largest number of unread events seen by the realtime 
+	thread. */
+    AtomicInt m_high_water;
+  
+  };
+
+
+}
+
+
+#endif
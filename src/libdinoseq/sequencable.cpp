@@ -16,12 +16,15 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#include <algorithm>
+
 #include "sequencable.hpp"
 
 
 namespace Dino {
   
   
+  using std::bad_alloc;
   using std::string;
   using std::unique_ptr;
   
@@ -39,6 +42,32 @@ namespace Dino {
   }
     
   
+  void Sequencable::ChangeFlag::set() throw() {
+    changed.set(1);
+    if (!pending || !queued.compare_and_set(0, 1))
+      return;
+    
+    // the reader reads the next pointer before it clears the queued flag,
+    // so nobody else is using it now
+    ChangeFlag* head;
+    do {
+      head = pending->get();
+      next.set_relaxed(head);
+    } while (!pending->compare_and_set(head, this));
+  }
+  
+  
+  Sequencable::ChangeFlag* 
+  Sequencable::ChangeFlag::take_pending(AtomicPtr<ChangeFlag>& list) 
+    throw() {
+    ChangeFlag* head;
+    do {
+      head = list.get();
+    } while (head && !list.compare_and_set(head, 0));
+    return head;
+  }
+  
+  
   /** Create a new Sequencable object with the given label and length. */
   Sequencable::Sequencable(string const label, SongTime const& length)
     : m_label(label),
@@ -57,6 +86,34 @@ namespace Dino {
   }
   
   
+  void Sequencable::copy_position(Position& dst, Position const& src) const {
+    update_position(dst, src.get_time());
+  }
+  
+  
+  void Sequencable::advance_position(Position& pos, 
+				     SongTime const& st) const {
+    update_position(pos, st);
+  }
+  
+  
+  SongTime Sequencable::get_next_event(Position const& pos) const {
+    return pos.get_time();
+  }
+  
+  
+  void Sequencable::add_change_flag(ChangeFlag& flag) const throw(bad_alloc) {
+    m_flags.push_back(&flag);
+  }
+  
+  
+  void Sequencable::remove_change_flag(ChangeFlag& flag) const throw() {
+    auto iter = std::find(m_flags.begin(), m_flags.end(), &flag);
+    if (iter != m_flags.end())
+      m_flags.erase(iter);
+  }
+  
+  
   string const& Sequencable::get_label() const throw() {
     return m_label;
   }
@@ -75,6 +132,18 @@ namespace Dino {
   void Sequencable::set_length(SongTime const& st) {
     m_length = st;
   }
+  
+  
+  void Sequencable::notify_changed() const throw() {
+    // the flags are set before the counters are increased, so a reader 
+    // that sees a new counter value also sees the flags
+    for (size_t i = 0; i < m_flags.size(); ++i)
+      m_flags[i]->set();
+    for (size_t i = 0; i < m_flags.size(); ++i) {
+      if (m_flags[i]->group)
+	m_flags[i]->group->increase();
+    }
+  }
 
 
 }
@@ -22,7 +22,10 @@
 #include <memory>
 #include <new>
 #include <string>
+#include <vector>
 
+#include "atomicint.hpp"
+#include "atomicptr.hpp"
 #include "songtime.hpp"
 
 
@@ -75,6 +78,56 @@ namespace Dino {
     };
     
     
+    /** A flag that is set every time the events of a Sequencable change, 
+	so a Sequencer knows that it has to ask for the next event time 
+	again. The flag is set by the thread that edits the Sequencable and
+	can be read and cleared by any other thread. 
+	
+	A flag can also be pushed onto a pending list when it is set, so the
+	reader can find the flags that have been set without looking at all
+	of them. The flag is only pushed if @c queued is 0, and the reader 
+	takes the whole list with take_pending() and sets @c queued to 0 
+	for every flag in it after reading its @c next pointer.
+	
+	@ingroup mididata */
+    struct ChangeFlag {
+      
+      /** Create a flag that is not set, with no group counter and no 
+	  pending list. */
+      ChangeFlag() throw() 
+	: changed(0), group(0), pending(0), next(0), queued(0) {}
+      
+      /** Set @c changed to 1 and push the flag onto the pending list if
+	  there is one and the flag is not in it already. This is lock-free
+	  and realtime safe, and any number of threads may push flags onto
+	  the same list. */
+      void set() throw();
+      
+      /** Remove all flags from the pending list @c list and return the 
+	  last one that was pushed, or 0 if the list was empty. The others
+	  follow through the @c next pointers. Only one thread may take 
+	  flags from a list. This is lock-free and realtime safe. */
+      static ChangeFlag* take_pending(AtomicPtr<ChangeFlag>& list) throw();
+      
+      /** Set to 1 when the Sequencable has changed. */
+      AtomicInt changed;
+      
+      /** A counter that is increased after @c changed has been set, or 0.
+	  Many flags can share the same counter, so the reader only has to
+	  look at the flags when it has changed. */
+      AtomicInt* group;
+      
+      /** The list that the flag is pushed onto when it is set, or 0. */
+      AtomicPtr<ChangeFlag>* pending;
+      
+      /** The flag that was pushed before this one in the pending list. */
+      AtomicPtr<ChangeFlag> next;
+      
+      /** 1 while the flag is in the pending list. */
+      AtomicInt queued;
+    };
+    
+    
     /** Create a new Sequencable object with the given label and length. */
     Sequencable(std::string const label, SongTime const& length = SongTime());
     
@@ -89,6 +142,21 @@ namespace Dino {
 	in an RT thread. */
     virtual void update_position(Position& pos, SongTime const& st) const;
     
+    /** Make @c dst a copy of @c src, which must be a Position created by
+	this object. This is used to jump to cached positions, e.g. the 
+	start of a loop, and subclasses should implement it in constant 
+	time if they can. The default implementation calls 
+	update_position(dst, src.get_time()). This function is realtime 
+	safe. */
+    virtual void copy_position(Position& dst, Position const& src) const;
+    
+    /** Move @c pos forward to @c st, as if sequence() had been called for
+	the range in between and found nothing to write. The Sequencer uses 
+	this for objects that it has skipped because of get_next_event(). 
+	The default implementation calls update_position(pos, st). This 
+	function is realtime safe. */
+    virtual void advance_position(Position& pos, SongTime const& st) const;
+    
     /** Write MIDI data from the Sequencable to an EventBuffer.
 	The function returns @c false if it was not able to write all events
 	in the range [@c pos, @c to) to @c buf. @c pos will be updated to point
@@ -97,6 +165,29 @@ namespace Dino {
     virtual bool sequence(Position& pos, SongTime const& to, 
 			  EventBuffer& buf) const = 0;
     
+    /** Return the earliest time, not before the time of @c pos, at which 
+	sequence() may write an event for @c pos, or SongTime::max_valid() 
+	if it will not write any more events. The answer only has to be 
+	valid until the position is moved or the Sequencable is changed, 
+	and it may be too early but never too late. The Sequencer uses this
+	to skip objects that have no events in the sequenced range. The 
+	default implementation returns the time of @c pos, which means 
+	that the object is sequenced every time. This function is realtime
+	safe. */
+    virtual SongTime get_next_event(Position const& pos) const;
+    
+    /** Set @c flag, and increase its group counter, every time the events
+	of this object change. This function is @b not realtime safe, and
+	it must be called from the thread that edits the object.
+	
+	@throw std::bad_alloc if the flag could not be stored
+    */
+    void add_change_flag(ChangeFlag& flag) const throw(std::bad_alloc);
+    
+    /** Stop setting @c flag when the events of this object change. This 
+	must be called from the thread that edits the object. */
+    void remove_change_flag(ChangeFlag& flag) const throw();
+    
     /** Returns the label of this Sequencable. */
     std::string const& get_label() const throw();
     
@@ -111,12 +202,21 @@ namespace Dino {
     /** Set the length of this Sequencable, if applicable. */
     void set_length(SongTime const& st);
     
+  protected:
+    
+    /** Set all change flags. Subclasses must call this after every change
+	that can move, add or remove events. */
+    void notify_changed() const throw();
+  
   private:
     
     std::string m_label;
     
     SongTime m_length;
     
+    /** The flags that are set when the events change. */
+    mutable std::vector<ChangeFlag*> m_flags;
+  
   };
 
 
@@ -17,10 +17,15 @@
 *****************************************************************************/
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
 #include <stdexcept>
 #include <string>
 
+#include "editlistener.hpp"
+#include "eventbuffer.hpp"
 #include "sequencer.hpp"
+#include "workerpool.hpp"
 
 
 namespace Dino {
@@ -28,12 +33,236 @@ namespace Dino {
 
   using std::invalid_argument;
   using std::move;
+  using std::runtime_error;
   using std::shared_ptr;
   using std::bad_alloc;
   using std::overflow_error;
+  using std::unique_ptr;
+  using std::vector;
+  
+  
+  struct Sequencer::StagedEvent {
+    
+    /** The time of the event. */
+    SongTime time;
+    
+    /** The index of the Sequencable that generated the event. */
+    unsigned index;
+    
+    /** The order in which the event was written by its worker. */
+    unsigned serial;
+    
+    /** The EventBuffer that the event should be written to. */
+    EventBuffer* target;
+    
+    /** The number of bytes in the event. */
+    size_t bytes;
+    
+    /** The event data, stored in the worker's byte buffer. */
+    unsigned char const* data;
+    
+  };
+  
+  
+  /** A Worker is an EventBuffer that stores the events in preallocated 
+      arrays so they can be merged later. */
+  struct Sequencer::Worker : EventBuffer {
+    
+    Worker() throw() 
+      : capacity(0), byte_capacity(0), 
+	events_used(0), bytes_used(0), serial(0), 
+	index(0), target(0) { 
+    }
+    
+    /** Allocate room for @c n events with @c b bytes of data in total. */
+    void allocate(size_t n, size_t b) {
+      events.reset(new StagedEvent[n]);
+      bytes.reset(new unsigned char[b]);
+      capacity = n;
+      byte_capacity = b;
+    }
+    
+    /** Forget all staged events. */
+    void clear() throw() {
+      events_used = 0;
+      bytes_used = 0;
+      serial = 0;
+    }
+    
+    bool write_event(SongTime const& st, size_t n, unsigned char const* d) {
+      if (events_used == capacity || n > byte_capacity - bytes_used)
+	return false;
+      StagedEvent& e = events[events_used++];
+      e.time = st;
+      e.index = index;
+      e.serial = serial++;
+      e.target = target;
+      e.bytes = n;
+      std::memcpy(&bytes[bytes_used], d, n);
+      e.data = &bytes[bytes_used];
+      bytes_used += n;
+      return true;
+    }
+    
+    /** The staged events. */
+    unique_ptr<StagedEvent[]> events;
+    
+    /** The data bytes of the staged events. */
+    unique_ptr<unsigned char[]> bytes;
+    
+    /** The number of elements in @c events. */
+    size_t capacity;
+    
+    /** The number of elements in @c bytes. */
+    size_t byte_capacity;
+    
+    /** The number of used elements in @c events. */
+    size_t events_used;
+    
+    /** The number of used elements in @c bytes. */
+    size_t bytes_used;
+    
+    /** The serial number of the next event. */
+    unsigned serial;
+    
+    /** The index of the Sequencable that is currently being sequenced. */
+    unsigned index;
+    
+    /** The EventBuffer of the Sequencable that is currently being 
+	sequenced. */
+    EventBuffer* target;
+    
+  };
+  
+  
+  namespace {
+    
+    /** Order staged events by time, then by Sequencable, then by the order
+	they were written in. */
+    struct StagedEventLess {
+      template <typename E>
+      bool operator()(E const* a, E const* b) const throw() {
+	if (a->time != b->time)
+	  return a->time < b->time;
+	if (a->index != b->index)
+	  return a->index < b->index;
+	return a->serial < b->serial;
+      }
+    };
+    
+    /** Order heap entries by their next event times, then by the order
+	they were added in. */
+    template <typename S>
+    inline bool earlier(S const* a, S const* b) throw() {
+      if (a->next != b->next)
+	return a->next < b->next;
+      return a->order < b->order;
+    }
+    
+    /** Meld the pairing heaps @c a and @c b and return the root of the 
+	result. Either of them may be 0. */
+    template <typename S>
+    S* heap_meld(S* a, S* b) throw() {
+      if (!a)
+	return b;
+      if (!b)
+	return a;
+      if (earlier(b, a))
+	std::swap(a, b);
+      b->sibling = a->child;
+      if (b->sibling)
+	b->sibling->prev = b;
+      b->prev = a;
+      a->child = b;
+      return a;
+    }
+    
+    /** Remove the root @c h from its pairing heap and return the root of
+	the remaining heap. This melds the children in pairs from the left
+	and then melds the pairs from the right. */
+    template <typename S>
+    S* heap_pop(S* h) throw() {
+      S* pairs = 0;
+      S* c = h->child;
+      while (c) {
+	S* a = c;
+	S* b = a->sibling;
+	c = b ? b->sibling : 0;
+	a->sibling = 0;
+	a->prev = 0;
+	if (b) {
+	  b->sibling = 0;
+	  b->prev = 0;
+	}
+	S* m = heap_meld(a, b);
+	m->sibling = pairs;
+	pairs = m;
+      }
+      S* result = 0;
+      while (pairs) {
+	S* next = pairs->sibling;
+	pairs->sibling = 0;
+	pairs->prev = 0;
+	result = heap_meld(result, pairs);
+	pairs = next;
+      }
+      h->child = 0;
+      return result;
+    }
+    
+    /** Remove @c x from the pairing heap with the root @c h and return the
+	root of the remaining heap. */
+    template <typename S>
+    S* heap_remove(S* h, S* x) throw() {
+      if (x == h)
+	return heap_pop(h);
+      if (x->prev->child == x)
+	x->prev->child = x->sibling;
+      else
+	x->prev->sibling = x->sibling;
+      if (x->sibling)
+	x->sibling->prev = x->prev;
+      x->sibling = 0;
+      x->prev = 0;
+      return heap_meld(h, heap_pop(x));
+    }
+  
+  }
   
 
-  Sequencer::Sequencer() {
+  Sequencer::Sequencer() 
+    : m_pending(0),
+      m_dead(0),
+      m_retired(m_sqbls.get_domain()),
+      m_dropped(0),
+      m_relocate(false),
+      m_profiled(0),
+      m_changes(0),
+      m_seen_changes(0),
+      m_removals(0),
+      m_seen_removals(0),
+      m_heap(0),
+      m_heap_valid(false),
+      m_next_order(0),
+      m_listener(0),
+      m_profiling(0),
+      m_profiled_runs(0),
+      m_budget(0) {
+  }
+  
+  
+  Sequencer::~Sequencer() {
+    // stop the threads before the buffers they write to go away
+    m_pool.reset();
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter) {
+      iter->seq->remove_change_flag(*iter->flag);
+      delete iter->flag;
+    }
+    while (m_dead) {
+      Slot* next = m_dead->link;
+      delete m_dead;
+      m_dead = next;
+    }
   }
   
   
@@ -46,7 +275,43 @@ namespace Dino {
     sd.seq = sqbl;
     sd.pos = sqbl->create_position(SongTime());
     sd.buf = shared_ptr<EventBuffer>();
-    return Iterator(m_sqbls.insert(m_sqbls.end(), move(sd)));
+    for (size_t i = 0; i < m_cues.size(); ++i)
+      sd.cues.push_back(sqbl->create_position(m_cues[i]));
+    if (m_profiling.get())
+      sd.hist.reset(new LatencyHistogram);
+    sd.order = m_next_order++;
+    
+    // the flag is registered before the object is inserted, so nothing 
+    // has to be undone in the list if that fails
+    unique_ptr<Slot> slot(new Slot);
+    slot->group = &m_changes;
+    slot->pending = &m_pending;
+    sqbl->add_change_flag(*slot);
+    
+    // the realtime thread can see the node as soon as it is inserted, so
+    // it must already have a valid flag pointer
+    sd.flag = slot.get();
+    Iterator iter;
+    try {
+      iter = Iterator(m_sqbls.insert(m_sqbls.end(), move(sd)));
+    }
+    catch (...) {
+      sqbl->remove_change_flag(*slot);
+      throw;
+    }
+    
+    // the flag is set so run() asks for the next event time and adds the
+    // new object to the heap
+    SeqData& data = *iter.base();
+    slot.release();
+    data.flag->data.set(&data);
+    data.flag->set();
+    m_changes.increase();
+    collect_slots();
+    
+    if (m_listener)
+      m_listener->sequencable_added(*sqbl);
+    return iter;
   }
   
   
@@ -100,34 +365,411 @@ namespace Dino {
   }
   
   
-  void Sequencer::remove_sequencable(Iterator iter) throw(overflow_error) {
+  void Sequencer::remove_sequencable(Iterator iter) throw() {
+    shared_ptr<Sequencable const> sqbl = *iter;
+    Slot* slot = iter.base()->flag;
+    sqbl->remove_change_flag(*slot);
+    slot->data.set(0);
+    
+    // the counters must be increased before the node is erased, run() 
+    // reads them after the quiescent point so it will not use the old heap
+    // once the node can be deallocated
+    m_removals.increase();
+    m_changes.increase();
     m_sqbls.erase(iter.base());
+    
+    // the slot may still be in the pending list, so it is kept until 
+    // run() has taken it
+    slot->link = m_dead;
+    m_dead = slot;
+    collect_slots();
+    if (m_listener)
+      m_listener->sequencable_removed(*sqbl);
   }
   
   
   void Sequencer::set_event_buffer(Iterator iter, 
 				   shared_ptr<EventBuffer> buf) throw() {
     iter.base()->buf = buf;
+    iter.base()->flag->set();
+    m_changes.increase();
+  }
+  
+  
+  void Sequencer::set_workers(unsigned workers, size_t events_per_worker,
+			      size_t bytes_per_worker, int rt_priority) 
+    throw(bad_alloc, runtime_error) {
+    
+    // the workers don't keep the event heap up to date
+    m_heap_valid = false;
+    
+    if (workers <= 1) {
+      m_pool.reset();
+      m_workers.reset();
+      m_merge.reset();
+      m_rejected.reset();
+      return;
+    }
+    
+    // allocate everything before we replace the old pool
+    unique_ptr<Worker[]> w(new Worker[workers]);
+    for (unsigned i = 0; i < workers; ++i)
+      w[i].allocate(events_per_worker, bytes_per_worker);
+    unique_ptr<StagedEvent const*[]> 
+      merge(new StagedEvent const*[workers * events_per_worker]);
+    unique_ptr<EventBuffer*[]> 
+      rejected(new EventBuffer*[workers * events_per_worker]);
+    unique_ptr<WorkerPool> pool(new WorkerPool(workers, rt_priority));
+    
+    m_pool = move(pool);
+    m_workers = move(w);
+    m_merge = move(merge);
+    m_rejected = move(rejected);
+  }
+  
+  
+  unsigned Sequencer::get_workers() const throw() {
+    return m_pool ? m_pool->get_workers() : 1;
+  }
+  
+  
+  size_t Sequencer::get_dropped() const throw() {
+    return m_dropped.get();
+  }
+  
+  
+  void Sequencer::set_profiling(bool enable, uint64_t budget) 
+    throw(bad_alloc) {
+    
+    // the histograms may be in use in run(), so they are only cleared and
+    // never replaced. The missing ones are allocated before the flag is 
+    // set, and run() does not touch them until it sees the flag.
+    AtomicInt::Type max = std::numeric_limits<AtomicInt::Type>::max();
+    m_budget.set(budget > uint64_t(max) ? max : AtomicInt::Type(budget));
+    if (!enable) {
+      m_profiling.set(0);
+      return;
+    }
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter) {
+      if (iter->hist)
+	iter->hist->reset();
+      else
+	iter->hist.reset(new LatencyHistogram);
+    }
+    m_run_hist.reset();
+    m_profiling.set(1);
+  }
+  
+  
+  LatencyHistogram const* 
+  Sequencer::get_histogram(ConstIterator iter) const throw() {
+    return m_profiling.get() ? iter.base()->hist.get() : 0;
+  }
+  
+  
+  LatencyHistogram const* Sequencer::get_run_histogram() const throw() {
+    return m_profiling.get() ? &m_run_hist : 0;
+  }
+  
+  
+  EditListener* Sequencer::get_edit_listener() const throw() {
+    return m_listener;
+  }
+  
+  
+  void Sequencer::set_edit_listener(EditListener* listener) throw() {
+    m_listener = listener;
+  }
+  
+  
+  void Sequencer::set_cues(vector<SongTime> const& cues) throw(bad_alloc) {
+    
+    // create all positions before we replace any of the old ones
+    vector<vector<unique_ptr<Sequencable::Position>>> positions;
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter) {
+      positions.push_back(vector<unique_ptr<Sequencable::Position>>());
+      for (size_t i = 0; i < cues.size(); ++i)
+	positions.back().push_back(iter->seq->create_position(cues[i]));
+    }
+    vector<SongTime> new_cues(cues);
+    
+    size_t j = 0;
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter, ++j)
+      iter->cues.swap(positions[j]);
+    m_cues.swap(new_cues);
+  }
+  
+  
+  vector<SongTime> const& Sequencer::get_cues() const throw() {
+    return m_cues;
   }
   
   
   void Sequencer::run(SongTime const& from, SongTime const& to) {
     
+    // the profiled calls are numbered so profile_run() can tell which 
+    // objects were sequenced in this one
+    unsigned profiled = 0;
+    uint64_t start = 0;
+    if (m_profiling.get()) {
+      if (++m_profiled_runs == 0)
+	++m_profiled_runs;
+      profiled = m_profiled_runs;
+      start = LatencyHistogram::now();
+    }
+    
     // let the list deallocate unused nodes we're no longer touching
     m_sqbls.reader_holds_no_iterator();
     
-    // if the start time isn't the same as last call's end time, update
-    if (m_next_start != from) {
-      for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter)
-	iter->seq->update_position(*iter->pos, from);
+    // if we have worker threads, let them do the job. They look at all 
+    // flags, so the pending list is only emptied.
+    if (m_pool) {
+      take_pending();
+      m_from = from;
+      m_to = to;
+      m_relocate = (m_next_start != from);
+      m_profiled = profiled;
+      m_pool->run(&Sequencer::run_worker, this);
+      merge_staged_events();
+      m_heap_valid = false;
     }
     
-    // sequence all the objects
-    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter)
-      iter->seq->sequence(*iter->pos, to, *iter->buf);
+    else {
+      
+      // if the start time isn't the same as last call's end time, update
+      bool relocated = (m_next_start != from);
+      if (relocated) {
+	for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter)
+	  relocate(*iter, from);
+      }
+      schedule(from, relocated);
+      
+      // sequence the objects that have events in the range, they are kept
+      // out of the heap until the end so an object that could not write
+      // all its events is only sequenced once
+      SeqData* done = 0;
+      while (m_heap && m_heap->next < to) {
+	SeqData* sd = m_heap;
+	m_heap = heap_pop(sd);
+	sequence(*sd, to, *sd->buf, profiled);
+	update_next(*sd);
+	sd->sibling = done;
+	done = sd;
+      }
+      while (done) {
+	SeqData* next = done->sibling;
+	done->sibling = 0;
+	m_heap = heap_meld(m_heap, done);
+	done = next;
+      }
+    }
     
     m_next_start = to;
+    if (profiled)
+      profile_run(LatencyHistogram::now() - start);
+  }
+  
+  
+  void Sequencer::run_worker(void* data, unsigned worker) {
+    Sequencer& me = *static_cast<Sequencer*>(data);
+    Worker& w = me.m_workers[worker];
+    unsigned workers = me.m_pool->get_workers();
+    w.clear();
+    
+    // the Sequencables are dealt out round-robin so neighbouring heavy 
+    // objects end up in different threads
+    unsigned index = 0;
+    for (auto iter = me.m_sqbls.begin(); iter != me.m_sqbls.end(); 
+	 ++iter, ++index) {
+      if (index % workers != worker)
+	continue;
+      if (me.m_relocate)
+	relocate(*iter, me.m_from);
+      if (me.m_relocate || iter->flag->changed.get())
+	refresh(*iter, me.m_from);
+      if (!iter->buf || !(iter->next < me.m_to))
+	continue;
+      w.index = index;
+      w.target = iter->buf.get();
+      sequence(*iter, me.m_to, w, me.m_profiled);
+      update_next(*iter);
+    }
+  }
+  
+  
+  void Sequencer::merge_staged_events() {
+    size_t n = 0;
+    for (unsigned i = 0; i < m_pool->get_workers(); ++i) {
+      Worker& w = m_workers[i];
+      for (size_t j = 0; j < w.events_used; ++j)
+	m_merge[n++] = &w.events[j];
+    }
+    
+    // std::sort() does not allocate any memory, so this is realtime safe
+    std::sort(&m_merge[0], &m_merge[0] + n, StagedEventLess());
+    
+    // the positions have already been moved past the staged events, so the
+    // events that a buffer rejects are lost. Later events for that buffer
+    // are dropped too, so it never gets them with a gap in between.
+    EventBuffer** rejected = &m_rejected[0];
+    EventBuffer** rejected_end = rejected;
+    for (size_t i = 0; i < n; ++i) {
+      StagedEvent const& e = *m_merge[i];
+      if (std::find(rejected, rejected_end, e.target) != rejected_end)
+	m_dropped.increase();
+      else if (!e.target->write_event(e.time, e.bytes, e.data)) {
+	*rejected_end++ = e.target;
+	m_dropped.increase();
+      }
+    }
+  }
+  
+  
+  void Sequencer::sequence(SeqData& sd, SongTime const& to, 
+			   EventBuffer& buf, unsigned profiled) {
+    if (!profiled) {
+      sd.seq->sequence(*sd.pos, to, buf);
+      return;
+    }
+    uint64_t start = LatencyHistogram::now();
+    sd.seq->sequence(*sd.pos, to, buf);
+    sd.cycles = LatencyHistogram::now() - start;
+    sd.profiled = profiled;
+    sd.hist->record(sd.cycles);
+  }
+  
+  
+  void Sequencer::profile_run(uint64_t cycles) throw() {
+    m_run_hist.record(cycles);
+    uint64_t budget = m_budget.get();
+    if (budget == 0 || cycles <= budget)
+      return;
+    
+    // this was an xrun, blame the Sequencable that took the longest time 
+    // in this call, the ones that were skipped have older times
+    m_run_hist.add_xrun();
+    SeqData* worst = 0;
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter) {
+      if (iter->profiled == m_profiled_runs && 
+	  (!worst || iter->cycles > worst->cycles))
+	worst = &*iter;
+    }
+    if (worst)
+      worst->hist->add_xrun();
   }
   
   
+  void Sequencer::relocate(SeqData& sd, SongTime const& st) throw() {
+    for (size_t i = 0; i < sd.cues.size(); ++i) {
+      if (sd.cues[i]->get_time() == st) {
+	sd.seq->copy_position(*sd.pos, *sd.cues[i]);
+	return;
+      }
+    }
+    sd.seq->update_position(*sd.pos, st);
+  }
+  
+  
+  Sequencer::Slot* Sequencer::take_pending() throw() {
+    
+    // the next pointer is read before the slot is marked as not queued, 
+    // since an edit may push it again after that
+    typedef Sequencable::ChangeFlag ChangeFlag;
+    ChangeFlag* f = ChangeFlag::take_pending(m_pending);
+    Slot* first = 0;
+    Slot* last = 0;
+    while (f) {
+      Slot* slot = static_cast<Slot*>(f);
+      f = f->next.get();
+      slot->taken = 0;
+      slot->queued.set(0);
+      if (last)
+	last->taken = slot;
+      else
+	first = slot;
+      last = slot;
+    }
+    return first;
+  }
+  
+  
+  void Sequencer::collect_slots() throw() {
+    
+    // a removed slot can't be pushed again, so once it is not queued 
+    // run() only uses it until the next quiescent point
+    Slot** link = &m_dead;
+    while (*link) {
+      Slot* slot = *link;
+      if (slot->queued.get()) {
+	link = &slot->link;
+	continue;
+      }
+      *link = slot->link;
+      m_retired.retire(slot);
+    }
+    m_retired.collect();
+  }
+  
+  
+  void Sequencer::update_next(SeqData& sd) throw() {
+    sd.next = sd.buf ? sd.seq->get_next_event(*sd.pos) : SongTime::max_valid();
+  }
+  
+  
+  void Sequencer::refresh(SeqData& sd, SongTime const& from) throw() {
+    
+    // the flag is cleared before the next event time is computed, so an 
+    // edit that happens in between will set it again
+    sd.flag->changed.set(0);
+    
+    // the position is not updated while there are no events, and an edit
+    // may have added events that are already behind it
+    if (sd.pos->get_time() < from)
+      sd.seq->advance_position(*sd.pos, from);
+    update_next(sd);
+  }
+  
+  
+  void Sequencer::schedule(SongTime const& from, bool all) throw() {
+    // m_removals is increased before m_changes, so if we see the new 
+    // change count we also see the removal
+    AtomicInt::Type changes = m_changes.get();
+    if (!all && m_heap_valid && changes == m_seen_changes)
+      return;
+    m_seen_changes = changes;
+    AtomicInt::Type removals = m_removals.get();
+    Slot* pending = take_pending();
+    
+    // if nothing has been removed, only the objects in the pending list
+    // are taken out of the heap and put back with their new times. Added
+    // objects are not in the heap yet.
+    if (!all && m_heap_valid && removals == m_seen_removals) {
+      for ( ; pending; pending = pending->taken) {
+	SeqData* sd = pending->data.get();
+	if (!sd)
+	  continue;
+	if (sd->prev || m_heap == sd)
+	  m_heap = heap_remove(m_heap, sd);
+	refresh(*sd, from);
+	m_heap = heap_meld(m_heap, sd);
+      }
+      return;
+    }
+    m_seen_removals = removals;
+    
+    all = all || !m_heap_valid;
+    m_heap = 0;
+    for (auto iter = m_sqbls.begin(); iter != m_sqbls.end(); ++iter) {
+      SeqData& sd = *iter;
+      if (all || sd.flag->changed.get())
+	refresh(sd, from);
+      sd.child = 0;
+      sd.sibling = 0;
+      sd.prev = 0;
+      m_heap = heap_meld(m_heap, &sd);
+    }
+    m_heap_valid = true;
+  }
+
+
 }
@@ -22,9 +22,14 @@
 #include <memory>
 #include <stdexcept>
 #include <utility>
+#include <vector>
 
 #include <boost/iterator/transform_iterator.hpp>
 
+#include "atomicint.hpp"
+#include "atomicptr.hpp"
+#include "epochdomain.hpp"
+#include "latencyhistogram.hpp"
 #include "linkedlist.hpp"
 #include "sequencable.hpp"
 #include "songtime.hpp"
@@ -33,22 +38,94 @@
 namespace Dino {
   
   
+  class EditListener;
   class EventBuffer;
+  class WorkerPool;
   
   
   /** This is the sequencer engine. It holds references to a collection
       of Sequencable objects and EventBuffer objects, and sequences data from
-      the former into the latter. */
+      the former into the latter. 
+      
+      By default all Sequencables are sequenced in the thread calling run(),
+      but the work can be spread over several threads using set_workers().
+      
+      Every Sequencable is asked for the time of its next event with
+      Sequencable::get_next_event(), and run() only calls 
+      Sequencable::sequence() for the ones that have an event before the
+      end of the range. The Sequencables tell the Sequencer when they have
+      been edited using a Sequencable::ChangeFlag, so the times are only
+      asked for again when something has changed.
+      
+      @ingroup seqengine */
   class Sequencer {
     
+    struct SeqData;
+    
+    /** The ChangeFlag of a Sequencable in the list. It is allocated apart
+	from its SeqData, since it may still be in the pending list after 
+	the Sequencable has been removed. */
+    struct Slot : Sequencable::ChangeFlag {
+      Slot() throw() : data(0), taken(0), link(0) {}
+      
+      /** The SeqData that the flag belongs to, or 0 when it has been 
+	  removed. */
+      AtomicPtr<SeqData> data;
+      
+      /** Links the slots that run() has taken from the pending list. */
+      Slot* taken;
+      
+      /** Links removed slots that are waiting to be deallocated. */
+      Slot* link;
+    };
+    
+    /** The EpochLimbo policy for removed slots. */
+    struct SlotPolicy {
+      Slot*& link(Slot* s) throw() { return s->link; }
+      void free(Slot* s) throw() { delete s; }
+    };
+    
     struct SeqData {
-      SeqData() throw() {}
+      SeqData() throw() 
+	: profiled(0), cycles(0), order(0), flag(0), 
+	  child(0), sibling(0), prev(0) {}
       SeqData(SeqData&& sd) throw()
-	: seq(sd.seq), pos(std::move(sd.pos)), buf(sd.buf) {}
+	: seq(sd.seq), pos(std::move(sd.pos)), buf(sd.buf), 
+	  cues(std::move(sd.cues)), hist(std::move(sd.hist)), 
+	  profiled(sd.profiled), cycles(sd.cycles), next(sd.next), 
+	  order(sd.order), flag(sd.flag), child(0), sibling(0), prev(0) {}
       SeqData(SeqData const&) = delete;
       std::shared_ptr<Sequencable const> seq;
       std::unique_ptr<Sequencable::Position> pos;
       std::shared_ptr<EventBuffer> buf;
+      std::vector<std::unique_ptr<Sequencable::Position>> cues;
+      std::unique_ptr<LatencyHistogram> hist;
+      
+      /** The number of the last profiled run() call that sequenced this
+	  object, or 0. */
+      unsigned profiled;
+      
+      /** The time that Sequencable::sequence() took in that call. */
+      uint64_t cycles;
+      
+      /** The time of the next event, or SongTime::max_valid(). */
+      SongTime next;
+      
+      /** Breaks ties between objects with the same next event time. */
+      unsigned order;
+      
+      /** Set by the Sequencable when it has changed. */
+      Slot* flag;
+      
+      /** The first child in the event heap. */
+      SeqData* child;
+      
+      /** The next sibling in the event heap. */
+      SeqData* sibling;
+      
+      /** The previous sibling in the event heap, or the parent if this is
+	  the first child, or 0 if this is the root or not in the heap. */
+      SeqData* prev;
     };
     
     struct GetSqbl {
@@ -73,6 +150,9 @@ namespace Dino {
   ConstIterator;
     
     Sequencer();
+    
+    /** Destroy the sequencer and stop any worker threads. */
+    ~Sequencer();
 
     /** Return the event buffer that the Sequencable that @c iter refers to 
 	will be sequenced to. */
@@ -116,22 +196,247 @@ namespace Dino {
     
     /** Remove the reference to the Sequencable that @c iter refers to from
 	the list, which means that it will not be sequenced any more. */
-    void remove_sequencable(Iterator iter) throw(std::overflow_error);
+    void remove_sequencable(Iterator iter) throw();
     
     /** Set the buffer that the Sequencable that @c iter refers to will be
-	sequenced to. */
+	sequenced to. The buffer pointer is not published atomically, so 
+	this must not be called while run() is active. */
     void set_event_buffer(Iterator iter, std::shared_ptr<EventBuffer> instr)
       throw();
     
+    /** Sequence the Sequencables using @c workers threads, counting the
+	thread that calls run(). The Sequencables are divided between the
+	workers, each worker sequences its share into a private buffer that
+	can hold @c events_per_worker events with @c bytes_per_worker bytes
+	of event data in total, and the events are then merged into the 
+	real EventBuffers ordered by time, with ties broken by the order of
+	the Sequencables in the list. A Sequencable whose events do not fit
+	in its worker's buffer is treated as if its EventBuffer were full.
+	If @c workers is 1 or less everything is sequenced directly in the
+	calling thread, which is the default. If @c rt_priority is larger 
+	than 0 the worker threads will try to use @c SCHED_FIFO scheduling 
+	with that priority.
+	
+	All threads and buffers are allocated here, so run() is still
+	realtime safe. This function is @b not realtime safe and must not
+	be called while another thread is in run().
+	
+	@throw std::bad_alloc if the buffers could not be allocated
+	@throw std::runtime_error if the worker threads could not be created
+    */
+    void set_workers(unsigned workers, size_t events_per_worker = 4096,
+		     size_t bytes_per_worker = 65536, int rt_priority = 0)
+      throw(std::bad_alloc, std::runtime_error);
+    
+    /** Return the number of threads used by run(), including the calling
+	thread. */
+    unsigned get_workers() const throw();
+    
+    /** Return the number of events that were sequenced by the worker 
+	threads but were rejected by their EventBuffers when they were 
+	merged. Once an EventBuffer rejects an event, the rest of its events
+	from the same run() call are dropped too so the events it gets 
+	are always in order. This can be called while another thread is in
+	run(). */
+    size_t get_dropped() const throw();
+    
+    /** Turn the latency profiling on or off. When profiling is on, every
+	call to Sequencable::sequence() in run() is timed and the times are
+	recorded in a LatencyHistogram for every Sequencable, and the time
+	of the whole run() call is recorded in another one. If @c budget is
+	larger than 0, every run() call that takes more than @c budget 
+	LatencyHistogram::now() units is counted as an xrun, and the
+	Sequencable that took the longest time in that call is blamed for
+	it. Budgets that don't fit in an AtomicInt are clamped.
+	
+	Turning profiling on clears all histograms. A Sequencable gets its
+	histogram the first time profiling is turned on while it is in the
+	list, or when it is added while profiling is on, and it is not freed
+	until the Sequencable is removed. Histograms are never replaced, so
+	this can be called while another thread is in run(). Times that are
+	recorded while the histograms are cleared may be lost.
+	
+	@throw std::bad_alloc if the histograms could not be allocated, 
+			      profiling is not turned on then
+    */
+    void set_profiling(bool enable, uint64_t budget = 0) 
+      throw(std::bad_alloc);
+    
+    /** Return the latency histogram for the Sequencable that @c iter 
+	refers to, or 0 if profiling is off. The histogram can be read 
+	while another thread is in run(). */
+    LatencyHistogram const* get_histogram(ConstIterator iter) const throw();
+    
+    /** Return the latency histogram for the run() calls, or 0 if profiling
+	is off. */
+    LatencyHistogram const* get_run_histogram() const throw();
+    
+    /** Return the EditListener that is told when Sequencables are added
+	and removed, or 0 if there is none. */
+    EditListener* get_edit_listener() const throw();
+    
+    /** Set the EditListener that is told when Sequencables are added and
+	removed. Use 0 to remove the current one. */
+    void set_edit_listener(EditListener* listener) throw();
+    
+    /** Set the cue times, the times that run() is expected to jump to 
+	often, such as the start of a loop. A Position at every cue is kept
+	for every Sequencable, so when run() jumps to a cue it only copies 
+	those instead of updating the positions with a search. This 
+	function is @b not realtime safe and must not be called while 
+	another thread is in run().
+	
+	@throw std::bad_alloc if the positions could not be allocated
+    */
+    void set_cues(std::vector<SongTime> const& cues) throw(std::bad_alloc);
+    
+    /** Return the cue times. */
+    std::vector<SongTime> const& get_cues() const throw();
+    
     /** This is the function that does the actual sequencing. */
     void run(SongTime const& from, SongTime const& to);
     
   private:
     
+    /** Per-worker state used when sequencing in parallel. */
+    struct Worker;
+    
+    /** An event sequenced by a worker that has not yet been written to its
+	target EventBuffer. */
+    struct StagedEvent;
+    
+    /** Sequence the share of worker @c worker. @c data is the Sequencer. */
+    static void run_worker(void* data, unsigned worker);
+    
+    /** Write all events staged by the workers to their EventBuffers. */
+    void merge_staged_events();
+    
+    /** Call Sequencable::sequence() for @c sd. If @c profiled is not 0 the
+	call is timed, and the time is recorded in the histogram of @c sd
+	and stored in @c sd together with @c profiled. */
+    static void sequence(SeqData& sd, SongTime const& to, EventBuffer& buf,
+			 unsigned profiled);
+    
+    /** Record the time of a run() call that took @c cycles cycles, and 
+	blame the slowest Sequencable that was sequenced in that call if it
+	was an xrun. */
+    void profile_run(uint64_t cycles) throw();
+    
+    /** Move the position of @c sd to @c st, by copying a cue position if
+	there is one at that time. */
+    static void relocate(SeqData& sd, SongTime const& st) throw();
+    
+    /** Take all slots from the pending list and mark them as not queued,
+	so they are pushed again if they change. Return the first one, the
+	others follow through their @c taken pointers. */
+    Slot* take_pending() throw();
+    
+    /** Move the removed slots that are no longer in the pending list to 
+	the limbo, and deallocate the ones that no reader can be using. */
+    void collect_slots() throw();
+    
+    /** Ask the Sequencable of @c sd for the time of its next event. */
+    static void update_next(SeqData& sd) throw();
+    
+    /** Clear the ChangeFlag of @c sd, advance its position to @c from if
+	it is behind it and ask for the next event time again. */
+    static void refresh(SeqData& sd, SongTime const& from) throw();
+    
+    /** Update the event heap if any Sequencable has changed. The objects 
+	in the pending list are refreshed and moved to their new places in 
+	the heap, so this does not depend on the number of objects that 
+	have not changed. If a Sequencable has been removed, the heap has 
+	not been used in the last run() call, or @c all is @c true, all 
+	objects are refreshed and the heap is rebuilt. */
+    void schedule(SongTime const& from, bool all) throw();
+    
     LinkedList<SeqData> m_sqbls;
     
+    /** The slots of the Sequencables that have changed since run() last 
+	took them. */
+    AtomicPtr<Sequencable::ChangeFlag> m_pending;
+    
+    /** The slots of removed Sequencables that are still in the pending
+	list, linked through Slot::link. */
+    Slot* m_dead;
+    
+    /** The slots of removed Sequencables that run() may still be using. 
+	It uses the EpochDomain of m_sqbls. */
+    EpochLimbo<Slot, SlotPolicy> m_retired;
+    
     SongTime m_next_start;
     
+    /** The worker threads, or 0 if everything is done in run(). */
+    std::unique_ptr<WorkerPool> m_pool;
+    
+    /** The worker states, one for each worker in m_pool. */
+    std::unique_ptr<Worker[]> m_workers;
+    
+    /** Room for pointers to all staged events, used when merging. */
+    std::unique_ptr<StagedEvent const*[]> m_merge;
+    
+    /** Room for the EventBuffers that have rejected an event, used when 
+	merging. */
+    std::unique_ptr<EventBuffer*[]> m_rejected;
+    
+    /** The number of staged events that could not be written. */
+    AtomicInt m_dropped;
+    
+    /** The start of the range that is being sequenced by the workers. */
+    SongTime m_from;
+    
+    /** The end of the range that is being sequenced by the workers. */
+    SongTime m_to;
+    
+    /** True if the workers need to update the positions before 
+	sequencing. */
+    bool m_relocate;
+    
+    /** The number of the current run() call if it is profiled, or 0. The
+	workers pass it to sequence(). */
+    unsigned m_profiled;
+    
+    /** The cue times. */
+    std::vector<SongTime> m_cues;
+    
+    /** Increased every time a Sequencable sets its ChangeFlag. */
+    AtomicInt m_changes;
+    
+    /** The value of m_changes when the event heap was updated. */
+    AtomicInt::Type m_seen_changes;
+    
+    /** Increased every time a Sequencable is removed. The removed object
+	may still be in the event heap, so it has to be rebuilt. */
+    AtomicInt m_removals;
+    
+    /** The value of m_removals when the event heap was built. */
+    AtomicInt::Type m_seen_removals;
+    
+    /** A pairing heap of all objects ordered by their next event times. It
+	is only used by run() when there are no worker threads. */
+    SeqData* m_heap;
+    
+    /** True if m_heap is up to date. */
+    bool m_heap_valid;
+    
+    /** The order that the next added object will get. */
+    unsigned m_next_order;
+    
+    /** The EditListener, or 0. */
+    EditListener* m_listener;
+    
+    /** The histogram for the run() calls. */
+    LatencyHistogram m_run_hist;
+    
+    /** 1 if run() should time the calls, 0 otherwise. */
+    AtomicInt m_profiling;
+    
+    /** The number of the last profiled run() call. */
+    unsigned m_profiled_runs;
+    
+    /** The time that a run() call can take before it is an xrun, or 0. */
+    AtomicInt m_budget;
+  
   };
 
 
@@ -0,0 +1,264 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "eventbuffer.hpp"
+#include "smfreader.hpp"
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::out_of_range;
+  using std::runtime_error;
+  using std::string;
+  
+  
+  namespace {
+    
+    /** The number of decoded bytes between the calls to release(). */
+    size_t const release_interval = 1 << 22;
+    
+    /** Read a big-endian integer of @c bytes bytes. */
+    inline uint32_t read_be(unsigned char const* p, unsigned bytes) throw() {
+      uint32_t value = 0;
+      for (unsigned i = 0; i < bytes; ++i)
+	value = (value << 8) | p[i];
+      return value;
+    }
+    
+    /** Read a variable length quantity at @c p, not reading past @c end.
+	Returns @c false if the quantity is truncated or too long. */
+    inline bool read_vlq(unsigned char const*& p, unsigned char const* end,
+			 uint32_t& value) throw() {
+      value = 0;
+      for (unsigned i = 0; i < 4 && p != end; ++i) {
+	unsigned char c = *p++;
+	value = (value << 7) | (c & 0x7F);
+	if (!(c & 0x80))
+	  return true;
+      }
+      return false;
+    }
+    
+    /** Return the number of data bytes after the status byte for a 
+	channel message. */
+    inline size_t channel_data_bytes(unsigned char status) throw() {
+      unsigned char type = status & 0xF0;
+      return (type == 0xC0 || type == 0xD0) ? 1 : 2;
+    }
+  
+  }
+  
+  
+  SmfReader::SmfReader(string const& filename) throw(runtime_error)
+    : m_fd(-1),
+      m_data(0),
+      m_size(0),
+      m_format(0),
+      m_ppqn(0) {
+    
+    m_fd = open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0)
+      throw runtime_error("Could not open " + filename);
+    struct stat st;
+    if (fstat(m_fd, &st) || st.st_size < 14) {
+      close(m_fd);
+      throw runtime_error(filename + " is not a MIDI file");
+    }
+    m_size = st.st_size;
+    void* mem = mmap(0, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (mem == MAP_FAILED) {
+      close(m_fd);
+      throw runtime_error("Could not map " + filename);
+    }
+    m_data = static_cast<unsigned char const*>(mem);
+    madvise(mem, m_size, MADV_SEQUENTIAL);
+    
+    // the header chunk
+    unsigned division = read_be(m_data + 12, 2);
+    if (std::memcmp(m_data, "MThd", 4) || read_be(m_data + 4, 4) < 6 ||
+	(division & 0x8000) || division == 0) {
+      munmap(mem, m_size);
+      close(m_fd);
+      throw runtime_error(filename + " is not a supported MIDI file");
+    }
+    m_format = read_be(m_data + 8, 2);
+    m_ppqn = division;
+    
+    // find the track chunks, skipping any unknown chunks
+    try {
+      size_t offset = 8 + read_be(m_data + 4, 4);
+      while (offset + 8 <= m_size) {
+	size_t length = read_be(m_data + offset + 4, 4);
+	if (length > m_size - offset - 8)
+	  length = m_size - offset - 8;
+	if (!std::memcmp(m_data + offset, "MTrk", 4)) {
+	  Track t = { offset + 8, length };
+	  m_tracks.push_back(t);
+	}
+	offset += 8 + length;
+      }
+    }
+    catch (...) {
+      munmap(mem, m_size);
+      close(m_fd);
+      throw runtime_error("Could not allocate the track list");
+    }
+  }
+  
+  
+  SmfReader::~SmfReader() throw() {
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+    close(m_fd);
+  }
+  
+  
+  unsigned SmfReader::get_format() const throw() {
+    return m_format;
+  }
+  
+  
+  unsigned SmfReader::get_ppqn() const throw() {
+    return m_ppqn;
+  }
+  
+  
+  size_t SmfReader::get_track_count() const throw() {
+    return m_tracks.size();
+  }
+  
+  
+  size_t SmfReader::read_track(size_t track, EventBuffer& buf) 
+    throw(out_of_range, runtime_error) {
+    
+    if (track >= m_tracks.size())
+      throw out_of_range("There is no track with that index");
+    
+    unsigned char const* const begin = m_data + m_tracks[track].offset;
+    unsigned char const* const end = begin + m_tracks[track].length;
+    unsigned char const* p = begin;
+    unsigned char const* released = begin;
+    uint64_t tick = 0;
+    unsigned char running_status = 0;
+    size_t events = 0;
+    
+    while (p != end) {
+      
+      // the delta time, converted to a SongTime
+      uint32_t delta;
+      if (!read_vlq(p, end, delta) || p == end)
+	throw runtime_error("Corrupt MIDI track");
+      tick += delta;
+      SongTime st(SongTime::Beat(tick / m_ppqn), 
+		  SongTime::Tick(((tick % m_ppqn) << 24) / m_ppqn));
+      
+      unsigned char status = *p;
+      
+      // meta events, which are skipped, except end of track
+      if (status == 0xFF) {
+	if (end - p < 2)
+	  throw runtime_error("Corrupt MIDI track");
+	unsigned char type = p[1];
+	p += 2;
+	uint32_t length;
+	if (!read_vlq(p, end, length) || length > size_t(end - p))
+	  throw runtime_error("Corrupt MIDI track");
+	p += length;
+	running_status = 0;
+	if (type == 0x2F)
+	  break;
+      }
+      
+      // sysex events
+      else if (status == 0xF0 || status == 0xF7) {
+	++p;
+	uint32_t length;
+	if (!read_vlq(p, end, length) || length > size_t(end - p))
+	  throw runtime_error("Corrupt MIDI track");
+	if (status == 0xF0) {
+	  // the status byte isn't stored in the same place as the rest of
+	  // the bytes, so put them together in a temporary buffer if they
+	  // are small enough, otherwise skip the event
+	  unsigned char tmp[512];
+	  if (length < sizeof(tmp)) {
+	    tmp[0] = 0xF0;
+	    std::memcpy(tmp + 1, p, length);
+	    if (buf.write_event(st, length + 1, tmp))
+	      ++events;
+	  }
+	}
+	else if (length > 0 && buf.write_event(st, length, p))
+	  ++events;
+	p += length;
+	running_status = 0;
+      }
+      
+      // channel messages, with or without running status
+      else if (status < 0xF0) {
+	if (status & 0x80) {
+	  running_status = status;
+	  ++p;
+	}
+	else if (!running_status)
+	  throw runtime_error("Corrupt MIDI track");
+	size_t bytes = channel_data_bytes(running_status);
+	if (size_t(end - p) < bytes)
+	  throw runtime_error("Corrupt MIDI track");
+	unsigned char msg[3] = { running_status, p[0], 0 };
+	if (bytes > 1)
+	  msg[2] = p[1];
+	if (buf.write_event(st, bytes + 1, msg))
+	  ++events;
+	p += bytes;
+      }
+      
+      // other system messages are not allowed in MIDI files
+      else
+	throw runtime_error("Corrupt MIDI track");
+      
+      // let the kernel drop the pages we have decoded
+      if (size_t(p - released) >= release_interval) {
+	release(released - m_data, p - m_data);
+	released = p;
+      }
+    }
+    
+    release(released - m_data, p - m_data);
+    return events;
+  }
+  
+  
+  void SmfReader::release(size_t begin, size_t end) throw() {
+    size_t page = sysconf(_SC_PAGESIZE);
+    begin = (begin + page - 1) / page * page;
+    end = end / page * page;
+    if (begin < end)
+      madvise(const_cast<unsigned char*>(m_data) + begin, end - begin, 
+	      MADV_DONTNEED);
+  }
+
+
+}
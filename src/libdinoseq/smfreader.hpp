@@ -0,0 +1,129 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef SMFREADER_HPP
+#define SMFREADER_HPP
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+
+namespace Dino {
+  
+  
+  class EventBuffer;
+  
+  
+  /** A reader for Standard MIDI Files. The file is mapped into memory 
+      instead of being read, and the events in a track are decoded one at
+      a time and written directly to an EventBuffer, e.g. a CurveRecorder,
+      so no copy of the file or the track is ever made. Pages that have 
+      been decoded are released as the reading goes on, so even very large
+      files can be read with a small, bounded amount of memory.
+      
+      Only files with the time division in ticks per beat are supported. 
+      Meta events are skipped. System exclusive events are passed on with
+      the leading 0xF0 if they are shorter than 512 bytes and skipped 
+      otherwise, F7 escapes are passed on as they are.
+      
+      @ingroup sequencing
+  */
+  class SmfReader {
+  public:
+    
+    /** Open and map the file @c filename and read the header and the 
+	positions of the track chunks.
+	
+	@throw std::runtime_error if the file could not be opened or mapped,
+				  or is not a supported MIDI file
+    */
+    SmfReader(std::string const& filename) throw(std::runtime_error);
+    
+    /** Unmap and close the file. */
+    ~SmfReader() throw();
+    
+    /** Return the format of the file, 0, 1 or 2. */
+    unsigned get_format() const throw();
+    
+    /** Return the number of MIDI ticks per beat. */
+    unsigned get_ppqn() const throw();
+    
+    /** Return the number of tracks in the file. */
+    size_t get_track_count() const throw();
+    
+    /** Decode the track with index @c track and write all its events to 
+	@c buf. Returns the number of events that @c buf accepted, events 
+	that it does not accept are skipped.
+	
+	@throw std::out_of_range if there is no track with that index
+	@throw std::runtime_error if the track is corrupt
+    */
+    size_t read_track(size_t track, EventBuffer& buf) 
+      throw(std::out_of_range, std::runtime_error);
+  
+  private:
+    
+    /** The position of a track chunk in the file. */
+    struct Track {
+      
+      /** The offset of the first byte after the chunk header. */
+      size_t offset;
+      
+      /** The length of the chunk data. */
+      size_t length;
+    };
+    
+    /** Copying is not allowed. */
+    SmfReader(SmfReader const&) = delete;
+    
+    /** Assignment is not allowed. */
+    SmfReader& operator=(SmfReader const&) = delete;
+    
+    /** Tell the kernel that we no longer need the mapped pages in the 
+	range [@c begin, @c end). */
+    void release(size_t begin, size_t end) throw();
+    
+    
+    /** The file descriptor. */
+    int m_fd;
+    
+    /** The mapped file. */
+    unsigned char const* m_data;
+    
+    /** The size of the file. */
+    size_t m_size;
+    
+    /** The file format. */
+    unsigned m_format;
+    
+    /** The number of MIDI ticks per beat. */
+    unsigned m_ppqn;
+    
+    /** The track chunks. */
+    std::vector<Track> m_tracks;
+  
+  };
+
+
+}
+
+
+#endif
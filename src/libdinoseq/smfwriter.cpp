@@ -0,0 +1,187 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "smfwriter.hpp"
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::ostream;
+  using std::runtime_error;
+  using std::streampos;
+  
+  
+  namespace {
+    
+    /** Write a big-endian integer of @c bytes bytes. */
+    void write_be(ostream& os, uint32_t value, unsigned bytes) {
+      for (unsigned i = bytes; i > 0; --i)
+	os.put(char((value >> (8 * (i - 1))) & 0xFF));
+    }
+  
+  }
+  
+  
+  SmfWriter::SmfWriter(ostream& stream, unsigned ppqn) 
+    throw(runtime_error)
+    : m_stream(stream),
+      m_ppqn(ppqn > 0 && ppqn < 0x8000 ? ppqn : 960),
+      m_last_tick(0),
+      m_running_status(0),
+      m_events(0),
+      m_finished(false) {
+    
+    // the header chunk, format 0 with one track
+    m_stream.write("MThd", 4);
+    write_be(m_stream, 6, 4);
+    write_be(m_stream, 0, 2);
+    write_be(m_stream, 1, 2);
+    write_be(m_stream, m_ppqn, 2);
+    
+    // the track chunk header, the length is filled in by finish()
+    m_stream.write("MTrk", 4);
+    m_length_pos = m_stream.tellp();
+    write_be(m_stream, 0, 4);
+    if (!m_stream)
+      throw runtime_error("Could not write the MIDI file header");
+  }
+  
+  
+  SmfWriter::~SmfWriter() throw() {
+    if (!m_finished) {
+      try {
+	finish();
+      }
+      catch (...) {
+      }
+    }
+  }
+  
+  
+  bool SmfWriter::write_event(SongTime const& st, size_t bytes, 
+			      unsigned char const* data) {
+    if (m_finished || !m_stream || bytes == 0)
+      return false;
+    
+    unsigned char status = data[0];
+    
+    // channel messages, with running status
+    if (status >= 0x80 && status < 0xF0) {
+      write_delta(st);
+      size_t first = 0;
+      if (status == m_running_status)
+	first = 1;
+      m_running_status = status;
+      m_stream.write(reinterpret_cast<char const*>(data) + first, 
+		     bytes - first);
+    }
+    
+    // sysex, written as F0 <length> <the rest of the bytes>
+    else if (status == 0xF0) {
+      write_delta(st);
+      m_stream.put(char(0xF0));
+      write_vlq(bytes - 1);
+      m_stream.write(reinterpret_cast<char const*>(data) + 1, bytes - 1);
+      m_running_status = 0;
+    }
+    
+    // everything else can't be written to a MIDI file
+    else
+      return true;
+    
+    ++m_events;
+    return bool(m_stream);
+  }
+  
+  
+  bool SmfWriter::write_tempo(SongTime const& st, double bpm) {
+    if (m_finished || !m_stream || bpm <= 0)
+      return false;
+    write_delta(st);
+    m_stream.put(char(0xFF));
+    m_stream.put(char(0x51));
+    m_stream.put(char(0x03));
+    write_be(m_stream, uint32_t(60000000 / bpm + 0.5), 3);
+    m_running_status = 0;
+    return bool(m_stream);
+  }
+  
+  
+  void SmfWriter::finish() throw(runtime_error) {
+    if (m_finished)
+      return;
+    m_finished = true;
+    
+    // end of track
+    m_stream.put(char(0x00));
+    m_stream.put(char(0xFF));
+    m_stream.put(char(0x2F));
+    m_stream.put(char(0x00));
+    
+    // go back and write the track length
+    streampos end = m_stream.tellp();
+    if (end == streampos(-1) || m_length_pos == streampos(-1))
+      throw runtime_error("The MIDI file stream is not seekable");
+    m_stream.seekp(m_length_pos);
+    write_be(m_stream, uint32_t(end - m_length_pos - 4), 4);
+    m_stream.seekp(end);
+    m_stream.flush();
+    if (!m_stream)
+      throw runtime_error("Could not write the MIDI file");
+  }
+  
+  
+  unsigned SmfWriter::get_ppqn() const throw() {
+    return m_ppqn;
+  }
+  
+  
+  size_t SmfWriter::get_event_count() const throw() {
+    return m_events;
+  }
+  
+  
+  void SmfWriter::write_delta(SongTime const& st) {
+    
+    // round to the nearest MIDI tick, negative times are written at 0
+    uint64_t tick = 0;
+    if (st.get_beat() >= 0) {
+      tick = uint64_t(st.get_beat()) * m_ppqn + 
+	((uint64_t(st.get_tick()) * m_ppqn + (1 << 23)) >> 24);
+    }
+    if (tick < m_last_tick)
+      tick = m_last_tick;
+    write_vlq(uint32_t(tick - m_last_tick));
+    m_last_tick = tick;
+  }
+  
+  
+  void SmfWriter::write_vlq(uint32_t value) {
+    unsigned char buf[5];
+    unsigned n = 0;
+    buf[n++] = value & 0x7F;
+    while (value >>= 7)
+      buf[n++] = 0x80 | (value & 0x7F);
+    while (n > 0)
+      m_stream.put(char(buf[--n]));
+  }
+
+
+}
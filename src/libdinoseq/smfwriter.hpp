@@ -0,0 +1,124 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef SMFWRITER_HPP
+#define SMFWRITER_HPP
+
+#include <iostream>
+#include <stdexcept>
+
+#include <stdint.h>
+
+#include "eventbuffer.hpp"
+
+
+namespace Dino {
+  
+  
+  class SongTime;
+  
+  
+  /** An EventBuffer that writes the events it receives to a Standard MIDI
+      File of format 0, i.e. with a single track. The events must be 
+      written in time order, events that are earlier than the previous one
+      are written at the time of the previous one. The SongTimes are 
+      converted to MIDI ticks with the resolution given in the constructor.
+      
+      The track is streamed to the @c ostream as the events arrive and 
+      the length of the track chunk is filled in by finish(), so the 
+      stream must be seekable. Channel messages use running status. System
+      exclusive messages are written as SMF sysex events, and other system
+      messages are ignored since they can't be stored in a MIDI file.
+      
+      @ingroup sequencing
+  */
+  class SmfWriter : public EventBuffer {
+  public:
+    
+    /** Start writing a MIDI file with @c ppqn ticks per beat to 
+	@c stream.
+	
+	@throw std::runtime_error if the header could not be written
+    */
+    SmfWriter(std::ostream& stream, unsigned ppqn = 960) 
+      throw(std::runtime_error);
+    
+    /** Call finish() if it hasn't been called, ignoring any errors. */
+    ~SmfWriter() throw();
+    
+    /** Write an event to the file. Returns @c false if the stream is in
+	a bad state or finish() has been called. */
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data);
+    
+    /** Write a tempo change to the file. Returns @c false if the stream 
+	is in a bad state or finish() has been called. */
+    bool write_tempo(SongTime const& st, double bpm);
+    
+    /** End the track and fill in its length. Nothing can be written after
+	this has been called.
+	
+	@throw std::runtime_error if the stream is not seekable or could not
+				  be written
+    */
+    void finish() throw(std::runtime_error);
+    
+    /** Return the number of MIDI ticks per beat. */
+    unsigned get_ppqn() const throw();
+    
+    /** Return the number of events that have been written. */
+    size_t get_event_count() const throw();
+  
+  private:
+    
+    /** Write the delta time for an event at @c st. */
+    void write_delta(SongTime const& st);
+    
+    /** Write a variable length quantity. */
+    void write_vlq(uint32_t value);
+    
+    
+    /** The stream that the file is written to. */
+    std::ostream& m_stream;
+    
+    /** The number of MIDI ticks per beat. */
+    unsigned m_ppqn;
+    
+    /** The stream position of the track length field. */
+    std::streampos m_length_pos;
+    
+    /** The time of the last event, in MIDI ticks. */
+    uint64_t m_last_tick;
+    
+    /** The last status byte written, for running status. 0 if the next 
+	event must have a status byte. */
+    unsigned char m_running_status;
+    
+    /** The number of events written. */
+    size_t m_events;
+    
+    /** True when finish() has been called. */
+    bool m_finished;
+  
+  };
+
+
+}
+
+
+#endif
@@ -0,0 +1,383 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstring>
+#include <fstream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "curve.hpp"
+#include "eventbuffer.hpp"
+#include "sequencer.hpp"
+#include "snapshot.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::dynamic_pointer_cast;
+  using std::logic_error;
+  using std::ofstream;
+  using std::runtime_error;
+  using std::shared_ptr;
+  using std::string;
+  using std::vector;
+  
+  
+  struct Snapshot::Header {
+    
+    /** "DINOSNAP". */
+    char magic[8];
+    
+    /** The format version. */
+    uint32_t version;
+    
+    /** The number of Sequencable records. */
+    uint32_t count;
+    
+    /** The size of the whole file. */
+    uint64_t size;
+  };
+  
+  
+  struct Snapshot::Record {
+    
+    /** 1 for Curves, 0 for other Sequencables. */
+    uint32_t type;
+    
+    /** The buffer index, or -1. */
+    int32_t buffer;
+    
+    /** The offset of the label in the file. */
+    uint64_t label_offset;
+    
+    /** The size of the label. */
+    uint64_t label_size;
+    
+    /** The beat of the length. */
+    int32_t length_beat;
+    
+    /** The tick of the length. */
+    uint32_t length_tick;
+    
+    /** The controller ID of a Curve. */
+    uint32_t cid;
+    
+    /** The interpolation mode of a Curve. */
+    uint32_t interpolation;
+    
+    /** The resolution of a Curve. */
+    uint32_t resolution;
+    
+    /** The storage of a Curve, 0 for SkipList and 1 for BTree. Files from
+	before this was added have 0 here. */
+    uint32_t storage;
+    
+    /** The offset of the points of a Curve in the file. */
+    uint64_t points_offset;
+    
+    /** The number of points of a Curve. */
+    uint64_t point_count;
+  };
+  
+  
+  struct Snapshot::PointRecord {
+    
+    /** The beat of the point time. */
+    int32_t beat;
+    
+    /** The tick of the point time. */
+    uint32_t tick;
+    
+    /** The point value. */
+    int32_t value;
+  };
+  
+  
+  namespace {
+    
+    /** The current format version. */
+    uint32_t const version = 1;
+    
+    /** The number of points that are converted at a time when a Curve is
+	materialised. */
+    size_t const load_batch = 4096;
+    
+    /** Round @c n up to a multiple of 8. */
+    inline uint64_t align(uint64_t n) throw() {
+      return (n + 7) & ~uint64_t(7);
+    }
+    
+    /** Write @c n zero bytes. */
+    void pad(ofstream& os, size_t n) {
+      char zero[8] = { 0 };
+      os.write(zero, n);
+    }
+  
+  }
+  
+  
+  void Snapshot::write(string const& filename, Sequencer& seq, 
+		       vector<shared_ptr<EventBuffer>>& buffers) 
+    throw(runtime_error) {
+    
+    try {
+      buffers.clear();
+      
+      // build the record table, with all data placed after it
+      vector<Record> records;
+      vector<shared_ptr<Curve const>> curves;
+      for (auto i = seq.sqbl_begin(); i != seq.sqbl_end(); ++i) {
+	Record r;
+	std::memset(&r, 0, sizeof(r));
+	r.buffer = -1;
+	shared_ptr<EventBuffer> buf = seq.get_event_buffer(i);
+	if (buf) {
+	  size_t b = 0;
+	  while (b < buffers.size() && buffers[b] != buf)
+	    ++b;
+	  if (b == buffers.size())
+	    buffers.push_back(buf);
+	  r.buffer = b;
+	}
+	r.label_size = (*i)->get_label().size();
+	r.length_beat = (*i)->get_length().get_beat();
+	r.length_tick = (*i)->get_length().get_tick();
+	shared_ptr<Curve const> c = dynamic_pointer_cast<Curve const>(*i);
+	if (c) {
+	  r.type = 1;
+	  r.cid = c->get_controller_id();
+	  r.interpolation = c->get_interpolation();
+	  r.resolution = c->get_resolution();
+	  r.storage = c->get_storage();
+	  r.point_count = std::distance(c->begin(), c->end());
+	}
+	records.push_back(r);
+	curves.push_back(c);
+      }
+      Header h;
+      std::memcpy(h.magic, "DINOSNAP", 8);
+      h.version = version;
+      h.count = records.size();
+      uint64_t offset = sizeof(Header) + records.size() * sizeof(Record);
+      for (size_t i = 0; i < records.size(); ++i) {
+	records[i].label_offset = offset;
+	offset = align(offset + records[i].label_size);
+	records[i].points_offset = offset;
+	offset = align(offset + records[i].point_count * sizeof(PointRecord));
+      }
+      h.size = offset;
+      
+      // then write everything in order
+      ofstream os(filename.c_str(), std::ios::binary | std::ios::trunc);
+      os.write(reinterpret_cast<char const*>(&h), sizeof(h));
+      if (!records.empty())
+	os.write(reinterpret_cast<char const*>(&records[0]), 
+		 records.size() * sizeof(Record));
+      auto sqbl = seq.sqbl_begin();
+      for (size_t i = 0; i < records.size(); ++i, ++sqbl) {
+	Record const& r = records[i];
+	os.write((*sqbl)->get_label().data(), r.label_size);
+	pad(os, align(r.label_size) - r.label_size);
+	if (!curves[i])
+	  continue;
+	for (auto p = curves[i]->begin(); p != curves[i]->end(); ++p) {
+	  PointRecord pr = { p->m_time.get_beat(), p->m_time.get_tick(), 
+			     p->m_value.get() };
+	  os.write(reinterpret_cast<char const*>(&pr), sizeof(pr));
+	}
+	uint64_t bytes = r.point_count * sizeof(PointRecord);
+	pad(os, align(bytes) - bytes);
+      }
+      os.close();
+      if (!os)
+	throw runtime_error("Could not write the snapshot to " + filename);
+    }
+    catch (bad_alloc&) {
+      throw runtime_error("Could not allocate memory for the snapshot");
+    }
+  }
+  
+  
+  Snapshot::Snapshot(string const& filename) throw(runtime_error)
+    : m_fd(-1),
+      m_data(0),
+      m_size(0),
+      m_count(0) {
+    
+    m_fd = open(filename.c_str(), O_RDONLY);
+    if (m_fd < 0)
+      throw runtime_error("Could not open " + filename);
+    struct stat st;
+    if (fstat(m_fd, &st) || size_t(st.st_size) < sizeof(Header)) {
+      close(m_fd);
+      throw runtime_error(filename + " is not a snapshot");
+    }
+    m_size = st.st_size;
+    void* mem = mmap(0, m_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if (mem == MAP_FAILED) {
+      close(m_fd);
+      throw runtime_error("Could not map " + filename);
+    }
+    m_data = static_cast<unsigned char const*>(mem);
+    
+    // check the header and that all records point inside the file
+    Header const& h = *reinterpret_cast<Header const*>(m_data);
+    bool valid = (!std::memcmp(h.magic, "DINOSNAP", 8) && 
+		  h.version == version && h.size == m_size &&
+		  h.count <= (m_size - sizeof(Header)) / sizeof(Record));
+    m_count = valid ? h.count : 0;
+    for (size_t i = 0; valid && i < m_count; ++i) {
+      Record const& r = record(i);
+      valid = (r.label_offset <= m_size && 
+	       r.label_size <= m_size - r.label_offset &&
+	       r.points_offset <= m_size && 
+	       r.point_count <= ((m_size - r.points_offset) / 
+				 sizeof(PointRecord)) &&
+	       (r.points_offset % 4) == 0);
+    }
+    if (!valid) {
+      munmap(mem, m_size);
+      close(m_fd);
+      throw runtime_error(filename + " is not a valid snapshot");
+    }
+    
+    try {
+      m_curves.resize(m_count);
+    }
+    catch (bad_alloc&) {
+      munmap(mem, m_size);
+      close(m_fd);
+      throw runtime_error("Could not allocate memory for the snapshot");
+    }
+  }
+  
+  
+  Snapshot::~Snapshot() throw() {
+    munmap(const_cast<unsigned char*>(m_data), m_size);
+    close(m_fd);
+  }
+  
+  
+  size_t Snapshot::get_sequencable_count() const throw() {
+    return m_count;
+  }
+  
+  
+  string Snapshot::get_label(size_t i) const {
+    Record const& r = record(i);
+    return string(reinterpret_cast<char const*>(m_data + r.label_offset), 
+		  r.label_size);
+  }
+  
+  
+  SongTime Snapshot::get_length(size_t i) const throw() {
+    Record const& r = record(i);
+    return SongTime(r.length_beat, r.length_tick);
+  }
+  
+  
+  long Snapshot::get_buffer_index(size_t i) const throw() {
+    return record(i).buffer;
+  }
+  
+  
+  bool Snapshot::is_curve(size_t i) const throw() {
+    return record(i).type == 1;
+  }
+  
+  
+  bool Snapshot::is_materialised(size_t i) const throw() {
+    return bool(m_curves[i]);
+  }
+  
+  
+  shared_ptr<Curve> Snapshot::get_curve(size_t i) 
+    throw(bad_alloc, runtime_error) {
+    if (m_curves[i] || !is_curve(i))
+      return m_curves[i];
+    
+    Record const& r = record(i);
+    Curve::Storage storage = 
+      (r.storage == Curve::BTree ? Curve::BTree : Curve::SkipList);
+    shared_ptr<Curve> c(new Curve(get_label(i), get_length(i), r.cid, 
+				  storage));
+    c->set_interpolation(Curve::Interpolation(r.interpolation));
+    c->set_resolution(r.resolution);
+    
+    // the points are sorted already, so they can be bulk loaded in 
+    // batches that are appended to the end of the curve. A tree is rebuilt
+    // for every batch, so it gets all points at once.
+    PointRecord const* p = 
+      reinterpret_cast<PointRecord const*>(m_data + r.points_offset);
+    PointRecord const* end = p + r.point_count;
+    size_t batch_size = 
+      (storage == Curve::BTree ? r.point_count : load_batch);
+    vector<Curve::Point> batch;
+    batch.reserve(std::min<uint64_t>(r.point_count, batch_size));
+    while (p != end) {
+      batch.clear();
+      for ( ; p != end && batch.size() < batch_size; ++p) {
+	batch.push_back(Curve::Point(SongTime(p->beat, p->tick), p->value));
+      }
+      
+      // the points are only out of range or out of order if the snapshot 
+      // is corrupt, and then the curve is not cached
+      try {
+	c->add_points(&batch[0], &batch[0] + batch.size());
+      }
+      catch (logic_error&) {
+	throw runtime_error("The points of curve " + get_label(i) + 
+			    " in the snapshot are corrupt");
+      }
+    }
+    
+    m_curves[i] = c;
+    return c;
+  }
+  
+  
+  void Snapshot::restore(Sequencer& seq, 
+			 vector<shared_ptr<EventBuffer>> const& buffers)
+    throw(bad_alloc, runtime_error) {
+    
+    // all curves are loaded first, so nothing is added if one is corrupt
+    for (size_t i = 0; i < m_count; ++i)
+      get_curve(i);
+    for (size_t i = 0; i < m_count; ++i) {
+      shared_ptr<Curve> c = m_curves[i];
+      if (!c)
+	continue;
+      auto iter = seq.add_sequencable(c);
+      long b = get_buffer_index(i);
+      if (b >= 0 && size_t(b) < buffers.size())
+	seq.set_event_buffer(iter, buffers[b]);
+    }
+  }
+  
+  
+  Snapshot::Record const& Snapshot::record(size_t i) const throw() {
+    return reinterpret_cast<Record const*>(m_data + sizeof(Header))[i];
+  }
+
+
+}
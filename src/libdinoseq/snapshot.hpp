@@ -0,0 +1,173 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include "songtime.hpp"
+
+
+namespace Dino {
+  
+  
+  class Curve;
+  class EventBuffer;
+  class Sequencer;
+  
+  
+  /** A compact binary snapshot of the Sequencables in a Sequencer and 
+      their routing. The file is written in the native byte order with 
+      fixed size records, so it can be mapped into memory and used 
+      directly without any parsing. Opening a snapshot only maps the file 
+      and checks the record table, the Curves are materialised one at a 
+      time when they are first asked for, by bulk loading their points 
+      with Curve::add_points() into the same storage as the saved Curve.
+      
+      Only Curves are stored with their data. For other Sequencables only
+      the label and the length are stored, and get_curve() returns 0 for
+      them. The EventBuffers can't be stored, so every distinct buffer is 
+      given an index, and the caller maps the indices back to buffers when
+      the snapshot is restored. A Curve that is added to the Sequencer more
+      than once is stored once for every time it was added, and will be
+      restored as separate Curves.
+      
+      A snapshot is not thread safe, and none of its functions are 
+      realtime safe.
+      
+      @ingroup mididata
+  */
+  class Snapshot {
+  public:
+    
+    /** Write a snapshot of all Sequencables in @c seq to @c filename. The
+	buffers that the Sequencables are routed to are stored as indices 
+	into @c buffers, which is filled in by this function. Sequencables 
+	without a buffer get the index -1.
+	
+	@throw std::runtime_error if the file could not be written
+    */
+    static void write(std::string const& filename, Sequencer& seq,
+		      std::vector<std::shared_ptr<EventBuffer>>& buffers)
+      throw(std::runtime_error);
+    
+    /** Map the snapshot in @c filename.
+	
+	@throw std::runtime_error if the file could not be mapped or is not
+				  a valid snapshot
+    */
+    Snapshot(std::string const& filename) throw(std::runtime_error);
+    
+    /** Unmap the file. Curves that have been materialised are not 
+	affected. */
+    ~Snapshot() throw();
+    
+    /** Return the number of Sequencables in the snapshot. */
+    size_t get_sequencable_count() const throw();
+    
+    /** Return the label of Sequencable number @c i. */
+    std::string get_label(size_t i) const;
+    
+    /** Return the length of Sequencable number @c i. */
+    SongTime get_length(size_t i) const throw();
+    
+    /** Return the buffer index of Sequencable number @c i, or -1 if it 
+	wasn't routed to any buffer. */
+    long get_buffer_index(size_t i) const throw();
+    
+    /** Return @c true if Sequencable number @c i is a Curve. */
+    bool is_curve(size_t i) const throw();
+    
+    /** Return @c true if Sequencable number @c i has been materialised. */
+    bool is_materialised(size_t i) const throw();
+    
+    /** Return the Curve for Sequencable number @c i, creating it and 
+	loading its points the first time it is called. Returns 0 if the 
+	Sequencable is not a Curve.
+	
+	@throw std::bad_alloc if the curve could not be created
+	@throw std::runtime_error if the stored points are out of order or
+				  outside the length of the curve
+    */
+    std::shared_ptr<Curve> get_curve(size_t i) 
+      throw(std::bad_alloc, std::runtime_error);
+    
+    /** Add all Curves in the snapshot to @c seq, routed to the buffers in
+	@c buffers using the stored buffer indices. Curves with an index 
+	outside @c buffers are added without a buffer. All Curves are 
+	materialised before any of them is added.
+	
+	@throw std::bad_alloc if the curves could not be created or added
+	@throw std::runtime_error if the points of a curve are corrupt, 
+				  nothing is added to @c seq then
+    */
+    void restore(Sequencer& seq, 
+		 std::vector<std::shared_ptr<EventBuffer>> const& buffers)
+      throw(std::bad_alloc, std::runtime_error);
+  
+  private:
+    
+    /** The file header. */
+    struct Header;
+    
+    /** A record in the Sequencable table. */
+    struct Record;
+    
+    /** A curve point. */
+    struct PointRecord;
+    
+    /** Copying is not allowed. */
+    Snapshot(Snapshot const&) = delete;
+    
+    /** Assignment is not allowed. */
+    Snapshot& operator=(Snapshot const&) = delete;
+    
+    /** Return the record for Sequencable number @c i. */
+    Record const& record(size_t i) const throw();
+    
+    
+    /** The file descriptor. */
+    int m_fd;
+    
+    /** The mapped file. */
+    unsigned char const* m_data;
+    
+    /** The size of the file. */
+    size_t m_size;
+    
+    /** The number of Sequencables. */
+    size_t m_count;
+    
+    /** The Curves that have been materialised, one for each 
+	Sequencable. */
+    std::vector<std::shared_ptr<Curve>> m_curves;
+  
+  };
+
+
+}
+
+
+#endif
@@ -0,0 +1,300 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "tempomap.hpp"
+
+
+namespace Dino {
+  
+  
+  using std::bad_alloc;
+  using std::invalid_argument;
+  using std::out_of_range;
+  using std::vector;
+  
+  
+  namespace {
+    
+    /** Return a SongTime as a number of beats. */
+    double to_beats(SongTime const& st) throw() {
+      return st.get_beat() + st.get_tick() / double(1 << 24);
+    }
+    
+    /** Return a number of beats as a SongTime. */
+    SongTime from_beats(double beats) throw() {
+      double b = std::floor(beats);
+      return SongTime(SongTime::Beat(b), 
+		      SongTime::Tick((beats - b) * (1 << 24)));
+    }
+    
+    /** A comparison for std::upper_bound() that orders segments by their 
+	start frames. */
+    template <typename S>
+    struct FrameLess {
+      bool operator()(TempoMap::Frame frame, S const& s) const { 
+	return frame < s.start_frame; 
+      }
+    };
+  
+  }
+  
+  
+  TempoMap::Segment::Segment(SongTime const& st, double b) throw()
+    : start(st),
+      start_beats(to_beats(st)),
+      start_frame(0),
+      bpm(b),
+      frames_per_beat(0),
+      beats_per_frame(0) {
+  }
+  
+  
+  bool TempoMap::Segment::operator<(Segment const& s) const throw() {
+    return start < s.start;
+  }
+  
+  
+  TempoMap::Cursor::Cursor() throw()
+    : m_index(0),
+      m_version(0) {
+  }
+  
+  
+  TempoMap::TempoMap(double frame_rate, double bpm) throw(bad_alloc)
+    : m_frame_rate(frame_rate),
+      m_table(0),
+      m_version(1),
+      m_reader(m_domain.register_reader()),
+      m_retired(m_domain) {
+    Table* t = new Table;
+    t->version = m_version;
+    t->segments.push_back(Segment(SongTime(0, 0), bpm));
+    t->retired = 0;
+    update_frames(*t);
+    m_table.set_release(t);
+  }
+  
+  
+  TempoMap::~TempoMap() throw() {
+    delete m_table.get();
+    m_domain.unregister_reader(m_reader);
+  }
+  
+  
+  double TempoMap::get_frame_rate() const throw() {
+    return m_frame_rate;
+  }
+  
+  
+  void TempoMap::add_change(SongTime const& st, double bpm)
+    throw(bad_alloc, out_of_range, invalid_argument) {
+    
+    m_retired.collect();
+    
+    if (st < SongTime(0, 0))
+      throw out_of_range("Tempo changes can not be earlier than 0:000000");
+    if (!(bpm > 0))
+      throw invalid_argument("The tempo must be positive");
+    
+    // build the new table next to the current one, the reader never sees
+    // it until it is complete
+    Table const& old = *m_table.get();
+    Table* t = new Table;
+    try {
+      t->segments.reserve(old.segments.size() + 1);
+      t->segments = old.segments;
+    }
+    catch (...) {
+      delete t;
+      throw;
+    }
+    
+    // if there already is a change at this time, just modify it, if not, 
+    // add a new one
+    vector<Segment>::iterator i = 
+      std::lower_bound(t->segments.begin(), t->segments.end(), Segment(st));
+    if (i != t->segments.end() && i->start == st)
+      i->bpm = bpm;
+    else
+      t->segments.insert(i, Segment(st, bpm));
+    
+    update_frames(*t);
+    publish(t);
+  }
+  
+  
+  bool TempoMap::remove_change(SongTime const& st) throw(bad_alloc) {
+    
+    m_retired.collect();
+    
+    if (st == SongTime(0, 0))
+      return false;
+    Table const& old = *m_table.get();
+    vector<Segment>::const_iterator i = 
+      std::lower_bound(old.segments.begin(), old.segments.end(), 
+		       Segment(st));
+    if (i == old.segments.end() || i->start != st)
+      return false;
+    
+    Table* t = new Table;
+    try {
+      t->segments.reserve(old.segments.size() - 1);
+      t->segments.insert(t->segments.end(), old.segments.begin(), i);
+      t->segments.insert(t->segments.end(), i + 1, old.segments.end());
+    }
+    catch (...) {
+      delete t;
+      throw;
+    }
+    
+    update_frames(*t);
+    publish(t);
+    
+    return true;
+  }
+  
+  
+  double TempoMap::get_bpm(SongTime const& st) const throw() {
+    Cursor cursor;
+    return find_time(*m_table.get_acquire(), st, cursor).bpm;
+  }
+  
+  
+  SongTime TempoMap::frame_to_songtime(Frame frame) const throw() {
+    Cursor cursor;
+    return frame_to_songtime(frame, cursor);
+  }
+  
+  
+  SongTime TempoMap::frame_to_songtime(Frame frame, Cursor& cursor) const 
+    throw() {
+    Segment const& s = find_frame(*m_table.get_acquire(), frame, cursor);
+    return from_beats(s.start_beats + 
+		      (frame - s.start_frame) * s.beats_per_frame);
+  }
+  
+  
+  TempoMap::Frame TempoMap::songtime_to_frame(SongTime const& st) const 
+    throw() {
+    Cursor cursor;
+    return songtime_to_frame(st, cursor);
+  }
+  
+  
+  TempoMap::Frame TempoMap::songtime_to_frame(SongTime const& st, 
+					      Cursor& cursor) const throw() {
+    Segment const& s = find_time(*m_table.get_acquire(), st, cursor);
+    return s.start_frame + 
+      Frame(std::floor((to_beats(st) - s.start_beats) * s.frames_per_beat));
+  }
+  
+  
+  void TempoMap::reader_holds_no_iterator() throw() {
+    m_domain.quiescent(m_reader);
+  }
+  
+  
+  TempoMap::Segment const& 
+  TempoMap::find_frame(Table const& table, Frame frame, Cursor& cursor)
+    throw() {
+    
+    vector<Segment> const& v = table.segments;
+    
+    // first try the segment from the last conversion and the one after it,
+    // the cursor only holds an index so it is never used with a table that
+    // it wasn't set for
+    if (cursor.m_version == table.version && 
+	v[cursor.m_index].start_frame <= frame) {
+      for (size_t i = cursor.m_index; i < cursor.m_index + 2; ++i) {
+	if (i + 1 == v.size() || frame < v[i + 1].start_frame) {
+	  cursor.m_index = i;
+	  return v[i];
+	}
+      }
+    }
+    
+    // if that didn't work, search
+    vector<Segment>::const_iterator i = 
+      std::upper_bound(v.begin(), v.end(), frame, FrameLess<Segment>());
+    if (i != v.begin())
+      --i;
+    cursor.m_index = i - v.begin();
+    cursor.m_version = table.version;
+    return *i;
+  }
+  
+  
+  TempoMap::Segment const& 
+  TempoMap::find_time(Table const& table, SongTime const& st, Cursor& cursor)
+    throw() {
+    
+    vector<Segment> const& v = table.segments;
+    
+    // first try the segment from the last conversion and the one after it
+    if (cursor.m_version == table.version && 
+	v[cursor.m_index].start <= st) {
+      for (size_t i = cursor.m_index; i < cursor.m_index + 2; ++i) {
+	if (i + 1 == v.size() || st < v[i + 1].start) {
+	  cursor.m_index = i;
+	  return v[i];
+	}
+      }
+    }
+    
+    // if that didn't work, search
+    vector<Segment>::const_iterator i = 
+      std::upper_bound(v.begin(), v.end(), Segment(st));
+    if (i != v.begin())
+      --i;
+    cursor.m_index = i - v.begin();
+    cursor.m_version = table.version;
+    return *i;
+  }
+  
+  
+  void TempoMap::update_frames(Table& table) const throw() {
+    Segment* prev = 0;
+    for (size_t i = 0; i < table.segments.size(); ++i) {
+      Segment& s = table.segments[i];
+      s.frames_per_beat = m_frame_rate * 60 / s.bpm;
+      s.beats_per_frame = 1 / s.frames_per_beat;
+      if (prev) {
+	s.start_frame = prev->start_frame + 
+	  Frame(std::floor((s.start_beats - prev->start_beats) * 
+			   prev->frames_per_beat));
+      }
+      else
+	s.start_frame = 0;
+      prev = &s;
+    }
+  }
+  
+  
+  void TempoMap::publish(Table* table) throw() {
+    table->version = ++m_version;
+    table->retired = 0;
+    Table* old = m_table.get();
+    m_table.set_release(table);
+    m_retired.retire(old);
+  }
+
+
+}
@@ -19,6 +19,16 @@
 #ifndef TEMPOMAP_HPP
 #define TEMPOMAP_HPP
 
+#include <new>
+#include <stdexcept>
+#include <vector>
+
+#include <stdint.h>
+
+#include "atomicptr.hpp"
+#include "epochdomain.hpp"
+#include "songtime.hpp"
+
 
 namespace Dino {
   
@@ -26,15 +36,217 @@ namespace Dino {
   /** A class that manages tempo changes and maps real time to song time,
       in both directions.
       
+      The map consists of segments with constant tempo, each starting at 
+      a tempo change. Every segment caches the frame it starts at, so a
+      conversion is a binary search in a sorted table of segments followed
+      by a single multiplication. There is always a tempo change at 
+      SongTime(0, 0).
+      
+      Like LinkedList, the map has one writer thread and one realtime safe
+      reader thread. The writer calls add_change() and remove_change(), 
+      the reader uses the conversion functions and calls 
+      reader_holds_no_iterator() periodically (e.g. once per period) when 
+      it is not in the middle of a conversion. The tables are never 
+      changed once they are visible to the reader. Every edit builds a new
+      table and publishes it with a single pointer store, and the old one
+      is deallocated through an EpochDomain when the reader is done with
+      it. The conversion functions do not lock, allocate, wait or retry,
+      and the reader always sees a consistent map.
+      
+      For the common case where the reader converts consecutive periods
+      you can keep a Cursor between calls. As long as the map has not been
+      edited and the new time is in the same segment as the last one, or
+      the next, the conversion is O(1).
+      
       @ingroup mididata
   */
   class TempoMap {
+  private:
+    
+    /** A segment of constant tempo. */
+    struct Segment {
+      
+      /** Create a new segment. */
+      Segment(SongTime const& st, double bpm = 120) throw();
+      
+      /** Segments are ordered by their start time. */
+      bool operator<(Segment const& s) const throw();
+      
+      /** The time where the segment starts. */
+      SongTime start;
+      
+      /** The start time in beats, for the conversions. */
+      double start_beats;
+      
+      /** The frame where the segment starts. */
+      int64_t start_frame;
+      
+      /** The tempo in beats per minute. */
+      double bpm;
+      
+      /** The number of frames per beat in this segment. */
+      double frames_per_beat;
+      
+      /** The number of beats per frame in this segment. */
+      double beats_per_frame;
+    
+    };
+    
+    /** A sorted table of all segments. A table is not changed after it
+	has been published. */
+    struct Table {
+      
+      /** The number of the edit that built this table. */
+      uint64_t version;
+      
+      /** The segments, ordered by their start times. */
+      std::vector<Segment> segments;
+      
+      /** Links replaced tables in the EpochLimbo. */
+      Table* retired;
+    
+    };
+    
+    /** The EpochLimbo policy for replaced tables. */
+    struct RetirePolicy {
+      Table*& link(Table* t) throw() { return t->retired; }
+      void free(Table* t) throw() { delete t; }
+    };
+  
   public:
     
+    /** The type used for frame counts. */
+    typedef int64_t Frame;
+    
+    
+    /** A cursor that remembers the segment that the last conversion was
+	done in, to make conversions of consecutive times faster. A cursor
+	should only be used in the reader thread. */
+    class Cursor {
+    public:
+      
+      /** Create a cursor that does not point to any segment yet. */
+      Cursor() throw();
+    
+    private:
+      
+      friend class TempoMap;
+      
+      /** The index of the segment of the last conversion. */
+      size_t m_index;
+      
+      /** The version of the table that @c m_index is for, or 0. */
+      uint64_t m_version;
+    
+    };
+    
+    
+    /** Create a new tempo map with the given sample rate and a single 
+	tempo of @c bpm beats per minute. */
+    TempoMap(double frame_rate, double bpm = 120) throw(std::bad_alloc);
+    
+    /** Release all memory used by the map. */
+    ~TempoMap() throw();
+    
+    /** Return the frame rate. */
+    double get_frame_rate() const throw();
+    
+    /** Set the tempo to @c bpm beats per minute from @c st until the next
+	tempo change. If there is already a tempo change at @c st it is 
+	modified, otherwise a new one is added. This function is @b not
+	realtime safe.
+	
+	@throw std::bad_alloc if the new table could not be allocated
+	@throw std::out_of_range if @c st is earlier than SongTime(0, 0)
+	@throw std::invalid_argument if @c bpm is not positive
+    */
+    void add_change(SongTime const& st, double bpm)
+      throw(std::bad_alloc, std::out_of_range, std::invalid_argument);
+    
+    /** Remove the tempo change at @c st. Returns @c false if there is no
+	tempo change at @c st or if @c st is SongTime(0, 0), since the first 
+	tempo change can not be removed. This function is @b not realtime 
+	safe.
+	
+	@throw std::bad_alloc if the new table could not be allocated
+    */
+    bool remove_change(SongTime const& st) throw(std::bad_alloc);
+    
+    /** @name Read-only thread
+	These functions are realtime safe and may be called from the 
+	reader thread.
+	@{ */
+    
+    /** Return the tempo at @c st, in beats per minute. */
+    double get_bpm(SongTime const& st) const throw();
+    
+    /** Return the song time at frame @c frame. */
+    SongTime frame_to_songtime(Frame frame) const throw();
+    
+    /** Return the song time at frame @c frame, starting the search at
+	@c cursor and updating it. */
+    SongTime frame_to_songtime(Frame frame, Cursor& cursor) const throw();
+    
+    /** Return the frame at song time @c st. */
+    Frame songtime_to_frame(SongTime const& st) const throw();
+    
+    /** Return the frame at song time @c st, starting the search at 
+	@c cursor and updating it. */
+    Frame songtime_to_frame(SongTime const& st, Cursor& cursor) const 
+      throw();
     
+    /** Tell the map that it's OK to deallocate replaced tables. This
+	works like LinkedList::reader_holds_no_iterator(), but Cursor
+	objects stay valid. */
+    void reader_holds_no_iterator() throw();
+    
+    /** @} */
     
   private:
     
+    /** Copying is not allowed. */
+    TempoMap(TempoMap const&) = delete;
+    
+    /** Assignment is not allowed. */
+    TempoMap& operator=(TempoMap const&) = delete;
+    
+    /** Find the segment in @c table containing @c frame, using and 
+	updating @c cursor. */
+    static Segment const& find_frame(Table const& table, Frame frame, 
+				     Cursor& cursor) throw();
+    
+    /** Find the segment in @c table containing @c st, using and updating 
+	@c cursor. */
+    static Segment const& find_time(Table const& table, SongTime const& st,
+				    Cursor& cursor) throw();
+    
+    /** Recompute the cached frame offsets and tempo factors of all 
+	segments in @c table. */
+    void update_frames(Table& table) const throw();
+    
+    /** Give @c table a new version number, publish it and retire the 
+	current table. */
+    void publish(Table* table) throw();
+    
+    
+    /** The frame rate. */
+    double m_frame_rate;
+    
+    /** The current table. */
+    AtomicPtr<Table> m_table;
+    
+    /** The version of the last table that was built. */
+    uint64_t m_version;
+    
+    /** The reclamation domain for replaced tables. */
+    EpochDomain m_domain;
+    
+    /** The slot in m_domain that reader_holds_no_iterator() uses. */
+    int m_reader;
+    
+    /** The replaced tables that the reader may still be using. */
+    EpochLimbo<Table, RetirePolicy> m_retired;
+  
   };
 
 
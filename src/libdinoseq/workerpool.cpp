@@ -0,0 +1,146 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cerrno>
+#include <cstring>
+
+#include <sched.h>
+
+#include "workerpool.hpp"
+
+
+namespace Dino {
+
+
+  using std::bad_alloc;
+  using std::runtime_error;
+
+
+  WorkerPool::WorkerPool(unsigned workers, int rt_priority)
+    throw(bad_alloc, runtime_error)
+    : m_workers(workers > 0 ? workers : 1),
+      m_threads(new Thread[m_workers - 1]),
+      m_job(0),
+      m_data(0),
+      m_quit(0) {
+
+    if (sem_init(&m_done, 0, 0))
+      throw runtime_error("Could not create semaphore for worker pool");
+
+    for (unsigned i = 0; i < m_workers - 1; ++i) {
+      Thread& t = m_threads[i];
+      t.pool = this;
+      t.index = i + 1;
+      if (sem_init(&t.start, 0, 0)) {
+	stop(i);
+	sem_destroy(&m_done);
+	throw runtime_error("Could not create semaphore for worker thread");
+      }
+      try {
+	spawn(t, rt_priority);
+      }
+      catch (...) {
+	sem_destroy(&t.start);
+	stop(i);
+	sem_destroy(&m_done);
+	throw;
+      }
+    }
+  }
+
+
+  WorkerPool::~WorkerPool() throw() {
+    stop(m_workers - 1);
+    sem_destroy(&m_done);
+  }
+
+
+  unsigned WorkerPool::get_workers() const throw() {
+    return m_workers;
+  }
+
+
+  void WorkerPool::run(Job job, void* data) throw() {
+    m_job = job;
+    m_data = data;
+
+    // wake up the spawned workers, sem_post() is a memory barrier so they
+    // will see the new job
+    for (unsigned i = 0; i < m_workers - 1; ++i)
+      sem_post(&m_threads[i].start);
+
+    // do our own share
+    job(data, 0);
+
+    // and wait for the others to finish
+    for (unsigned i = 0; i < m_workers - 1; ++i) {
+      while (sem_wait(&m_done) && errno == EINTR);
+    }
+  }
+
+
+  void* WorkerPool::thread_main(void* arg) {
+    Thread& t = *static_cast<Thread*>(arg);
+    WorkerPool& pool = *t.pool;
+    while (true) {
+      while (sem_wait(&t.start) && errno == EINTR);
+      if (pool.m_quit.get())
+	break;
+      pool.m_job(pool.m_data, t.index);
+      sem_post(&pool.m_done);
+    }
+    return 0;
+  }
+
+
+  void WorkerPool::spawn(Thread& t, int rt_priority) throw(runtime_error) {
+
+    // try to create a realtime thread first if we have been asked to
+    if (rt_priority > 0) {
+      pthread_attr_t attr;
+      sched_param param;
+      std::memset(&param, 0, sizeof(param));
+      param.sched_priority = rt_priority;
+      pthread_attr_init(&attr);
+      pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+      pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+      pthread_attr_setschedparam(&attr, &param);
+      int result = pthread_create(&t.thread, &attr, &thread_main, &t);
+      pthread_attr_destroy(&attr);
+      if (result == 0)
+	return;
+    }
+
+    // if that fails, or we don't need RT scheduling, use the defaults
+    if (pthread_create(&t.thread, 0, &thread_main, &t))
+      throw runtime_error("Could not create worker thread");
+  }
+
+
+  void WorkerPool::stop(unsigned n) throw() {
+    m_quit.set(1);
+    for (unsigned i = 0; i < n; ++i)
+      sem_post(&m_threads[i].start);
+    for (unsigned i = 0; i < n; ++i) {
+      pthread_join(m_threads[i].thread, 0);
+      sem_destroy(&m_threads[i].start);
+    }
+  }
+
+
+}
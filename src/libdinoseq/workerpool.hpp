@@ -0,0 +1,130 @@
+/*****************************************************************************
+    libdinoseq - a library for MIDI sequencing
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <memory>
+#include <new>
+#include <stdexcept>
+
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "atomicint.hpp"
+
+
+namespace Dino {
+  
+  
+  /** A pool of pre-spawned worker threads that can run a job in parallel.
+      The threads are created in the constructor and then sleep on a
+      semaphore until run() is called, so running a job does not allocate
+      any memory or create any threads. The thread calling run() acts as
+      worker 0 and runs its share of the job itself, so a pool with N
+      workers only spawns N - 1 threads.
+      
+      Only one thread may call run() at a time.
+      
+      @ingroup seqengine
+  */
+  class WorkerPool {
+  public:
+    
+    /** The type of the jobs that the workers run. @c data is the pointer
+	that was passed to run(), @c worker is the index of the worker
+	running the job, in the range [0, get_workers()). */
+    typedef void (*Job)(void* data, unsigned worker);
+    
+    /** Create a new pool with @c workers workers, counting the thread that
+	will call run(). If @c rt_priority is larger than 0 the threads will
+	be created with @c SCHED_FIFO scheduling at that priority if
+	possible, otherwise they fall back to the default scheduling policy.
+	This function is @b not realtime safe.
+	
+	@throw std::bad_alloc if the thread data could not be allocated
+	@throw std::runtime_error if the threads could not be created
+    */
+    WorkerPool(unsigned workers, int rt_priority = 0)
+      throw(std::bad_alloc, std::runtime_error);
+    
+    /** Stop all threads and wait for them to finish. This function is
+	@b not realtime safe. */
+    ~WorkerPool() throw();
+    
+    /** Return the number of workers, including the calling thread. */
+    unsigned get_workers() const throw();
+    
+    /** Run @c job once in every worker and wait for all of them to finish.
+	This function does not allocate memory or take any locks, it only
+	posts and waits on semaphores. */
+    void run(Job job, void* data) throw();
+  
+  private:
+    
+    /** Per-thread data. */
+    struct Thread {
+      
+      /** The pool that this thread belongs to. */
+      WorkerPool* pool;
+      
+      /** The worker index of this thread. */
+      unsigned index;
+      
+      /** The thread handle. */
+      pthread_t thread;
+      
+      /** Posted by run() when there is a new job to do. */
+      sem_t start;
+    };
+    
+    /** The function that the spawned threads execute. */
+    static void* thread_main(void* arg);
+    
+    /** Create the thread for @c t. */
+    void spawn(Thread& t, int rt_priority) throw(std::runtime_error);
+    
+    /** Stop and join the first @c n threads. */
+    void stop(unsigned n) throw();
+    
+    
+    /** The number of workers, including the thread calling run(). */
+    unsigned m_workers;
+    
+    /** The spawned threads. There are m_workers - 1 of them. */
+    std::unique_ptr<Thread[]> m_threads;
+    
+    /** Posted by every spawned worker when it has finished a job. */
+    sem_t m_done;
+    
+    /** The current job. */
+    Job m_job;
+    
+    /** The data pointer for the current job. */
+    void* m_data;
+    
+    /** Set to 1 when the threads should exit. */
+    AtomicInt m_quit;
+  
+  };
+
+
+}
+
+
+#endif
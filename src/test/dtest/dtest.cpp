@@ -19,18 +19,23 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <map>
 #include <memory>
 #include <stdexcept>
 
 #include <dlfcn.h>
+#ifdef __linux__
+#include <sched.h>
+#endif
 
 #include "dtest.hpp"
 
 
 using std::cout;
 using std::endl;
+using std::ofstream;
 using std::runtime_error;
 using std::string;
 using std::unique_ptr;
@@ -79,8 +84,14 @@ namespace {
       }
     }
     
-    /** Run all tests and suites and print some info. */
-    bool run(size_t indent = 0) {
+    /** Return @c true if there are no tests or suites. */
+    bool empty() const {
+      return m_tests.empty() && m_suites.empty();
+    }
+    
+    /** Run all tests and suites and print some info. @c prefix is the 
+	name of this suite, including its parent suites. */
+    bool run(size_t indent = 0, string const& prefix = "") {
       bool passed = true;
       string indent_str(indent, ' ');
       int good = 0, bad = 0;
@@ -90,6 +101,7 @@ namespace {
 	  DTest::state.indent = indent;
 	  DTest::state.good = DTest::state.bad = 0;
 	  cout<<indent_str<<"* "<<ti->first<<": "<<endl;
+	  DTest::state.bench = prefix + ti->first;
 	  try {
 	    ti->second();
 	  }
@@ -115,7 +127,7 @@ namespace {
 	good = 0; bad = 0;
 	for (auto si = m_suites.begin(); si != m_suites.end(); ++si) {
 	  cout<<indent_str<<"* Suite: "<<si->first<<endl;
-	  if (si->second.run(indent + 2))
+	  if (si->second.run(indent + 2, prefix + si->first + "::"))
 	    ++good;
 	  else
 	    ++bad;
@@ -148,13 +160,84 @@ namespace {
   }
   
   
+  /** Return @c s quoted as a JSON string. */
+  string json_string(string const& s) {
+    string result = "\"";
+    for (size_t i = 0; i < s.size(); ++i) {
+      if (s[i] == '"' || s[i] == '\\')
+	result += '\\';
+      if (static_cast<unsigned char>(s[i]) < 0x20)
+	continue;
+      result += s[i];
+    }
+    return result + '"';
+  }
+  
+  
+  /** Write all benchmark results to the file @c name. */
+  void write_json(char const* name) {
+    ofstream os(name);
+    os.precision(9);
+    os<<"{\n  \"benchmarks\": ["<<endl;
+    for (size_t i = 0; i < DTest::state.results.size(); ++i) {
+      DTest::State::Result const& r = DTest::state.results[i];
+      os<<"    { \"name\": "<<json_string(r.name)
+	<<", \"reps\": "<<r.reps
+	<<", \"warmup\": "<<DTest::state.warmup
+	<<", \"median\": "<<r.median
+	<<", \"mad\": "<<r.mad
+	<<", \"min\": "<<r.min
+	<<", \"ops\": "<<r.ops
+	<<", \"ops_per_second\": "<<(r.ops / r.median)<<" }"
+	<<(i + 1 < DTest::state.results.size() ? "," : "")<<endl;
+    }
+    os<<"  ]\n}"<<endl;
+    if (!os)
+      throw runtime_error(string("Could not write ") + name);
+  }
+  
+  
+  /** Pin this process and all threads it creates to CPU @c cpu. */
+  void pin_to_cpu(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set))
+      throw runtime_error("Could not pin the benchmarks to the CPU");
+#else
+    throw runtime_error("CPU pinning is not supported on this platform");
+#endif
+  }
+
+
 }
 
   
 int main(int argc, char** argv) {
   
-  /* If there's an argument, load that. Otherwise, load ourself. */
-  char const* lib = (argc > 1 ? argv[1] : argv[0]);
+  /* Parse the options. The first non-option argument is the library. */
+  char const* lib = argv[0];
+  char const* json = 0;
+  bool bench = false;
+  for (int i = 1; i < argc; ++i) {
+    string arg = argv[i];
+    bool has_value = (i + 1 < argc);
+    if (arg == "--bench")
+      bench = true;
+    else if (arg == "--reps" && has_value)
+      DTest::state.reps = std::atoi(argv[++i]);
+    else if (arg == "--warmup" && has_value)
+      DTest::state.warmup = std::atoi(argv[++i]);
+    else if (arg == "--cpu" && has_value)
+      pin_to_cpu(std::atoi(argv[++i]));
+    else if (arg == "--json" && has_value)
+      json = argv[++i];
+    else if (arg.substr(0, 2) == "--")
+      throw runtime_error("Unknown option " + arg);
+    else
+      lib = argv[i];
+  }
   
   /* First, get the list of functions that we should run. */
   unique_ptr<char[]> real_symbol_cmd(new char[std::strlen(symbol_cmd) - 2 +
@@ -162,9 +245,10 @@ int main(int argc, char** argv) {
   std::sprintf(real_symbol_cmd.get(), symbol_cmd, lib);
   auto cmd_pipe = make_unique(popen(real_symbol_cmd.get(), "r"), &pclose);
   
-  /* Then, build the test suites. */
+  /* Then, build the test suites, with the benchmarks in their own tree. */
   char line[256];
   TestSuite root;
+  TestSuite benchmarks;
   auto self = make_unique(dlopen(lib, RTLD_LAZY | RTLD_GLOBAL), &dlclose);
   if (!self)
     throw runtime_error(string("Could not dlopen() ") + lib);
@@ -181,7 +265,20 @@ int main(int argc, char** argv) {
     char* i;
     for (i = space + 1; *i != 0 && *i != '\n'; ++i);
     *i = 0;
-    root.add_test(space + 1, dltestsym(self.get(), line));
+    string name = space + 1;
+    if (name.find("::dtest_bench_") != string::npos)
+      benchmarks.add_test(name, dltestsym(self.get(), line));
+    else
+      root.add_test(name, dltestsym(self.get(), line));
+  }
+  
+  /* Run the benchmarks if we were asked to, or if there are no tests. */
+  if (bench || root.empty()) {
+    cout<<"Running benchmarks..."<<endl;
+    bool passed = benchmarks.run();
+    if (json)
+      write_json(json);
+    return passed ? 0 : 1;
   }
   
   /* And run the test suites. */
@@ -19,10 +19,16 @@
 #ifndef DTEST_HPP
 #define DTEST_HPP
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <string>
 #include <typeinfo>
+#include <vector>
+
+#include <time.h>
 
 /** @mainpage
     This is the documentation for DTest, a simple testing framework for
@@ -69,6 +75,37 @@
     throw an exception (DTEST_THROW()), and that it throws an exception of
     a certain type (DTEST_THROW_TYPE()).
     
+    Functions whose names begin with @c dtest_bench_ are benchmarks. They
+    are not run as tests, but only when the program is given the 
+    @c --bench option, or when it contains no tests at all. A benchmark
+    function sets up whatever it needs and then measures one or more code
+    snippets with DTEST_BENCH():
+    
+    @code
+    namespace MyBench {
+      
+      void dtest_bench_sort() {
+	std::vector<int> v(1000000);
+	DTEST_BENCH("std::sort, 1M ints", v.size(), 
+		    std::generate(v.begin(), v.end(), rand);
+		    std::sort(v.begin(), v.end()));
+      }
+    
+    }
+    @endcode
+    
+    Every snippet is run a few times to warm up and then a number of
+    times while it is timed, and the median and the median absolute 
+    deviation of the running times are reported. These options can be
+    given to the program to control the benchmarks:
+    
+    - @c --reps @c N runs every snippet @c N times (default 10)
+    - @c --warmup @c N runs every snippet @c N times before timing it 
+      (default 1)
+    - @c --cpu @c N pins the program to CPU number @c N, including any 
+      threads it creates
+    - @c --json @c FILE writes all results to @c FILE in JSON format
+    
     Test programs need to be compiled with @c -fPIC and @c -pie, and linked with
     @c -fPIC, @c -pie, @c -ldl and @c -rdynamic. This is because the program
     will @c dlopen() itself to get pointers to the test functions.
@@ -93,7 +130,7 @@ namespace DTest {
     
     /** @internal
 	Resets the indentation to 0. */
-    State() : indent(0), good(0), bad(0) { }
+    State() : indent(0), good(0), bad(0), warmup(1), reps(10) { }
     
     /** @internal
 	The current indentation level. */
@@ -106,8 +143,64 @@ namespace DTest {
     /** @internal
 	The bad counter. */
     size_t bad;
+    
+    /** @internal
+	The number of untimed runs of every benchmark snippet. */
+    unsigned warmup;
+    
+    /** @internal
+	The number of timed runs of every benchmark snippet. */
+    unsigned reps;
+    
+    /** @internal
+	The name of the benchmark function that is running. */
+    std::string bench;
+    
+    /** @internal
+	The result of a benchmark snippet. */
+    struct Result {
+      
+      /** The benchmark function name and the snippet name. */
+      std::string name;
+      
+      /** The number of timed runs. */
+      unsigned reps;
+      
+      /** The median running time in seconds. */
+      double median;
+      
+      /** The median absolute deviation of the running times. */
+      double mad;
+      
+      /** The shortest running time. */
+      double min;
+      
+      /** The number of operations done in every run. */
+      double ops;
+    };
+    
+    /** @internal
+	The results of all benchmark snippets that have been run. */
+    std::vector<Result> results;
   } state;
   
+  /** @internal
+      Return the time in seconds from a monotonic clock. */
+  inline double now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+  }
+  
+  /** @internal
+      Return the median of @c v, which must not be empty. */
+  inline double median(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    size_t n = v.size();
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+  }
+
+
 }
 
 
@@ -119,6 +212,46 @@ namespace DTest {
 extern DTest::State* _dtest;
 
 
+namespace DTest {
+  
+  /** @internal
+      Run the benchmark snippet @c f, which does @c ops operations, and 
+      record and print the results. */
+  template <typename F>
+  void bench(std::string const& name, double ops, F f) {
+    for (unsigned i = 0; i < _dtest->warmup; ++i)
+      f();
+    std::vector<double> times;
+    for (unsigned i = 0; i < std::max(_dtest->reps, 1u); ++i) {
+      double start = now();
+      f();
+      times.push_back(now() - start);
+    }
+    State::Result r;
+    r.name = _dtest->bench + '/' + name;
+    r.reps = times.size();
+    r.median = median(times);
+    std::vector<double> dev;
+    for (size_t i = 0; i < times.size(); ++i)
+      dev.push_back(std::fabs(times[i] - r.median));
+    r.mad = median(dev);
+    r.min = *std::min_element(times.begin(), times.end());
+    r.ops = ops;
+    _dtest->results.push_back(r);
+    // format in a local stream so std::cout keeps its own flags
+    std::ostringstream os;
+    os<<std::string(_dtest->indent + 2, ' ')<<"+ "
+      <<std::left<<std::setw(36)<<name<<std::right<<std::fixed
+      <<std::setprecision(3)<<std::setw(12)<<(r.median * 1000)<<" ms "
+      <<"+- "<<std::setw(8)<<(r.mad * 1000)<<" ms "
+      <<std::setprecision(0)<<std::setw(14)<<(ops / r.median)
+      <<" ops/s";
+    std::cout<<os.str()<<std::endl;
+  }
+
+}
+
+
 /** @internal
     Run the given code block (must be enclosed in curly brackets) as a lambda
     function. */
@@ -232,4 +365,12 @@ extern DTest::State* _dtest;
   })
 
 
+/** Time the code snippet @c code, which does @c ops operations, and report
+    the result with the name @c name. This should only be used in benchmark
+    functions. @c code should be a list of statements, separated by @c ;,
+    with no trailing @c ;. */
+#define DTEST_BENCH(name, ops, ...)					\
+  DTest::bench(name, ops, [&]() -> void { __VA_ARGS__; })
+
+
 #endif
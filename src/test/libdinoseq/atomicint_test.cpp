@@ -57,4 +57,19 @@ namespace AtomicIntTest {
   }
 
 
+  void dtest_ordered_get_set() {
+    AtomicInt ai = 42;
+    
+    DTEST_TRUE(ai.get_acquire() == 42 && ai.get_relaxed() == 42);
+    
+    ai.set_release(666);
+    
+    DTEST_TRUE(ai.get() == 666);
+    
+    ai.set_relaxed(7);
+    
+    DTEST_TRUE(ai.get_acquire() == 7);
+  }
+
+
 }
@@ -16,6 +16,9 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#include <pthread.h>
+#include <sched.h>
+
 #include "dtest.hpp"
 #include "atomicptr.hpp"
 
@@ -53,4 +56,79 @@ namespace AtomicPtrTest {
   }
 
 
+  void dtest_ordered_get_set() {
+    int a = 42;
+    int b = 666;
+    AtomicPtr<int> ap = &a;
+    
+    DTEST_TRUE(ap.get_acquire() == &a && ap.get_relaxed() == &a);
+    
+    ap.set_release(&b);
+    
+    DTEST_TRUE(ap.get() == &b);
+    
+    ap.set_relaxed(&a);
+    
+    AtomicPtr<int> const& ap_c = ap;
+    
+    DTEST_TRUE(ap_c.get_acquire() == &a && ap_c.get_relaxed() == &a);
+  }
+  
+  
+  /** A message with plain, non-atomic fields. */
+  struct Message {
+    int a;
+    int b;
+    int c;
+  };
+  
+  
+  /** The messages and the slot they are passed through. */
+  struct Channel {
+    Channel() : slot(0), ok(true) {}
+    static unsigned const count = 100000;
+    Message messages[count];
+    AtomicPtr<Message> slot;
+    bool ok;
+  };
+  
+  
+  void* receive(void* arg) {
+    Channel& ch = *static_cast<Channel*>(arg);
+    for (unsigned i = 0; i < Channel::count; ++i) {
+      Message* m;
+      while (!(m = ch.slot.get_acquire()))
+	sched_yield();
+      ch.ok = ch.ok && m->a == int(i) && m->b == 2 * m->a && m->c == 3 * m->a;
+      ch.slot.set_release(0);
+    }
+    return 0;
+  }
+  
+  
+  void dtest_message_passing() {
+    // the fields are written with plain stores before the pointer is 
+    // published with release ordering, so the receiver must always see 
+    // them. On weakly ordered CPUs, or under ThreadSanitizer, this fails
+    // if the ordering is missing.
+    Channel* ch = new Channel;
+    pthread_t thread;
+    pthread_create(&thread, 0, &receive, ch);
+    for (unsigned i = 0; i < Channel::count; ++i) {
+      Message* m = &ch->messages[i];
+      m->a = i;
+      m->b = 2 * i;
+      m->c = 3 * i;
+      while (ch->slot.get_acquire())
+	sched_yield();
+      ch->slot.set_release(m);
+    }
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(ch->ok);
+    
+    delete ch;
+  }
+
+
 }
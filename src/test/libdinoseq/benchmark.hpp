@@ -0,0 +1,67 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+/** @file
+    Some helpers for the libdinoseq benchmarks. The benchmarks are 
+    @c dtest_bench_ functions in the @c *_bench.cpp files, and are run by
+    the DTest harness. They are not part of the test suite since their 
+    running times depend on the machine, but they should be run before 
+    and after any change that may affect the performance of the code they
+    measure. */
+
+
+namespace Benchmark {
+  
+  
+  /** Return the number of online CPUs. */
+  unsigned cpus();
+  
+  
+  /** A counter for the hardware cache misses in the calling thread. It
+      uses perf_event_open() where that is available, otherwise it does 
+      nothing and stop() returns -1. */
+  class CacheMisses {
+  public:
+    
+    CacheMisses();
+    ~CacheMisses();
+    
+    /** Reset and start the counter. */
+    void start();
+    
+    /** Stop the counter and return the number of cache misses since 
+	start(), or -1 if the counter is not available. */
+    long long stop();
+  
+  private:
+    
+    CacheMisses(CacheMisses const&);
+    CacheMisses& operator=(CacheMisses const&);
+    
+    int m_fd;
+  
+  };
+
+
+}
+
+
+#endif
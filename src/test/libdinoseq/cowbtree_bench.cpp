@@ -0,0 +1,153 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include "cowbtree.hpp"
+#include "dtest.hpp"
+#include "epochdomain.hpp"
+#include "nodepool.hpp"
+#include "nodeskiplist.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace CowBTreeBench {
+  
+  
+  typedef CowBTree<int, 64, 16, PoolAllocator> Tree;
+  
+  typedef NodeSkipList<int, 2, 20, PoolAllocator> List;
+  
+  
+  /** Return @c n pseudo-random integers. */
+  vector<int> random_values(unsigned n) {
+    vector<int> v(n);
+    unsigned x = 1;
+    for (unsigned i = 0; i < n; ++i) {
+      x = x * 1664525 + 1013904223;
+      v[i] = x >> 1;
+    }
+    return v;
+  }
+  
+  
+  /** Scan and search 1M elements in the tree and in a skip list that have
+      been loaded in bulk, with the readers inside an EpochDomain read-side
+      section like a Curve reader would be. */
+  void dtest_bench_read() {
+    unsigned const n = 1000000;
+    vector<int> values = random_values(n);
+    vector<int> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    
+    EpochDomain d;
+    Tree t(d);
+    t.assign(sorted.begin(), sorted.end());
+    List l;
+    l.seed(1);
+    l.bulk_insert(l.end_marker(), sorted.begin(), sorted.end());
+    
+    volatile long sum = 0;
+    DTEST_BENCH("scan, CowBTree, 1M elements", n,
+		int token = d.enter();
+		long s = 0;
+		for (Tree::ConstIterator i = t.begin(); i != t.end(); ++i)
+		  s += *i;
+		d.leave(token);
+		sum = s);
+    
+    DTEST_BENCH("scan, NodeSkipList, 1M elements", n,
+		int token = d.enter();
+		long s = 0;
+		List::NodeBase const* i = l.first_node();
+		for ( ; i != l.end_marker();
+		      i = i->links()[0].next.get_acquire())
+		  s += static_cast<List::Node const*>(i)->data;
+		d.leave(token);
+		sum = s);
+    
+    DTEST_BENCH("lower_bound, CowBTree, 1M elements", n,
+		int token = d.enter();
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (t.lower_bound(values[i]) != t.end());
+		d.leave(token);
+		sum = s);
+    
+    DTEST_BENCH("lower_bound, NodeSkipList, 1M elements", n,
+		int token = d.enter();
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (l.lower_bound(values[i]) != l.end_marker());
+		d.leave(token);
+		sum = s);
+  }
+  
+  
+  /** Insert 200k random values one at a time and then erase them again,
+      which copies a path in the tree for every edit. The skip list nodes
+      are deallocated directly since there are no readers. */
+  void dtest_bench_edit() {
+    unsigned const n = 200000;
+    vector<int> values = random_values(n);
+    
+    DTEST_BENCH("insert and erase, CowBTree, 200k elements", 2 * n,
+		EpochDomain d;
+		Tree t(d);
+		for (unsigned i = 0; i < n; ++i)
+		  t.insert(values[i]);
+		for (unsigned i = 0; i < n; ++i)
+		  t.erase(t.lower_bound(values[i])));
+    
+    DTEST_BENCH("insert and erase, NodeSkipList, 200k elements", 2 * n,
+		List l;
+		l.seed(1);
+		for (unsigned i = 0; i < n; ++i)
+		  l.insert(l.upper_bound(values[i]), l.create_node(values[i]));
+		for (unsigned i = 0; i < n; ++i) {
+		  List::Node* node =
+		    static_cast<List::Node*>(l.lower_bound(values[i]));
+		  l.remove(node);
+		  l.destroy_node(node);
+		});
+  }
+  
+  
+  /** Load 1M sorted values in bulk. */
+  void dtest_bench_assign() {
+    unsigned const n = 1000000;
+    vector<int> sorted = random_values(n);
+    std::sort(sorted.begin(), sorted.end());
+    
+    DTEST_BENCH("assign, CowBTree, 1M elements", n,
+		EpochDomain d;
+		Tree t(d);
+		t.assign(sorted.begin(), sorted.end()));
+    
+    DTEST_BENCH("bulk_insert, NodeSkipList, 1M elements", n,
+		List l;
+		l.seed(1);
+		l.bulk_insert(l.end_marker(), sorted.begin(), sorted.end()));
+  }
+
+
+}
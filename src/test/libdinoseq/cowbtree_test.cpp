@@ -0,0 +1,362 @@
+/*****************************************************************************
+    libdinoseq_test - unit test suite for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <iterator>
+#include <set>
+#include <vector>
+
+#include <pthread.h>
+
+#include "atomicint.hpp"
+#include "cowbtree.hpp"
+#include "dtest.hpp"
+#include "epochdomain.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace CowBTreeTest {
+  
+  
+  /** A tree with small nodes, so the tests get many levels. */
+  typedef CowBTree<int, 4, 3> SmallTree;
+  
+  
+  /** An element that is ordered by its key only and counts how many
+      copies are alive. */
+  struct Counted {
+    Counted(int k, int s) : key(k), seq(s) { ++alive; }
+    Counted(Counted const& c) : key(c.key), seq(c.seq) { ++alive; }
+    ~Counted() { --alive; }
+    bool operator<(Counted const& c) const { return key < c.key; }
+    int key;
+    int seq;
+    static int alive;
+  };
+  
+  int Counted::alive = 0;
+  
+  
+  /** Return @c true if the tree has the same elements as @c ref. */
+  template <typename Tree>
+  bool same(Tree const& tree, multiset<int> const& ref) {
+    return tree.size() == ref.size() &&
+      std::equal(ref.begin(), ref.end(), tree.begin());
+  }
+  
+  
+  void dtest_constructor() {
+    EpochDomain d;
+    DTEST_NOTHROW(CowBTree<int> t(d));
+    CowBTree<int> t(d);
+    DTEST_TRUE(t.size() == 0);
+    DTEST_TRUE(t.begin() == t.end());
+    DTEST_TRUE(t.lower_bound(0) == t.end());
+  }
+  
+  
+  void dtest_insert() {
+    EpochDomain d;
+    SmallTree t(d);
+    multiset<int> ref;
+    unsigned x = 1;
+    bool ok = true;
+    for (int i = 0; i < 2000; ++i) {
+      x = x * 1664525 + 1013904223;
+      int v = (x >> 8) % 500;
+      t.insert(v);
+      ref.insert(v);
+      if (i % 97 == 0)
+	ok = ok && same(t, ref);
+    }
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(same(t, ref));
+  }
+  
+  
+  void dtest_lower_upper_bound() {
+    EpochDomain d;
+    SmallTree t(d);
+    multiset<int> ref;
+    for (int i = 0; i < 300; ++i) {
+      t.insert((i * 37) % 100 * 2);
+      ref.insert((i * 37) % 100 * 2);
+    }
+    
+    bool ok = true;
+    for (int v = -1; v < 202; ++v) {
+      auto lb = ref.lower_bound(v);
+      auto ub = ref.upper_bound(v);
+      ok = ok &&
+	std::distance(t.begin(), t.lower_bound(v)) ==
+	std::distance(ref.begin(), lb) &&
+	std::distance(t.begin(), t.upper_bound(v)) ==
+	std::distance(ref.begin(), ub);
+    }
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(t.lower_bound(199) == t.end());
+    
+    DTEST_TRUE(*t.lower_bound(197) == 198);
+  }
+  
+  
+  void dtest_equal_order() {
+    // elements with the same key stay in the order they were inserted
+    EpochDomain d;
+    CowBTree<Counted, 4, 3> t(d);
+    for (int i = 0; i < 200; ++i)
+      t.insert(Counted(i % 5, i));
+    
+    bool ok = true;
+    auto i = t.begin();
+    for (int k = 0; k < 5; ++k) {
+      for (int s = k; s < 200; s += 5, ++i)
+	ok = ok && i->key == k && i->seq == s;
+    }
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(i == t.end());
+  }
+  
+  
+  void dtest_decrement() {
+    EpochDomain d;
+    SmallTree t(d);
+    
+    DTEST_TRUE(t.begin() == t.end());
+    
+    for (int i = 0; i < 300; ++i)
+      t.insert(i);
+    
+    // stepping back from the end visits all elements in reverse order
+    bool ok = true;
+    auto i = t.end();
+    for (int v = 299; v >= 0; --v)
+      ok = ok && *--i == v;
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(i == t.begin());
+    
+    DTEST_TRUE(i.is_first() && !t.lower_bound(1).is_first() &&
+	       !t.end().is_first());
+    
+    auto j = t.lower_bound(150);
+    j--;
+    
+    DTEST_TRUE(*j == 149 && *++j == 150);
+  }
+  
+  
+  void dtest_insert_at_set() {
+    EpochDomain d;
+    CowBTree<Counted, 4, 3> t(d);
+    
+    // inserting before an element puts the new one before it even if they
+    // are equal, and inserting at the end appends
+    t.insert(t.end(), Counted(1, 0));
+    for (int i = 1; i < 100; ++i)
+      t.insert(t.begin(), Counted(1, i));
+    t.insert(t.end(), Counted(2, 100));
+    
+    bool ok = true;
+    auto i = t.begin();
+    for (int s = 99; s >= 0; --s, ++i)
+      ok = ok && i->key == 1 && i->seq == s;
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(i->key == 2 && ++i == t.end());
+    
+    // every element can be replaced without changing its position
+    for (int s = 0; s < 100; ++s) {
+      auto j = t.begin();
+      for (int k = 0; k < s; ++k)
+	++j;
+      t.set(j, Counted(1, s));
+    }
+    ok = true;
+    i = t.begin();
+    for (int s = 0; s < 100; ++s, ++i)
+      ok = ok && i->seq == s;
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(t.size() == 101);
+    
+    t.clear();
+    t.collect();
+    t.collect();
+    
+    DTEST_TRUE(Counted::alive == 0);
+  }
+  
+  
+  void dtest_erase() {
+    EpochDomain d;
+    SmallTree t(d);
+    multiset<int> ref;
+    for (int i = 0; i < 1000; ++i) {
+      t.insert(i % 250);
+      ref.insert(i % 250);
+    }
+    
+    // erase in an order that empties some leaves and leaves others small
+    unsigned x = 1;
+    bool ok = true;
+    while (!ref.empty()) {
+      x = x * 1664525 + 1013904223;
+      int v = (x >> 8) % 250;
+      if (ref.find(v) == ref.end())
+	continue;
+      t.erase(t.lower_bound(v));
+      ref.erase(ref.find(v));
+      if (ref.size() % 37 == 0)
+	ok = ok && same(t, ref);
+    }
+    
+    DTEST_TRUE(ok);
+    
+    DTEST_TRUE(t.size() == 0 && t.begin() == t.end());
+  }
+  
+  
+  void dtest_assign() {
+    EpochDomain d;
+    SmallTree t(d);
+    t.insert(5);
+    vector<int> v;
+    for (int i = 0; i < 1000; ++i)
+      v.push_back(i / 3);
+    
+    DTEST_TRUE(t.assign(v.begin(), v.end()));
+    
+    DTEST_TRUE(t.size() == v.size() &&
+	       std::equal(v.begin(), v.end(), t.begin()));
+    
+    // the tree can be edited after a bulk load
+    t.insert(500);
+    t.erase(t.lower_bound(0));
+    
+    DTEST_TRUE(t.size() == v.size() && *t.begin() == 0 &&
+	       *t.lower_bound(400) == 500);
+    
+    // an unsorted range is not loaded
+    v[500] = 0;
+    
+    DTEST_TRUE(!t.assign(v.begin(), v.end()));
+    
+    DTEST_TRUE(t.size() == v.size());
+    
+    t.clear();
+    
+    DTEST_TRUE(t.size() == 0 && t.begin() == t.end());
+  }
+  
+  
+  void dtest_reclaim() {
+    // without readers the replaced nodes are deallocated at the next edit
+    // and everything is deallocated with the tree
+    {
+      EpochDomain d;
+      CowBTree<Counted, 4, 3> t(d);
+      for (int i = 0; i < 100; ++i)
+	t.insert(Counted(i, 0));
+      
+      DTEST_TRUE(Counted::alive < 400);
+      
+      // a reader keeps the old nodes alive until it is quiescent
+      int r = d.register_reader();
+      int before = Counted::alive;
+      for (int i = 0; i < 100; ++i)
+	t.erase(t.begin());
+      
+      DTEST_TRUE(Counted::alive > before);
+      
+      d.quiescent(r);
+      t.collect();
+      t.collect();
+      
+      DTEST_TRUE(Counted::alive == 0);
+      
+      d.unregister_reader(r);
+    }
+    
+    DTEST_TRUE(Counted::alive == 0);
+  }
+  
+  
+  /** A tree that is scanned by another thread while it is changed. */
+  struct Reader {
+    Reader() : tree(domain) {}
+    EpochDomain domain;
+    SmallTree tree;
+    AtomicInt quit;
+    bool ok;
+  };
+  
+  
+  void* scan(void* arg) {
+    Reader& r = *static_cast<Reader*>(arg);
+    while (!r.quit.get()) {
+      // every version that the reader sees is sorted and complete, the
+      // writer keeps the values 0 and 1000 in the tree all the time
+      int token = r.domain.enter();
+      auto i = r.tree.begin();
+      int last = -1;
+      for ( ; i != r.tree.end(); ++i) {
+	r.ok = r.ok && !(*i < last);
+	last = *i;
+      }
+      r.ok = r.ok && last == 1000 && *r.tree.lower_bound(-5) == 0;
+      r.domain.leave(token);
+    }
+    return 0;
+  }
+  
+  
+  void dtest_concurrent_read() {
+    Reader r;
+    r.ok = true;
+    r.tree.insert(0);
+    r.tree.insert(1000);
+    pthread_t thread;
+    pthread_create(&thread, 0, &scan, &r);
+    for (int i = 0; i < 20000; ++i) {
+      int v = 1 + (i * 7919) % 998;
+      if (i % 3 != 2)
+	r.tree.insert(v);
+      else if (*r.tree.lower_bound(v) != 1000)
+	r.tree.erase(r.tree.lower_bound(v));
+    }
+    r.quit.set(1);
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(r.ok);
+  }
+
+
+}
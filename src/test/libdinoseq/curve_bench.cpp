@@ -0,0 +1,385 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#if defined(__GLIBC__) && \
+  (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2 1
+#endif
+
+#include "curve.hpp"
+#include "curvehistory.hpp"
+#include "curverecorder.hpp"
+#include "dtest.hpp"
+#include "eventbuffer.hpp"
+#include "sequencer.hpp"
+#include "smfreader.hpp"
+#include "smfwriter.hpp"
+#include "snapshot.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace CurveBench {
+  
+  
+  /** An EventBuffer that just counts the events. */
+  class CountingBuffer : public EventBuffer {
+  public:
+    CountingBuffer() : events(0) { }
+    bool write_event(SongTime const&, size_t, unsigned char const*) {
+      ++events;
+      return true;
+    }
+    size_t events;
+  };
+  
+  
+  /** The storages that are compared. */
+  Curve::Storage const storages[] = { Curve::SkipList, Curve::BTree };
+  
+  
+  /** Return the name of a benchmark for a storage. The SkipList names are
+      the same as before the BTree storage was added. */
+  string named(char const* name, Curve::Storage storage) {
+    return storage == Curve::BTree ? string(name) + ", BTree" : name;
+  }
+  
+  
+  /** Sequence a curve with a point every beat through 1024 beats, one 
+      period at a time, with the given interpolation mode and resolution. */
+  void bench_sequence(Curve::Interpolation mode, unsigned resolution,
+		      char const* name, 
+		      Curve::Storage storage = Curve::SkipList) {
+    unsigned const beats = 1024;
+    SongTime const period(0, 1 << 21);
+    
+    Curve c("Bench curve", SongTime(beats, 0), 7, storage);
+    c.set_interpolation(mode);
+    c.set_resolution(resolution);
+    for (unsigned i = 0; i < beats; ++i)
+      c.add_point(SongTime(i, 0), (i % 2) ? 0x7FFFFFFF : 0);
+    
+    CountingBuffer buf;
+    DTEST_BENCH(named(name, storage), beats,
+		auto pos = c.create_position(SongTime(0, 0));
+		for (SongTime from; from < SongTime(beats, 0); from += period)
+		  c.sequence(*pos, from + period, buf));
+  }
+  
+  
+  void dtest_bench_sequence() {
+    bench_sequence(Curve::Linear, 32, "linear, 32/beat, beats");
+    bench_sequence(Curve::Linear, 256, "linear, 256/beat, beats");
+    bench_sequence(Curve::Step, 256, "step, 256/beat, beats");
+    bench_sequence(Curve::Linear, 32, "linear, 32/beat, beats", Curve::BTree);
+    bench_sequence(Curve::Step, 256, "step, 256/beat, beats", Curve::BTree);
+  }
+  
+  
+  /** Sequence a curve with 1M points, 64 per beat, in periods that each
+      contain many points, which is mostly a test of how fast the points
+      can be walked through. */
+  void dtest_bench_sequence_dense() {
+    unsigned const points = 1000000;
+    SongTime const period(4, 0);
+    SongTime const end(points / 64, 0);
+    
+    for (Curve::Storage storage : storages) {
+      Curve c("Bench curve", end, 7, storage);
+      c.set_interpolation(Curve::Step);
+      c.set_resolution(64);
+      vector<Curve::Point> lane;
+      for (unsigned i = 0; i < points; ++i)
+	lane.push_back(Curve::Point(SongTime(i / 64, (i % 64) << 18), i));
+      c.add_points(&lane[0], &lane[0] + points);
+      
+      CountingBuffer buf;
+      DTEST_BENCH(named("step, 64/beat, 1M points", storage), points,
+		  auto pos = c.create_position(SongTime(0, 0));
+		  for (SongTime from; from < end; from += period)
+		    c.sequence(*pos, from + period, buf));
+    }
+  }
+  
+  
+  /** Look up random times in a curve with a million points, which is 
+      mostly a test of how fast the skip list can be traversed. */
+  void dtest_bench_search() {
+    unsigned const points = 1000000;
+    unsigned const lookups = 1000000;
+    
+    vector<SongTime> times(lookups);
+    unsigned x = 1;
+    for (unsigned i = 0; i < lookups; ++i) {
+      x = x * 1664525 + 1013904223;
+      times[i] = SongTime(x % (points - 1), x & 0xFFFFFF);
+    }
+    
+    for (Curve::Storage storage : storages) {
+      Curve c("Bench curve", SongTime(points, 0), 7, storage);
+      for (unsigned i = 0; i < points; ++i)
+	c.add_point(SongTime(i, 0), i);
+      
+      volatile int sum = 0;
+      DTEST_BENCH(named("lower_bound, 1M points", storage), lookups,
+		  int s = 0;
+		  for (unsigned i = 0; i < lookups; ++i)
+		    s += c.lower_bound(times[i])->m_value.get();
+		  sum = s);
+      
+      DTEST_BENCH(named("upper_bound, 1M points", storage), lookups,
+		  int s = 0;
+		  for (unsigned i = 0; i < lookups; ++i)
+		    s += (--c.upper_bound(times[i]))->m_value.get();
+		  sum = s);
+    }
+  }
+  
+  
+  /** Scrub through a curve with 100k points by relocating a position in
+      short steps, forward and backward. Forward steps search from the 
+      last node of the position, backward steps search from the head. */
+  void dtest_bench_scrub() {
+    unsigned const points = 100000;
+    unsigned const steps = 30000;
+    SongTime const step(3, 1 << 22);
+    SongTime const end(points, 0);
+    
+    for (Curve::Storage storage : storages) {
+      Curve c("Bench curve", end, 7, storage);
+      for (unsigned i = 0; i < points; ++i)
+	c.add_point(SongTime(i, 0), i);
+      
+      CountingBuffer buf;
+      auto pos = c.create_position(SongTime(0, 0));
+      
+      DTEST_BENCH(named("update_position, forward steps, 100k points", 
+			storage), steps,
+		  SongTime st;
+		  for (unsigned i = 0; i < steps; ++i) {
+		    st += step;
+		    c.update_position(*pos, st);
+		    c.sequence(*pos, st + SongTime(0, 1), buf);
+		  });
+      
+      DTEST_BENCH(named("update_position, backward steps, 100k points",
+			storage), steps,
+		  SongTime st = end;
+		  for (unsigned i = 0; i < steps; ++i) {
+		    st -= step;
+		    c.update_position(*pos, st);
+		    c.sequence(*pos, st + SongTime(0, 1), buf);
+		  });
+    }
+  }
+  
+  
+  /** Drag a selection of 2000 points in a curve with 100k points one 
+      tick to the right and change their values, with one move_point()
+      per point and with a single Transaction. */
+  void dtest_bench_transaction() {
+    unsigned const points = 100000;
+    unsigned const selected = 2000;
+    
+    SongTime const start(points / 2, 0);
+    
+    for (Curve::Storage storage : storages) {
+      Curve c("Bench curve", SongTime(points, 0), 7, storage);
+      for (unsigned i = 0; i < points; ++i)
+	c.add_point(SongTime(i, 0), i);
+      
+      // move the last point first so no point passes another
+      DTEST_BENCH(named("move_point, 2000 of 100k points", storage), selected,
+		  Curve::Iterator i = 
+		    c.lower_bound(start + SongTime(selected, 0));
+		  for (unsigned n = 0; n < selected; ++n) {
+		    --i;
+		    i = c.move_point(i, i->m_time + SongTime(0, 1), n);
+		  });
+      
+      Curve::Transaction t;
+      DTEST_BENCH(named("Transaction, 2000 of 100k points", storage), 
+		  selected,
+		  Curve::Iterator i = c.lower_bound(start);
+		  for (unsigned n = 0; n < selected; ++n, ++i)
+		    t.move_point(i, i->m_time + SongTime(0, 1), n);
+		  c.commit(t));
+    }
+  }
+  
+  
+  /** Take a snapshot of a curve with 100k points after editing one point,
+      compared to copying all points, and undo and redo the edit. */
+  void dtest_bench_version() {
+    unsigned const points = 100000;
+    
+    Curve c("Bench curve", SongTime(points, 0), 7);
+    for (unsigned i = 0; i < points; ++i)
+      c.add_point(SongTime(i, 0), i);
+    c.get_version();
+    
+    unsigned n = 0;
+    DTEST_BENCH("Copy all points, 100k points", 1,
+		vector<Curve::Point> copy(c.begin(), c.end()));
+    
+    DTEST_BENCH("Edit and get_version(), 100k points", 1,
+		Curve::Iterator i = c.lower_bound(SongTime(++n % points, 0));
+		c.move_point(i, i->m_time, n);
+		c.get_version());
+    
+    CurveHistory h(c);
+    c.move_point(c.lower_bound(SongTime(points / 2, 0)), 
+		 SongTime(points / 2, 0), 0);
+    h.checkpoint();
+    DTEST_BENCH("Undo and redo one edit, 100k points", 2,
+		h.undo();
+		h.redo());
+  }
+  
+  
+  /** Import a lane with 500k points into an empty curve, one point at 
+      a time and with add_points(). */
+  void dtest_bench_import() {
+    unsigned const points = 500000;
+    
+    vector<Curve::Point> lane;
+    for (unsigned i = 0; i < points; ++i)
+      lane.push_back(Curve::Point(SongTime(i / 16, (i % 16) << 20), i));
+    
+    for (Curve::Storage storage : storages) {
+      DTEST_BENCH(named("add_point, 500k points", storage), points,
+		  Curve c("Bench curve", SongTime(points, 0), 7, storage);
+		  for (unsigned i = 0; i < points; ++i)
+		    c.add_point(lane[i].m_time, lane[i].m_value.get()));
+      
+      DTEST_BENCH(named("add_points, 500k points", storage), points,
+		  Curve c("Bench curve", SongTime(points, 0), 7, storage);
+		  c.add_points(&lane[0], &lane[0] + points));
+    }
+  }
+  
+  
+  /** Import a MIDI file with 2M controller events into a curve, in 
+      batches of 64k points. */
+  void dtest_bench_smf_import() {
+    unsigned const events = 2000000;
+    char const* name = "/tmp/curve_bench.mid";
+    {
+      std::ofstream os(name);
+      SmfWriter smf(os);
+      for (unsigned i = 0; i < events; ++i) {
+	unsigned char data[] = { 0xB0, 7, 
+				 static_cast<unsigned char>(i & 0x7F) };
+	smf.write_event(SongTime(i / 64, (i % 64) << 18), 3, data);
+      }
+    }
+    
+    DTEST_BENCH("SmfReader -> Curve, 2M events", events,
+		Curve c("Bench curve", SongTime(events / 64 + 1, 0), 7);
+		CurveRecorder cr(c, 65536);
+		SmfReader smf(name);
+		smf.read_track(0, cr);
+		cr.flush());
+    std::remove(name);
+  }
+  
+  
+  /** Load a song with 1000 curves of 2000 points each, by adding the 
+      points one at a time, by opening a snapshot and by opening a 
+      snapshot and materialising all curves. */
+  void dtest_bench_snapshot() {
+    unsigned const curves = 1000;
+    unsigned const points = 2000;
+    char const* name = "/tmp/curve_bench.snap";
+    
+    auto fill = [&](Sequencer& seq) {
+      for (unsigned i = 0; i < curves; ++i) {
+	auto c = make_shared<Curve>("Bench curve", SongTime(points, 0), 7);
+	for (unsigned j = 0; j < points; ++j)
+	  c->add_point(SongTime(j, 0), j);
+	seq.add_sequencable(c);
+      }
+    };
+    {
+      Sequencer seq;
+      fill(seq);
+      vector<shared_ptr<EventBuffer>> buffers;
+      Snapshot::write(name, seq, buffers);
+    }
+    
+    DTEST_BENCH("add_point, 1000 x 2000 points", curves * points,
+		Sequencer seq;
+		fill(seq));
+    
+    DTEST_BENCH("Snapshot open, 1000 curves", curves,
+		Snapshot s(name));
+    
+    DTEST_BENCH("Snapshot restore, 1000 x 2000 points", curves * points,
+		Snapshot s(name);
+		Sequencer seq;
+		s.restore(seq, vector<shared_ptr<EventBuffer>>()));
+    std::remove(name);
+  }
+  
+  
+  /** Return the number of bytes that are allocated from the heap, or 0 if
+      the C library can't tell. */
+  size_t heap_bytes() {
+#ifdef HAVE_MALLINFO2
+    struct mallinfo2 mi = mallinfo2();
+    return mi.uordblks + mi.hblkhd;
+#else
+    return 0;
+#endif
+  }
+  
+  
+  /** Print the memory that every Curve object uses before any points are
+      added, including its storage on the heap. For a skip list most of it
+      is the head and end markers of the point list. A song with many short
+      curves pays this once per curve. */
+  void dtest_bench_memory() {
+    if (heap_bytes() == 0) {
+      DTEST_MSG("  memory per empty curve: not measured");
+      return;
+    }
+    unsigned const curves = 1000;
+    for (Curve::Storage storage : storages) {
+      vector<unique_ptr<Curve>> v;
+      v.reserve(curves);
+      size_t before = heap_bytes();
+      for (unsigned i = 0; i < curves; ++i)
+	v.emplace_back(new Curve("Bench curve", SongTime(1, 0), 7, storage));
+      ostringstream msg;
+      msg<<"  "<<named("memory per empty curve", storage)<<": "
+	 <<(heap_bytes() - before) / curves<<" bytes";
+      DTEST_MSG(msg.str());
+    }
+  }
+
+
+}
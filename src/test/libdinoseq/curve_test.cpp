@@ -20,8 +20,11 @@
 #include <iterator>
 #include <vector>
 
+#include <pthread.h>
+
 #include "dtest.hpp"
 #include "curve.hpp"
+#include "eventbuffer.hpp"
 
 
 using namespace Dino;
@@ -31,15 +34,33 @@ using namespace Dino;
    read and write tests. */
 
 namespace CurveTest {
-
-
+  
+  
+  /** Run the test @c test once for every curve storage. The tests that 
+      keep iterators from before an edit only work with SkipList storage,
+      since every edit of a BTree curve invalidates its iterators. */
+  void for_each_storage(void (*test)(Curve::Storage)) {
+    test(Curve::SkipList);
+    test(Curve::BTree);
+  }
+  
+  
+  void test_constructor(Curve::Storage storage) {
+    DTEST_NOTHROW(Curve c("Test curve", SongTime(1, 0), 1, storage));
+    
+    Curve c("Test curve", SongTime(1, 0), 1, storage);
+    
+    DTEST_TRUE(c.get_storage() == storage);
+  }
+  
+  
   void dtest_constructor() {
-    DTEST_NOTHROW(Curve c("Test curve", SongTime(1, 0), 1));
+    for_each_storage(test_constructor);
   }
 
 
-  void dtest_get_set_controller_id() {
-    Curve c("Test curve", SongTime(4, 0), 1);
+  void test_get_set_controller_id(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 1, storage);
     
     DTEST_TRUE(c.get_controller_id() == 1);
     
@@ -47,6 +68,11 @@ namespace CurveTest {
     
     DTEST_TRUE(c.get_controller_id() == 42);
   }
+  
+  
+  void dtest_get_set_controller_id() {
+    for_each_storage(test_get_set_controller_id);
+  }
 
 
   void dtest_add_move_remove_point() {
@@ -95,8 +121,311 @@ namespace CurveTest {
 }
 
 
-  void dtest_begin_end() {
-  Curve c("Test curve", SongTime(4, 0), 1);
+  void test_transaction(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(8, 0), 1, storage);
+    for (int i = 0; i < 8; ++i)
+      c.add_point(SongTime(i, 0), i);
+    
+    // nothing happens until the transaction is committed
+    Curve::Transaction t;
+    Curve::Iterator iter = c.lower_bound(SongTime(2, 0));
+    t.move_point(iter, SongTime(5, 1), 20);
+    t.remove_point(++iter);
+    t.add_point(SongTime(4, 0), 40);
+    t.move_point(c.lower_bound(SongTime(6, 0)), SongTime(1, 1), 60);
+    DTEST_TRUE(t.get_size() == 4);
+    DTEST_TRUE(c.lower_bound(SongTime(2, 0))->m_value.get() == 2);
+    
+    c.commit(t);
+    DTEST_TRUE(t.get_size() == 0);
+    std::vector<std::pair<SongTime, int> > points;
+    for (Curve::ConstIterator i = c.begin(); i != c.end(); ++i)
+      points.push_back(std::make_pair(i->m_time, i->m_value.get()));
+    std::vector<std::pair<SongTime, int> > expected;
+    expected.push_back(std::make_pair(SongTime(0, 0), 0));
+    expected.push_back(std::make_pair(SongTime(1, 0), 1));
+    expected.push_back(std::make_pair(SongTime(1, 1), 60));
+    expected.push_back(std::make_pair(SongTime(4, 0), 4));
+    expected.push_back(std::make_pair(SongTime(4, 0), 40));
+    expected.push_back(std::make_pair(SongTime(5, 0), 5));
+    expected.push_back(std::make_pair(SongTime(5, 1), 20));
+    expected.push_back(std::make_pair(SongTime(7, 0), 7));
+    DTEST_TRUE(points == expected);
+    
+    // the order is checked with the backwards links too
+    bool ordered = true;
+    Curve::ConstIterator i = c.end();
+    for (int n = expected.size() - 1; n >= 0; --n)
+      ordered = ordered && (--i)->m_time == expected[n].first;
+    DTEST_TRUE(ordered && i == c.begin());
+    
+    // invalid transactions don't change anything
+    t.add_point(SongTime(9, 0), 0);
+    DTEST_THROW_TYPE(c.commit(t), std::out_of_range);
+    t.clear();
+    t.remove_point(c.begin());
+    t.move_point(c.begin(), SongTime(3, 0), 0);
+    DTEST_THROW_TYPE(c.commit(t), std::invalid_argument);
+    DTEST_TRUE(c.begin()->m_time == SongTime(0, 0));
+    
+    // removing everything
+    t.clear();
+    for (Curve::Iterator i = c.begin(); i != c.end(); ++i)
+      t.remove_point(i);
+    c.commit(t);
+    DTEST_TRUE(c.begin() == c.end());
+  }
+  
+  
+  void dtest_transaction() {
+    for_each_storage(test_transaction);
+  }
+  
+  
+  /** The data for a thread that sequences a curve over and over. */
+  struct Reader {
+    Curve* curve;
+    AtomicInt quit;
+    bool consistent;
+    AtomicInt passes;
+  };
+  
+  
+  void* read_curve(void* arg);
+  
+  
+  void test_transaction_atomic(Curve::Storage storage) {
+    // all points have the same value in every committed state, so a step
+    // curve gives exactly one event per pass unless the sequencer sees a
+    // partly applied transaction
+    Curve c("Test curve", SongTime(64, 0), 1, storage);
+    c.set_interpolation(Curve::Step);
+    for (int i = 0; i < 256; ++i)
+      c.add_point(SongTime(i / 4, (i % 4) << 22), 0);
+    
+    Reader r = { &c, false, true, 0 };
+    pthread_t thread;
+    pthread_create(&thread, 0, &read_curve, &r);
+    Curve::Transaction t;
+    for (int n = 1; n <= 200 || r.passes.get() < 10; ++n) {
+      for (Curve::Iterator i = c.begin(); i != c.end(); ++i)
+	t.move_point(i, i->m_time, (n % 127) << 24);
+      c.commit(t);
+    }
+    r.quit.set(1);
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(r.consistent);
+  }
+  
+  
+  void dtest_transaction_atomic() {
+    for_each_storage(test_transaction_atomic);
+  }
+  
+  
+  void test_add_points(Curve::Storage storage) {
+    typedef Curve::Point Point;
+    
+    Curve c("Test curve", SongTime(4, 0), 1, storage);
+    c.add_point(SongTime(1, 0), 1);
+    c.add_point(SongTime(3, 0), 3);
+    
+    Point outside[] = { Point(SongTime(0, 0), 10), Point(SongTime(5, 0), 11) };
+    Point unsorted[] = { Point(SongTime(2, 0), 10), Point(SongTime(0, 0), 11) };
+    
+    DTEST_THROW_TYPE(c.add_points(outside, outside + 2), std::out_of_range);
+    
+    DTEST_THROW_TYPE(c.add_points(unsorted, unsorted + 2), 
+		     std::invalid_argument);
+    
+    DTEST_TRUE(std::distance(c.begin(), c.end()) == 2);
+    
+    // new points are merged with the old ones, after old points with the
+    // same time
+    Point p[] = { Point(SongTime(0, 0), 20), Point(SongTime(1, 0), 21),
+		  Point(SongTime(2, 0), 22), Point(SongTime(2, 5), 23),
+		  Point(SongTime(4, 0), 24) };
+    
+    DTEST_NOTHROW(c.add_points(p, p + 5));
+    
+    SongTime times[] = { SongTime(0, 0), SongTime(1, 0), SongTime(1, 0),
+			 SongTime(2, 0), SongTime(2, 5), SongTime(3, 0),
+			 SongTime(4, 0) };
+    int values[] = { 20, 1, 21, 22, 23, 3, 24 };
+    bool merged = true;
+    Curve::ConstIterator iter = c.begin();
+    for (int i = 0; i < 7; ++i, ++iter) {
+      merged = merged && iter->m_time == times[i] && 
+	iter->m_value.get() == values[i];
+    }
+    
+    DTEST_TRUE(merged);
+    
+    DTEST_TRUE(iter == c.end());
+  }
+  
+  
+  void dtest_add_points() {
+    for_each_storage(test_add_points);
+  }
+  
+  
+  /** Return @c true if @c v has the same points as @c c. */
+  bool same_points(Curve::Version const& v, Curve const& c) {
+    Curve::ConstIterator i = c.begin();
+    for (Curve::Version::ConstIterator j = v.begin(); j != v.end(); ++i, ++j) {
+      if (i == c.end() || i->m_time != j->m_time || 
+	  i->m_value.get() != j->m_value.get())
+	return false;
+    }
+    return i == c.end() && 
+      size_t(std::distance(c.begin(), c.end())) == v.get_size();
+  }
+  
+  
+  void test_version(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(1000, 0), 1, storage);
+    std::shared_ptr<Curve::Version const> empty = c.get_version();
+    
+    DTEST_TRUE(empty->get_size() == 0 && empty->begin() == empty->end());
+    
+    for (int i = 0; i < 1000; ++i)
+      c.add_point(SongTime(i, 0), i);
+    std::shared_ptr<Curve::Version const> v1 = c.get_version();
+    
+    DTEST_TRUE(v1->get_size() == 1000 && same_points(*v1, c));
+    
+    DTEST_TRUE(c.get_version() == v1);
+    
+    // an edit only copies the chunk it is in, and the old version is left
+    // as it was
+    c.move_point(c.lower_bound(SongTime(500, 0)), SongTime(500, 0), 42);
+    c.remove_point(c.lower_bound(SongTime(501, 0)));
+    std::shared_ptr<Curve::Version const> v2 = c.get_version();
+    
+    DTEST_TRUE(v2 != v1 && same_points(*v2, c));
+    
+    DTEST_TRUE(v2->count_shared_chunks(*v1) == v1->get_chunk_count() - 1);
+    
+    DTEST_TRUE(v1->get_size() == 1000 && 
+	       std::next(v1->begin(), 500)->m_value.get() == 500);
+    
+    // points with the same time are never split between chunks
+    for (int i = 0; i < 200; ++i)
+      c.add_point(SongTime(100, 0), i);
+    std::shared_ptr<Curve::Version const> v3 = c.get_version();
+    
+    DTEST_TRUE(same_points(*v3, c));
+    
+    DTEST_TRUE(v3->count_shared_chunks(*v2) == v2->get_chunk_count() - 1);
+    
+    // a transaction and a bulk insert mark the whole range as changed
+    Curve::Transaction t;
+    t.move_point(c.lower_bound(SongTime(10, 0)), SongTime(900, 1), 7);
+    c.commit(t);
+    Curve::Point p[] = { Curve::Point(SongTime(0, 1), 1), 
+			 Curve::Point(SongTime(999, 1), 2) };
+    c.add_points(p, p + 2);
+    
+    DTEST_TRUE(same_points(*c.get_version(), c));
+  }
+  
+  
+  void dtest_version() {
+    for_each_storage(test_version);
+  }
+  
+  
+  void test_version_restore(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(1000, 0), 1, storage);
+    for (int i = 0; i < 1000; ++i)
+      c.add_point(SongTime(i, 0), i);
+    std::shared_ptr<Curve::Version const> v1 = c.get_version();
+    
+    c.move_point(c.lower_bound(SongTime(300, 0)), SongTime(300, 1), 42);
+    c.add_point(SongTime(700, 1), 43);
+    c.remove_point(c.begin());
+    std::shared_ptr<Curve::Version const> v2 = c.get_version();
+    
+    c.restore(v1);
+    
+    DTEST_TRUE(same_points(*v1, c) && c.get_version() == v1);
+    
+    c.restore(v2);
+    
+    DTEST_TRUE(same_points(*v2, c) && c.get_version() == v2);
+    
+    // a version from a longer curve doesn't fit
+    Curve longer("Longer curve", SongTime(2000, 0), 1, storage);
+    longer.add_point(SongTime(1500, 0), 1);
+    
+    DTEST_THROW_TYPE(c.restore(longer.get_version()), std::invalid_argument);
+    
+    DTEST_TRUE(same_points(*v2, c));
+    
+    // restoring an empty version removes everything
+    Curve empty("Empty curve", SongTime(1000, 0), 1, storage);
+    c.restore(empty.get_version());
+    
+    DTEST_TRUE(c.begin() == c.end());
+    
+    c.restore(v1);
+    
+    DTEST_TRUE(same_points(*v1, c));
+  }
+  
+  
+  void dtest_version_restore() {
+    for_each_storage(test_version_restore);
+  }
+  
+  
+  /** Sums the values in a Version in another thread. */
+  struct Summer {
+    std::shared_ptr<Curve::Version const> version;
+    long long sum;
+  };
+  
+  
+  void* sum_version(void* arg) {
+    Summer& s = *static_cast<Summer*>(arg);
+    s.sum = 0;
+    for (int n = 0; n < 50; ++n) {
+      for (Curve::Version::ConstIterator i = s.version->begin(); 
+	   i != s.version->end(); ++i)
+	s.sum += i->m_value.get();
+    }
+    return 0;
+  }
+  
+  
+  void test_version_thread(Curve::Storage storage) {
+    // a version can be read by another thread while the curve is edited
+    Curve c("Test curve", SongTime(10000, 0), 1, storage);
+    for (int i = 0; i < 10000; ++i)
+      c.add_point(SongTime(i, 0), 1);
+    Summer s = { c.get_version(), 0 };
+    pthread_t thread;
+    pthread_create(&thread, 0, &sum_version, &s);
+    for (int i = 0; i < 10000; i += 7) {
+      c.move_point(c.lower_bound(SongTime(i, 0)), SongTime(i, 0), 2);
+      if (i % 70 == 0)
+	c.get_version();
+    }
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(s.sum == 50 * 10000);
+  }
+  
+  
+  void dtest_version_thread() {
+    for_each_storage(test_version_thread);
+  }
+  
+  
+  void test_begin_end(Curve::Storage storage) {
+  Curve c("Test curve", SongTime(4, 0), 1, storage);
   
   Curve::Iterator begin = c.begin();
   
@@ -114,10 +443,15 @@ namespace CurveTest {
   
   DTEST_TRUE(c.begin() == begin);
 }
+  
+  
+  void dtest_begin_end() {
+    for_each_storage(test_begin_end);
+  }
 
 
-  void dtest_begin_end_const() {
-  Curve c("Test curve", SongTime(4, 0), 1);
+  void test_begin_end_const(Curve::Storage storage) {
+  Curve c("Test curve", SongTime(4, 0), 1, storage);
   Curve const& cc = c;
   
   Curve::Iterator begin = c.begin();
@@ -136,6 +470,11 @@ namespace CurveTest {
   
   DTEST_TRUE(cc.begin() == begin);
 }
+  
+  
+  void dtest_begin_end_const() {
+    for_each_storage(test_begin_end_const);
+  }
 
 
   void dtest_lower_upper_bound() {
@@ -173,8 +512,8 @@ namespace CurveTest {
   }
   
   
-  void dtest_Iterator() {
-    Curve c("Test curve", SongTime(4, 0), 1);
+  void test_Iterator(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 1, storage);
     Curve const& cc = c;
     
     c.add_point(SongTime(1, 0), 0);
@@ -242,8 +581,13 @@ namespace CurveTest {
   }
   
   
-  void dtest_ConstIterator() {
-    Curve c("Test curve", SongTime(4, 0), 1);
+  void dtest_Iterator() {
+    for_each_storage(test_Iterator);
+  }
+  
+  
+  void test_ConstIterator(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 1, storage);
     Curve const& cc = c;
     
     c.add_point(SongTime(1, 0), 0);
@@ -284,6 +628,298 @@ namespace CurveTest {
     
     DTEST_NOTHROW(c_iter = iter);
   }
+  
+  
+  void dtest_ConstIterator() {
+    for_each_storage(test_ConstIterator);
+  }
+  
+  
+  /** An EventBuffer that stores the events in a vector, and optionally
+      refuses to take more than a given number of them. */
+  struct VectorBuffer : EventBuffer {
+    
+    struct Event {
+      SongTime time;
+      std::vector<unsigned char> data;
+    };
+    
+    VectorBuffer(size_t max = size_t(-1)) : max_events(max) { }
+    
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data) {
+      if (events.size() >= max_events)
+	return false;
+      Event e;
+      e.time = st;
+      e.data.assign(data, data + bytes);
+      events.push_back(e);
+      return true;
+    }
+    
+    std::vector<Event> events;
+    size_t max_events;
+  };
+  
+  
+  void test_sequence_linear(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 7, storage);
+    c.set_resolution(16);
+    c.add_point(SongTime(1, 0), 0);
+    c.add_point(SongTime(2, 0), 0x7FFFFFFF);
+    
+    VectorBuffer buf;
+    auto pos = c.create_position(SongTime(0, 0));
+    DTEST_TRUE(c.sequence(*pos, SongTime(4, 0), buf));
+    DTEST_TRUE(pos->get_time() == SongTime(4, 0));
+    
+    // one event per grid step between the points, then the last value
+    DTEST_TRUE(buf.events.size() == 17);
+    DTEST_TRUE(buf.events[0].time == SongTime(1, 0));
+    DTEST_TRUE(buf.events[16].time == SongTime(2, 0));
+    for (size_t i = 0; i < buf.events.size(); ++i) {
+      DTEST_TRUE(buf.events[i].data.size() == 3);
+      DTEST_TRUE(buf.events[i].data[0] == 0xB0);
+      DTEST_TRUE(buf.events[i].data[1] == 7);
+      DTEST_TRUE(buf.events[i].data[2] == i * 8 - (i == 16 ? 1 : 0));
+    }
+  }
+  
+  
+  void dtest_sequence_linear() {
+    for_each_storage(test_sequence_linear);
+  }
+  
+  
+  void test_sequence_split(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 7, storage);
+    c.set_resolution(64);
+    c.add_point(SongTime(0, 0), 0x10000000);
+    c.add_point(SongTime(3, 0), 0x70000000);
+    
+    // sequencing in small pieces should give the same result as all at once
+    VectorBuffer buf1;
+    auto pos1 = c.create_position(SongTime(0, 0));
+    c.sequence(*pos1, SongTime(4, 0), buf1);
+    
+    VectorBuffer buf2;
+    auto pos2 = c.create_position(SongTime(0, 0));
+    for (unsigned i = 1; i < 25; ++i) {
+      unsigned t = 0x28F5C2 * i;
+      c.sequence(*pos2, SongTime(t >> 24, t & 0xFFFFFF), buf2);
+    }
+    c.sequence(*pos2, SongTime(4, 0), buf2);
+    
+    DTEST_TRUE(buf1.events.size() == 97);
+    DTEST_TRUE(buf1.events.size() == buf2.events.size());
+    for (size_t i = 0; i < buf1.events.size(); ++i) {
+      DTEST_TRUE(buf1.events[i].time == buf2.events[i].time);
+      DTEST_TRUE(buf1.events[i].data == buf2.events[i].data);
+    }
+  }
+  
+  
+  void dtest_sequence_split() {
+    for_each_storage(test_sequence_split);
+  }
+  
+  
+  void test_sequence_step(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 1, storage);
+    c.set_interpolation(Curve::Step);
+    c.add_point(SongTime(0, 0x123456), 0x10000000);
+    c.add_point(SongTime(1, 0), 0x10000000);
+    c.add_point(SongTime(2, 0), 0x20000000);
+    
+    VectorBuffer buf;
+    auto pos = c.create_position(SongTime(0, 0));
+    c.sequence(*pos, SongTime(4, 0), buf);
+    
+    // unchanged values are not written again
+    DTEST_TRUE(buf.events.size() == 2);
+    DTEST_TRUE(buf.events[0].time == SongTime(0, 0x180000));
+    DTEST_TRUE(buf.events[0].data[2] == 0x10);
+    DTEST_TRUE(buf.events[1].time == SongTime(2, 0));
+    DTEST_TRUE(buf.events[1].data[2] == 0x20);
+    
+    // but they are written again after the position has been moved
+    c.update_position(*pos, SongTime(3, 0));
+    c.sequence(*pos, SongTime(4, 0), buf);
+    DTEST_TRUE(buf.events.size() == 3);
+    DTEST_TRUE(buf.events[2].time == SongTime(3, 0));
+    DTEST_TRUE(buf.events[2].data[2] == 0x20);
+  }
+  
+  
+  void dtest_sequence_step() {
+    for_each_storage(test_sequence_step);
+  }
+  
+  
+  void test_sequence_pitchbend(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), Curve::pitchbend(), storage);
+    c.add_point(SongTime(0, 0), 0x40000000);
+    
+    VectorBuffer buf;
+    auto pos = c.create_position(SongTime(0, 0));
+    c.sequence(*pos, SongTime(1, 0), buf);
+    
+    DTEST_TRUE(buf.events.size() == 1);
+    DTEST_TRUE(buf.events[0].data[0] == 0xE0);
+    DTEST_TRUE(buf.events[0].data[1] == 0x00);
+    DTEST_TRUE(buf.events[0].data[2] == 0x40);
+    
+    // unknown controllers are not sequenced at all
+    c.set_controller_id(1000);
+    c.update_position(*pos, SongTime(0, 0));
+    c.sequence(*pos, SongTime(1, 0), buf);
+    DTEST_TRUE(buf.events.size() == 1);
+    DTEST_TRUE(pos->get_time() == SongTime(1, 0));
+  }
+  
+  
+  void dtest_sequence_pitchbend() {
+    for_each_storage(test_sequence_pitchbend);
+  }
+  
+  
+  void test_sequence_full_buffer(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(4, 0), 7, storage);
+    c.set_resolution(4);
+    c.add_point(SongTime(0, 0), 0);
+    c.add_point(SongTime(4, 0), 0x7FFFFFFF);
+    
+    // a full buffer stops the sequencing at the first event that didn't fit
+    VectorBuffer buf(5);
+    auto pos = c.create_position(SongTime(0, 0));
+    DTEST_TRUE(!c.sequence(*pos, SongTime(4, 0), buf));
+    DTEST_TRUE(buf.events.size() == 5);
+    DTEST_TRUE(pos->get_time() == SongTime(1, 1 << 22));
+    
+    buf.max_events = size_t(-1);
+    DTEST_TRUE(c.sequence(*pos, SongTime(4, 0), buf));
+    DTEST_TRUE(buf.events.size() == 16);
+    for (size_t i = 0; i < buf.events.size(); ++i)
+      DTEST_TRUE(buf.events[i].time == SongTime(i / 4, (i % 4) << 22));
+  }
+  
+  
+  void dtest_sequence_full_buffer() {
+    for_each_storage(test_sequence_full_buffer);
+  }
+  
+  
+  void test_copy_position(Curve::Storage storage) {
+    Curve c("Test curve", SongTime(8, 0), 7, storage);
+    c.set_interpolation(Curve::Step);
+    c.add_point(SongTime(2, 0), 0x10000000);
+    c.add_point(SongTime(4, 0), 0x20000000);
+    
+    // positions are looked up lazily, so this works even though the 
+    // node that the cue would have found is removed before it's used
+    auto cue = c.create_position(SongTime(3, 0));
+    auto pos = c.create_position(SongTime(0, 0));
+    c.remove_point(c.begin());
+    c.add_point(SongTime(1, 0), 0x30000000);
+    
+    VectorBuffer buf;
+    c.copy_position(*pos, *cue);
+    
+    DTEST_TRUE(pos->get_time() == SongTime(3, 0));
+    
+    DTEST_TRUE(c.sequence(*pos, SongTime(5, 0), buf));
+    
+    DTEST_TRUE(buf.events.size() == 2);
+    
+    DTEST_TRUE(buf.events[0].time == SongTime(3, 0) && 
+	       buf.events[0].data[2] == 0x30);
+    
+    DTEST_TRUE(buf.events[1].time == SongTime(4, 0) && 
+	       buf.events[1].data[2] == 0x20);
+    
+    // relocating within a segment and copying resolved positions gives 
+    // the same result
+    buf.events.clear();
+    c.update_position(*pos, SongTime(3, 0));
+    c.sequence(*pos, SongTime(5, 0), buf);
+    c.copy_position(*pos, *cue);
+    c.sequence(*pos, SongTime(5, 0), buf);
+    
+    DTEST_TRUE(buf.events.size() == 4);
+    
+    DTEST_TRUE(buf.events[2].time == SongTime(3, 0) && 
+	       buf.events[2].data[2] == 0x30);
+  }
+  
+  
+  void dtest_copy_position() {
+    for_each_storage(test_copy_position);
+  }
+  
+  
+  void dtest_btree_iterators() {
+    // every edit invalidates the iterators of a BTree curve, so the 
+    // returned iterators must be used instead
+    Curve c("Test curve", SongTime(4, 0), 1, Curve::BTree);
+    c.add_point(SongTime(0, 0), 666);
+    c.add_point(SongTime(1, 0), 420);
+    Curve::Iterator iter = c.add_point(SongTime(0, 0), 28, ++c.begin());
+    
+    DTEST_TRUE(iter == ++c.begin() && iter->m_value.get() == 28);
+    
+    iter = c.move_point(c.begin(), SongTime(0, 0), 667);
+    
+    DTEST_TRUE(iter == c.begin() && iter->m_value.get() == 667);
+    
+    iter = c.move_point(++c.begin(), SongTime(0, 5), 28);
+    
+    DTEST_TRUE(iter == ++c.begin() && iter->m_time == SongTime(0, 5));
+    
+    iter = c.remove_point(c.begin());
+    
+    DTEST_TRUE(iter == c.begin() && iter->m_value.get() == 28);
+    
+    iter = c.remove_point(iter);
+    
+    DTEST_TRUE(iter == c.begin() && iter->m_value.get() == 420);
+    
+    DTEST_TRUE(c.remove_point(iter) == c.end());
+    
+    // equal times are found in the order they were added, across leaves
+    for (int i = 0; i < 300; ++i)
+      c.add_point(SongTime(i / 100, 0), i);
+    
+    DTEST_TRUE(c.lower_bound(SongTime(1, 0))->m_value.get() == 100);
+    
+    DTEST_TRUE(c.upper_bound(SongTime(1, 0))->m_value.get() == 200);
+    
+    DTEST_TRUE((--c.upper_bound(SongTime(1, 0)))->m_value.get() == 199);
+    
+    DTEST_TRUE(c.lower_bound(SongTime(4, 0)) == c.end());
+    
+    iter = c.remove_point(c.lower_bound(SongTime(1, 0)));
+    
+    DTEST_TRUE(iter->m_value.get() == 101);
+    
+    iter = c.add_point(SongTime(1, 0), 1000, c.upper_bound(SongTime(1, 0)));
+    
+    DTEST_TRUE(iter->m_value.get() == 1000 && (++iter)->m_value.get() == 200);
+  }
+  
+  
+  void* read_curve(void* arg) {
+    Reader& r = *static_cast<Reader*>(arg);
+    auto pos = r.curve->create_position(SongTime(0, 0));
+    while (!r.quit.get()) {
+      VectorBuffer buf;
+      r.curve->update_position(*pos, SongTime(0, 0));
+      r.curve->sequence(*pos, SongTime(64, 0), buf);
+      if (buf.events.size() != 1)
+	r.consistent = false;
+      r.passes.increase();
+    }
+    return 0;
+  }
 
 
 }
@@ -0,0 +1,92 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <iterator>
+
+#include "dtest.hpp"
+#include "curvehistory.hpp"
+
+
+using namespace Dino;
+
+
+namespace CurveHistoryTest {
+  
+  
+  /** Return the value of the point at beat @c beat. */
+  int value_at(Curve& c, int beat) {
+    return c.lower_bound(SongTime(beat, 0))->m_value.get();
+  }
+  
+  
+  void dtest_undo_redo() {
+    Curve c("Test curve", SongTime(1000, 0), 1);
+    for (int i = 0; i < 1000; ++i)
+      c.add_point(SongTime(i, 0), i);
+    CurveHistory h(c);
+    
+    DTEST_TRUE(!h.can_undo() && !h.can_redo() && !h.undo() && !h.redo());
+    
+    c.move_point(c.lower_bound(SongTime(10, 0)), SongTime(10, 0), 100);
+    h.checkpoint();
+    c.remove_point(c.lower_bound(SongTime(20, 0)));
+    h.checkpoint();
+    h.checkpoint();
+    
+    DTEST_TRUE(h.can_undo() && !h.can_redo());
+    
+    DTEST_TRUE(h.undo() && std::distance(c.begin(), c.end()) == 1000);
+    
+    DTEST_TRUE(value_at(c, 10) == 100);
+    
+    DTEST_TRUE(h.undo() && value_at(c, 10) == 10 && !h.can_undo());
+    
+    DTEST_TRUE(h.redo() && value_at(c, 10) == 100);
+    
+    DTEST_TRUE(h.redo() && std::distance(c.begin(), c.end()) == 999);
+    
+    DTEST_TRUE(!h.can_redo());
+    
+    // a new checkpoint after an undo forgets the undone steps
+    h.undo();
+    c.add_point(SongTime(20, 1), 7);
+    h.checkpoint();
+    
+    DTEST_TRUE(!h.can_redo() && c.get_version() == h.get_current());
+    
+    DTEST_TRUE(h.undo() && c.lower_bound(SongTime(20, 1)) == 
+	       c.lower_bound(SongTime(21, 0)));
+  }
+  
+  
+  void dtest_max_depth() {
+    Curve c("Test curve", SongTime(100, 0), 1);
+    CurveHistory h(c, 3);
+    for (int i = 0; i < 10; ++i) {
+      c.add_point(SongTime(i, 0), i);
+      h.checkpoint();
+    }
+    int undone = 0;
+    while (h.undo())
+      ++undone;
+    
+    DTEST_TRUE(undone == 3 && std::distance(c.begin(), c.end()) == 7);
+  }
+
+
+}
@@ -0,0 +1,145 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "curve.hpp"
+#include "curverecorder.hpp"
+#include "dtest.hpp"
+#include "recordbuffer.hpp"
+#include "songtime.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace CurveRecorderTest {
+  
+  
+  void dtest_record_cc() {
+    Curve c("Test curve", SongTime(4, 0), 7);
+    c.add_point(SongTime(1, 0), 0);
+    CurveRecorder cr(c);
+    
+    unsigned char cc7[] = { 0xB3, 0x07, 0x40 };
+    unsigned char cc8[] = { 0xB0, 0x08, 0x20 };
+    unsigned char on[] = { 0x90, 0x07, 0x7F };
+    unsigned char pb[] = { 0xE0, 0x00, 0x40 };
+    
+    DTEST_TRUE(cr.write_event(SongTime(0, 0), 3, cc7));
+    
+    DTEST_TRUE(cr.write_event(SongTime(1, 0), 3, cc8));
+    
+    DTEST_TRUE(cr.write_event(SongTime(1, 0), 3, on));
+    
+    DTEST_TRUE(cr.write_event(SongTime(2, 0), 3, pb));
+    
+    DTEST_TRUE(cr.write_event(SongTime(5, 0), 3, cc7));
+    
+    DTEST_TRUE(cr.get_pending() == 1);
+    
+    cc7[2] = 0x7F;
+    cr.write_event(SongTime(3, 0), 3, cc7);
+    
+    DTEST_NOTHROW(cr.flush());
+    
+    DTEST_TRUE(cr.get_pending() == 0);
+    
+    Curve::ConstIterator iter = c.begin();
+    
+    DTEST_TRUE(iter->m_time == SongTime(0, 0) && 
+	       iter->m_value.get() == 0x40000000);
+    
+    ++iter;
+    
+    DTEST_TRUE(iter->m_time == SongTime(1, 0) && iter->m_value.get() == 0);
+    
+    ++iter;
+    
+    DTEST_TRUE(iter->m_time == SongTime(3, 0) && 
+	       iter->m_value.get() == 0x7F000000);
+    
+    ++iter;
+    
+    DTEST_TRUE(iter == c.end());
+  }
+  
+  
+  void dtest_record_pitchbend() {
+    Curve c("Test curve", SongTime(4, 0), Curve::pitchbend());
+    CurveRecorder cr(c);
+    
+    unsigned char pb[] = { 0xE5, 0x7F, 0x7F };
+    unsigned char cc[] = { 0xB0, 0x07, 0x40 };
+    
+    cr.write_event(SongTime(1, 0), 3, pb);
+    cr.write_event(SongTime(2, 0), 3, cc);
+    cr.flush();
+    
+    DTEST_TRUE(c.begin() != c.end() && 
+	       c.begin()->m_value.get() == 0x3FFF << 17);
+    
+    DTEST_TRUE(++c.begin() == c.end());
+  }
+  
+  
+  void dtest_shortened_curve() {
+    Curve c("Test curve", SongTime(4, 0), 7);
+    CurveRecorder cr(c);
+    
+    unsigned char cc[] = { 0xB0, 0x07, 0x40 };
+    cr.write_event(SongTime(1, 0), 3, cc);
+    cr.write_event(SongTime(3, 0), 3, cc);
+    c.set_length(SongTime(2, 0));
+    
+    DTEST_NOTHROW(cr.flush());
+    
+    DTEST_TRUE(cr.get_pending() == 0);
+    
+    DTEST_TRUE(c.begin() != c.end() && c.begin()->m_time == SongTime(1, 0));
+    
+    DTEST_TRUE(++c.begin() == c.end());
+  }
+  
+  
+  void dtest_from_record_buffer() {
+    Curve c("Test curve", SongTime(4, 0), 1);
+    CurveRecorder cr(c);
+    RecordBuffer rb(16);
+    
+    for (int i = 0; i < 8; ++i) {
+      unsigned char cc[] = { 0xB0, 0x01, static_cast<unsigned char>(i) };
+      rb.write_event(SongTime(0, i << 21), 3, cc);
+    }
+    rb.end_cycle();
+    
+    DTEST_TRUE(rb.read_events(cr) == 8);
+    
+    cr.flush();
+    
+    bool recorded = true;
+    int i = 0;
+    for (Curve::ConstIterator iter = c.begin(); iter != c.end(); ++iter, ++i)
+      recorded = recorded && iter->m_value.get() == i << 24;
+    
+    DTEST_TRUE(recorded);
+    
+    DTEST_TRUE(i == 8);
+  }
+
+
+}
@@ -0,0 +1,145 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "dtest.hpp"
+#include "epochdomain.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace EpochDomainTest {
+  
+  
+  /** A node type for the EpochLimbo tests. */
+  struct TestNode {
+    TestNode* link;
+  };
+  
+  
+  /** An EpochLimbo policy that counts the freed nodes instead of 
+      deallocating them. */
+  struct CountPolicy {
+    CountPolicy(unsigned& c) : freed(&c) {}
+    TestNode*& link(TestNode* n) { return n->link; }
+    void free(TestNode*) { ++*freed; }
+    unsigned* freed;
+  };
+  
+  
+  void dtest_register_reader() {
+    EpochDomain d;
+    DTEST_TRUE(d.get_readers() == 0);
+    int r1 = d.register_reader();
+    int r2 = d.register_reader();
+    DTEST_TRUE(r1 >= 0 && r2 >= 0 && r1 != r2);
+    DTEST_TRUE(d.get_readers() == 2);
+    d.unregister_reader(r1);
+    DTEST_TRUE(d.get_readers() == 1);
+    DTEST_TRUE(d.register_reader() == r1);
+    
+    // the slots are limited
+    EpochDomain d2;
+    bool ok = true;
+    for (unsigned i = 0; i < EpochDomain::max_readers; ++i)
+      ok = ok && d2.register_reader() >= 0;
+    DTEST_TRUE(ok);
+    DTEST_TRUE(d2.register_reader() == -1);
+  }
+  
+  
+  void dtest_is_safe() {
+    EpochDomain d;
+    
+    // nothing to wait for without readers
+    DTEST_TRUE(d.is_safe(d.retire()));
+    
+    int r1 = d.register_reader();
+    int r2 = d.register_reader();
+    EpochDomain::Epoch e = d.retire();
+    DTEST_TRUE(!d.is_safe(e));
+    d.quiescent(r1);
+    DTEST_TRUE(!d.is_safe(e));
+    d.quiescent(r2);
+    DTEST_TRUE(d.is_safe(e));
+    
+    // offline readers don't block anything
+    EpochDomain::Epoch e2 = d.retire();
+    d.quiescent(r1);
+    DTEST_TRUE(!d.is_safe(e2));
+    d.offline(r2);
+    DTEST_TRUE(d.is_safe(e2));
+    
+    // and neither do unregistered ones
+    EpochDomain::Epoch e3 = d.retire();
+    d.quiescent(r2);
+    DTEST_TRUE(!d.is_safe(e3));
+    d.unregister_reader(r1);
+    DTEST_TRUE(d.is_safe(e3));
+  }
+  
+  
+  void dtest_limbo() {
+    EpochDomain d;
+    int r = d.register_reader();
+    unsigned freed = 0;
+    TestNode nodes[3];
+    {
+      EpochLimbo<TestNode, CountPolicy> limbo(d, CountPolicy(freed));
+      limbo.retire(&nodes[0]);
+      limbo.retire(&nodes[1]);
+      DTEST_TRUE(limbo.get_size() == 2);
+      DTEST_TRUE(limbo.collect() == 0);
+      d.quiescent(r);
+      DTEST_TRUE(limbo.collect() == 2);
+      DTEST_TRUE(freed == 2);
+      DTEST_TRUE(limbo.get_size() == 0);
+      
+      // the destructor frees the rest
+      limbo.retire(&nodes[2]);
+    }
+    DTEST_TRUE(freed == 3);
+  }
+  
+  
+  void dtest_limbo_interleaved() {
+    // a reader that is always sampled in the middle of a burst of edits 
+    // must not make the garbage grow without bounds
+    EpochDomain d;
+    int r = d.register_reader();
+    unsigned freed = 0;
+    EpochLimbo<TestNode, CountPolicy> limbo(d, CountPolicy(freed));
+    TestNode nodes[1000];
+    size_t max_size = 0;
+    for (unsigned i = 0; i < 1000; ++i) {
+      limbo.collect();
+      limbo.retire(&nodes[i]);
+      max_size = std::max(max_size, limbo.get_size());
+      if (i % 10 == 5)
+	d.quiescent(r);
+    }
+    DTEST_TRUE(max_size <= 30);
+    DTEST_TRUE(freed + limbo.get_size() == 1000);
+    d.quiescent(r);
+    limbo.collect();
+    DTEST_TRUE(limbo.get_size() == 0);
+  }
+
+
+}
@@ -0,0 +1,134 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+
+#include "dtest.hpp"
+#include "fixedeventbuffer.hpp"
+#include "songtime.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace FixedEventBufferTest {
+  
+  
+  void dtest_constructor() {
+    DTEST_NOTHROW(FixedEventBuffer feb);
+    FixedEventBuffer feb(1024, 16);
+    DTEST_TRUE(feb.get_event_count() == 0);
+    DTEST_TRUE(feb.get_bytes_used() == 0);
+    DTEST_TRUE(feb.get_overflows() == 0);
+    DTEST_TRUE(feb.begin() == feb.end());
+  }
+  
+  
+  void dtest_write_event() {
+    FixedEventBuffer feb(1024, 16);
+    
+    unsigned char event1[] = {0x90, 0x34, 0x42};
+    unsigned char event2[] = {0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7};
+    
+    SongTime st1(0, 0x238388);
+    SongTime st2(5, 0xFFAD03);
+    
+    DTEST_TRUE(feb.write_event(st1, 3, event1));
+    DTEST_TRUE(feb.write_event(st2, 6, event2));
+    DTEST_TRUE(feb.get_event_count() == 2);
+    DTEST_TRUE(feb.end() - feb.begin() == 2);
+    
+    FixedEventBuffer::ConstIterator iter = feb.begin();
+    DTEST_TRUE(iter->get_time() == st1);
+    DTEST_TRUE(iter->get_size() == 3);
+    DTEST_TRUE(equal(event1, event1 + 3, iter->get_data()));
+    ++iter;
+    DTEST_TRUE(iter->get_time() == st2);
+    DTEST_TRUE(iter->get_size() == 6);
+    DTEST_TRUE(equal(event2, event2 + 6, iter->get_data()));
+    ++iter;
+    DTEST_TRUE(iter == feb.end());
+    
+    feb.clear();
+    DTEST_TRUE(feb.get_event_count() == 0);
+    DTEST_TRUE(feb.get_bytes_used() == 0);
+    DTEST_TRUE(feb.begin() == feb.end());
+  }
+  
+  
+  void dtest_overflow() {
+    unsigned char event[] = {0x90, 0x34, 0x42};
+    
+    // limited by the number of events
+    FixedEventBuffer feb1(1024, 2);
+    DTEST_TRUE(feb1.write_event(SongTime(0, 0), 3, event));
+    DTEST_TRUE(feb1.write_event(SongTime(1, 0), 3, event));
+    DTEST_TRUE(!feb1.write_event(SongTime(2, 0), 3, event));
+    DTEST_TRUE(feb1.get_event_count() == 2);
+    DTEST_TRUE(feb1.get_overflows() == 1);
+    
+    // limited by the number of bytes
+    FixedEventBuffer feb2(64, 100);
+    size_t written = 0;
+    for (int i = 0; i < 100; ++i)
+      written += feb2.write_event(SongTime(i, 0), 3, event) ? 1 : 0;
+    DTEST_TRUE(written == feb2.get_event_count());
+    DTEST_TRUE(written > 0 && written < 100);
+    DTEST_TRUE(feb2.get_overflows() == 100 - written);
+    DTEST_TRUE(feb2.get_bytes_used() <= 64);
+    
+    // clear() makes room again but keeps the overflow count
+    feb2.clear();
+    DTEST_TRUE(feb2.write_event(SongTime(0, 0), 3, event));
+    DTEST_TRUE(feb2.get_overflows() == 100 - written);
+    feb2.reset_overflows();
+    DTEST_TRUE(feb2.get_overflows() == 0);
+  }
+  
+  
+  void dtest_sort() {
+    FixedEventBuffer feb(1024, 16);
+    unsigned char e[] = {0x90, 0x00, 0x40};
+    
+    e[1] = 3;
+    feb.write_event(SongTime(2, 0), 3, e);
+    e[1] = 1;
+    feb.write_event(SongTime(1, 0), 3, e);
+    e[1] = 4;
+    feb.write_event(SongTime(2, 0), 3, e);
+    e[1] = 2;
+    feb.write_event(SongTime(1, 0), 3, e);
+    e[1] = 0;
+    feb.write_event(SongTime(0, 5), 3, e);
+    
+    feb.sort();
+    
+    // sorted by time, and stable for equal times
+    unsigned char expected = 0;
+    for (FixedEventBuffer::ConstIterator iter = feb.begin();
+	 iter != feb.end(); ++iter, ++expected) {
+      DTEST_TRUE(iter->get_data()[1] == expected);
+      if (iter != feb.begin())
+	DTEST_TRUE(!(iter->get_time() < iter[-1].get_time()));
+    }
+    DTEST_TRUE(expected == 5);
+  }
+
+
+}
@@ -0,0 +1,232 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "curve.hpp"
+#include "dtest.hpp"
+#include "journal.hpp"
+#include "sequencer.hpp"
+#include "tempfile.hpp"
+
+
+using namespace Dino;
+using namespace std;
+using namespace TempFile;
+
+
+namespace JournalTest {
+  
+  
+  /** Return the size of the file @c name. */
+  size_t file_size(string const& name) {
+    struct stat st;
+    if (stat(name.c_str(), &st))
+      return 0;
+    return st.st_size;
+  }
+  
+  
+  /** Return @c true if @c a and @c b have the same points. */
+  bool same_points(Curve const& a, Curve const& b) {
+    auto i = a.begin();
+    auto j = b.begin();
+    for ( ; i != a.end() && j != b.end(); ++i, ++j) {
+      if (i->m_time != j->m_time || i->m_value.get() != j->m_value.get())
+	return false;
+    }
+    return i == a.end() && j == b.end();
+  }
+  
+  
+  /** Make some edits to @c c1, @c c2 and @c seq. */
+  void edit(Curve& c1, Curve& c2, Sequencer& seq, 
+	    shared_ptr<Curve> const& sc1, shared_ptr<Curve> const& sc2) {
+    c1.add_point(SongTime(1, 0), 10);
+    c1.add_point(SongTime(2, 0), 20);
+    Curve::Iterator i = c1.add_point(SongTime(3, 0), 30);
+    c1.add_point(SongTime(2, 0), 25);
+    c1.move_point(i, SongTime(4, 0), 40);
+    c1.move_point(c1.begin(), SongTime(1, 0), 15);
+    c1.remove_point(c1.lower_bound(SongTime(2, 0)));
+    Curve::Point points[] = { Curve::Point(SongTime(0, 0), 1),
+			      Curve::Point(SongTime(5, 0), 2),
+			      Curve::Point(SongTime(6, 0), 3) };
+    c2.add_points(points, points + 3);
+    seq.add_sequencable(sc1);
+    seq.add_sequencable(sc2);
+    seq.add_sequencable(sc1);
+    seq.remove_sequencable(seq.sqbl_find(sc2));
+  }
+  
+  
+  void dtest_constructor() {
+    string name = temp_file("journal_test");
+    
+    DTEST_NOTHROW(Journal j(name));
+    DTEST_TRUE(file_size(name) == 16);
+    DTEST_NOTHROW(Journal j(name));
+    DTEST_TRUE(file_size(name) == 16);
+    
+    {
+      ofstream ofs(name.c_str());
+      ofs << "This is not a journal";
+    }
+    DTEST_THROW_TYPE(Journal j(name), std::runtime_error);
+    
+    DTEST_THROW_TYPE(Journal j("/nonexistent/journal"), std::runtime_error);
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_record_replay() {
+    string name = temp_file("journal_test");
+    unlink(name.c_str());
+    
+    auto c1 = make_shared<Curve>("Curve 1", SongTime(8, 0));
+    auto c2 = make_shared<Curve>("Curve 2", SongTime(8, 0));
+    Sequencer seq;
+    {
+      Journal j(name);
+      j.attach(*c1, 0);
+      j.attach(*c2, 1);
+      j.attach(seq);
+      DTEST_TRUE(c1->get_edit_listener() == &j);
+      DTEST_TRUE(seq.get_edit_listener() == &j);
+      edit(*c1, *c2, seq, c1, c2);
+      j.flush();
+      DTEST_TRUE(j.get_written() == 14);
+      DTEST_TRUE(j.get_dropped() == 0);
+      DTEST_TRUE(file_size(name) == 16 + 14 * 32);
+    }
+    DTEST_TRUE(c1->get_edit_listener() == 0);
+    DTEST_TRUE(seq.get_edit_listener() == 0);
+    
+    // a crash in the middle of a write leaves a partial record
+    {
+      ofstream ofs(name.c_str(), ios::app);
+      ofs << "junk";
+    }
+    
+    vector<shared_ptr<Curve>> curves;
+    curves.push_back(make_shared<Curve>("Curve 1", SongTime(8, 0)));
+    curves.push_back(make_shared<Curve>("Curve 2", SongTime(8, 0)));
+    Sequencer seq2;
+    DTEST_TRUE(Journal::replay(name, curves, &seq2) == 14);
+    DTEST_TRUE(same_points(*curves[0], *c1));
+    DTEST_TRUE(same_points(*curves[1], *c2));
+    DTEST_TRUE(distance(seq2.sqbl_begin(), seq2.sqbl_end()) == 2);
+    DTEST_TRUE(*seq2.sqbl_begin() == curves[0]);
+    DTEST_TRUE(*++seq2.sqbl_begin() == curves[0]);
+    
+    // unknown curves are skipped
+    curves.pop_back();
+    curves[0] = make_shared<Curve>("Curve 1", SongTime(8, 0));
+    DTEST_TRUE(Journal::replay(name, curves) == 7);
+    DTEST_TRUE(same_points(*curves[0], *c1));
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_partial_record() {
+    string name = temp_file("journal_test");
+    unlink(name.c_str());
+    
+    Curve c("Curve", SongTime(8, 0));
+    {
+      Journal j(name);
+      j.attach(c, 0);
+      c.add_point(SongTime(1, 0), 1);
+      c.add_point(SongTime(2, 0), 2);
+    }
+    
+    // a crash in the middle of a write leaves half a record
+    {
+      ofstream ofs(name.c_str(), ios::app);
+      ofs << string(16, 'x');
+    }
+    DTEST_TRUE(file_size(name) == 16 + 2 * 32 + 16);
+    
+    // the partial record is cut off when the journal is opened again
+    {
+      Journal j(name);
+      
+      DTEST_TRUE(file_size(name) == 16 + 2 * 32);
+      
+      j.attach(c, 0);
+      c.add_point(SongTime(3, 0), 3);
+      c.remove_point(c.begin());
+      j.flush();
+      
+      DTEST_TRUE(file_size(name) == 16 + 4 * 32);
+    }
+    
+    vector<shared_ptr<Curve>> curves;
+    curves.push_back(make_shared<Curve>("Curve", SongTime(8, 0)));
+    
+    DTEST_TRUE(Journal::replay(name, curves) == 4);
+    
+    DTEST_TRUE(same_points(*curves[0], c));
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_detach() {
+    string name = temp_file("journal_test");
+    unlink(name.c_str());
+    
+    Curve c("Curve", SongTime(8, 0));
+    Journal j(name);
+    j.attach(c, 0);
+    c.add_point(SongTime(1, 0), 1);
+    j.detach(c);
+    DTEST_TRUE(c.get_edit_listener() == 0);
+    c.add_point(SongTime(2, 0), 2);
+    j.flush();
+    DTEST_TRUE(j.get_written() == 1);
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_sync_batching() {
+    string name = temp_file("journal_test");
+    unlink(name.c_str());
+    
+    Curve c("Curve", SongTime(100000, 0));
+    Journal j(name, 10000);
+    j.attach(c, 0);
+    for (int i = 0; i < 10000; ++i)
+      c.add_point(SongTime(i, 0), i);
+    j.flush();
+    DTEST_TRUE(j.get_written() == 10000);
+    DTEST_TRUE(j.get_syncs() <= 2);
+    
+    unlink(name.c_str());
+  }
+
+
+}
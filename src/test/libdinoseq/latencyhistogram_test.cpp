@@ -0,0 +1,112 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <limits>
+
+#include "dtest.hpp"
+#include "latencyhistogram.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace LatencyHistogramTest {
+  
+  
+  void dtest_constructor() {
+    LatencyHistogram h;
+    DTEST_TRUE(h.get_count() == 0);
+    DTEST_TRUE(h.get_max() == 0);
+    DTEST_TRUE(h.get_percentile(0.5) == 0);
+    DTEST_TRUE(h.get_xruns() == 0);
+  }
+  
+  
+  void dtest_record() {
+    LatencyHistogram h;
+    for (uint64_t i = 1; i <= 1000; ++i)
+      h.record(i);
+    DTEST_TRUE(h.get_count() == 1000);
+    DTEST_TRUE(h.get_last() == 1000);
+    DTEST_TRUE(h.get_max() == 1000);
+    
+    // the bins are at most 25% wide
+    uint64_t p50 = h.get_percentile(0.5);
+    uint64_t p99 = h.get_percentile(0.99);
+    DTEST_TRUE(p50 >= 500 && p50 < 625);
+    DTEST_TRUE(p99 >= 990 && p99 <= 1000);
+    DTEST_TRUE(h.get_percentile(1) == 1000);
+    DTEST_TRUE(h.get_percentile(0) == 1);
+    
+    // small values are exact
+    LatencyHistogram h2;
+    h2.record(0);
+    h2.record(1);
+    h2.record(2);
+    h2.record(3);
+    DTEST_TRUE(h2.get_percentile(0.5) == 1);
+    DTEST_TRUE(h2.get_percentile(0.75) == 2);
+  }
+  
+  
+  void dtest_bins() {
+    // every value must end up in a bin whose limit is above it, and 
+    // whose previous bin's limit is not
+    bool ok = true;
+    for (uint64_t v = 1; v < (uint64_t(1) << 31); v = v * 5 / 4 + 1) {
+      LatencyHistogram h;
+      h.record(v);
+      h.record(uint64_t(1) << 31);
+      uint64_t p = h.get_percentile(0.5);
+      ok = ok && p >= v && p <= v + v / 4;
+    }
+    DTEST_TRUE(ok);
+  }
+  
+  
+  void dtest_clamp() {
+    LatencyHistogram h;
+    h.record(uint64_t(1) << 40);
+    DTEST_TRUE(h.get_count() == 1);
+    DTEST_TRUE(h.get_max() == uint64_t(numeric_limits<int>::max()));
+  }
+  
+  
+  void dtest_reset() {
+    LatencyHistogram h;
+    h.record(100);
+    h.add_xrun();
+    DTEST_TRUE(h.get_xruns() == 1);
+    h.reset();
+    DTEST_TRUE(h.get_count() == 0);
+    DTEST_TRUE(h.get_max() == 0);
+    DTEST_TRUE(h.get_xruns() == 0);
+    DTEST_TRUE(h.get_percentile(0.99) == 0);
+  }
+  
+  
+  void dtest_now() {
+    uint64_t a = LatencyHistogram::now();
+    uint64_t b = LatencyHistogram::now();
+    DTEST_TRUE(b >= a);
+    DTEST_TRUE(LatencyHistogram::ticks_per_second() > 1e6);
+  }
+
+
+}
@@ -0,0 +1,70 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "dtest.hpp"
+#include "linkedlist.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace LinkedListBench {
+  
+  
+  /** Append 200k elements and erase them again from the front, letting the
+      erased nodes be deleted every 64 elements as a reader thread would. */
+  void dtest_bench_insert_erase() {
+    unsigned const elements = 200000;
+    
+    DTEST_BENCH("insert+erase, 200k elements", 2 * elements,
+		LinkedList<int> l;
+		for (unsigned i = 0; i < elements; ++i)
+		  l.insert(l.end(), i);
+		for (unsigned i = 0; i < elements; ++i) {
+		  l.erase(l.begin());
+		  if (i % 64 == 0)
+		    l.reader_holds_no_iterator();
+		});
+  }
+  
+  
+  /** Iterate over a list with 1M elements, as the writer and as the
+      reader. */
+  void dtest_bench_iterate() {
+    unsigned const elements = 1000000;
+    LinkedList<int> l;
+    for (unsigned i = 0; i < elements; ++i)
+      l.insert(l.end(), i);
+    
+    volatile long sum = 0;
+    DTEST_BENCH("iterate, 1M elements", elements,
+		long s = 0;
+		for (auto i = l.begin(); i != l.end(); ++i)
+		  s += *i;
+		sum = s);
+    
+    DTEST_BENCH("reader iterate, 1M elements", elements,
+		long s = 0;
+		for (auto i = l.reader_begin(); i != l.reader_end(); ++i)
+		  s += *i;
+		sum = s);
+  }
+
+
+}
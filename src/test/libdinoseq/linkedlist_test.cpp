@@ -154,6 +154,73 @@ namespace LinkedListTest {
 }
 
 
+  void dtest_interleaved_deletion() {
+  // the reader may be sampled between any two erases without stopping
+  // the deallocation
+  LinkedList<int> ll;
+  AtomicInt::Type max_erased = 0;
+  for (int i = 0; i < 1000; ++i) {
+    ll.insert(ll.end(), i);
+    ll.erase(ll.begin());
+    max_erased = std::max(max_erased, ll.get_erased_size());
+    if (i % 3 == 1)
+      ll.reader_holds_no_iterator();
+  }
+  
+  DTEST_TRUE(max_erased <= 9);
+}
+
+
+  void dtest_shared_domain() {
+  EpochDomain d;
+  int r1 = d.register_reader();
+  int r2 = d.register_reader();
+  LinkedList<int> ll1(d, r1);
+  LinkedList<int> ll2(d, r2);
+  DTEST_TRUE(&ll1.get_domain() == &d);
+  ll1.insert(ll1.end(), 1);
+  ll2.insert(ll2.end(), 2);
+  ll1.erase(ll1.begin());
+  ll2.erase(ll2.begin());
+  
+  // both readers must be quiescent before anything is freed
+  ll1.reader_holds_no_iterator();
+  
+  DTEST_TRUE(ll1.delete_erased_nodes() == 0);
+  
+  ll2.reader_holds_no_iterator();
+  
+  DTEST_TRUE(ll1.delete_erased_nodes() == 1);
+  DTEST_TRUE(ll2.delete_erased_nodes() == 1);
+}
+
+
+  void dtest_shared_domain_deletion() {
+  // a list in a shared domain frees its nodes when only its own 
+  // reader_holds_no_iterator() is called
+  EpochDomain d;
+  int r = d.register_reader();
+  LinkedList<int> ll(d, r);
+  AtomicInt::Type max_erased = 0;
+  for (int i = 0; i < 1000; ++i) {
+    ll.insert(ll.end(), i);
+    ll.erase(ll.begin());
+    max_erased = std::max(max_erased, ll.get_erased_size());
+    if (i % 3 == 1)
+      ll.reader_holds_no_iterator();
+  }
+  
+  DTEST_TRUE(max_erased <= 9);
+  
+  ll.reader_holds_no_iterator();
+  ll.delete_erased_nodes();
+  ll.reader_holds_no_iterator();
+  ll.delete_erased_nodes();
+  
+  DTEST_TRUE(ll.get_erased_size() == 0);
+}
+
+
   void dtest_Iterator() {
   LinkedList<int> ll;
   LinkedList<int> const& ll_const = ll;
@@ -0,0 +1,80 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include "dtest.hpp"
+#include "nodelist.hpp"
+#include "nodepool.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace NodeListBench {
+  
+  
+  /** Build a list with 200k nodes by inserting every node in front of the
+      previous one, then remove and destroy them all. */
+  template <typename A>
+  void bench_insert_remove(char const* name) {
+    typedef NodeList<int, A> List;
+    unsigned const nodes = 200000;
+    
+    A alloc;
+    DTEST_BENCH(name, 2 * nodes,
+		List l(alloc);
+		typename List::NodeBase* before = l.end_marker();
+		for (unsigned i = 0; i < nodes; ++i) {
+		  typename List::Node* n = l.create_node(i);
+		  l.insert(before, n);
+		  before = n;
+		}
+		while (l.first_node() != l.end_marker()) {
+		  typename List::Node* n = 
+		    static_cast<typename List::Node*>(l.first_node());
+		  l.remove(n);
+		  l.destroy_node(n);
+		});
+  }
+  
+  
+  void dtest_bench_insert_remove() {
+    bench_insert_remove<HeapAllocator>("insert+remove, 200k nodes, heap");
+    bench_insert_remove<PoolAllocator>("insert+remove, 200k nodes, pool");
+  }
+  
+  
+  /** Iterate over a list with 1M nodes. */
+  void dtest_bench_iterate() {
+    typedef NodeList<int> List;
+    unsigned const nodes = 1000000;
+    List l;
+    for (unsigned i = 0; i < nodes; ++i)
+      l.insert(l.end_marker(), l.create_node(i));
+    
+    volatile long sum = 0;
+    DTEST_BENCH("iterate, 1M nodes", nodes,
+		long s = 0;
+		for (List::NodeBase* nb = l.first_node(); nb != l.end_marker();
+		     nb = static_cast<List::Node*>(nb)->m_next.get())
+		  s += static_cast<List::Node*>(nb)->m_data;
+		sum = s);
+  }
+
+
+}
@@ -0,0 +1,100 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "dtest.hpp"
+#include "nodepool.hpp"
+#include "nodeskiplist.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace NodePoolBench {
+  
+  
+  /** Insert 200k nodes at the end of a skip list and remove them again,
+      then build a list while other allocations happen inbetween (as they 
+      would in a real program) and iterate over it, counting cache misses 
+      if possible. */
+  template <typename A>
+  void bench_allocator(string const& name) {
+    typedef NodeSkipList<int, 2, 20, A> List;
+    unsigned const nodes = 200000;
+    
+    A alloc;
+    DTEST_BENCH("insert+remove, " + name, 2 * nodes,
+		List l(alloc);
+		l.seed(1);
+		for (unsigned i = 0; i < nodes; ++i)
+		  l.insert(l.end_marker(), l.create_node(i));
+		while (l.first_node() != l.end_marker()) {
+		  typename List::Node* n = 
+		    static_cast<typename List::Node*>(l.first_node());
+		  l.remove(n);
+		  l.destroy_node(n);
+		});
+    
+    List l(alloc);
+    l.seed(1);
+    vector<char*> noise;
+    for (unsigned i = 0; i < nodes; ++i) {
+      l.insert(l.end_marker(), l.create_node(i));
+      noise.push_back(new char[48]);
+    }
+    
+    Benchmark::CacheMisses misses;
+    long long count = -1;
+    volatile long sum = 0;
+    DTEST_BENCH("iterate, " + name, nodes,
+		misses.start();
+		long s = 0;
+		for (auto nb = l.first_node(); nb != l.end_marker(); 
+		     nb = nb->links()[0].next.get())
+		  s += static_cast<typename List::Node*>(nb)->data;
+		sum = s;
+		count = misses.stop());
+    ostringstream msg;
+    msg<<"  iterate, "<<name<<": ";
+    if (count >= 0)
+      msg<<count<<" cache misses";
+    else
+      msg<<"cache misses n/a";
+    DTEST_MSG(msg.str());
+    
+    for (size_t i = 0; i < noise.size(); ++i)
+      delete [] noise[i];
+  }
+  
+  
+  void dtest_bench_heap() {
+    bench_allocator<HeapAllocator>("heap");
+  }
+  
+  
+  void dtest_bench_pool() {
+    bench_allocator<PoolAllocator>("pool");
+  }
+
+
+}
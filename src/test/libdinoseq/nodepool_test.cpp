@@ -0,0 +1,127 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <set>
+
+#include "dtest.hpp"
+#include "nodepool.hpp"
+#include "nodequeue.hpp"
+#include "nodeskiplist.hpp"
+
+
+using namespace Dino;
+
+
+namespace NodePoolTest {
+  
+  
+  void dtest_constructor() {
+    DTEST_NOTHROW(NodePool np(24));
+    NodePool np(24, 16);
+    DTEST_TRUE(np.get_block_size() >= 24);
+    DTEST_TRUE(np.get_block_size() % 16 == 0);
+    DTEST_TRUE(np.get_allocated() == 0);
+    DTEST_TRUE(np.get_capacity() == 0);
+  }
+  
+  
+  void dtest_allocate_deallocate() {
+    NodePool np(24, 16);
+    std::set<void*> blocks;
+    
+    // blocks must be distinct and the pool must grow as needed
+    for (int i = 0; i < 40; ++i)
+      blocks.insert(np.allocate());
+    DTEST_TRUE(blocks.size() == 40);
+    DTEST_TRUE(np.get_allocated() == 40);
+    DTEST_TRUE(np.get_capacity() == 48);
+    
+    // deallocated blocks are reused
+    void* p = *blocks.begin();
+    np.deallocate(p);
+    DTEST_TRUE(np.get_allocated() == 39);
+    DTEST_TRUE(np.allocate() == p);
+    
+    for (auto i = blocks.begin(); i != blocks.end(); ++i)
+      np.deallocate(*i);
+    DTEST_TRUE(np.get_allocated() == 0);
+    DTEST_TRUE(np.get_capacity() == 48);
+  }
+  
+  
+  void dtest_reserve() {
+    NodePool np(8, 16);
+    np.reserve(100);
+    DTEST_TRUE(np.get_capacity() >= 100);
+    size_t capacity = np.get_capacity();
+    for (int i = 0; i < 100; ++i)
+      np.allocate();
+    DTEST_TRUE(np.get_capacity() == capacity);
+  }
+  
+  
+  void dtest_pool_allocator() {
+    PoolAllocator pa1(16);
+    PoolAllocator pa2 = pa1;
+    
+    // copies share the pools
+    void* p = pa1.allocate(40);
+    pa2.deallocate(p, 40);
+    DTEST_TRUE(pa2.allocate(48) == p);
+    pa1.deallocate(p, 48);
+    
+    // sizes that are too large go to the heap
+    size_t big = PoolAllocator::max_pooled_size() + 1;
+    void* q = pa1.allocate(big);
+    DTEST_TRUE(q != 0);
+    pa2.deallocate(q, big);
+  }
+  
+  
+  void dtest_containers() {
+    PoolAllocator pa;
+    
+    // nodes can be moved between queues that share an allocator
+    NodeQueue<int, PoolAllocator> q1(pa);
+    NodeQueue<int, PoolAllocator> q2(pa);
+    for (int i = 0; i < 10; ++i)
+      q1.push_node(q1.create_node(i));
+    NodeQueue<int, PoolAllocator>::Node* n;
+    int expected = 0;
+    while ((n = q1.pop_node())) {
+      DTEST_TRUE(n->data == expected++);
+      q2.push_node(n);
+    }
+    DTEST_TRUE(expected == 9);
+    
+    // and the skiplist works the same with either allocator
+    typedef NodeSkipList<int, 2, 20, PoolAllocator> PoolSkipList;
+    PoolSkipList nsl(pa);
+    for (int i = 0; i < 100; ++i)
+      nsl.insert(nsl.end_marker(), nsl.create_node(i));
+    PoolSkipList::Node* node = 
+      static_cast<PoolSkipList::Node*>(nsl.lower_bound(42));
+    DTEST_TRUE(node->data == 42);
+    nsl.remove(node);
+    nsl.destroy_node(node);
+    node = static_cast<PoolSkipList::Node*>(nsl.lower_bound(42));
+    DTEST_TRUE(node->data == 43);
+  }
+
+
+}
@@ -0,0 +1,85 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <pthread.h>
+
+#include "dtest.hpp"
+#include "nodepool.hpp"
+#include "nodequeue.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace NodeQueueBench {
+  
+  
+  /** The NodePools are not thread safe, so the threaded benchmark uses the
+      heap. */
+  typedef NodeQueue<int> Queue;
+  
+  
+  /** The number of nodes passed through the queue in the threaded 
+      benchmark. */
+  unsigned const nodes = 1000000;
+  
+  
+  /** Pop and destroy @c nodes nodes from the queue that @c arg points 
+      to. */
+  void* consume(void* arg) {
+    Queue& q = *static_cast<Queue*>(arg);
+    unsigned popped = 0;
+    while (popped < nodes) {
+      if (Queue::Node* n = q.pop_node()) {
+	q.destroy_node(n);
+	++popped;
+      }
+    }
+    return 0;
+  }
+  
+  
+  /** Push and pop 1M nodes in one thread, with at most one node in the
+      queue at a time. */
+  void dtest_bench_push_pop() {
+    NodeQueue<int, PoolAllocator> q;
+    DTEST_BENCH("push+pop, 1M nodes", 2 * nodes,
+		q.push_node(q.create_node(0));
+		for (unsigned i = 0; i < nodes; ++i) {
+		  q.push_node(q.create_node(i));
+		  q.destroy_node(q.pop_node());
+		});
+  }
+  
+  
+  /** Push 1M nodes from one thread while another thread pops them. One
+      extra node is pushed at the end since the last node can't be 
+      popped. */
+  void dtest_bench_threaded() {
+    DTEST_BENCH("push/pop in two threads, 1M nodes", nodes,
+		Queue q;
+		pthread_t consumer;
+		pthread_create(&consumer, 0, &consume, &q);
+		for (unsigned i = 0; i <= nodes; ++i)
+		  q.push_node(q.create_node(i));
+		pthread_join(consumer, 0));
+  }
+
+
+}
@@ -16,6 +16,9 @@
     along with this program. If not, see <http://www.gnu.org/licenses/>.
 *****************************************************************************/
 
+#include <pthread.h>
+#include <sched.h>
+
 #include "dtest.hpp"
 #include "nodequeue.hpp"
 
@@ -66,5 +69,45 @@ namespace NodeQueueTest {
     delete node;
   }
   
+  
+  /** A queue and the state of the thread that pops from it. */
+  struct Consumer {
+    NodeQueue<int> queue;
+    int popped;
+    bool ok;
+  };
+  
+  
+  void* consume(void* arg) {
+    Consumer& c = *static_cast<Consumer*>(arg);
+    typedef NodeQueue<int>::Node Node;
+    while (c.popped < 99999) {
+      Node* n = c.queue.pop_node();
+      if (!n) {
+	sched_yield();
+	continue;
+      }
+      c.ok = c.ok && n->data == c.popped;
+      ++c.popped;
+      c.queue.destroy_node(n);
+    }
+    return 0;
+  }
+  
+  
+  void dtest_threads() {
+    // the last node can't be popped, so 100000 pushes give 99999 pops
+    Consumer c;
+    c.popped = 0;
+    c.ok = true;
+    pthread_t thread;
+    pthread_create(&thread, 0, &consume, &c);
+    for (int i = 0; i < 100000; ++i)
+      c.queue.push_node(c.queue.create_node(i));
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(c.ok && c.popped == 99999);
+  }
+
 
 }
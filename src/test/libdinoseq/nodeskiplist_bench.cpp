@@ -0,0 +1,219 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include "dtest.hpp"
+#include "nodepool.hpp"
+#include "nodeskiplist.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace NodeSkipListBench {
+  
+  
+  typedef NodeSkipList<int, 2, 20, PoolAllocator> List;
+  
+  
+  /** Return @c n pseudo-random integers. */
+  vector<int> random_values(unsigned n) {
+    vector<int> v(n);
+    unsigned x = 1;
+    for (unsigned i = 0; i < n; ++i) {
+      x = x * 1664525 + 1013904223;
+      v[i] = x >> 1;
+    }
+    return v;
+  }
+  
+  
+  /** Insert 200k random values in sorted order, one at a time and with
+      bulk_insert(). */
+  void dtest_bench_insert() {
+    unsigned const n = 200000;
+    vector<int> values = random_values(n);
+    vector<int> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    
+    DTEST_BENCH("insert random, 200k nodes", n,
+		List l;
+		l.seed(1);
+		for (unsigned i = 0; i < n; ++i)
+		  l.insert(l.upper_bound(values[i]), l.create_node(values[i])));
+    
+    DTEST_BENCH("insert sorted at end, 200k nodes", n,
+		List l;
+		l.seed(1);
+		for (unsigned i = 0; i < n; ++i)
+		  l.insert(l.end_marker(), l.create_node(sorted[i])));
+    
+    DTEST_BENCH("bulk_insert, 200k nodes", n,
+		List l;
+		l.seed(1);
+		l.bulk_insert(l.end_marker(), sorted.begin(), sorted.end()));
+  }
+  
+  
+  /** Look up 1M random values in a list with 1M nodes. */
+  void dtest_bench_search() {
+    unsigned const n = 1000000;
+    vector<int> values = random_values(n);
+    vector<int> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    List l;
+    l.seed(1);
+    for (unsigned i = 0; i < n; ++i)
+      l.insert(l.end_marker(), l.create_node(sorted[i]));
+    
+    volatile long sum = 0;
+    DTEST_BENCH("lower_bound, 1M nodes", n,
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (l.lower_bound(values[i]) != l.end_marker());
+		sum = s);
+  }
+  
+  
+  /** Look up 1M random values in lists of different sizes. The small
+      lists only have a few levels, so the searches start lower. */
+  void dtest_bench_search_sizes() {
+    unsigned const n = 1000000;
+    vector<int> values = random_values(n);
+    char const* names[] = { "lower_bound, 16 nodes", 
+			    "lower_bound, 256 nodes",
+			    "lower_bound, 4096 nodes",
+			    "lower_bound, 64k nodes" };
+    for (unsigned k = 0; k < 4; ++k) {
+      vector<int> sorted(values.begin(), values.begin() + (16 << (4 * k)));
+      std::sort(sorted.begin(), sorted.end());
+      List l;
+      l.seed(1);
+      for (unsigned i = 0; i < sorted.size(); ++i)
+	l.insert(l.end_marker(), l.create_node(sorted[i]));
+      
+      volatile long sum = 0;
+      DTEST_BENCH(names[k], n,
+		  long s = 0;
+		  for (unsigned i = 0; i < n; ++i)
+		    s += (l.lower_bound(values[i]) != l.end_marker());
+		  sum = s);
+    }
+  }
+  
+  
+  /** Load a link with a full barrier, like AtomicPtr::get() does on 
+      platforms where the glib atomics use fences. */
+  struct FullBarrier {
+    List::NodeBase const* operator()(List::LinkNode const& l) const {
+      __sync_synchronize();
+      List::NodeBase const* result = l.next.get();
+      __sync_synchronize();
+      return result;
+    }
+  };
+  
+  
+  /** Load a link with AtomicPtr::get(). */
+  struct Get {
+    List::NodeBase const* operator()(List::LinkNode const& l) const {
+      return l.next.get();
+    }
+  };
+  
+  
+  /** Load a link with AtomicPtr::get_acquire(). */
+  struct Acquire {
+    List::NodeBase const* operator()(List::LinkNode const& l) const {
+      return l.next.get_acquire();
+    }
+  };
+  
+  
+  /** Iterate over all nodes in @c l at level 0 and return the sum. */
+  template <typename Load>
+  long iterate(List const& l, Load load) {
+    long s = 0;
+    List::NodeBase const* n = l.head_marker();
+    while ((n = load(n->links()[0])) != l.end_marker())
+      s += static_cast<List::Node const*>(n)->data;
+    return s;
+  }
+  
+  
+  /** The same search as List::find_less(). */
+  template <typename Load>
+  List::NodeBase const* find_less(List const& l, int v, Load load) {
+    List::NodeBase const* i = l.head_marker();
+    int level = l.levels() - 1;
+    do {
+      List::NodeBase const* next = load(i->links()[level]);
+      if (next == l.end_marker() || 
+	  !(static_cast<List::Node const*>(next)->data < v))
+	--level;
+      else
+	i = next;
+    } while (level >= 0);
+    return i;
+  }
+  
+  
+  /** Iterate over and search in a list with 1M nodes, loading the links 
+      with a full barrier, with AtomicPtr::get() and with 
+      AtomicPtr::get_acquire(). */
+  void dtest_bench_traverse() {
+    unsigned const n = 1000000;
+    vector<int> values = random_values(n);
+    vector<int> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    List l;
+    l.seed(1);
+    l.bulk_insert(l.end_marker(), sorted.begin(), sorted.end());
+    List const& cl = l;
+    
+    volatile long sum = 0;
+    DTEST_BENCH("iterate with full barriers, 1M nodes", n,
+		sum = iterate(cl, FullBarrier()));
+    DTEST_BENCH("iterate with get(), 1M nodes", n,
+		sum = iterate(cl, Get()));
+    DTEST_BENCH("iterate with get_acquire(), 1M nodes", n,
+		sum = iterate(cl, Acquire()));
+    
+    DTEST_BENCH("find_less with full barriers, 1M nodes", n,
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (find_less(cl, values[i], FullBarrier()) != 
+			cl.head_marker());
+		sum = s);
+    DTEST_BENCH("find_less with get(), 1M nodes", n,
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (find_less(cl, values[i], Get()) != cl.head_marker());
+		sum = s);
+    DTEST_BENCH("find_less with get_acquire(), 1M nodes", n,
+		long s = 0;
+		for (unsigned i = 0; i < n; ++i)
+		  s += (cl.find_less(values[i]) != cl.head_marker());
+		sum = s);
+  }
+
+
+}
@@ -18,7 +18,11 @@
 
 #include <algorithm>
 #include <iterator>
+#include <vector>
 
+#include <pthread.h>
+
+#include "atomicint.hpp"
 #include "dtest.hpp"
 #include "nodeskiplist.hpp"
 
@@ -46,12 +50,88 @@ namespace NodeSkipListTest {
 
     DTEST_TRUE(nsl.head_marker() != nsl.end_marker());
   
-    DTEST_TRUE(nsl.head_marker()->links[0].next.get() == nsl.first_node());
+    DTEST_TRUE(nsl.head_marker()->links()[0].next.get() == nsl.first_node());
 
-    DTEST_TRUE(nsl.head_marker()->links[0].next.get() == nsl.end_marker());
+    DTEST_TRUE(nsl.head_marker()->links()[0].next.get() == nsl.end_marker());
+  }
+  
+  
+  void dtest_create_destroy_node() {
+    typedef NodeSkipList<int>::Node Node;
+    typedef NodeSkipList<int>::LinkNode LinkNode;
+    
+    NodeSkipList<int> nsl;
+    Node* n = nsl.create_node(42, 5);
+    
+    DTEST_TRUE(n->data == 42);
+    
+    DTEST_TRUE(n->levels == 5);
+    
+    // the links are stored directly before the node
+    DTEST_TRUE(reinterpret_cast<LinkNode*>(n) == n->links() + 5);
+    
+    for (size_t l = 0; l < n->levels; ++l) {
+      DTEST_TRUE(n->links()[l].prev == 0);
+      DTEST_TRUE(n->links()[l].next.get() == 0);
+    }
+    
+    nsl.destroy_node(n);
+    
+    // random levels are always in the range [1, M]
+    bool in_range = true;
+    for (int i = 0; i < 10000; ++i) {
+      n = nsl.create_node(i);
+      in_range = in_range && n->levels >= 1 && n->levels <= 20;
+      nsl.destroy_node(n);
+    }
+    
+    DTEST_TRUE(in_range);
   }
 
 
+  void dtest_seed() {
+    typedef NodeSkipList<int>::Node Node;
+    
+    NodeSkipList<int> nsl1;
+    NodeSkipList<int> nsl2;
+    nsl1.seed(1234);
+    nsl2.seed(1234);
+    
+    // the same seed gives the same levels, and about half of the nodes
+    // get more than one level
+    bool same = true;
+    unsigned histogram[21] = { 0 };
+    for (int i = 0; i < 10000; ++i) {
+      Node* n1 = nsl1.create_node(i);
+      Node* n2 = nsl2.create_node(i);
+      same = same && n1->levels == n2->levels;
+      ++histogram[n1->levels];
+      nsl1.destroy_node(n1);
+      nsl2.destroy_node(n2);
+    }
+    
+    DTEST_TRUE(same);
+    
+    DTEST_TRUE(histogram[1] > 4500 && histogram[1] < 5500);
+    
+    DTEST_TRUE(histogram[2] > 2000 && histogram[2] < 3000);
+    
+    // a different seed gives different levels
+    nsl1.seed(1234);
+    nsl2.seed(4321);
+    same = true;
+    for (int i = 0; i < 100; ++i) {
+      Node* n1 = nsl1.create_node(i);
+      Node* n2 = nsl2.create_node(i);
+      same = same && n1->levels == n2->levels;
+      nsl1.destroy_node(n1);
+      nsl2.destroy_node(n2);
+    }
+    
+    DTEST_TRUE(!same);
+  }
+  
+  
   void dtest_insert_remove() {
     typedef NodeSkipList<int>::NodeBase NodeBase;
     typedef NodeSkipList<int>::Node Node;
@@ -61,63 +141,137 @@ namespace NodeSkipListTest {
   
     DTEST_TRUE(nl.first_node() == nl.end_marker());
   
-    DTEST_TRUE(nl.insert(end, new Node(1)));
+    DTEST_TRUE(nl.insert(end, nl.create_node(1)));
 
     DTEST_TRUE(nl.first_node() != nl.end_marker());
   
-    DTEST_TRUE(nl.insert(end, new Node(2)));
+    DTEST_TRUE(nl.insert(end, nl.create_node(2)));
   
-    DTEST_TRUE(nl.insert(nl.first_node(), new Node(0)));
+    DTEST_TRUE(nl.insert(nl.first_node(), nl.create_node(0)));
   
     NodeBase* nb = nl.first_node();
   
     DTEST_TRUE(static_cast<Node*>(nb)->data == 0);
 
-    nb = static_cast<Node*>(nb)->links[0].next.get();
+    nb = static_cast<Node*>(nb)->links()[0].next.get();
   
     DTEST_TRUE(static_cast<Node*>(nb)->data == 1);
   
-    nb = static_cast<Node*>(nb)->links[0].next.get();
+    nb = static_cast<Node*>(nb)->links()[0].next.get();
   
     DTEST_TRUE(static_cast<Node*>(nb)->data == 2);
   
     Node* n = static_cast<Node*>(nl.first_node());
     nl.remove(n);
-    delete n;
+    nl.destroy_node(n);
   
     n = static_cast<Node*>(nl.first_node());
   
     DTEST_TRUE(n->data == 1);
   
     nl.remove(n);
-    delete n;
+    nl.destroy_node(n);
     n = static_cast<Node*>(nl.first_node());
 
     DTEST_TRUE(n->data == 2);
   
     nl.remove(n);
-    delete n;
+    nl.destroy_node(n);
   
     DTEST_TRUE(nl.first_node() == nl.end_marker());
   }
 
 
+  void dtest_bulk_insert() {
+    typedef NodeSkipList<int>::NodeBase NodeBase;
+    typedef NodeSkipList<int>::Node Node;
+    
+    NodeSkipList<int> nsl;
+    int a[] = { 0, 2, 4, 6, 8, 10, 12, 14 };
+    int b[] = { 4, 5, 5 };
+    int c[] = { 20, 22, 21 };
+    
+    // an empty range doesn't change anything
+    DTEST_TRUE(nsl.bulk_insert(nsl.end_marker(), a, a) == nsl.end_marker());
+    
+    DTEST_TRUE(nsl.first_node() == nsl.end_marker());
+    
+    // the new nodes get the levels of a balanced skip list
+    NodeBase* nb = nsl.bulk_insert(nsl.end_marker(), a, a + 8);
+    
+    DTEST_TRUE(nb == nsl.first_node());
+    
+    size_t levels[] = { 1, 2, 1, 3, 1, 2, 1, 4 };
+    bool balanced = true;
+    for (int i = 0; i < 8; ++i, nb = nb->links()[0].next.get()) {
+      balanced = balanced && static_cast<Node*>(nb)->data == a[i] &&
+	nb->levels == levels[i];
+    }
+    
+    DTEST_TRUE(balanced);
+    
+    DTEST_TRUE(nb == nsl.end_marker());
+    
+    // the higher levels skip the right nodes
+    NodeBase const* head = nsl.head_marker();
+    
+    Node const* second = static_cast<Node const*>(head->links()[2].next.get());
+    
+    DTEST_TRUE(second->data == 6);
+    
+    DTEST_TRUE(static_cast<Node*>(nsl.lower_bound(10))->data == 10);
+    
+    // insert in the middle of the list
+    nb = nsl.bulk_insert(nsl.upper_bound(4), b, b + 3);
+    
+    DTEST_TRUE(nb != 0 && static_cast<Node*>(nb)->data == 4);
+    
+    int merged[] = { 0, 2, 4, 4, 5, 5, 6, 8, 10, 12, 14 };
+    nb = nsl.first_node();
+    bool sorted = true;
+    for (int i = 0; i < 11; ++i, nb = nb->links()[0].next.get())
+      sorted = sorted && static_cast<Node*>(nb)->data == merged[i];
+    
+    DTEST_TRUE(sorted);
+    
+    DTEST_TRUE(nb == nsl.end_marker());
+    
+    for (int i = 0; i < 11; ++i) {
+      sorted = sorted && 
+	static_cast<Node*>(nsl.lower_bound(merged[i]))->data == merged[i];
+    }
+    
+    DTEST_TRUE(sorted);
+    
+    // unsorted ranges and ranges that don't fit are not inserted
+    DTEST_TRUE(nsl.bulk_insert(nsl.end_marker(), c, c + 3) == 0);
+    
+    DTEST_TRUE(nsl.bulk_insert(nsl.first_node(), b, b + 3) == 0);
+    
+    nb = nsl.first_node();
+    for (int i = 0; i < 11; ++i)
+      nb = nb->links()[0].next.get();
+    
+    DTEST_TRUE(nb == nsl.end_marker());
+  }
+  
+  
   void dtest_lower_bound() {
     typedef NodeSkipList<int>::NodeBase NodeBase;
     typedef NodeSkipList<int>::Node Node;
 
     NodeSkipList<int> nsl;
   
-    Node* n1 = new Node(1);
+    Node* n1 = nsl.create_node(1);
     nsl.insert(nsl.end_marker(), n1);
-    Node* n2 = new Node(2);
+    Node* n2 = nsl.create_node(2);
     nsl.insert(nsl.end_marker(), n2);
-    nsl.insert(nsl.end_marker(), new Node(2));
-    Node* n3 = new Node(3);
+    nsl.insert(nsl.end_marker(), nsl.create_node(2));
+    Node* n3 = nsl.create_node(3);
     nsl.insert(nsl.end_marker(), n3);
-    nsl.insert(nsl.end_marker(), new Node(3));
-    nsl.insert(nsl.end_marker(), new Node(3));
-    Node* n4 = new Node(4);
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    Node* n4 = nsl.create_node(4);
     nsl.insert(nsl.end_marker(), n4);
   
     DTEST_TRUE(nsl.lower_bound(0) == n1);
@@ -154,16 +308,16 @@ namespace NodeSkipListTest {
 
     NodeSkipList<int> nsl;
   
-    Node* n1 = new Node(1);
+    Node* n1 = nsl.create_node(1);
     nsl.insert(nsl.end_marker(), n1);
-    Node* n2 = new Node(2);
+    Node* n2 = nsl.create_node(2);
     nsl.insert(nsl.end_marker(), n2);
-    nsl.insert(nsl.end_marker(), new Node(2));
-    Node* n3 = new Node(3);
+    nsl.insert(nsl.end_marker(), nsl.create_node(2));
+    Node* n3 = nsl.create_node(3);
     nsl.insert(nsl.end_marker(), n3);
-    nsl.insert(nsl.end_marker(), new Node(3));
-    nsl.insert(nsl.end_marker(), new Node(3));
-    Node* n4 = new Node(4);
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    Node* n4 = nsl.create_node(4);
     nsl.insert(nsl.end_marker(), n4);
   
     DTEST_TRUE(nsl.upper_bound(0) == n1);
@@ -196,16 +350,16 @@ namespace NodeSkipListTest {
 
     NodeSkipList<int> nsl;
   
-    Node* n1 = new Node(1);
+    Node* n1 = nsl.create_node(1);
     nsl.insert(nsl.end_marker(), n1);
-    nsl.insert(nsl.end_marker(), new Node(2));
-    Node* n2 = new Node(2);
+    nsl.insert(nsl.end_marker(), nsl.create_node(2));
+    Node* n2 = nsl.create_node(2);
     nsl.insert(nsl.end_marker(), n2);
-    nsl.insert(nsl.end_marker(), new Node(3));
-    nsl.insert(nsl.end_marker(), new Node(3));
-    Node* n3 = new Node(3);
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    Node* n3 = nsl.create_node(3);
     nsl.insert(nsl.end_marker(), n3);
-    Node* n4 = new Node(4);
+    Node* n4 = nsl.create_node(4);
     nsl.insert(nsl.end_marker(), n4);
   
     DTEST_TRUE(nsl.find_less(0) == nsl.head_marker());
@@ -236,22 +390,150 @@ namespace NodeSkipListTest {
   }
 
 
+  void dtest_levels() {
+    typedef NodeSkipList<int>::Node Node;
+    
+    NodeSkipList<int> nsl;
+    
+    DTEST_TRUE(nsl.levels() == 1);
+    
+    // the levels follow the tallest node in the list
+    Node* n1 = nsl.create_node(1, 3);
+    Node* n2 = nsl.create_node(2, 7);
+    nsl.insert(nsl.end_marker(), n1);
+    nsl.insert(nsl.end_marker(), n2);
+    
+    DTEST_TRUE(nsl.levels() == 7);
+    
+    DTEST_TRUE(nsl.find_less(2) == n1 && nsl.find_less(3) == n2);
+    
+    nsl.remove(n2);
+    nsl.destroy_node(n2);
+    
+    DTEST_TRUE(nsl.levels() == 3);
+    
+    DTEST_TRUE(nsl.find_less(3) == n1);
+    
+    // and so do the nodes from bulk_insert() and replace()
+    std::vector<int> values;
+    for (int i = 2; i < 100; ++i)
+      values.push_back(i);
+    nsl.bulk_insert(nsl.end_marker(), values.begin(), values.end());
+    
+    DTEST_TRUE(nsl.levels() == 7);
+    
+    std::vector<Node*> old;
+    for (NodeSkipList<int>::NodeBase* n = nsl.first_node(); 
+	 n != nsl.end_marker(); n = n->links()[0].next.get())
+      old.push_back(static_cast<Node*>(n));
+    nsl.replace(nsl.first_node(), nsl.end_marker(), 
+		values.begin(), values.begin() + 2);
+    for (size_t i = 0; i < old.size(); ++i)
+      nsl.destroy_node(old[i]);
+    
+    DTEST_TRUE(nsl.levels() == 2);
+    
+    DTEST_TRUE(nsl.find_less(3) == nsl.first_node());
+  }
+  
+  
+  void dtest_find_less_from() {
+    typedef NodeSkipList<int>::NodeBase NodeBase;
+    
+    NodeSkipList<int> nsl;
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i)
+      values.push_back(2 * i);
+    nsl.bulk_insert(nsl.end_marker(), values.begin(), values.end());
+    for (int i = 1; i < 2000; i += 2)
+      nsl.insert(nsl.upper_bound(i), nsl.create_node(i));
+    
+    // a search from any node before the value finds the same node as a 
+    // search from the head
+    bool same = true;
+    for (int s = -1; s < 2000; s += 37) {
+      NodeBase* start = (s < 0 ? nsl.head_marker() : nsl.lower_bound(s));
+      for (int v = s + 1; v < 2010; v += 13)
+	same = same && (nsl.find_less(v, start) == nsl.find_less(v));
+    }
+    
+    DTEST_TRUE(same);
+    
+    NodeSkipList<int> const& nslc = nsl;
+    NodeBase const* n = nslc.lower_bound(500);
+    
+    DTEST_TRUE(nslc.find_less(501, n) == n);
+    
+    DTEST_TRUE(nslc.find_less(2500, n) == nslc.find_less(2500));
+  }
+  
+  
+  /** A list that is searched by another thread while it is changed. */
+  struct Searcher {
+    NodeSkipList<int> list;
+    AtomicInt quit;
+    bool ok;
+  };
+  
+  
+  void* search(void* arg) {
+    Searcher& s = *static_cast<Searcher*>(arg);
+    typedef NodeSkipList<int>::Node Node;
+    NodeSkipList<int> const& l = s.list;
+    for (int v = 0; !s.quit.get(); v = (v + 7919) % 150000) {
+      // new nodes may be inserted after n at any time, but the list must
+      // stay sorted
+      NodeSkipList<int>::NodeBase const* n = l.find_less(v);
+      NodeSkipList<int>::NodeBase const* next = 
+	n->links()[0].next.get_acquire();
+      s.ok = s.ok && 
+	(n == l.head_marker() || static_cast<Node const*>(n)->data < v) &&
+	(n == l.head_marker() || next == l.end_marker() || 
+	 !(static_cast<Node const*>(next)->data < 
+	   static_cast<Node const*>(n)->data));
+    }
+    return 0;
+  }
+  
+  
+  void dtest_concurrent_search() {
+    // the nodes are published with release ordering, so a searching thread
+    // must always see their data initialised
+    Searcher s;
+    s.ok = true;
+    std::vector<int> values;
+    for (int i = 100000; i < 150000; i += 3)
+      values.push_back(i);
+    pthread_t thread;
+    pthread_create(&thread, 0, &search, &s);
+    for (int i = 0; i < 100000; ++i) {
+      int v = (i * 7333) % 100000;
+      s.list.insert(s.list.upper_bound(v), s.list.create_node(v));
+    }
+    s.list.bulk_insert(s.list.end_marker(), values.begin(), values.end());
+    s.quit.set(1);
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(s.ok);
+  }
+  
+  
   void dtest_find_less_or_equal() {
     typedef NodeSkipList<int>::NodeBase NodeBase;
     typedef NodeSkipList<int>::Node Node;
 
     NodeSkipList<int> nsl;
   
-    Node* n1 = new Node(1);
+    Node* n1 = nsl.create_node(1);
     nsl.insert(nsl.end_marker(), n1);
-    nsl.insert(nsl.end_marker(), new Node(2));
-    Node* n2 = new Node(2);
+    nsl.insert(nsl.end_marker(), nsl.create_node(2));
+    Node* n2 = nsl.create_node(2);
     nsl.insert(nsl.end_marker(), n2);
-    nsl.insert(nsl.end_marker(), new Node(3));
-    nsl.insert(nsl.end_marker(), new Node(3));
-    Node* n3 = new Node(3);
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    nsl.insert(nsl.end_marker(), nsl.create_node(3));
+    Node* n3 = nsl.create_node(3);
     nsl.insert(nsl.end_marker(), n3);
-    Node* n4 = new Node(4);
+    Node* n4 = nsl.create_node(4);
     nsl.insert(nsl.end_marker(), n4);
   
     DTEST_TRUE(nsl.find_less_or_equal(0) == nsl.head_marker());
@@ -0,0 +1,77 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <fstream>
+#include <memory>
+#include <sstream>
+
+#include "curve.hpp"
+#include "dtest.hpp"
+#include "offlinerenderer.hpp"
+#include "rawdumpbuffer.hpp"
+#include "sequencer.hpp"
+#include "smfwriter.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace OfflineRendererBench {
+  
+  
+  /** Render a song with 64 curves of 1024 beats, interpolated at 64 
+      events per beat, to a MIDI file and to a raw dump. */
+  void dtest_bench_render() {
+    unsigned const curves = 64;
+    unsigned const beats = 1024;
+    
+    Sequencer seq;
+    OfflineRenderer r(seq);
+    for (unsigned i = 0; i < curves; ++i) {
+      auto c = make_shared<Curve>("Bench curve", SongTime(beats, 0), i);
+      c->set_resolution(64);
+      for (unsigned j = 0; j <= beats; j += 4)
+	c->add_point(SongTime(j, 0), ((j / 4) % 2) ? 0x7FFFFFFF : 0);
+      seq.set_event_buffer(seq.add_sequencable(c), r.get_buffer());
+    }
+    
+    // count the events first so the rates can be reported as events/s
+    size_t events;
+    {
+      ofstream os("/dev/null");
+      RawDumpBuffer rdb(os);
+      events = r.render(SongTime(0, 0), SongTime(beats, 0), rdb);
+    }
+    ostringstream param;
+    param<<(events / 1000)<<"k events";
+    
+    DTEST_BENCH("SMF, " + param.str(), events,
+		ofstream os("/dev/null");
+		SmfWriter smf(os);
+		r.render(SongTime(0, 0), SongTime(beats, 0), smf);
+		smf.finish());
+    
+    DTEST_BENCH("raw, " + param.str(), events,
+		ofstream os("/dev/null");
+		RawDumpBuffer rdb(os);
+		r.render(SongTime(0, 0), SongTime(beats, 0), rdb));
+  }
+
+
+}
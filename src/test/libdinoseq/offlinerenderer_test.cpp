@@ -0,0 +1,121 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <memory>
+#include <vector>
+
+#include "dtest.hpp"
+#include "eventbuffer.hpp"
+#include "offlinerenderer.hpp"
+#include "sequencable.hpp"
+#include "sequencer.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace OfflineRendererTest {
+  
+  
+  /** A Sequencable that writes an event every @c step ticks. */
+  class StepSequence : public Sequencable {
+  public:
+    
+    StepSequence(SongTime::Tick step, unsigned char id) 
+      : Sequencable("Steps"), m_step(step), m_id(id) { }
+    
+    bool sequence(Position& pos, SongTime const& to, EventBuffer& buf) const {
+      SongTime t(pos.get_time().get_beat(), 0);
+      while (t < pos.get_time())
+	t += SongTime(0, m_step);
+      for ( ; t < to; t += SongTime(0, m_step)) {
+	unsigned char data[] = { 0xB0, m_id, 0 };
+	if (!buf.write_event(t, 3, data)) {
+	  update_position(pos, t);
+	  return false;
+	}
+      }
+      update_position(pos, to);
+      return true;
+    }
+  
+  private:
+    
+    SongTime::Tick m_step;
+    unsigned char m_id;
+  };
+  
+  
+  /** An EventBuffer that stores the event times and the second bytes. */
+  class VectorBuffer : public EventBuffer {
+  public:
+    bool write_event(SongTime const& st, size_t, unsigned char const* data) {
+      times.push_back(st);
+      ids.push_back(data[1]);
+      return true;
+    }
+    vector<SongTime> times;
+    vector<unsigned char> ids;
+  };
+  
+  
+  void dtest_render() {
+    Sequencer seq;
+    OfflineRenderer r(seq, 1024, 16);
+    seq.set_event_buffer(seq.add_sequencable
+			 (make_shared<StepSequence>(1 << 22, 1)), 
+			 r.get_buffer());
+    seq.set_event_buffer(seq.add_sequencable
+			 (make_shared<StepSequence>(1 << 21, 2)), 
+			 r.get_buffer());
+    
+    // 4 + 8 events per beat and 16 events per window, so the windows 
+    // have to be split
+    VectorBuffer buf;
+    
+    DTEST_TRUE(r.render(SongTime(0, 0), SongTime(16, 0), buf) == 192);
+    
+    DTEST_TRUE(buf.times.size() == 192);
+    
+    DTEST_TRUE(r.get_windows() > 12);
+    
+    bool sorted = true;
+    for (size_t i = 1; i < buf.times.size(); ++i) {
+      sorted = sorted && (buf.times[i - 1] < buf.times[i] || 
+			  (buf.times[i - 1] == buf.times[i] && 
+			   buf.ids[i - 1] < buf.ids[i]));
+    }
+    
+    DTEST_TRUE(sorted);
+    
+    DTEST_TRUE(buf.times.back() == SongTime(15, 0xE00000));
+    
+    // a single tick with too many events can't be rendered
+    for (int i = 0; i < 16; ++i) {
+      seq.set_event_buffer(seq.add_sequencable
+			   (make_shared<StepSequence>(1 << 22, 3)), 
+			   r.get_buffer());
+    }
+    
+    DTEST_THROW_TYPE(r.render(SongTime(0, 0), SongTime(1, 0), buf),
+		     std::runtime_error);
+  }
+
+
+}
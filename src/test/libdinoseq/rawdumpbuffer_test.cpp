@@ -0,0 +1,73 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "dtest.hpp"
+#include "rawdumpbuffer.hpp"
+#include "songtime.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace RawDumpBufferTest {
+  
+  
+  void dtest_constructor() {
+    ostringstream os;
+    DTEST_NOTHROW(RawDumpBuffer rdb(os));
+  }
+  
+  
+  void dtest_write_event() {
+    ostringstream os;
+    RawDumpBuffer rdb(os);
+    
+    unsigned char event1[] = { 0x90, 0x34, 0x42 };
+    unsigned char event2[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+    
+    DTEST_TRUE(rdb.write_event(SongTime(0, 0x238388), 3, event1));
+    
+    DTEST_TRUE(rdb.write_event(SongTime(5, 0xFFAD03), 6, event2));
+    
+    DTEST_TRUE(rdb.get_event_count() == 2);
+    
+    string s = os.str();
+    
+    DTEST_TRUE(s.size() == 2 * sizeof(RawDumpBuffer::Header) + 9);
+    
+    RawDumpBuffer::Header h;
+    memcpy(&h, s.data(), sizeof(h));
+    
+    DTEST_TRUE(h.beat == 0 && h.tick == 0x238388 && h.size == 3);
+    
+    DTEST_TRUE(memcmp(s.data() + sizeof(h), event1, 3) == 0);
+    
+    memcpy(&h, s.data() + sizeof(h) + 3, sizeof(h));
+    
+    DTEST_TRUE(h.beat == 5 && h.tick == 0xFFAD03 && h.size == 6);
+    
+    DTEST_TRUE(memcmp(s.data() + 2 * sizeof(h) + 3, event2, 6) == 0);
+  }
+
+
+}
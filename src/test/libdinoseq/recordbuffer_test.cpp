@@ -0,0 +1,209 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <algorithm>
+#include <vector>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "dtest.hpp"
+#include "fixedeventbuffer.hpp"
+#include "recordbuffer.hpp"
+#include "songtime.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace RecordBufferTest {
+  
+  
+  void dtest_constructor() {
+    DTEST_NOTHROW(RecordBuffer rb);
+    RecordBuffer rb(16);
+    DTEST_TRUE(rb.get_capacity() == 16);
+    DTEST_TRUE(rb.get_written() == 0);
+    DTEST_TRUE(rb.get_dropped() == 0);
+    DTEST_TRUE(rb.get_high_water() == 0);
+  }
+  
+  
+  void dtest_write_read() {
+    RecordBuffer rb(16);
+    FixedEventBuffer feb;
+    
+    unsigned char cc[] = { 0xB0, 0x07, 0x40 };
+    unsigned char on[] = { 0x90, 0x3C, 0x7F };
+    unsigned char sysex[] = { 0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7 };
+    
+    DTEST_TRUE(rb.write_event(SongTime(1, 0), 3, cc));
+    
+    DTEST_TRUE(rb.write_event(SongTime(2, 0), 3, on));
+    
+    DTEST_TRUE(!rb.write_event(SongTime(3, 0), 6, sysex));
+    
+    DTEST_TRUE(rb.get_dropped() == 1);
+    
+    // the last event isn't readable until the cycle has ended
+    DTEST_TRUE(rb.read_events(feb) == 1);
+    
+    rb.end_cycle();
+    
+    DTEST_TRUE(rb.read_events(feb) == 1);
+    
+    DTEST_TRUE(rb.read_events(feb) == 0);
+    
+    DTEST_TRUE(feb.get_event_count() == 2);
+    
+    FixedEventBuffer::ConstIterator iter = feb.begin();
+    
+    DTEST_TRUE(iter->get_time() == SongTime(1, 0));
+    
+    DTEST_TRUE(iter->get_size() == 3 && equal(cc, cc + 3, iter->get_data()));
+    
+    ++iter;
+    
+    DTEST_TRUE(iter->get_time() == SongTime(2, 0));
+    
+    DTEST_TRUE(iter->get_size() == 3 && equal(on, on + 3, iter->get_data()));
+    
+    DTEST_TRUE(rb.get_written() == 2);
+    
+    DTEST_TRUE(rb.get_high_water() == 2);
+  }
+  
+  
+  void dtest_full() {
+    RecordBuffer rb(4);
+    FixedEventBuffer feb(1024, 2);
+    unsigned char cc[] = { 0xB0, 0x07, 0x40 };
+    
+    // at least get_capacity() events fit, and then the rest is dropped
+    size_t written = 0;
+    while (rb.write_event(SongTime(0, written), 3, cc))
+      ++written;
+    
+    DTEST_TRUE(written >= 4 && written <= 6);
+    
+    DTEST_TRUE(rb.get_dropped() == 1);
+    
+    DTEST_TRUE(rb.get_high_water() == written);
+    
+    // there is no room for a marker either, so the last event can't be
+    // read yet
+    DTEST_TRUE(!rb.end_cycle());
+    
+    // events that don't fit in the output buffer are kept for the next 
+    // read
+    DTEST_TRUE(rb.read_events(feb) == 2);
+    
+    DTEST_TRUE(feb.get_overflows() == 1);
+    
+    DTEST_TRUE(feb.begin()->get_time() == SongTime(0, 0));
+    
+    feb.clear();
+    
+    DTEST_TRUE(rb.read_events(feb) == 2);
+    
+    DTEST_TRUE(feb.begin()->get_time() == SongTime(0, 2));
+    
+    DTEST_TRUE(rb.end_cycle());
+    
+    feb.clear();
+    
+    DTEST_TRUE(rb.read_events(feb) == written - 4);
+    
+    // nodes that have been read can be reused
+    DTEST_TRUE(rb.write_event(SongTime(1, 0), 3, cc));
+  }
+  
+  
+  /** An EventBuffer that checks that the events arrive in order. */
+  class CheckingBuffer : public EventBuffer {
+  public:
+    CheckingBuffer() : events(0), last(-1, 0), ordered(true) { }
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data) {
+      ordered = ordered && bytes == 3 && data[0] == 0xB0 && last < st;
+      last = st;
+      ++events;
+      return true;
+    }
+    size_t events;
+    SongTime last;
+    bool ordered;
+  };
+  
+  
+  /** The data for the producer thread. */
+  struct Producer {
+    RecordBuffer* rb;
+    unsigned events;
+    unsigned per_cycle;
+  };
+  
+  
+  /** Write events like a realtime thread would, never waiting for the 
+      consumer. */
+  void* produce(void* arg) {
+    Producer& p = *static_cast<Producer*>(arg);
+    for (unsigned i = 0; i < p.events; ++i) {
+      unsigned char data[] = { 0xB0, 
+			       static_cast<unsigned char>(i & 0x7F),
+			       static_cast<unsigned char>((i >> 7) & 0x7F) };
+      p.rb->write_event(SongTime(i / 100000, (i % 100000) * 167), 3, data);
+      if (i % p.per_cycle == p.per_cycle - 1) {
+	p.rb->end_cycle();
+	sched_yield();
+      }
+    }
+    while (!p.rb->end_cycle())
+      sched_yield();
+    return 0;
+  }
+  
+  
+  void dtest_threads() {
+    
+    // one second of 100k events/s, in 1 ms cycles
+    unsigned const events = 100000;
+    RecordBuffer rb(1024);
+    Producer p = { &rb, events, 100 };
+    CheckingBuffer buf;
+    
+    pthread_t thread;
+    DTEST_TRUE(pthread_create(&thread, 0, &produce, &p) == 0);
+    while (buf.events + rb.get_dropped() < events) {
+      if (rb.read_events(buf) == 0)
+	sched_yield();
+    }
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(buf.ordered);
+    
+    DTEST_TRUE(buf.events + rb.get_dropped() == events);
+    
+    DTEST_TRUE(rb.get_written() == buf.events);
+    
+    DTEST_TRUE(rb.get_high_water() <= rb.get_capacity() + 1);
+  }
+
+
+}
@@ -0,0 +1,219 @@
+/*****************************************************************************
+    libdinoseq_bench - benchmarks for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "curve.hpp"
+#include "dtest.hpp"
+#include "eventbuffer.hpp"
+#include "sequencable.hpp"
+#include "sequencer.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace SequencerBench {
+  
+  
+  /** A Sequencable that writes an event every 1/64 beat and does some
+      arithmetic for each of them, standing in for a dense Curve. */
+  class DenseSequencable : public Sequencable {
+  public:
+    
+    DenseSequencable() : Sequencable("Dense") { }
+    
+    bool sequence(Sequencable::Position& pos,
+		  SongTime const& to, EventBuffer& buf) const {
+      SongTime step(0, 1 << 18);
+      SongTime t(pos.get_time().get_beat(), 0);
+      while (t < pos.get_time())
+	t += step;
+      for ( ; t < to; t += step) {
+	unsigned x = t.get_tick();
+	for (unsigned i = 0; i < 256; ++i)
+	  x = x * 1664525 + 1013904223;
+	unsigned char data[3] = { 0xB0, 7,
+				  static_cast<unsigned char>(x >> 25) };
+	if (!buf.write_event(t, 3, data)) {
+	  update_position(pos, t);
+	  return false;
+	}
+      }
+      update_position(pos, to);
+      return true;
+    }
+  
+  };
+  
+  
+  /** An EventBuffer that just counts the events. */
+  class CountingBuffer : public EventBuffer {
+  public:
+    CountingBuffer() : events(0) { }
+    bool write_event(SongTime const&, size_t, unsigned char const*) {
+      ++events;
+      return true;
+    }
+    size_t events;
+  };
+  
+  
+  /** Sequence 256 dense tracks for 64 periods with 1 to max(4, CPUs) 
+      workers. */
+  void dtest_bench_workers() {
+    unsigned const tracks = 256;
+    unsigned const periods = 64;
+    SongTime const period(0, 1 << 21);
+    
+    unsigned max_workers = Benchmark::cpus();
+    if (max_workers < 4)
+      max_workers = 4;
+    
+    for (unsigned workers = 1; workers <= max_workers; ++workers) {
+      Sequencer seq;
+      auto buf = make_shared<CountingBuffer>();
+      for (unsigned i = 0; i < tracks; ++i)
+	seq.set_event_buffer(seq.add_sequencable
+			     (make_shared<DenseSequencable>()), buf);
+      seq.set_workers(workers, 8192);
+      
+      ostringstream name;
+      name<<"run, "<<workers<<" workers, periods";
+      DTEST_BENCH(name.str(), periods,
+		  SongTime from;
+		  for (unsigned p = 0; p < periods; ++p) {
+		    seq.run(from, from + period);
+		    from += period;
+		  });
+    }
+  }
+  
+  
+  /** Play a one beat loop in 1000 curves with 2000 points each, with and
+      without a cue at the loop start. */
+  void dtest_bench_loop() {
+    unsigned const curves = 1000;
+    unsigned const points = 2000;
+    unsigned const loops = 64;
+    SongTime const start(500, 0);
+    SongTime const period(0, 1 << 21);
+    
+    Sequencer seq;
+    auto buf = make_shared<CountingBuffer>();
+    for (unsigned i = 0; i < curves; ++i) {
+      auto c = make_shared<Curve>("Bench curve", SongTime(points, 0), 7);
+      for (unsigned j = 0; j < points; ++j)
+	c->add_point(SongTime(j, (i * 4099) & 0xFFFFFF), (j % 2) << 30);
+      seq.set_event_buffer(seq.add_sequencable(c), buf);
+    }
+    
+    for (int cued = 0; cued < 2; ++cued) {
+      if (cued)
+	seq.set_cues(vector<SongTime>(1, start));
+      DTEST_BENCH(cued ? "loop wrap, 1000 curves, cued, loops" : 
+		  "loop wrap, 1000 curves, loops", loops,
+		  for (unsigned l = 0; l < loops; ++l) {
+		    for (SongTime from = start; from < start + SongTime(1, 0);
+			 from += period)
+		      seq.run(from, from + period);
+		  });
+    }
+  }
+  
+  
+  /** Play 64 beats of 2000 curves that have a point every 16 beats, so 
+      only a few of them have events in each period, and the same number
+      of curves that change all the time. */
+  void dtest_bench_sparse() {
+    unsigned const curves = 2000;
+    unsigned const beats = 64;
+    SongTime const period(0, 1 << 21);
+    
+    for (int sparse = 1; sparse >= 0; --sparse) {
+      Sequencer seq;
+      auto buf = make_shared<CountingBuffer>();
+      for (unsigned i = 0; i < curves; ++i) {
+	auto c = make_shared<Curve>("Bench curve", SongTime(beats, 0), 7);
+	c->set_interpolation(sparse ? Curve::Step : Curve::Linear);
+	for (unsigned j = 0; j < beats / 16; ++j)
+	  c->add_point(SongTime(j * 16 + i % 16, (i * 4099) & 0xFFFFFF), 
+		       (j % 2) << 30);
+	seq.set_event_buffer(seq.add_sequencable(c), buf);
+      }
+      
+      DTEST_BENCH(sparse ? "run, 2000 sparse curves, periods" :
+		  "run, 2000 dense curves, periods", beats * 8,
+		  SongTime from;
+		  while (from < SongTime(beats, 0)) {
+		    seq.run(from, from + period);
+		    from += period;
+		  });
+    }
+  }
+  
+  
+  /** Play 64 beats of 2000 sparse curves and move a point in one of them
+      in every period, and play them one beat at a time in a shuffled 
+      order so the curves are relocated at every beat. */
+  void dtest_bench_edits() {
+    unsigned const curves = 2000;
+    unsigned const beats = 64;
+    SongTime const period(0, 1 << 21);
+    
+    Sequencer seq;
+    vector<shared_ptr<Curve>> c;
+    auto buf = make_shared<CountingBuffer>();
+    for (unsigned i = 0; i < curves; ++i) {
+      c.push_back(make_shared<Curve>("Bench curve", SongTime(beats, 0), 7));
+      c[i]->set_interpolation(Curve::Step);
+      for (unsigned j = 0; j < beats / 16; ++j)
+	c[i]->add_point(SongTime(j * 16 + i % 16, (i * 4099) & 0xFFFFFF), 
+			(j % 2) << 30);
+      seq.set_event_buffer(seq.add_sequencable(c[i]), buf);
+    }
+    
+    unsigned n = 0;
+    DTEST_BENCH("run, 2000 sparse curves, one edit per period, periods", 
+		beats * 8,
+		SongTime from;
+		while (from < SongTime(beats, 0)) {
+		  Curve& e = *c[(n++ * 7919) % curves];
+		  Curve::Iterator p = e.begin();
+		  e.move_point(p, p->m_time, (n % 2) << 30);
+		  seq.run(from, from + period);
+		  from += period;
+		});
+    
+    DTEST_BENCH("run, 2000 sparse curves, shuffled beats, periods",
+		beats * 8,
+		for (unsigned b = 0; b < beats; ++b) {
+		  SongTime from((b * 37) % beats, 0);
+		  seq.run(from, from + period);
+		  for (unsigned p = 1; p < 8; ++p) {
+		    from += period;
+		    seq.run(from, from + period);
+		  }
+		});
+  }
+
+}
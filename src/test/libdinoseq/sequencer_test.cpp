@@ -19,8 +19,13 @@
 #include <limits>
 #include <sstream>
 
+#include <pthread.h>
+#include <sched.h>
+
+#include "curve.hpp"
 #include "dtest.hpp"
 #include "eventbuffer.hpp"
+#include "latencyhistogram.hpp"
 #include "ostreambuffer.hpp"
 #include "sequencable.hpp"
 #include "sequencer.hpp"
@@ -171,4 +176,638 @@ namespace SequencerTest {
   }
 
 
+  void dtest_run_workers() {
+    ostringstream os1;
+    ostringstream os2;
+    auto sqbl = make_shared<BeatSequence>();
+    auto buf1 = make_shared<OStreamBuffer>(os1);
+    auto buf2 = make_shared<OStreamBuffer>(os2);
+    Sequencer seq;
+    
+    DTEST_TRUE(seq.get_workers() == 1);
+    
+    DTEST_NOTHROW(seq.set_workers(3, 16));
+    
+    DTEST_TRUE(seq.get_workers() == 3);
+    
+    seq.set_event_buffer(seq.add_sequencable(sqbl), buf1);
+    seq.set_event_buffer(seq.add_sequencable(sqbl), buf2);
+    seq.set_event_buffer(seq.add_sequencable(sqbl), buf2);
+    seq.add_sequencable(sqbl);
+  
+    seq.run(SongTime(0, 0), SongTime(2, 0x838382));
+    seq.run(SongTime(0, 0), SongTime(2, 0x838382));
+    seq.run(SongTime(89, 1), SongTime(90, 0));
+    seq.run(SongTime(90, 0), SongTime(90, 0));
+    
+    os1<<flush;
+    os2<<flush;
+    
+    string expected1 = 
+      "0:000000: 00\n"
+      "1:000000: 01\n"
+      "2:000000: 02\n"
+      "0:000000: 00\n"
+      "1:000000: 01\n"
+      "2:000000: 02\n";
+
+    string expected2 = 
+      "0:000000: 00\n"
+      "0:000000: 00\n"
+      "1:000000: 01\n"
+      "1:000000: 01\n"
+      "2:000000: 02\n"
+      "2:000000: 02\n"
+      "0:000000: 00\n"
+      "0:000000: 00\n"
+      "1:000000: 01\n"
+      "1:000000: 01\n"
+      "2:000000: 02\n"
+      "2:000000: 02\n";
+    
+    DTEST_TRUE(os1.str() == expected1);
+    
+    DTEST_TRUE(os2.str() == expected2);
+    
+    DTEST_NOTHROW(seq.set_workers(1));
+    
+    DTEST_TRUE(seq.get_workers() == 1);
+  }
+
+
+  /** An EventBuffer that accepts a fixed number of events and counts the
+      events it is asked to write after it has rejected one. */
+  class LimitedBuffer : public EventBuffer {
+  public:
+    
+    LimitedBuffer(unsigned n) : room(n), after_reject(0), rejected(false) { }
+    
+    bool write_event(SongTime const&, size_t, unsigned char const*) {
+      if (rejected)
+	++after_reject;
+      if (room == 0) {
+	rejected = true;
+	return false;
+      }
+      --room;
+      return true;
+    }
+    
+    unsigned room;
+    unsigned after_reject;
+    bool rejected;
+  };
+  
+  
+  void dtest_merge_dropped() {
+    auto sqbl = make_shared<BeatSequence>();
+    auto full = make_shared<LimitedBuffer>(3);
+    auto open = make_shared<LimitedBuffer>(100);
+    Sequencer seq;
+    seq.set_workers(2, 16);
+    seq.set_event_buffer(seq.add_sequencable(sqbl), full);
+    seq.set_event_buffer(seq.add_sequencable(sqbl), full);
+    seq.set_event_buffer(seq.add_sequencable(sqbl), open);
+    
+    DTEST_TRUE(seq.get_dropped() == 0);
+    
+    // 10 events for the full buffer, it takes 3 and rejects the 4th
+    seq.run(SongTime(0, 0), SongTime(4, 1));
+    
+    DTEST_TRUE(seq.get_dropped() == 7);
+    
+    DTEST_TRUE(full->after_reject == 0);
+    
+    DTEST_TRUE(open->room == 95);
+  }
+  
+  
+  /** A Sequencable that counts how its positions are relocated. */
+  class RelocationCounter : public Sequencable {
+  public:
+    
+    RelocationCounter() : Sequencable("Counter"), updates(0), copies(0) { }
+    
+    void update_position(Position& pos, SongTime const& st) const {
+      ++updates;
+      Sequencable::update_position(pos, st);
+    }
+    
+    void copy_position(Position& dst, Position const& src) const {
+      ++copies;
+      Sequencable::update_position(dst, src.get_time());
+    }
+    
+    bool sequence(Position& pos, SongTime const& to, EventBuffer&) const {
+      Sequencable::update_position(pos, to);
+      return true;
+    }
+    
+    mutable unsigned updates;
+    mutable unsigned copies;
+  };
+  
+  
+  void dtest_cues() {
+    auto counter = make_shared<RelocationCounter>();
+    auto curve = make_shared<Curve>("Test curve", SongTime(8, 0), 7);
+    curve->set_resolution(1);
+    curve->add_point(SongTime(0, 0), 0);
+    curve->add_point(SongTime(4, 0), 0x7FFFFFFF);
+    ostringstream os1;
+    ostringstream os2;
+    
+    Sequencer seq1;
+    seq1.set_event_buffer(seq1.add_sequencable(curve), 
+			  make_shared<OStreamBuffer>(os1));
+    Sequencer seq2;
+    seq2.set_event_buffer(seq2.add_sequencable(curve), 
+			  make_shared<OStreamBuffer>(os2));
+    seq2.set_event_buffer(seq2.add_sequencable(counter), 
+			  make_shared<OStreamBuffer>(os2));
+    vector<SongTime> cues(1, SongTime(1, 0));
+    
+    DTEST_NOTHROW(seq2.set_cues(cues));
+    
+    DTEST_TRUE(seq2.get_cues().size() == 1);
+    
+    // loop [1, 3) three times, with and without cues
+    counter->updates = 0;
+    for (int i = 0; i < 3; ++i) {
+      seq1.run(SongTime(1, 0), SongTime(2, 0));
+      seq1.run(SongTime(2, 0), SongTime(3, 0));
+      seq2.run(SongTime(1, 0), SongTime(2, 0));
+      seq2.run(SongTime(2, 0), SongTime(3, 0));
+    }
+    
+    DTEST_TRUE(counter->copies == 3);
+    
+    DTEST_TRUE(counter->updates == 0);
+    
+    // jumps to other times still update the positions, and removing a 
+    // point doesn't break the cached cue positions
+    seq2.run(SongTime(0, 0), SongTime(1, 0));
+    
+    DTEST_TRUE(counter->updates == 1);
+    
+    curve->remove_point(curve->begin());
+    curve->add_point(SongTime(0, 0), 0);
+    seq1.run(SongTime(1, 0), SongTime(2, 0));
+    seq2.run(SongTime(1, 0), SongTime(2, 0));
+    
+    string expected1 = 
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "1:000000: B0 07 20\n";
+    
+    string expected2 = 
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "1:000000: B0 07 20\n"
+      "2:000000: B0 07 40\n"
+      "0:000000: B0 07 00\n"
+      "1:000000: B0 07 20\n";
+    
+    DTEST_TRUE(os1.str() == expected1);
+    
+    DTEST_TRUE(os2.str() == expected2);
+  }
+  
+  
+  /** A Sequencable that spins for a while every time it is sequenced. */
+  class SlowSequencable : public Sequencable {
+  public:
+    SlowSequencable() : Sequencable("Slow") {}
+    bool sequence(Position&, SongTime const&, EventBuffer&) const {
+      uint64_t start = LatencyHistogram::now();
+      while (LatencyHistogram::now() - start < 100000);
+      return true;
+    }
+  };
+  
+  
+  /** A SlowSequencable that only has an event at the start. */
+  class SlowStart : public SlowSequencable {
+  public:
+    bool sequence(Position& pos, SongTime const& to, EventBuffer& buf) const {
+      SlowSequencable::sequence(pos, to, buf);
+      update_position(pos, to);
+      return true;
+    }
+    SongTime get_next_event(Position const& pos) const {
+      if (pos.get_time() == SongTime(0, 0))
+	return pos.get_time();
+      return SongTime::max_valid();
+    }
+  };
+  
+  
+  void dtest_profiling() {
+    auto fast = make_shared<PhonySequencable>();
+    auto slow = make_shared<SlowSequencable>();
+    auto buf = make_shared<PhonyEventBuffer>();
+    Sequencer seq;
+    seq.set_event_buffer(seq.add_sequencable(fast), buf);
+    
+    DTEST_TRUE(seq.get_run_histogram() == 0);
+    DTEST_TRUE(seq.get_histogram(seq.sqbl_begin()) == 0);
+    
+    // every call is an xrun with a budget of 1 cycle
+    DTEST_NOTHROW(seq.set_profiling(true, 1));
+    seq.set_event_buffer(seq.add_sequencable(slow), buf);
+    for (unsigned i = 0; i < 10; ++i)
+      seq.run(SongTime(i, 0), SongTime(i + 1, 0));
+    
+    LatencyHistogram const* run = seq.get_run_histogram();
+    LatencyHistogram const* h1 = seq.get_histogram(seq.sqbl_begin());
+    LatencyHistogram const* h2 = seq.get_histogram(++seq.sqbl_begin());
+    DTEST_TRUE(run && h1 && h2);
+    DTEST_TRUE(run->get_count() == 10);
+    DTEST_TRUE(h1->get_count() == 10);
+    DTEST_TRUE(h2->get_count() == 10);
+    DTEST_TRUE(h2->get_percentile(0.5) >= 75000);
+    DTEST_TRUE(run->get_max() >= h2->get_max());
+    DTEST_TRUE(run->get_xruns() == 10);
+    DTEST_TRUE(h1->get_xruns() == 0);
+    DTEST_TRUE(h2->get_xruns() == 10);
+    
+    // the workers time the calls too
+    seq.set_workers(2);
+    seq.set_profiling(true);
+    for (unsigned i = 0; i < 10; ++i)
+      seq.run(SongTime(i, 0), SongTime(i + 1, 0));
+    DTEST_TRUE(seq.get_histogram(++seq.sqbl_begin())->get_count() == 10);
+    DTEST_TRUE(seq.get_run_histogram()->get_xruns() == 0);
+    
+    seq.set_profiling(false);
+    DTEST_TRUE(seq.get_run_histogram() == 0);
+    DTEST_TRUE(seq.get_histogram(seq.sqbl_begin()) == 0);
+    
+    // only the objects that were sequenced in a call are blamed for it
+    for (unsigned workers = 1; workers <= 2; ++workers) {
+      Sequencer seq2;
+      seq2.set_workers(workers);
+      seq2.set_event_buffer(seq2.add_sequencable(fast), buf);
+      seq2.set_event_buffer(seq2.add_sequencable(make_shared<SlowStart>()), 
+			    buf);
+      seq2.set_profiling(true, 1);
+      for (unsigned i = 0; i < 10; ++i)
+	seq2.run(SongTime(i, 0), SongTime(i + 1, 0));
+      
+      DTEST_TRUE(seq2.get_run_histogram()->get_xruns() == 10);
+      
+      DTEST_TRUE(seq2.get_histogram(seq2.sqbl_begin())->get_xruns() == 9);
+      
+      DTEST_TRUE(seq2.get_histogram(++seq2.sqbl_begin())->get_xruns() == 1);
+    }
+  }
+  
+  
+  /** An EventBuffer that counts the events and keeps a checksum of them. */
+  class ChecksumBuffer : public EventBuffer {
+  public:
+    
+    ChecksumBuffer() : events(0), sum(0) { }
+    
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data) {
+      ++events;
+      sum = sum * 31 + st.get_beat() * 7 + st.get_tick();
+      for (size_t i = 0; i < bytes; ++i)
+	sum = sum * 31 + data[i];
+      return true;
+    }
+    
+    unsigned long events;
+    unsigned long sum;
+  };
+  
+  
+  /** The data for a thread that plays a Sequencer in a loop. */
+  struct Player {
+    Sequencer* seq;
+    AtomicInt* quit;
+    AtomicInt loops;
+  };
+  
+  
+  void* play(void* arg) {
+    Player& p = *static_cast<Player*>(arg);
+    while (!p.quit->get()) {
+      for (int b = 0; b < 16; ++b)
+	p.seq->run(SongTime(b, 0), SongTime(b + 1, 0));
+      p.loops.increase();
+    }
+    return 0;
+  }
+  
+  
+  void dtest_profiling_while_playing() {
+    auto curve = make_shared<Curve>("Profiled", SongTime(16, 0), 7);
+    for (int i = 0; i < 64; ++i)
+      curve->add_point(SongTime(i / 4, (i % 4) << 22), i << 24);
+    auto buf = make_shared<ChecksumBuffer>();
+    Sequencer seq;
+    seq.set_event_buffer(seq.add_sequencable(curve), buf);
+    seq.set_profiling(true);
+    LatencyHistogram const* run = seq.get_run_histogram();
+    LatencyHistogram const* h = seq.get_histogram(seq.sqbl_begin());
+    
+    // turn profiling on and off while another thread is playing
+    AtomicInt quit(0);
+    Player p = { &seq, &quit, 0 };
+    pthread_t t;
+    pthread_create(&t, 0, &play, &p);
+    for (int i = 0; i < 2000 || p.loops.get() < 2; ++i) {
+      seq.set_profiling(i % 2 == 0, i % 3);
+      if (i % 64 == 0)
+	sched_yield();
+    }
+    quit.set(1);
+    pthread_join(t, 0);
+    
+    // the histograms are cleared, not replaced
+    seq.set_profiling(true);
+    
+    DTEST_TRUE(seq.get_run_histogram() == run);
+    
+    DTEST_TRUE(seq.get_histogram(seq.sqbl_begin()) == h);
+    
+    seq.run(SongTime(0, 0), SongTime(16, 0));
+    
+    DTEST_TRUE(run->get_count() == 1 && h->get_count() == 1);
+  }
+  
+  
+  void dtest_shared_curve() {
+    auto curve = make_shared<Curve>("Shared", SongTime(16, 0), 7);
+    for (int i = 0; i < 64; ++i)
+      curve->add_point(SongTime(i / 4, (i % 4) << 22), i << 24);
+    auto buf1 = make_shared<ChecksumBuffer>();
+    auto buf2 = make_shared<ChecksumBuffer>();
+    Sequencer live;
+    Sequencer preview;
+    live.set_event_buffer(live.add_sequencable(curve), buf1);
+    preview.set_event_buffer(preview.add_sequencable(curve), buf2);
+    
+    // edit the curve while two sequencers in other threads are playing it
+    AtomicInt quit(0);
+    Player p1 = { &live, &quit, 0 };
+    Player p2 = { &preview, &quit, 0 };
+    pthread_t t1;
+    pthread_t t2;
+    pthread_create(&t1, 0, &play, &p1);
+    pthread_create(&t2, 0, &play, &p2);
+    for (int i = 0; i < 20000 || p1.loops.get() < 2 || p2.loops.get() < 2; 
+	 ++i) {
+      auto iter = curve->lower_bound(SongTime((i * 7) % 16, (i % 3) << 22));
+      if (iter == curve->end())
+	continue;
+      SongTime t = iter->m_time;
+      if (i % 2)
+	curve->move_point(iter, t, (i * 12345) & 0x7FFFFFFF);
+      else {
+	curve->remove_point(iter);
+	curve->add_point(t, (i * 54321) & 0x7FFFFFFF);
+      }
+      if (i % 256 == 0)
+	sched_yield();
+    }
+    quit.set(1);
+    pthread_join(t1, 0);
+    pthread_join(t2, 0);
+    
+    // both sequencers see the same curve afterwards
+    buf1->events = buf1->sum = 0;
+    buf2->events = buf2->sum = 0;
+    live.run(SongTime(0, 0), SongTime(16, 0));
+    preview.run(SongTime(0, 0), SongTime(16, 0));
+    
+    DTEST_TRUE(buf1->events > 0);
+    
+    DTEST_TRUE(buf1->events == buf2->events);
+    
+    DTEST_TRUE(buf1->sum == buf2->sum);
+  }
+  
+  
+  void dtest_add_remove_while_playing() {
+    auto curve = make_shared<Curve>("Added", SongTime(16, 0), 7);
+    for (int i = 0; i < 64; ++i)
+      curve->add_point(SongTime(i / 4, (i % 4) << 22), i << 24);
+    
+    auto ref = make_shared<ChecksumBuffer>();
+    Sequencer reference;
+    reference.set_event_buffer(reference.add_sequencable(curve), ref);
+    reference.run(SongTime(0, 0), SongTime(16, 0));
+    
+    // add and remove objects while another thread is playing, with and 
+    // without workers
+    for (unsigned workers = 1; workers <= 3; workers += 2) {
+      auto buf = make_shared<ChecksumBuffer>();
+      Sequencer seq;
+      seq.set_workers(workers);
+      seq.set_event_buffer(seq.add_sequencable(curve), buf);
+      AtomicInt quit(0);
+      Player p = { &seq, &quit, 0 };
+      pthread_t t;
+      pthread_create(&t, 0, &play, &p);
+      
+      // set_event_buffer() can't be called while run() is active, so the
+      // added objects don't have buffers
+      for (int i = 0; i < 2000 || p.loops.get() < 2; ++i) {
+	auto a = seq.add_sequencable(curve);
+	auto b = seq.add_sequencable(curve);
+	if (i % 2) {
+	  seq.remove_sequencable(a);
+	  seq.remove_sequencable(b);
+	}
+	else {
+	  seq.remove_sequencable(b);
+	  seq.remove_sequencable(a);
+	}
+	if (i % 64 == 0)
+	  sched_yield();
+      }
+      quit.set(1);
+      pthread_join(t, 0);
+      
+      DTEST_TRUE(distance(seq.sqbl_begin(), seq.sqbl_end()) == 1);
+      
+      buf->events = buf->sum = 0;
+      seq.run(SongTime(0, 0), SongTime(16, 0));
+      
+      DTEST_TRUE(buf->events == ref->events);
+      
+      DTEST_TRUE(buf->sum == ref->sum);
+      
+      DTEST_TRUE(seq.get_dropped() == 0);
+    }
+  }
+  
+  
+  /** A Sequencable that has an event every @c interval beats and counts 
+      how many times it is sequenced. */
+  class IntervalSequencable : public Sequencable {
+  public:
+    
+    IntervalSequencable() 
+      : Sequencable("Interval"), interval(4), calls(0) { }
+    
+    bool sequence(Sequencable::Position& pos, 
+		  SongTime const& to, EventBuffer& buf) const {
+      ++calls;
+      SongTime const step(interval, 0);
+      for (SongTime t = get_next_event(pos); t < to; t += step) {
+	unsigned char data = t.get_beat();
+	buf.write_event(t, 1, &data);
+      }
+      update_position(pos, to);
+      return true;
+    }
+    
+    SongTime get_next_event(Position const& pos) const {
+      SongTime::Beat b = pos.get_time().get_beat();
+      if (pos.get_time().get_tick() > 0)
+	++b;
+      b = (b + interval - 1) / interval * interval;
+      return SongTime(b, 0);
+    }
+    
+    /** Change the interval and tell the sequencers about it. */
+    void set_interval(unsigned i) {
+      interval = i;
+      notify_changed();
+    }
+    
+    unsigned interval;
+    mutable unsigned calls;
+  };
+  
+  
+  void dtest_next_event() {
+    for (unsigned workers = 1; workers <= 2; ++workers) {
+      auto sqbl = make_shared<IntervalSequencable>();
+      auto buf = make_shared<ChecksumBuffer>();
+      Sequencer seq;
+      seq.set_workers(workers);
+      seq.set_event_buffer(seq.add_sequencable(sqbl), buf);
+      
+      // only the periods with events are sequenced
+      for (int b = 0; b < 16; ++b)
+	seq.run(SongTime(b, 0), SongTime(b + 1, 0));
+      
+      DTEST_TRUE(sqbl->calls == 4);
+      
+      DTEST_TRUE(buf->events == 4);
+      
+      // an edit makes the sequencer ask for the next event time again, 
+      // without sequencing the events it has already passed
+      sqbl->set_interval(2);
+      for (int b = 16; b < 32; ++b)
+	seq.run(SongTime(b, 0), SongTime(b + 1, 0));
+      
+      DTEST_TRUE(sqbl->calls == 12);
+      
+      DTEST_TRUE(buf->events == 12);
+      
+      // so does a relocation
+      seq.run(SongTime(3, 0), SongTime(4, 0));
+      seq.run(SongTime(5, 0), SongTime(6, 0));
+      
+      DTEST_TRUE(sqbl->calls == 12);
+      
+      seq.run(SongTime(6, 0), SongTime(7, 0));
+      
+      DTEST_TRUE(sqbl->calls == 13);
+    }
+  }
+  
+  
+  void dtest_many_edits() {
+    // edit a few objects in every period, the heap is updated for them
+    // only and all objects must still be sequenced exactly when they have
+    // events, also when objects are added and removed on the way
+    vector<shared_ptr<IntervalSequencable>> sqbls;
+    auto buf = make_shared<ChecksumBuffer>();
+    Sequencer seq;
+    for (unsigned i = 0; i < 40; ++i) {
+      sqbls.push_back(make_shared<IntervalSequencable>());
+      sqbls[i]->set_interval(1 + i % 7);
+      seq.set_event_buffer(seq.add_sequencable(sqbls[i]), buf);
+    }
+    
+    unsigned expected = 0;
+    for (unsigned b = 0; b < 300; ++b) {
+      for (unsigned j = 0; j < 3; ++j)
+	sqbls[(b * 7 + j * 13) % 40]->set_interval(1 + (b + j) % 5);
+      
+      // the removed object is still pending when it is removed
+      if (b == 100) {
+	sqbls[39]->set_interval(3);
+	seq.remove_sequencable(seq.sqbl_find(sqbls[39]));
+      }
+      if (b == 200)
+	seq.set_event_buffer(seq.add_sequencable(sqbls[39]), buf);
+      for (unsigned i = 0; i < 40; ++i) {
+	if ((i != 39 || b < 100 || b >= 200) && b % sqbls[i]->interval == 0)
+	  ++expected;
+      }
+      seq.run(SongTime(b, 0), SongTime(b + 1, 0));
+    }
+    
+    unsigned calls = 0;
+    for (unsigned i = 0; i < 40; ++i)
+      calls += sqbls[i]->calls;
+    
+    DTEST_TRUE(buf->events == expected);
+    
+    DTEST_TRUE(calls == expected);
+  }
+  
+  
+  void dtest_sparse_curve() {
+    for (int linear = 0; linear < 2; ++linear) {
+      auto curve = make_shared<Curve>("Sparse", SongTime(64, 0), 7);
+      curve->set_interpolation(linear ? Curve::Linear : Curve::Step);
+      for (int i = 0; i < 8; ++i)
+	curve->add_point(SongTime(4 + i * 6, 0), (i % 3) << 29);
+      auto buf = make_shared<ChecksumBuffer>();
+      auto ref = make_shared<ChecksumBuffer>();
+      Sequencer seq;
+      seq.set_event_buffer(seq.add_sequencable(curve), buf);
+      auto pos = curve->create_position(SongTime());
+      
+      // the sequencer writes the same events as a position that is 
+      // sequenced every period, also when the curve is edited on the way
+      SongTime const period(0, 1 << 21);
+      for (SongTime from; from < SongTime(64, 0); from += period) {
+	if (from == SongTime(16, 0))
+	  curve->add_point(SongTime(30, 0), 1 << 30);
+	if (from == SongTime(20, 0)) {
+	  curve->remove_point(curve->lower_bound(SongTime(40, 0)));
+	  curve->add_point(SongTime(18, 0), 3 << 29);
+	}
+	if (from == SongTime(24, 0))
+	  curve->move_point(curve->lower_bound(SongTime(46, 0)), 
+			    SongTime(50, 0), 3 << 29);
+	seq.run(from, from + period);
+	curve->sequence(*pos, from + period, *ref);
+      }
+      
+      DTEST_TRUE(buf->events > 0);
+      
+      DTEST_TRUE(buf->events == ref->events);
+      
+      DTEST_TRUE(buf->sum == ref->sum);
+    }
+  }
+
+
 }
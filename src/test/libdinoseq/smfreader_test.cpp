@@ -0,0 +1,191 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "curve.hpp"
+#include "curverecorder.hpp"
+#include "dtest.hpp"
+#include "eventbuffer.hpp"
+#include "smfreader.hpp"
+#include "smfwriter.hpp"
+#include "songtime.hpp"
+#include "tempfile.hpp"
+
+
+using namespace Dino;
+using namespace std;
+using namespace TempFile;
+
+
+namespace SmfReaderTest {
+  
+  
+  /** An EventBuffer that stores all events. */
+  struct VectorBuffer : EventBuffer {
+    
+    struct Event {
+      SongTime time;
+      vector<unsigned char> data;
+    };
+    
+    bool write_event(SongTime const& st, size_t bytes, 
+		     unsigned char const* data) {
+      Event e;
+      e.time = st;
+      e.data.assign(data, data + bytes);
+      events.push_back(e);
+      return true;
+    }
+    
+    vector<Event> events;
+  };
+  
+  
+  void dtest_constructor() {
+    string name = temp_file("smfreader_test");
+    
+    DTEST_THROW_TYPE(SmfReader smf(name), std::runtime_error);
+    
+    DTEST_THROW_TYPE(SmfReader smf(name + ".missing"), std::runtime_error);
+    
+    {
+      ofstream os(name.c_str());
+      SmfWriter smf(os, 480);
+    }
+    
+    DTEST_NOTHROW(SmfReader smf(name));
+    
+    SmfReader smf(name);
+    
+    DTEST_TRUE(smf.get_format() == 0);
+    
+    DTEST_TRUE(smf.get_ppqn() == 480);
+    
+    DTEST_TRUE(smf.get_track_count() == 1);
+    
+    std::remove(name.c_str());
+  }
+  
+  
+  void dtest_read_track() {
+    string name = temp_file("smfreader_test");
+    
+    // a format 1 file with an empty tempo track, and a track with meta 
+    // events, running status and sysex
+    unsigned char file[] = {
+      'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 1, 0, 2, 0, 96,
+      'M', 'T', 'r', 'k', 0, 0, 0, 11,
+      0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+      0x00, 0xFF, 0x2F, 0x00,
+      'M', 'T', 'r', 'k', 0, 0, 0, 29,
+      0x00, 0xFF, 0x03, 0x01, 'x',
+      0x00, 0x90, 0x3C, 0x7F,
+      0x81, 0x10, 0x3C, 0x00,
+      0x30, 0xC1, 0x05,
+      0x00, 0xF0, 0x02, 0x7E, 0xF7,
+      0x18, 0xB0, 0x07, 0x40,
+      0x00, 0xFF, 0x2F, 0x00 };
+    {
+      ofstream os(name.c_str());
+      os.write(reinterpret_cast<char*>(file), sizeof(file));
+    }
+    
+    SmfReader smf(name);
+    VectorBuffer buf;
+    
+    DTEST_TRUE(smf.get_format() == 1);
+    
+    DTEST_TRUE(smf.get_track_count() == 2);
+    
+    DTEST_TRUE(smf.read_track(0, buf) == 0);
+    
+    DTEST_TRUE(smf.read_track(1, buf) == 5);
+    
+    DTEST_THROW_TYPE(smf.read_track(2, buf), std::out_of_range);
+    
+    DTEST_TRUE(buf.events.size() == 5);
+    
+    DTEST_TRUE(buf.events[0].time == SongTime(0, 0) && 
+	       buf.events[0].data.size() == 3 && 
+	       buf.events[0].data[0] == 0x90);
+    
+    DTEST_TRUE(buf.events[1].time == SongTime(1, 0x800000) && 
+	       buf.events[1].data.size() == 3 && 
+	       buf.events[1].data[0] == 0x90 && 
+	       buf.events[1].data[2] == 0x00);
+    
+    DTEST_TRUE(buf.events[2].time == SongTime(2, 0) && 
+	       buf.events[2].data.size() == 2 && 
+	       buf.events[2].data[1] == 0x05);
+    
+    DTEST_TRUE(buf.events[3].data.size() == 3 && 
+	       buf.events[3].data[0] == 0xF0 && 
+	       buf.events[3].data[2] == 0xF7);
+    
+    DTEST_TRUE(buf.events[4].time == SongTime(2, 0x400000) &&
+	       buf.events[4].data[0] == 0xB0);
+    
+    std::remove(name.c_str());
+  }
+  
+  
+  void dtest_curve_round_trip() {
+    string name = temp_file("smfreader_test");
+    
+    // export a curve by sequencing it to a MIDI file
+    Curve c1("Test curve", SongTime(16, 0), 7);
+    c1.set_interpolation(Curve::Step);
+    for (int i = 0; i < 16; ++i)
+      c1.add_point(SongTime(i, 0), (i * 8) << 24);
+    {
+      ofstream os(name.c_str());
+      SmfWriter smf(os);
+      auto pos = c1.create_position(SongTime(0, 0));
+      c1.sequence(*pos, c1.get_length(), smf);
+    }
+    
+    // and import it into another curve in small batches
+    Curve c2("Test curve", SongTime(16, 0), 7);
+    CurveRecorder cr(c2, 4);
+    SmfReader smf(name);
+    
+    DTEST_TRUE(smf.read_track(0, cr) == 16);
+    
+    cr.flush();
+    
+    bool same = true;
+    Curve::ConstIterator i1 = c1.begin();
+    Curve::ConstIterator i2 = c2.begin();
+    for ( ; i1 != c1.end() && i2 != c2.end(); ++i1, ++i2) {
+      same = same && i1->m_time == i2->m_time && 
+	i1->m_value.get() == i2->m_value.get();
+    }
+    
+    DTEST_TRUE(same);
+    
+    DTEST_TRUE(i1 == c1.end() && i2 == c2.end());
+    
+    std::remove(name.c_str());
+  }
+
+
+}
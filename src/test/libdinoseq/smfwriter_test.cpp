@@ -0,0 +1,83 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <sstream>
+#include <string>
+
+#include "dtest.hpp"
+#include "smfwriter.hpp"
+#include "songtime.hpp"
+
+
+using namespace Dino;
+using namespace std;
+
+
+namespace SmfWriterTest {
+  
+  
+  void dtest_constructor() {
+    ostringstream os;
+    DTEST_NOTHROW(SmfWriter smf(os));
+  }
+  
+  
+  void dtest_write_event() {
+    ostringstream os;
+    SmfWriter smf(os, 96);
+    
+    unsigned char on[] = { 0x90, 0x3C, 0x7F };
+    unsigned char off[] = { 0x90, 0x3C, 0x00 };
+    unsigned char cc[] = { 0xB0, 0x07, 0x40 };
+    unsigned char sysex[] = { 0xF0, 0x7E, 0xF7 };
+    unsigned char clock[] = { 0xF8 };
+    
+    DTEST_TRUE(smf.write_tempo(SongTime(0, 0), 120));
+    
+    DTEST_TRUE(smf.write_event(SongTime(0, 0), 3, on));
+    
+    DTEST_TRUE(smf.write_event(SongTime(1, 0x800000), 3, off));
+    
+    DTEST_TRUE(smf.write_event(SongTime(2, 0), 3, cc));
+    
+    DTEST_TRUE(smf.write_event(SongTime(2, 0), 3, sysex));
+    
+    DTEST_TRUE(smf.write_event(SongTime(3, 0), 1, clock));
+    
+    DTEST_TRUE(smf.get_event_count() == 4);
+    
+    DTEST_NOTHROW(smf.finish());
+    
+    DTEST_TRUE(!smf.write_event(SongTime(4, 0), 3, on));
+    
+    unsigned char expected[] = {
+      'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0, 96,
+      'M', 'T', 'r', 'k', 0, 0, 0, 28,
+      0x00, 0xFF, 0x51, 0x03, 0x07, 0xA1, 0x20,
+      0x00, 0x90, 0x3C, 0x7F,
+      0x81, 0x10, 0x3C, 0x00,
+      0x30, 0xB0, 0x07, 0x40,
+      0x00, 0xF0, 0x02, 0x7E, 0xF7,
+      0x00, 0xFF, 0x2F, 0x00 };
+    
+    DTEST_TRUE(os.str() == string(reinterpret_cast<char*>(expected), 
+				  sizeof(expected)));
+  }
+
+
+}
@@ -0,0 +1,259 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <unistd.h>
+
+#include "curve.hpp"
+#include "dtest.hpp"
+#include "eventbuffer.hpp"
+#include "sequencable.hpp"
+#include "sequencer.hpp"
+#include "snapshot.hpp"
+#include "tempfile.hpp"
+
+
+using namespace Dino;
+using namespace std;
+using namespace TempFile;
+
+
+namespace SnapshotTest {
+  
+  
+  class PhonySequencable : public Sequencable {
+  public:
+    PhonySequencable() : Sequencable("Phony", SongTime(3, 0)) {}
+    bool sequence(Position&, SongTime const&, EventBuffer&) const { 
+      return true; 
+    }
+  };
+  
+  
+  class PhonyEventBuffer : public EventBuffer {
+  public:
+    bool write_event(SongTime const&, size_t, unsigned char const*) { 
+      return false; 
+    }
+  };
+  
+  
+  /** Return @c true if @c a and @c b have the same points. */
+  bool same_points(Curve const& a, Curve const& b) {
+    auto i = a.begin();
+    auto j = b.begin();
+    for ( ; i != a.end() && j != b.end(); ++i, ++j) {
+      if (i->m_time != j->m_time || i->m_value.get() != j->m_value.get())
+	return false;
+    }
+    return i == a.end() && j == b.end();
+  }
+  
+  
+  /** Fill a Sequencer with two curves and a generic Sequencable, routed to
+      two different buffers. */
+  void fill(Sequencer& seq, shared_ptr<Curve>& c1, shared_ptr<Curve>& c2,
+	    shared_ptr<EventBuffer>& b1, shared_ptr<EventBuffer>& b2) {
+    c1 = make_shared<Curve>("Volume", SongTime(64, 0), 7);
+    c1->set_interpolation(Curve::Step);
+    c1->set_resolution(16);
+    for (int i = 0; i < 10000; ++i)
+      c1->add_point(SongTime(i / 200, (i % 200) * 1000), i * 1000);
+    c2 = make_shared<Curve>("Empty", SongTime(1, 5), 0, Curve::BTree);
+    b1 = make_shared<PhonyEventBuffer>();
+    b2 = make_shared<PhonyEventBuffer>();
+    seq.set_event_buffer(seq.add_sequencable(c1), b1);
+    seq.add_sequencable(make_shared<PhonySequencable>());
+    seq.set_event_buffer(seq.add_sequencable(c2), b2);
+    seq.set_event_buffer(seq.add_sequencable(c1), b2);
+  }
+  
+  
+  void dtest_constructor() {
+    string name = temp_file("snapshot_test");
+    
+    DTEST_THROW_TYPE(Snapshot s(name), std::runtime_error);
+    
+    DTEST_THROW_TYPE(Snapshot s(name + ".missing"), std::runtime_error);
+    
+    {
+      ofstream ofs(name.c_str());
+      ofs << "DINOSNAP but not really a snapshot";
+    }
+    DTEST_THROW_TYPE(Snapshot s(name), std::runtime_error);
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_write_read() {
+    string name = temp_file("snapshot_test");
+    Sequencer seq;
+    shared_ptr<Curve> c1, c2;
+    shared_ptr<EventBuffer> b1, b2;
+    fill(seq, c1, c2, b1, b2);
+    
+    vector<shared_ptr<EventBuffer>> buffers;
+    DTEST_NOTHROW(Snapshot::write(name, seq, buffers));
+    DTEST_TRUE(buffers.size() == 2);
+    DTEST_TRUE(buffers[0] == b1);
+    DTEST_TRUE(buffers[1] == b2);
+    
+    Snapshot s(name);
+    DTEST_TRUE(s.get_sequencable_count() == 4);
+    DTEST_TRUE(s.get_label(0) == "Volume");
+    DTEST_TRUE(s.get_label(1) == "Phony");
+    DTEST_TRUE(s.get_label(2) == "Empty");
+    DTEST_TRUE(s.get_length(0) == SongTime(64, 0));
+    DTEST_TRUE(s.get_length(1) == SongTime(3, 0));
+    DTEST_TRUE(s.get_length(2) == SongTime(1, 5));
+    DTEST_TRUE(s.get_buffer_index(0) == 0);
+    DTEST_TRUE(s.get_buffer_index(1) == -1);
+    DTEST_TRUE(s.get_buffer_index(2) == 1);
+    DTEST_TRUE(s.get_buffer_index(3) == 1);
+    DTEST_TRUE(s.is_curve(0));
+    DTEST_TRUE(!s.is_curve(1));
+    DTEST_TRUE(s.is_curve(2));
+    
+    // curves are only materialised when asked for
+    DTEST_TRUE(!s.is_materialised(0));
+    shared_ptr<Curve> c = s.get_curve(0);
+    DTEST_TRUE(c);
+    DTEST_TRUE(s.is_materialised(0));
+    DTEST_TRUE(!s.is_materialised(2));
+    DTEST_TRUE(s.get_curve(0) == c);
+    DTEST_TRUE(c->get_controller_id() == 7);
+    DTEST_TRUE(c->get_interpolation() == Curve::Step);
+    DTEST_TRUE(c->get_resolution() == 16);
+    DTEST_TRUE(c->get_storage() == Curve::SkipList);
+    DTEST_TRUE(same_points(*c, *c1));
+    
+    DTEST_TRUE(!s.get_curve(1));
+    DTEST_TRUE(s.get_curve(2)->begin() == s.get_curve(2)->end());
+    DTEST_TRUE(s.get_curve(2)->get_storage() == Curve::BTree);
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_empty() {
+    string name = temp_file("snapshot_test");
+    vector<shared_ptr<EventBuffer>> buffers;
+    {
+      Sequencer seq;
+      
+      DTEST_NOTHROW(Snapshot::write(name, seq, buffers));
+    }
+    
+    DTEST_NOTHROW(Snapshot s(name));
+    
+    Snapshot s(name);
+    
+    DTEST_TRUE(s.get_sequencable_count() == 0);
+    
+    Sequencer seq;
+    
+    DTEST_NOTHROW(s.restore(seq, buffers));
+    
+    DTEST_TRUE(seq.sqbl_begin() == seq.sqbl_end());
+    
+    DTEST_TRUE(buffers.empty());
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_restore() {
+    string name = temp_file("snapshot_test");
+    vector<shared_ptr<EventBuffer>> buffers;
+    {
+      Sequencer seq;
+      shared_ptr<Curve> c1, c2;
+      shared_ptr<EventBuffer> b1, b2;
+      fill(seq, c1, c2, b1, b2);
+      Snapshot::write(name, seq, buffers);
+    }
+    
+    Snapshot s(name);
+    Sequencer seq;
+    DTEST_NOTHROW(s.restore(seq, buffers));
+    
+    // the generic Sequencable is skipped
+    DTEST_TRUE(distance(seq.sqbl_begin(), seq.sqbl_end()) == 3);
+    auto iter = seq.sqbl_begin();
+    DTEST_TRUE(*iter == s.get_curve(0));
+    DTEST_TRUE(seq.get_event_buffer(iter) == buffers[0]);
+    ++iter;
+    DTEST_TRUE(*iter == s.get_curve(2));
+    DTEST_TRUE(seq.get_event_buffer(iter) == buffers[1]);
+    ++iter;
+    DTEST_TRUE(*iter == s.get_curve(3));
+    DTEST_TRUE(seq.get_event_buffer(iter) == buffers[1]);
+    
+    unlink(name.c_str());
+  }
+  
+  
+  void dtest_corrupt_curve() {
+    string name = temp_file("snapshot_test");
+    vector<shared_ptr<EventBuffer>> buffers;
+    {
+      Sequencer seq;
+      shared_ptr<Curve> c1, c2;
+      shared_ptr<EventBuffer> b1, b2;
+      fill(seq, c1, c2, b1, b2);
+      Snapshot::write(name, seq, buffers);
+    }
+    
+    // move a point of the first curve far past its end
+    {
+      fstream fs(name.c_str(), ios::in | ios::out | ios::binary);
+      string data((istreambuf_iterator<char>(fs)), 
+		  istreambuf_iterator<char>());
+      int32_t point[] = { 0, 100000, 100000 };
+      size_t pos = data.find(string(reinterpret_cast<char*>(point), 
+				    sizeof(point)));
+      point[0] = 1000;
+      fs.clear();
+      fs.seekp(pos);
+      fs.write(reinterpret_cast<char*>(point), sizeof(point));
+    }
+    
+    Snapshot s(name);
+    
+    DTEST_THROW_TYPE(s.get_curve(0), std::runtime_error);
+    
+    DTEST_TRUE(!s.is_materialised(0));
+    
+    Sequencer seq;
+    
+    DTEST_THROW_TYPE(s.restore(seq, buffers), std::runtime_error);
+    
+    DTEST_TRUE(seq.sqbl_begin() == seq.sqbl_end());
+    
+    unlink(name.c_str());
+  }
+
+
+}
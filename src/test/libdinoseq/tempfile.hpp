@@ -0,0 +1,40 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+
+#ifndef TEMPFILE_HPP
+#define TEMPFILE_HPP
+
+/** @file
+    A helper for the libdinoseq tests that read and write files. */
+
+#include <string>
+
+
+namespace TempFile {
+  
+  
+  /** Create a new, empty file in /tmp whose name starts with @c prefix 
+      and return its name. The caller removes it when it is done. */
+  std::string temp_file(std::string const& prefix);
+  
+  
+}
+
+
+#endif
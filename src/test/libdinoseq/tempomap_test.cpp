@@ -0,0 +1,178 @@
+/*****************************************************************************
+    libdinoseq_test - unit test module for libdinoseq
+    Copyright (C) 2009  Lars Luthman <mail@larsluthman.net>
+    
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+    
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+    GNU General Public License for more details.
+    
+    You should have received a copy of the GNU General Public License
+    along with this program. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#include <pthread.h>
+
+#include "atomicint.hpp"
+#include "dtest.hpp"
+#include "tempomap.hpp"
+
+
+using namespace Dino;
+
+
+namespace TempoMapTest {
+  
+  
+  void dtest_constructor() {
+    DTEST_NOTHROW(TempoMap tm(48000));
+  }
+  
+  
+  void dtest_constant_tempo() {
+    TempoMap tm(48000, 120);
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(0, 0)) == 120);
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(1000, 0)) == 120);
+    
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(0, 0)) == 0);
+    
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(1, 0)) == 24000);
+    
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(2, 1 << 23)) == 60000);
+    
+    DTEST_TRUE(tm.frame_to_songtime(0) == SongTime(0, 0));
+    
+    DTEST_TRUE(tm.frame_to_songtime(24000) == SongTime(1, 0));
+    
+    DTEST_TRUE(tm.frame_to_songtime(60000) == SongTime(2, 1 << 23));
+  }
+  
+  
+  void dtest_add_remove_change() {
+    TempoMap tm(48000, 120);
+    
+    DTEST_THROW_TYPE(tm.add_change(SongTime(-1, 0), 100), std::out_of_range);
+    
+    DTEST_THROW_TYPE(tm.add_change(SongTime(1, 0), 0), 
+		     std::invalid_argument);
+    
+    DTEST_NOTHROW(tm.add_change(SongTime(4, 0), 60));
+    
+    DTEST_NOTHROW(tm.add_change(SongTime(8, 0), 240));
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(3, 0)) == 120);
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(4, 0)) == 60);
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(9, 0)) == 240);
+    
+    // 4 beats at 120 bpm, 4 at 60 and 2 at 240
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(10, 0)) == 
+	       4 * 24000 + 4 * 48000 + 2 * 12000);
+    
+    DTEST_TRUE(tm.frame_to_songtime(4 * 24000 + 2 * 48000) == 
+	       SongTime(6, 0));
+    
+    DTEST_NOTHROW(tm.add_change(SongTime(0, 0), 240));
+    
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(10, 0)) == 
+	       4 * 12000 + 4 * 48000 + 2 * 12000);
+    
+    DTEST_TRUE(!tm.remove_change(SongTime(0, 0)));
+    
+    DTEST_TRUE(!tm.remove_change(SongTime(5, 0)));
+    
+    DTEST_TRUE(tm.remove_change(SongTime(4, 0)));
+    
+    DTEST_TRUE(tm.songtime_to_frame(SongTime(10, 0)) == 
+	       8 * 12000 + 2 * 12000);
+    
+    tm.reader_holds_no_iterator();
+    
+    DTEST_TRUE(tm.remove_change(SongTime(8, 0)));
+    
+    DTEST_TRUE(tm.get_bpm(SongTime(9, 0)) == 240);
+  }
+  
+  
+  void dtest_cursor() {
+    TempoMap tm(44100, 120);
+    for (int i = 1; i < 64; ++i)
+      tm.add_change(SongTime(i, 0), 60 + i);
+    
+    TempoMap::Cursor c1;
+    TempoMap::Cursor c2;
+    bool same = true;
+    for (TempoMap::Frame f = 0; f < 44100 * 40; f += 256) {
+      SongTime st = tm.frame_to_songtime(f, c1);
+      same = same && (st == tm.frame_to_songtime(f));
+      same = same && (tm.songtime_to_frame(st, c2) == 
+		      tm.songtime_to_frame(st));
+    }
+    
+    DTEST_TRUE(same);
+    
+    // the cursor must notice that the map has changed
+    SongTime before = tm.frame_to_songtime(44100, c1);
+    tm.add_change(SongTime(0, 0), 30);
+    
+    DTEST_TRUE(tm.frame_to_songtime(44100, c1) != before);
+    
+    DTEST_TRUE(tm.frame_to_songtime(44100, c1) == 
+	       tm.frame_to_songtime(44100));
+  }
+  
+  
+  /** A map that is read by another thread while it is changed. */
+  struct Reader {
+    Reader() : tm(48000, 120), ok(true), reads(0) {}
+    TempoMap tm;
+    AtomicInt quit;
+    bool ok;
+    long reads;
+  };
+  
+  
+  void* convert(void* arg) {
+    Reader& r = *static_cast<Reader*>(arg);
+    TempoMap::Cursor c;
+    while (!r.quit.get()) {
+      // the writer switches the first beat between 120 and 60 BPM and 
+      // moves other changes around after it, so every conversion must 
+      // give one of two values and never a half done edit
+      TempoMap::Frame f = r.tm.songtime_to_frame(SongTime(1, 0), c);
+      r.ok = r.ok && (f == 24000 || f == 48000);
+      SongTime st = r.tm.frame_to_songtime(24000, c);
+      r.ok = r.ok && (st == SongTime(1, 0) || st == SongTime(0, 1 << 23));
+      r.tm.reader_holds_no_iterator();
+      ++r.reads;
+    }
+    return 0;
+  }
+  
+  
+  void dtest_concurrent_read() {
+    Reader r;
+    pthread_t thread;
+    pthread_create(&thread, 0, &convert, &r);
+    for (int i = 0; i < 20000; ++i) {
+      r.tm.add_change(SongTime(0, 0), i % 2 ? 60 : 120);
+      r.tm.add_change(SongTime(1 + i % 7, 0), 90 + i % 13);
+      if (i % 3 == 0)
+	r.tm.remove_change(SongTime(1 + (i + 3) % 7, 0));
+    }
+    r.quit.set(1);
+    pthread_join(thread, 0);
+    
+    DTEST_TRUE(r.ok);
+  }
+
+
+}